@@ -78,5 +78,6 @@ OPENAFS_C_STRUCT_LABEL_CHECK
 OPENAFS_DIRENT_CHECKS
 OPENAFS_SYS_RESOURCE_CHECKS
 OPENAFS_UUID_CHECKS
+OPENAFS_ZLIB_CHECKS
 OPENAFS_CTF_TOOLS_CHECKS
 ])
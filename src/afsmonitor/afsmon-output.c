@@ -231,7 +231,17 @@ Print_fs_OverallPerfInfo(struct afs_PerfStats *a_ovP)
     fprintf(fs_outFD, "\t%10d rx_nBusies\n\n", a_ovP->rx_nBusies);
 
     fprintf(fs_outFD, "\t%10d fs_nBusies\n", a_ovP->fs_nBusies);
-    fprintf(fs_outFD, "\t%10d fs_GetCapabilities\n\n", a_ovP->fs_nGetCaps);
+    fprintf(fs_outFD, "\t%10d fs_GetCapabilities\n", a_ovP->fs_nGetCaps);
+    fprintf(fs_outFD, "\t%10d fs_nThrottledOps\n", a_ovP->fs_nThrottledOps);
+    fprintf(fs_outFD, "\t%10d fs_nThrottledXfers\n", a_ovP->fs_nThrottledXfers);
+    fprintf(fs_outFD, "\t%10d fs_ThrottledMSecs\n\n", a_ovP->fs_ThrottledMSecs);
+
+    fprintf(fs_outFD, "\t%10d fd_CacheSize\n", a_ovP->fd_CacheSize);
+    fprintf(fs_outFD, "\t%10d fd_InUse\n", a_ovP->fd_InUse);
+    fprintf(fs_outFD, "\t%10d fd_Hits\n", a_ovP->fd_Hits);
+    fprintf(fs_outFD, "\t%10d fd_Misses\n", a_ovP->fd_Misses);
+    fprintf(fs_outFD, "\t%10d fd_Evictions\n", a_ovP->fd_Evictions);
+    fprintf(fs_outFD, "\t%10d fd_Emfile\n\n", a_ovP->fd_Emfile);
 
     /*
      * Host module fields.
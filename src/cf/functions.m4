@@ -2,6 +2,7 @@ AC_DEFUN([OPENAFS_FUNCTION_CHECKS],[
 AC_CHECK_FUNCS([ \
     arc4random \
     closelog \
+    copy_file_range \
     fcntl \
     fseeko64 \
     ftello64 \
@@ -15,6 +16,7 @@ AC_CHECK_FUNCS([ \
     mkstemp \
     openlog \
     poll \
+    posix_fadvise \
     pread \
     preadv \
     preadv64 \
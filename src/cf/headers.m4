@@ -11,6 +11,7 @@ AC_CHECK_HEADERS([ \
     errno.h \
     fcntl.h \
     grp.h \
+    linux/fs.h \
     math.h \
     mntent.h \
     ncurses.h \
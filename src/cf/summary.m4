@@ -90,6 +90,7 @@ libraries:
   crypt   : ${LIB_crypt}
   hcrypto : ${LIB_hcrypto}
   intl    : ${LIB_libintl}
+  zlib    : ${LIB_z}
 ***************************************************************
 EOF
 ])
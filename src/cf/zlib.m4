@@ -0,0 +1,18 @@
+AC_DEFUN([OPENAFS_ZLIB_CHECKS],[
+dnl Check for zlib, which the volserver uses to compress volume dumps
+AC_ARG_WITH([zlib],
+    [AS_HELP_STRING([--without-zlib],
+	[do not support compressed volume dumps])],
+    [],
+    [with_zlib=check])
+LIB_z=
+AS_IF([test "x$with_zlib" != xno],
+    [AC_CHECK_HEADERS([zlib.h],
+	[AC_CHECK_LIB([z], [deflate],
+	    [LIB_z="-lz"
+	     AC_DEFINE([HAVE_ZLIB], [1],
+		[define if zlib is available to compress volume dumps])])])])
+AS_IF([test "x$with_zlib" = xyes -a "x$LIB_z" = x],
+    [AC_MSG_ERROR([zlib was requested but cannot be found])])
+AC_SUBST(LIB_z)
+])
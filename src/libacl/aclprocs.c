@@ -69,14 +69,45 @@ CmpMinus(const void *arg1, const void *arg2)
     return (1);
 }
 
+/*
+ * Return the index of the first entry in the sorted CPS at or after
+ * position 'start' whose id is not less than 'id', or prlist_len if there is
+ * no such entry.  An exponential probe brackets the target before a binary
+ * search narrows it down, so a lookup costs O(log d) where d is the
+ * distance moved, instead of O(d).
+ */
 static int
-CmpInt(int x, int y)
+SeekCPS(prlist *groups, int start, afs_int32 id)
 {
-    if (x < y)
-	return (-1);
-    if (x == y)
-	return (0);
-    return (1);
+    afs_int32 *cps = groups->prlist_val;
+    int len = groups->prlist_len;
+    int lo, hi, step, mid;
+
+    if (start >= len || cps[start] >= id)
+	return start;
+
+    /* Invariant: cps[lo] < id, and cps[hi] >= id (or hi == len). */
+    lo = start;
+    step = 1;
+    for (;;) {
+	hi = lo + step;
+	if (hi >= len) {
+	    hi = len;
+	    break;
+	}
+	if (cps[hi] >= id)
+	    break;
+	lo = hi;
+	step <<= 1;
+    }
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	if (cps[mid] < id)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return hi;
 }
 
 
@@ -358,46 +389,33 @@ acl_CheckRights(struct acl_accessList *acl, prlist *groups, int *rights)
 	return 0;
     }
 
-    /* Each iteration eats up exactly one entry from either acl or groups.
+    /* ACLs hold at most ACL_MAXENTRIES entries, but the CPS of a user in
+     * many groups can be thousands of ids long.  Rather than stepping
+     * through the CPS one id at a time, gallop forward to each ACL entry's
+     * id.  Both lists are sorted, so the CPS cursor never moves backwards.
      * Duplicate Entries in access list ==> accumulated rights are obtained.
      * Duplicate Entries in groups ==> irrelevant */
     temprights = 0;
-    c = a = 0;
-    while ((a < acl->positive) && (c < groups->prlist_len))
-	switch (CmpInt(acl->entries[a].id, groups->prlist_val[c])) {
-	case -1:
-	    a += 1;
+    c = 0;
+    for (a = 0; a < acl->positive; a++) {
+	c = SeekCPS(groups, c, acl->entries[a].id);
+	if (c >= groups->prlist_len)
 	    break;
-
-	case 0:
+	if (groups->prlist_val[c] == acl->entries[a].id)
 	    temprights |= acl->entries[a].rights;
-	    a += 1;
-	    break;
-
-	case 1:
-	    c += 1;
-	    break;
+    }
 
-	default:
-	    printf("CmpInt() returned bogus value. Aborting ...\n");
-	    abort();
-	}
+    /* Negative entries are stored backwards from the end of the acl, so
+     * walking them from the end visits them in ascending id order. */
     negrights = 0;
     c = 0;
-    a = acl->total - 1;
-    while ((c < groups->prlist_len) && (a > acl->total - acl->negative - 1))
-	switch (CmpInt(acl->entries[a].id, groups->prlist_val[c])) {
-	case -1:
-	    a -= 1;
+    for (a = acl->total - 1; a > acl->total - acl->negative - 1; a--) {
+	c = SeekCPS(groups, c, acl->entries[a].id);
+	if (c >= groups->prlist_len)
 	    break;
-	case 0:
+	if (groups->prlist_val[c] == acl->entries[a].id)
 	    negrights |= acl->entries[a].rights;
-	    a -= 1;
-	    break;
-	case 1:
-	    c += 1;
-	    break;
-	}
+    }
     *rights = temprights & (~negrights);
     return (0);
 }
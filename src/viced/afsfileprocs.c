@@ -195,7 +195,8 @@ static afs_int32 FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 				   struct rx_call *Call, afs_sfsize_t Pos,
 				   afs_sfsize_t Len, afs_int32 Int64Mode,
 				   afs_sfsize_t * a_bytesToFetchP,
-				   afs_sfsize_t * a_bytesFetchedP);
+				   afs_sfsize_t * a_bytesFetchedP,
+				   int *a_throttleMsP);
 
 static afs_int32 StoreData_RXStyle(Volume * volptr, Vnode * targetptr,
 				   struct AFSFid *Fid, struct client *client,
@@ -203,7 +204,8 @@ static afs_int32 StoreData_RXStyle(Volume * volptr, Vnode * targetptr,
 				   afs_fsize_t Length, afs_fsize_t FileLength,
 				   int sync,
 				   afs_sfsize_t * a_bytesToStoreP,
-				   afs_sfsize_t * a_bytesStoredP);
+				   afs_sfsize_t * a_bytesStoredP,
+				   int *a_throttleMsP);
 
 #ifdef AFS_SGI_XFS_IOPS_ENV
 #include <afs/xfsattrs.h>
@@ -353,7 +355,8 @@ LogClientError(const char *message, struct rx_connection *tcon, afs_int32 viceid
  * that CallPostamble can block without the host's disappearing.
  * Call returns rx connection in passed in *tconn
  *
- * 'Fid' is optional, and is just used for printing log messages.
+ * 'Fid' is optional; it is used for printing log messages, and to charge
+ * active calls against the volume's rate limits.
  */
 static int
 CallPreamble(struct rx_call *acall, int activecall, struct AFSFid *Fid,
@@ -362,6 +365,8 @@ CallPreamble(struct rx_call *acall, int activecall, struct AFSFid *Fid,
     struct host *thost;
     struct client *tclient;
     afs_int32 viceid = -1;
+    afs_int32 clientid;
+    afs_uint32 hostaddr;
     int retry_flag = 1;
     int code = 0;
     char hoststr[16], hoststr2[16];
@@ -466,10 +471,20 @@ CallPreamble(struct rx_call *acall, int activecall, struct AFSFid *Fid,
 	code = 0;
     }
 
+    clientid = tclient->z.ViceId;
+    hostaddr = thost->z.host;
     h_ReleaseClient_r(tclient);
     h_Unlock_r(thost);
     H_UNLOCK;
     *ahostp = thost;
+
+    /* nothing is locked yet; if too many threads are already being held
+     * back, send the client away to retry rather than tie up another */
+    if (code == 0 && activecall) {
+	if (throttle_Wait(throttle_Charge(hostaddr, clientid,
+					  Fid ? Fid->Volume : 0, 1, 0), 0))
+	    code = VBUSY;
+    }
     return code;
 
 }				/*CallPreamble */
@@ -1376,6 +1391,15 @@ CopyOnWrite(Vnode * targetptr, Volume * volptr, afs_foff_t off, afs_fsize_t len)
     }
 
     done = off;
+    if (size > 0) {
+	/* Let the kernel copy what it can; with reflinks the new inode just
+	 * shares the old one's blocks.  The loop below handles the rest. */
+	afs_sfsize_t copied = FDH_COPYRANGE(targFdP, newFdP, off, size);
+	if (copied > 0) {
+	    done += copied;
+	    size -= copied;
+	}
+    }
     while (size > 0) {
 	if (size > COPYBUFFSIZE) {	/* more than a buffer */
 	    length = COPYBUFFSIZE;
@@ -2221,8 +2245,8 @@ AllocSendBuffer(void)
  */
 static
     void
-GetStatus(Vnode * targetptr, AFSFetchStatus * status, afs_int32 rights,
-	  afs_int32 anyrights, Vnode * parentptr)
+GetStatusInDir(Vnode * targetptr, AFSFetchStatus * status, afs_int32 rights,
+	       afs_int32 anyrights, VnodeId parentVnode, Unique parentUnique)
 {
     int Time = time(NULL);
 
@@ -2254,15 +2278,29 @@ GetStatus(Vnode * targetptr, AFSFetchStatus * status, afs_int32 rights,
     status->ClientModTime = targetptr->disk.unixModifyTime;	/* This might need rework */
     status->ParentVnode =
 	(status->FileType ==
-	 Directory ? targetptr->vnodeNumber : parentptr->vnodeNumber);
+	 Directory ? targetptr->vnodeNumber : parentVnode);
     status->ParentUnique =
 	(status->FileType ==
-	 Directory ? targetptr->disk.uniquifier : parentptr->disk.uniquifier);
+	 Directory ? targetptr->disk.uniquifier : parentUnique);
     status->ServerModTime = targetptr->disk.serverModifyTime;
     status->Group = targetptr->disk.group;
     status->lockCount = Time > targetptr->disk.lock.lockTime ? 0 : targetptr->disk.lock.lockCount;
     status->errorCode = 0;
 
+}				/*GetStatusInDir */
+
+/* as GetStatusInDir, for a vnode whose parent is at hand; a directory
+ * is its own parent, and parentptr is then not used */
+static
+    void
+GetStatus(Vnode * targetptr, AFSFetchStatus * status, afs_int32 rights,
+	  afs_int32 anyrights, Vnode * parentptr)
+{
+    if (targetptr->disk.type == vDirectory)
+	GetStatusInDir(targetptr, status, rights, anyrights, 0, 0);
+    else
+	GetStatusInDir(targetptr, status, rights, anyrights,
+		       parentptr->vnodeNumber, parentptr->disk.uniquifier);
 }				/*GetStatus */
 
 static afs_int32
@@ -2290,6 +2328,7 @@ common_FetchData64(struct rx_call *acall, struct AFSFid *Fid,
     afs_sfsize_t bytesToXfer;  /* # bytes to xfer */
     afs_sfsize_t bytesXferred; /* # bytes actually xferred */
     int readIdx;		/* Index of read stats array to bump */
+    int throttleMs = 0;		/* delay owed to the rate limits */
 
     fsstats_StartOp(&fsstats, FS_STATS_RPCIDX_FETCHDATA);
 
@@ -2360,7 +2399,7 @@ common_FetchData64(struct rx_call *acall, struct AFSFid *Fid,
     /* actually do the data transfer */
     errorCode =
 	FetchData_RXStyle(volptr, targetptr, acall, Pos, Len, type,
-			  &bytesToXfer, &bytesXferred);
+			  &bytesToXfer, &bytesXferred, &throttleMs);
 
     fsstats_FinishXfer(&fsstats, errorCode, bytesToXfer, bytesXferred,
 		       &remainder);
@@ -2386,6 +2425,8 @@ common_FetchData64(struct rx_call *acall, struct AFSFid *Fid,
     /* Update and store volume/vnode and parent vnodes back */
     (void)PutVolumePackageWithCall(acall, parentwhentargetnotdir, targetptr,
                                    (Vnode *) 0, volptr, &client, cbv);
+    /* nothing is locked now, so pay off the transfer's rate limit debt */
+    (void)throttle_Wait(throttleMs, 1);
     ViceLog(2, ("SRXAFS_FetchData returns %d\n", errorCode));
     errorCode = CallPostamble(tcon, errorCode, thost);
 
@@ -2588,6 +2629,155 @@ SAFSS_FetchStatus(struct rx_call *acall, struct AFSFid *Fid,
 }				/*SAFSS_FetchStatus */
 
 
+/*
+ * State carried across the fids of one bulk status request.  The fids of a
+ * bulk request nearly always come from a single directory (the client is
+ * filling in an "ls -l"), so the volume reference, the client and the
+ * rights derived from the directory's ACL are kept from one fid to the
+ * next instead of being looked up again for each.
+ */
+struct BulkStatusState {
+    Volume *volptr;		/* volume of the previous fid */
+    struct client *client;	/* the calling client */
+    int aclValid;		/* aclVnode/aclUnique/rights are set */
+    VnodeId aclVnode;		/* the directory the rights came from */
+    Unique aclUnique;		/* and its uniquifier */
+    afs_int32 rights;		/* caller's rights from its ACL */
+    afs_int32 anyrights;	/* anyuser's rights from its ACL */
+    int permDenied;		/* the last fid failed the permission check */
+};
+
+/*
+ * Pull the vnode index pages for the remaining fids in this volume into
+ * the page cache with one read, rather than one read per vnode.
+ */
+static void
+BulkStatusPrefetch(Volume *volptr, AFSFid *fids, int nfids)
+{
+    VnodeId vnodes[AFSCBMAX];
+    int i, n = 0;
+
+    for (i = 0; i < nfids && n < AFSCBMAX; i++) {
+	if (fids[i].Volume == V_id(volptr))
+	    vnodes[n++] = fids[i].Vnode;
+    }
+    if (n > 1)
+	VPrefetchVnodes(volptr, vnodes, n);
+}
+
+/*
+ * Fetch the status and set up the callback for one fid of a bulk status
+ * request.  This is the per-fid part of GetVolumePackage, GetStatus and
+ * the callback setup, but reusing what the previous fid left in bs.
+ */
+static afs_int32
+BulkStatusOne(struct rx_call *acall, struct BulkStatusState *bs,
+	      AFSFid *tfid, int nremaining, AFSFetchStatus *status,
+	      AFSCallBack *callback)
+{
+    Vnode *targetptr = NULL;
+    Vnode *parentptr = NULL;
+    struct acl_accessList *aCL;
+    int aCLSize, newvol;
+    afs_int32 rights, anyrights;
+    Error errorCode, fileCode;
+
+    bs->permDenied = 0;
+    if (bs->volptr && V_id(bs->volptr) != tfid->Volume) {
+	VPutVolume(bs->volptr);
+	bs->volptr = NULL;
+	bs->aclValid = 0;
+    }
+    newvol = (bs->volptr == NULL);
+
+    errorCode = CheckVnode(tfid, &bs->volptr, &targetptr, READ_LOCK);
+    if (newvol && bs->volptr)
+	BulkStatusPrefetch(bs->volptr, tfid + 1, nremaining - 1);
+    if (errorCode)
+	goto done;
+
+    if (!bs->client) {
+	if ((errorCode = GetClient(rx_ConnectionOf(acall), &bs->client)) != 0)
+	    goto done;
+	if (!bs->client) {
+	    errorCode = EINVAL;
+	    goto done;
+	}
+    }
+
+    if (targetptr->disk.type == vDirectory) {
+	if (bs->aclValid && bs->aclVnode == targetptr->vnodeNumber) {
+	    rights = bs->rights;
+	    anyrights = bs->anyrights;
+	} else {
+	    /* a subdirectory carries its own ACL; use it without evicting
+	     * the directory whose files we are most likely listing */
+	    GetRights(bs->client, VVnodeACL(targetptr), &rights, &anyrights);
+	}
+    } else {
+	if (!bs->aclValid || bs->aclVnode != targetptr->disk.parent) {
+	    bs->aclValid = 0;
+	    if ((errorCode = SetAccessList(&targetptr, &bs->volptr, &aCL,
+					   &aCLSize, &parentptr, tfid,
+					   READ_LOCK)) != 0)
+		goto done;
+	    bs->aclVnode = parentptr->vnodeNumber;
+	    bs->aclUnique = parentptr->disk.uniquifier;
+	    GetRights(bs->client, aCL, &bs->rights, &bs->anyrights);
+	    bs->aclValid = 1;
+	}
+	rights = bs->rights;
+	anyrights = bs->anyrights;
+
+	/* set the PRSFS_ADMINISTER bit iff we're the owner */
+	if (targetptr->disk.owner == bs->client->z.ViceId)
+	    rights |= PRSFS_ADMINISTER;
+	else
+	    rights &= ~PRSFS_ADMINISTER;
+    }
+#ifdef ADMIN_IMPLICIT_LOOKUP
+    /* admins get automatic lookup on everything */
+    if (!VanillaUser(bs->client))
+	rights |= PRSFS_LOOKUP;
+#endif /* ADMIN_IMPLICIT_LOOKUP */
+
+    /* Are we allowed to fetch Fid's status? */
+    if (targetptr->disk.type != vDirectory) {
+	if ((errorCode =
+	     Check_PermissionRights(targetptr, bs->client, rights,
+				    CHK_FETCHSTATUS, 0))) {
+	    bs->permDenied = 1;
+	    goto done;
+	}
+    }
+
+    GetStatusInDir(targetptr, status, rights, anyrights, bs->aclVnode,
+		   bs->aclUnique);
+
+    /* If a r/w volume, also set the CallBack state */
+    if (VolumeWriteable(bs->volptr))
+	SetCallBackStruct(AddBulkCallBack(bs->client->z.host, tfid),
+			  callback);
+    else {
+	struct AFSFid myFid;
+	memset(&myFid, 0, sizeof(struct AFSFid));
+	myFid.Volume = tfid->Volume;
+	SetCallBackStruct(AddVolCallBack(bs->client->z.host, &myFid),
+			  callback);
+    }
+
+  done:
+    if (parentptr) {
+	VPutVnode(&fileCode, parentptr);
+	assert_vnode_success_or_salvaging(fileCode);
+    }
+    if (targetptr) {
+	VPutVnode(&fileCode, targetptr);
+	assert_vnode_success_or_salvaging(fileCode);
+    }
+    return errorCode;
+}
+
 afs_int32
 SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 		  struct AFSBulkStats * OutStats, struct AFSCBs * CallBacks,
@@ -2595,12 +2785,8 @@ SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 {
     int i;
     afs_int32 nfiles;
-    Vnode *targetptr = 0;	/* pointer to vnode to fetch */
-    Vnode *parentwhentargetnotdir = 0;	/* parent vnode if targetptr is a file */
     Error errorCode = 0;		/* return code to caller */
-    Volume *volptr = 0;		/* pointer to the volume */
-    struct client *client = 0;	/* pointer to the client data */
-    afs_int32 rights, anyrights;	/* rights for this and any user */
+    struct BulkStatusState bs;	/* volume, client and rights cache */
     struct AFSFid *tfid;	/* file id we're dealing with now */
     struct rx_connection *tcon = rx_ConnectionOf(acall);
     struct host *thost;
@@ -2631,66 +2817,31 @@ SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     }
     CallBacks->AFSCBs_len = nfiles;
 
+    memset(&bs, 0, sizeof(bs));
     tfid = Fids->AFSCBFids_val;
 
     if ((errorCode = CallPreamble(acall, ACTIVECALL, tfid, &tcon, &thost)))
 	goto Bad_BulkStatus;
 
     for (i = 0; i < nfiles; i++, tfid++) {
-	/*
-	 * Get volume/vnode for the fetched file; caller's rights to it
-	 * are also returned
-	 */
 	if ((errorCode =
-	     GetVolumePackage(acall, tfid, &volptr, &targetptr, DONTCHECK,
-			      &parentwhentargetnotdir, &client, READ_LOCK,
-			      &rights, &anyrights)))
+	     BulkStatusOne(acall, &bs, tfid, nfiles - i,
+			   &OutStats->AFSBulkStats_val[i],
+			   &CallBacks->AFSCBs_val[i]))) {
+	    if (bs.permDenied && rx_GetCallAbortCode(acall) == errorCode)
+		rx_SetCallAbortCode(acall, 0);
 	    goto Bad_BulkStatus;
+	}
 
 	/* set volume synchronization information, but only once per call */
 	if (i == 0)
-	    SetVolumeSync(Sync, volptr);
-
-	/* Are we allowed to fetch Fid's status? */
-	if (targetptr->disk.type != vDirectory) {
-	    if ((errorCode =
-		 Check_PermissionRights(targetptr, client, rights,
-					CHK_FETCHSTATUS, 0))) {
-		if (rx_GetCallAbortCode(acall) == errorCode)
-		    rx_SetCallAbortCode(acall, 0);
-		goto Bad_BulkStatus;
-	    }
-	}
-
-	/* set OutStatus From the Fid  */
-	GetStatus(targetptr, &OutStats->AFSBulkStats_val[i], rights,
-		  anyrights, parentwhentargetnotdir);
-
-	/* If a r/w volume, also set the CallBack state */
-	if (VolumeWriteable(volptr))
-	    SetCallBackStruct(AddBulkCallBack(client->z.host, tfid),
-			      &CallBacks->AFSCBs_val[i]);
-	else {
-	    struct AFSFid myFid;
-	    memset(&myFid, 0, sizeof(struct AFSFid));
-	    myFid.Volume = tfid->Volume;
-	    SetCallBackStruct(AddVolCallBack(client->z.host, &myFid),
-			      &CallBacks->AFSCBs_val[i]);
-	}
-
-	/* put back the file ID and volume */
-	(void)PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
-			       (Vnode *) 0, volptr, &client);
-	parentwhentargetnotdir = (Vnode *) 0;
-	targetptr = (Vnode *) 0;
-	volptr = (Volume *) 0;
-	client = (struct client *)0;
+	    SetVolumeSync(Sync, bs.volptr);
     }
 
   Bad_BulkStatus:
-    /* Update and store volume/vnode and parent vnodes back */
-    (void)PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
-			   (Vnode *) 0, volptr, &client);
+    /* put back the volume and client */
+    (void)PutVolumePackage(acall, (Vnode *) 0, (Vnode *) 0, (Vnode *) 0,
+			   bs.volptr, &bs.client);
     errorCode = CallPostamble(tcon, errorCode, thost);
 
     t_client = (struct client *)rx_GetSpecific(tcon, rxcon_client_key);
@@ -2714,12 +2865,8 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 {
     int i;
     afs_int32 nfiles;
-    Vnode *targetptr = 0;	/* pointer to vnode to fetch */
-    Vnode *parentwhentargetnotdir = 0;	/* parent vnode if targetptr is a file */
     Error errorCode = 0;		/* return code to caller */
-    Volume *volptr = 0;		/* pointer to the volume */
-    struct client *client = 0;	/* pointer to the client data */
-    afs_int32 rights, anyrights;	/* rights for this and any user */
+    struct BulkStatusState bs;	/* volume, client and rights cache */
     struct AFSFid *tfid;	/* file id we're dealing with now */
     struct rx_connection *tcon;
     struct host *thost;
@@ -2755,6 +2902,7 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     /* Zero out return values to avoid leaking information on partial succes */
     memset(Sync, 0, sizeof(*Sync));
 
+    memset(&bs, 0, sizeof(bs));
     tfid = Fids->AFSCBFids_val;
 
     if ((errorCode = CallPreamble(acall, ACTIVECALL, tfid, &tcon, &thost))) {
@@ -2762,14 +2910,10 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     }
 
     for (i = 0; i < nfiles; i++, tfid++) {
-	/*
-	 * Get volume/vnode for the fetched file; caller's rights to it
-	 * are also returned
-	 */
 	if ((errorCode =
-	     GetVolumePackage(acall, tfid, &volptr, &targetptr, DONTCHECK,
-			      &parentwhentargetnotdir, &client, READ_LOCK,
-			      &rights, &anyrights))) {
+	     BulkStatusOne(acall, &bs, tfid, nfiles - i,
+			   &OutStats->AFSBulkStats_val[i],
+			   &CallBacks->AFSCBs_val[i]))) {
 	    tstatus = &OutStats->AFSBulkStats_val[i];
 
 	    tstatus->InterfaceVersion = 1;
@@ -2778,78 +2922,21 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 	    } else {
 		tstatus->errorCode = errorCode;
 	    }
-
-	    PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
-			     (Vnode *) 0, volptr, &client);
-	    parentwhentargetnotdir = (Vnode *) 0;
-	    targetptr = (Vnode *) 0;
-	    volptr = (Volume *) 0;
-	    client = (struct client *)0;
 	    continue;
 	}
 
 	/* set volume synchronization information, but only once per call */
 	if (!VolSync_set) {
-	    SetVolumeSync(Sync, volptr);
+	    SetVolumeSync(Sync, bs.volptr);
 	    VolSync_set = 1;
 	}
-
-	/* Are we allowed to fetch Fid's status? */
-	if (targetptr->disk.type != vDirectory) {
-	    if ((errorCode =
-		 Check_PermissionRights(targetptr, client, rights,
-					CHK_FETCHSTATUS, 0))) {
-		tstatus = &OutStats->AFSBulkStats_val[i];
-
-		tstatus->InterfaceVersion = 1;
-		if (thost->z.hostFlags & HERRORTRANS) {
-		    tstatus->errorCode = sys_error_to_et(errorCode);
-		} else {
-		    tstatus->errorCode = errorCode;
-		}
-
-		(void)PutVolumePackage(acall, parentwhentargetnotdir,
-				       targetptr, (Vnode *) 0, volptr,
-				       &client);
-		parentwhentargetnotdir = (Vnode *) 0;
-		targetptr = (Vnode *) 0;
-		volptr = (Volume *) 0;
-		client = (struct client *)0;
-		continue;
-	    }
-	}
-
-	/* set OutStatus From the Fid  */
-	GetStatus(targetptr,
-		  (struct AFSFetchStatus *)&OutStats->AFSBulkStats_val[i],
-		  rights, anyrights, parentwhentargetnotdir);
-
-	/* If a r/w volume, also set the CallBack state */
-	if (VolumeWriteable(volptr))
-	    SetCallBackStruct(AddBulkCallBack(client->z.host, tfid),
-			      &CallBacks->AFSCBs_val[i]);
-	else {
-	    struct AFSFid myFid;
-	    memset(&myFid, 0, sizeof(struct AFSFid));
-	    myFid.Volume = tfid->Volume;
-	    SetCallBackStruct(AddVolCallBack(client->z.host, &myFid),
-			      &CallBacks->AFSCBs_val[i]);
-	}
-
-	/* put back the file ID and volume */
-	(void)PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
-			       (Vnode *) 0, volptr, &client);
-	parentwhentargetnotdir = (Vnode *) 0;
-	targetptr = (Vnode *) 0;
-	volptr = (Volume *) 0;
-	client = (struct client *)0;
     }
     errorCode = 0;
 
   Bad_InlineBulkStatus:
-    /* Update and store volume/vnode and parent vnodes back */
-    (void)PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
-			   (Vnode *) 0, volptr, &client);
+    /* put back the volume and client */
+    (void)PutVolumePackage(acall, (Vnode *) 0, (Vnode *) 0, (Vnode *) 0,
+			   bs.volptr, &bs.client);
     errorCode = CallPostamble(tcon, errorCode, thost);
 
     t_client = (struct client *)rx_GetSpecific(tcon, rxcon_client_key);
@@ -2921,6 +3008,7 @@ common_StoreData64(struct rx_call *acall, struct AFSFid *Fid,
     afs_sfsize_t bytesToXfer;
     afs_sfsize_t bytesXferred;
     static int remainder = 0;
+    int throttleMs = 0;		/* delay owed to the rate limits */
 
     ViceLog(1,
 	    ("StoreData: Fid = %u.%u.%u\n", Fid->Volume, Fid->Vnode,
@@ -2985,7 +3073,7 @@ common_StoreData64(struct rx_call *acall, struct AFSFid *Fid,
     errorCode =
 	StoreData_RXStyle(volptr, targetptr, Fid, client, acall, Pos, Length,
 			  FileLength, (InStatus->Mask & AFS_FSYNC),
-			  &bytesToXfer, &bytesXferred);
+			  &bytesToXfer, &bytesXferred, &throttleMs);
 
     fsstats_FinishXfer(&fsstats, errorCode, bytesToXfer, bytesXferred,
 		       &remainder);
@@ -3005,6 +3093,8 @@ common_StoreData64(struct rx_call *acall, struct AFSFid *Fid,
     /* Update and store volume/vnode and parent vnodes back */
     (void)PutVolumePackage(acall, parentwhentargetnotdir, targetptr,
 			   (Vnode *) 0, volptr, &client);
+    /* nothing is locked now, so pay off the transfer's rate limit debt */
+    (void)throttle_Wait(throttleMs, 1);
     ViceLog(2, ("SAFS_StoreData	returns	%d\n", errorCode));
 
     errorCode = CallPostamble(tcon, errorCode, thost);
@@ -5253,6 +5343,7 @@ FillPerfValues(struct afs_PerfStats *a_perfP)
     int dir_Calls;		/*# read calls in dir package */
     int dir_IOs;		/*# I/O ops in dir package */
     struct rx_statistics *stats;
+    ih_cache_stats_t fdstats;	/*fd cache counters */
 
     /*
      * Vnode cache section.
@@ -5349,6 +5440,20 @@ FillPerfValues(struct afs_PerfStats *a_perfP)
     a_perfP->sysname_ID = afs_perfstats.sysname_ID;
     a_perfP->rx_nBusies = (afs_int32) stats->nBusies;
     a_perfP->fs_nBusies = afs_perfstats.fs_nBusies;
+    a_perfP->fs_nThrottledOps = afs_perfstats.fs_nThrottledOps;
+    a_perfP->fs_nThrottledXfers = afs_perfstats.fs_nThrottledXfers;
+    a_perfP->fs_ThrottledMSecs = afs_perfstats.fs_ThrottledMSecs;
+
+    /*
+     * File descriptor cache section.
+     */
+    ih_GetCacheStats(&fdstats);
+    a_perfP->fd_CacheSize = fdstats.size;
+    a_perfP->fd_InUse = fdstats.inUse;
+    a_perfP->fd_Hits = fdstats.hits;
+    a_perfP->fd_Misses = fdstats.misses;
+    a_perfP->fd_Evictions = fdstats.evictions;
+    a_perfP->fd_Emfile = fdstats.emfile;
     rx_FreeStatistics(&stats);
 }				/*FillPerfValues */
 
@@ -5690,6 +5795,7 @@ SRXAFS_FlushCPS(struct rx_call * acall, struct ViceIds * vids,
     for (i = 0; i < nids; i++, vd++) {
 	if (!*vd)
 	    continue;
+	h_FlushUserCPS(*vd);
 	h_EnumerateClients(*vd, FlushClientCPS, NULL);
     }
 
@@ -6110,6 +6216,28 @@ SRXAFS_GetTime(struct rx_call * acall, afs_uint32 * Seconds,
 }				/*SRXAFS_GetTime */
 
 
+/*
+ * Charge a chunk of file data moved on this call against the rate limits
+ * of its volume, host and user.  The vnode is locked here, so rather than
+ * sleep, remember the longest delay owed in *a_throttleMsP; the caller
+ * waits it out once it has put back the volume package.
+ */
+static void
+ThrottleXfer(struct rx_call *Call, Volume *volptr, afs_sfsize_t nbytes,
+	     int *a_throttleMsP)
+{
+    struct client *client;
+    int ms;
+
+    client = rx_GetSpecific(rx_ConnectionOf(Call), rxcon_client_key);
+    if (client && client->z.host && nbytes > 0) {
+	ms = throttle_Charge(client->z.host->z.host, client->z.ViceId,
+			     V_id(volptr), 0, nbytes);
+	if (ms > *a_throttleMsP)
+	    *a_throttleMsP = ms;
+    }
+}
+
 /*
  * FetchData_RXStyle
  *
@@ -6126,6 +6254,8 @@ SRXAFS_GetTime(struct rx_call * acall, afs_uint32 * Seconds,
  *			  the File Server.
  *	a_bytesFetchedP	: Set to the actual number of bytes fetched from
  *			  the File Server.
+ *	a_throttleMsP	: Set to the delay, in milliseconds, owed to the
+ *			  rate limits for this transfer.
  */
 
 static afs_int32
@@ -6133,13 +6263,17 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 		  struct rx_call * Call, afs_sfsize_t Pos,
 		  afs_sfsize_t Len, afs_int32 Int64Mode,
 		  afs_sfsize_t * a_bytesToFetchP,
-		  afs_sfsize_t * a_bytesFetchedP)
+		  afs_sfsize_t * a_bytesFetchedP,
+		  int *a_throttleMsP)
 {
     struct timeval StartTime, StopTime;	/* used to calculate file  transfer rates */
     IHandle_t *ihP;
     FdHandle_t *fdP;
 #ifndef HAVE_PIOV
-    char *tbuffer;
+    char *tbuffer[2];		/* one being sent, one being read into */
+    int cur = 0;
+    ih_aio_t aio;
+    int reading = 0;
 #else /* HAVE_PIOV */
     struct iovec tiov[RX_MAXIOVECS];
     int tnio;
@@ -6213,7 +6347,13 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
     }
     (*a_bytesToFetchP) = Len;
 #ifndef HAVE_PIOV
-    tbuffer = AllocSendBuffer();
+    tbuffer[0] = AllocSendBuffer();
+    tbuffer[1] = AllocSendBuffer();
+    if (Len > 0) {
+	FDH_APREAD(&aio, fdP, tbuffer[cur], (Len > optSize) ? optSize : Len,
+		   Pos);
+	reading = 1;
+    }
 #endif /* HAVE_PIOV */
     while (Len > 0) {
 	size_t wlen;
@@ -6223,16 +6363,26 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 	else
 	    wlen = Len;
 #ifndef HAVE_PIOV
-	nBytes = FDH_PREAD(fdP, tbuffer, wlen, Pos);
+	nBytes = FDH_AWAIT(&aio);
+	reading = 0;
 	if (nBytes != wlen) {
 	    FDH_CLOSE(fdP);
-	    FreeSendBuffer((struct afs_buffer *)tbuffer);
+	    FreeSendBuffer((struct afs_buffer *)tbuffer[0]);
+	    FreeSendBuffer((struct afs_buffer *)tbuffer[1]);
 	    VTakeOffline(volptr);
 	    ViceLog(0, ("Volume %" AFS_VOLID_FMT " now offline, must be salvaged.\n",
 			afs_printable_VolumeId_lu(volptr->hashid)));
 	    return EIO;
 	}
-	nBytes = rx_Write(Call, tbuffer, wlen);
+	/* read the next chunk from disk while this one is sent */
+	if (Len > wlen) {
+	    FDH_APREAD(&aio, fdP, tbuffer[!cur],
+		       (Len - wlen > optSize) ? optSize : Len - wlen,
+		       Pos + wlen);
+	    reading = 1;
+	}
+	nBytes = rx_Write(Call, tbuffer[cur], wlen);
+	cur = !cur;
 #else /* HAVE_PIOV */
 	nBytes = rx_WritevAlloc(Call, tiov, &tnio, RX_MAXIOVECS, wlen);
 	if (nBytes <= 0) {
@@ -6258,10 +6408,13 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 	(*a_bytesFetchedP) += nBytes;
 	if (nBytes != wlen) {
 	    afs_int32 err;
-	    FDH_CLOSE(fdP);
 #ifndef HAVE_PIOV
-	    FreeSendBuffer((struct afs_buffer *)tbuffer);
+	    if (reading)
+		(void)FDH_AWAIT(&aio);
+	    FreeSendBuffer((struct afs_buffer *)tbuffer[0]);
+	    FreeSendBuffer((struct afs_buffer *)tbuffer[1]);
 #endif /* HAVE_PIOV */
+	    FDH_CLOSE(fdP);
 	    err = VIsGoingOffline(volptr);
 	    if (err) {
 		return err;
@@ -6269,9 +6422,11 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 	    return -31;
 	}
 	Len -= wlen;
+	ThrottleXfer(Call, volptr, wlen, a_throttleMsP);
     }
 #ifndef HAVE_PIOV
-    FreeSendBuffer((struct afs_buffer *)tbuffer);
+    FreeSendBuffer((struct afs_buffer *)tbuffer[0]);
+    FreeSendBuffer((struct afs_buffer *)tbuffer[1]);
 #endif /* HAVE_PIOV */
     FDH_CLOSE(fdP);
     gettimeofday(&StopTime, 0);
@@ -6346,6 +6501,8 @@ GetLinkCountAndSize(Volume * vp, FdHandle_t * fdP, int *lc,
  *			  the File Server.
  *	a_bytesStoredP	: Set to the actual number of bytes stored to
  *			  the File Server.
+ *	a_throttleMsP	: Set to the delay, in milliseconds, owed to the
+ *			  rate limits for this transfer.
  */
 afs_int32
 StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
@@ -6353,12 +6510,17 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 		  afs_fsize_t Pos, afs_fsize_t Length, afs_fsize_t FileLength,
 		  int sync,
 		  afs_sfsize_t * a_bytesToStoreP,
-		  afs_sfsize_t * a_bytesStoredP)
+		  afs_sfsize_t * a_bytesStoredP,
+		  int *a_throttleMsP)
 {
     afs_sfsize_t bytesTransfered;	/* number of bytes actually transfered */
     Error errorCode = 0;		/* Returned error code to caller */
 #ifndef HAVE_PIOV
-    char *tbuffer;	/* data copying buffer */
+    char *tbuffer[2];	/* data copying buffers: one being written out,
+			 * one being received into */
+    int cur = 0;
+    ih_aio_t aio;
+    int writing = 0;	/* bytes being written out from the other buffer */
 #else /* HAVE_PIOV */
     struct iovec tiov[RX_MAXIOVECS];	/* no data copying with iovec */
     int tnio;			/* temp for iovec size */
@@ -6437,6 +6599,10 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 	     */
 	    FDH_CLOSE(fdP);
 	    VN_GET_LEN(size, targetptr);
+	    /* A reflinked copy shares its extents with the clone; only the
+	     * blocks this store rewrites will take new space. */
+	    if ((volptr->partition->flags & PART_REFLINK) && Length < size)
+		size = Length;
 	    volptr->partition->flags &= ~PART_DONTUPDATE;
 	    VSetPartitionDiskUsage(volptr->partition);
 	    volptr->partition->flags |= PART_DONTUPDATE;
@@ -6503,7 +6669,8 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 
     bytesTransfered = 0;
 #ifndef HAVE_PIOV
-    tbuffer = AllocSendBuffer();
+    tbuffer[0] = AllocSendBuffer();
+    tbuffer[1] = AllocSendBuffer();
 #endif /* HAVE_PIOV */
     /* truncate the file iff it needs it (ftruncate is slow even when its a noop) */
     if (FileLength < DataLength) {
@@ -6545,7 +6712,7 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 	    else
 		rlen = (int)tlen;
 #ifndef HAVE_PIOV
-	    errorCode = rx_Read(Call, tbuffer, rlen);
+	    errorCode = rx_Read(Call, tbuffer[cur], rlen);
 #else /* HAVE_PIOV */
 	    errorCode = rx_Readv(Call, tiov, &tnio, RX_MAXIOVECS, rlen);
 #endif /* HAVE_PIOV */
@@ -6556,21 +6723,40 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 	    (*a_bytesStoredP) += errorCode;
 	    rlen = errorCode;
 #ifndef HAVE_PIOV
-	    nBytes = FDH_PWRITE(fdP, tbuffer, rlen, Pos);
+	    /* the previous chunk was written out while this one came in;
+	     * start writing this one while the next comes in */
+	    if (writing) {
+		nBytes = FDH_AWAIT(&aio);
+		if (nBytes != writing) {
+		    writing = 0;
+		    errorCode = VDISKFULL;
+		    break;
+		}
+	    }
+	    FDH_APWRITE(&aio, fdP, tbuffer[cur], rlen, Pos);
+	    writing = rlen;
+	    cur = !cur;
 #else /* HAVE_PIOV */
 	    nBytes = FDH_PWRITEV(fdP, tiov, tnio, Pos);
-#endif /* HAVE_PIOV */
 	    if (nBytes != rlen) {
 		errorCode = VDISKFULL;
 		break;
 	    }
+#endif /* HAVE_PIOV */
 	    bytesTransfered += rlen;
 	    Pos += rlen;
+	    ThrottleXfer(Call, volptr, rlen, a_throttleMsP);
 	}
     }
   done:
 #ifndef HAVE_PIOV
-    FreeSendBuffer((struct afs_buffer *)tbuffer);
+    if (writing) {
+	nBytes = FDH_AWAIT(&aio);
+	if (nBytes != writing && !errorCode)
+	    errorCode = VDISKFULL;
+    }
+    FreeSendBuffer((struct afs_buffer *)tbuffer[0]);
+    FreeSendBuffer((struct afs_buffer *)tbuffer[1]);
 #endif /* HAVE_PIOV */
     if (sync) {
 	(void) FDH_SYNC(fdP);
@@ -1735,6 +1735,18 @@ static int cb_stateCheckHeader(struct callback_state_header * hdr);
 
 static int cb_stateAllocMap(struct fs_dump_state * state);
 
+/* size of the saved callback state, used to size the dump file up front */
+afs_uint64
+cb_stateSizeHint(void)
+{
+    return sizeof(struct callback_state_header) +
+	sizeof(struct callback_state_timeout_header) + sizeof(timeout) +
+	sizeof(struct callback_state_fehash_header) + sizeof(HashTable) +
+	(afs_uint64)cbstuff.nFEs * (sizeof(struct callback_state_entry_header) +
+				   sizeof(struct FEDiskEntry)) +
+	(afs_uint64)cbstuff.nCBs * sizeof(struct CBDiskEntry);
+}
+
 int
 cb_stateSave(struct fs_dump_state * state)
 {
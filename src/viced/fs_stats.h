@@ -126,10 +126,27 @@ struct afs_PerfStats {
      * Can't count this as an RPC because it breaks the data structure
      */
     afs_int32 fs_nGetCaps;	/* Number of GetCapabilities calls */
+
+    /*
+     * Rate limiting (see throttle.c)
+     */
+    afs_int32 fs_nThrottledOps;		/* RPCs delayed by a ops/sec limit */
+    afs_int32 fs_nThrottledXfers;	/* data transfers delayed by a limit */
+    afs_int32 fs_ThrottledMSecs;	/* total time spent throttled, msecs */
+
+    /*
+     * File descriptor cache (see vol/ihandle.c)
+     */
+    afs_int32 fd_CacheSize;	/* current size of the fd cache */
+    afs_int32 fd_InUse;		/* open descriptors, cached or in use */
+    afs_int32 fd_Hits;		/* opens served from the cache */
+    afs_int32 fd_Misses;	/* opens that had to open the file */
+    afs_int32 fd_Evictions;	/* cached descriptors closed for room */
+    afs_int32 fd_Emfile;	/* opens that ran out of descriptors */
     /*
      * Spares
      */
-    afs_int32 spare[28];
+    afs_int32 spare[19];
 };
 
 /*
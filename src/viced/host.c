@@ -16,6 +16,7 @@
 #include <roken.h>
 #include <afs/opr.h>
 #include <opr/lock.h>
+#include <opr/queue.h>
 
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
@@ -57,6 +58,7 @@ extern struct afsconf_dir *confDir;	/* config dir object */
 extern int lwps;		/* the max number of server threads */
 extern afsUUID FS_HostUUID;
 extern char *FS_configPath;
+extern int hostaclRefresh;
 
 afsUUID nulluuid;
 int CEs = 0;			/* active clients */
@@ -646,6 +648,372 @@ h_flushhostcps(afs_uint32 hostaddr, afs_uint16 hport)
 }
 
 
+/*
+ * Background CPS refresh.
+ *
+ * A host's CPS is refetched every hostaclRefresh seconds, and a user's CPS
+ * is fetched whenever a new connection for that user appears.  Doing that
+ * inline from the RPC thread means a slow ptserver stalls the thread, and
+ * everyone else waiting on HCPS_INPROGRESS for that host.  When we already
+ * hold a usable CPS we keep serving it, and hand the refresh to a small pool
+ * of worker threads which swap the new CPS in once it arrives.
+ *
+ * If enabled with -cache-user-cps, user CPSs are remembered in a small
+ * cache keyed by vice id, so that new connections for a user we have seen
+ * recently do not have to go to the ptserver at all.  Entries are dropped
+ * by FlushCPS.  This is off by default, since a cached CPS outlives group
+ * membership changes until it is refreshed, even across logins.
+ *
+ * All of this state is protected by H_LOCK.
+ */
+#define H_USERCPS_MAX		4096	/* max user CPSs cached */
+#define H_CPS_RETRY		60	/* secs before retrying a failed refresh */
+#define H_CPS_BATCH		16	/* max requests handled per wakeup */
+
+struct h_UserCPS {
+    struct h_UserCPS *next;	/* hash chain */
+    struct opr_queue lru;	/* entry in h_userCPSLRU */
+    afs_int32 viceid;
+    afs_uint32 fetchTime;	/* when cps was fetched from the ptserver */
+    char queued;		/* background refresh queued */
+    prlist cps;
+};
+
+struct h_CPSRequest {
+    struct opr_queue q;
+    struct host *host;		/* held; NULL for a user CPS refresh */
+    afs_uint32 hostaddr;	/* host->z.host when the batch was taken */
+    afs_int32 viceid;
+    afs_int32 code;		/* result of the ptserver call */
+    prlist cps;
+};
+
+static int h_cpsRefreshThreads;	/* 0 if background refresh is disabled */
+static int h_userCPSCache;	/* remember user CPSs across connections */
+static struct opr_queue h_cpsRequests;
+static pthread_cond_t h_cpsRequestCV;
+
+static struct h_UserCPS *h_userCPSHash[h_HASHENTRIES];
+static struct opr_queue h_userCPSLRU;
+static int h_userCPSCount;
+
+#define h_UserCPSHashIndex(id) (((afs_uint32)(id)) & (h_HASHENTRIES - 1))
+
+static_inline int
+h_CPSIsTransientError(afs_int32 code)
+{
+    return (code < 0 || code == UNOQUORUM || code == UNOTSYNC);
+}
+
+static int
+h_CopyCPS(prlist *from, prlist *to)
+{
+    to->prlist_val = malloc(from->prlist_len * sizeof(afs_int32));
+    if (to->prlist_val == NULL) {
+	to->prlist_len = 0;
+	return ENOMEM;
+    }
+    memcpy(to->prlist_val, from->prlist_val,
+	   from->prlist_len * sizeof(afs_int32));
+    to->prlist_len = from->prlist_len;
+    return 0;
+}
+
+static struct h_UserCPS *
+h_LookupUserCPS_r(afs_int32 viceid)
+{
+    struct h_UserCPS *entry;
+
+    for (entry = h_userCPSHash[h_UserCPSHashIndex(viceid)]; entry;
+	 entry = entry->next) {
+	if (entry->viceid == viceid)
+	    return entry;
+    }
+    return NULL;
+}
+
+static void
+h_DeleteUserCPS_r(struct h_UserCPS *entry)
+{
+    struct h_UserCPS **prev;
+
+    for (prev = &h_userCPSHash[h_UserCPSHashIndex(entry->viceid)];
+	 *prev != entry; prev = &(*prev)->next)
+	opr_Assert(*prev != NULL);
+    *prev = entry->next;
+    opr_queue_Remove(&entry->lru);
+    h_userCPSCount--;
+    free(entry->cps.prlist_val);
+    free(entry);
+}
+
+/*
+ * Queue a background CPS refresh for a host (if host is non-NULL) or a
+ * user.  The host, if any, must be held by the caller; the request takes
+ * its own hold.  Returns 0 if the request was queued, nonzero if the
+ * refresh service is not running.
+ */
+static int
+h_QueueCPSRefresh_r(struct host *host, afs_int32 viceid)
+{
+    struct h_CPSRequest *req;
+
+    if (h_cpsRefreshThreads == 0)
+	return -1;
+    req = calloc(1, sizeof(*req));
+    if (req == NULL)
+	return ENOMEM;
+    if (host) {
+	h_Hold_r(host);
+	host->z.hostFlags |= HCPS_REFRESH;
+    }
+    req->host = host;
+    req->viceid = viceid;
+    opr_queue_Append(&h_cpsRequests, &req->q);
+    opr_cv_signal(&h_cpsRequestCV);
+    return 0;
+}
+
+/*
+ * Copy a cached CPS for the given user into cps.  A stale entry is still
+ * returned, but a background refresh for it is queued.  Returns 0 if cps
+ * was filled in, nonzero if no usable CPS is cached.
+ */
+static int
+h_GetUserCPS_r(afs_int32 viceid, prlist *cps)
+{
+    struct h_UserCPS *entry;
+    afs_uint32 now = time(NULL);
+
+    if (!h_userCPSCache)
+	return ENOENT;
+    entry = h_LookupUserCPS_r(viceid);
+    if (entry == NULL)
+	return ENOENT;
+    if (entry->fetchTime + hostaclRefresh < now && !entry->queued) {
+	if (h_QueueCPSRefresh_r(NULL, viceid) != 0) {
+	    /* Nobody to refresh it for us; have the caller fetch it. */
+	    h_DeleteUserCPS_r(entry);
+	    return ENOENT;
+	}
+	entry->queued = 1;
+    }
+    if (h_CopyCPS(&entry->cps, cps) != 0)
+	return ENOMEM;
+    opr_queue_Remove(&entry->lru);
+    opr_queue_Prepend(&h_userCPSLRU, &entry->lru);
+    return 0;
+}
+
+/* Remember a freshly fetched CPS for the given user. */
+static void
+h_PutUserCPS_r(afs_int32 viceid, prlist *cps)
+{
+    struct h_UserCPS *entry;
+    prlist copy;
+
+    if (!h_userCPSCache || cps->prlist_len <= 0)
+	return;
+    if (h_CopyCPS(cps, &copy) != 0)
+	return;
+
+    entry = h_LookupUserCPS_r(viceid);
+    if (entry != NULL) {
+	free(entry->cps.prlist_val);
+	opr_queue_Remove(&entry->lru);
+    } else {
+	if (h_userCPSCount >= H_USERCPS_MAX) {
+	    struct h_UserCPS *victim;
+
+	    victim = opr_queue_Last(&h_userCPSLRU, struct h_UserCPS, lru);
+	    h_DeleteUserCPS_r(victim);
+	}
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+	    free(copy.prlist_val);
+	    return;
+	}
+	entry->viceid = viceid;
+	entry->next = h_userCPSHash[h_UserCPSHashIndex(viceid)];
+	h_userCPSHash[h_UserCPSHashIndex(viceid)] = entry;
+	h_userCPSCount++;
+    }
+    entry->cps = copy;
+    entry->fetchTime = time(NULL);
+    opr_queue_Prepend(&h_userCPSLRU, &entry->lru);
+}
+
+/* Forget any cached CPS for the given user; called for FlushCPS. */
+void
+h_FlushUserCPS(afs_int32 viceid)
+{
+    struct h_UserCPS *entry;
+
+    H_LOCK;
+    entry = h_LookupUserCPS_r(viceid);
+    if (entry != NULL)
+	h_DeleteUserCPS_r(entry);
+    H_UNLOCK;
+}
+
+/* Install the result of a background host CPS refresh. */
+static void
+h_ApplyHostCPS_r(struct h_CPSRequest *req, afs_uint32 now)
+{
+    struct host *host = req->host;
+    char hoststr[16];
+
+    host->z.hostFlags &= ~HCPS_REFRESH;
+
+    /*
+     * If the host went away, or someone flushed or is synchronously
+     * refetching its CPS while we were out, our answer is not wanted.
+     */
+    if ((host->z.hostFlags & (HOSTDELETED | HCPS_INPROGRESS))
+	|| host->z.hcpsfailed)
+	return;
+
+    if (req->code == 0) {
+	free(host->z.hcps.prlist_val);
+	host->z.hcps = req->cps;
+	req->cps.prlist_val = NULL;
+	req->cps.prlist_len = 0;
+	host->z.cpsCall = now;
+    } else if (h_CPSIsTransientError(req->code)) {
+	/* Keep serving the old CPS, and try again in a little while. */
+	ViceLog(0,
+		("Warning:  background GetHostCPS failed (%d) for %p (%s:%d); "
+		 "will retry\n", req->code, host,
+		 afs_inet_ntoa_r(host->z.host, hoststr), ntohs(host->z.port)));
+	host->z.cpsCall = now - hostaclRefresh + H_CPS_RETRY;
+    } else {
+	ViceLog(1,
+		("gethost:  GetHostCPS failed (%d) for %p (%s:%d); ignored\n",
+		 req->code, host, afs_inet_ntoa_r(host->z.host, hoststr),
+		 ntohs(host->z.port)));
+	free(host->z.hcps.prlist_val);
+	host->z.hcps.prlist_val = NULL;
+	host->z.hcps.prlist_len = 0;
+	host->z.cpsCall = now;
+    }
+}
+
+/* Install the result of a background user CPS refresh. */
+static void
+h_ApplyUserCPS_r(struct h_CPSRequest *req, afs_uint32 now)
+{
+    struct h_UserCPS *entry;
+
+    /* If the entry was flushed while we were out, drop our answer. */
+    entry = h_LookupUserCPS_r(req->viceid);
+    if (entry == NULL || !entry->queued)
+	return;
+    entry->queued = 0;
+
+    if (req->code == 0 && req->cps.prlist_len > 0) {
+	free(entry->cps.prlist_val);
+	entry->cps = req->cps;
+	req->cps.prlist_val = NULL;
+	req->cps.prlist_len = 0;
+	entry->fetchTime = now;
+    } else if (req->code != 0 && h_CPSIsTransientError(req->code)) {
+	ViceLog(0, ("Warning:  background GetCPS failed (%d) for user %d; "
+		    "will retry\n", req->code, req->viceid));
+	entry->fetchTime = now - hostaclRefresh + H_CPS_RETRY;
+    } else {
+	ViceLog(0, ("pr_GetCPS failed(%d) for user %d\n", req->code,
+		    req->viceid));
+	h_DeleteUserCPS_r(entry);
+    }
+}
+
+static void *
+h_CPSRefreshThread(void *unused)
+{
+    struct opr_queue batch;
+    struct opr_queue *cursor, *store;
+    struct h_CPSRequest *req;
+    afs_uint32 now;
+    int n;
+
+    rx_SetThreadNum();
+    opr_threadname_set("CPSRefresh");
+    opr_queue_Init(&batch);
+
+    H_LOCK;
+    for (;;) {
+	while (opr_queue_IsEmpty(&h_cpsRequests))
+	    opr_cv_wait(&h_cpsRequestCV, &host_glock_mutex);
+
+	/* Take a batch of requests, and fetch them all with H_LOCK dropped. */
+	for (n = 0; n < H_CPS_BATCH && !opr_queue_IsEmpty(&h_cpsRequests);
+	     n++) {
+	    req = opr_queue_First(&h_cpsRequests, struct h_CPSRequest, q);
+	    opr_queue_Remove(&req->q);
+	    if (req->host)
+		req->hostaddr = req->host->z.host;
+	    opr_queue_Append(&batch, &req->q);
+	}
+	H_UNLOCK;
+
+	for (opr_queue_Scan(&batch, cursor)) {
+	    req = opr_queue_Entry(cursor, struct h_CPSRequest, q);
+	    if (req->host)
+		req->code = hpr_GetHostCPS(ntohl(req->hostaddr), &req->cps);
+	    else
+		req->code = hpr_GetCPS(req->viceid, &req->cps);
+	}
+
+	now = time(NULL);
+	H_LOCK;
+	for (opr_queue_ScanSafe(&batch, cursor, store)) {
+	    req = opr_queue_Entry(cursor, struct h_CPSRequest, q);
+	    opr_queue_Remove(&req->q);
+	    if (req->host) {
+		h_ApplyHostCPS_r(req, now);
+		h_Release_r(req->host);
+	    } else {
+		h_ApplyUserCPS_r(req, now);
+	    }
+	    free(req->cps.prlist_val);
+	    free(req);
+	}
+    }
+    AFS_UNREACHED(return(NULL));
+}
+
+/*
+ * Start the background CPS refresh service, remembering user CPSs across
+ * connections if usercache is set; not reentrant.
+ */
+void
+h_StartCPSRefresh(int nthreads, int usercache)
+{
+    pthread_attr_t tattr;
+    pthread_t tid;
+    int i;
+
+    if (nthreads <= 0)
+	return;
+
+    opr_queue_Init(&h_cpsRequests);
+    opr_queue_Init(&h_userCPSLRU);
+    opr_cv_init(&h_cpsRequestCV);
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    for (i = 0; i < nthreads; i++)
+	opr_Verify(pthread_create(&tid, &tattr, h_CPSRefreshThread,
+				  NULL) == 0);
+
+    H_LOCK;
+    h_cpsRefreshThreads = nthreads;
+    h_userCPSCache = usercache;
+    H_UNLOCK;
+    ViceLog(1, ("Started %d CPS refresh threads\n", nthreads));
+}
+
 /*
  * Allocate a host.  It will be identified by the peer (ip,port) info in the
  * rx connection provided.  The host is returned held and locked
@@ -736,7 +1104,6 @@ h_Lookup_r(afs_uint32 haddr, afs_uint16 hport, struct host **hostp)
     struct host *host = NULL;
     struct h_AddrHashChain *chain;
     int index = h_HashIndex(haddr);
-    extern int hostaclRefresh;
 
   restart:
     for (chain = hostAddrHashTable[index]; chain; chain = chain->next) {
@@ -759,16 +1126,25 @@ h_Lookup_r(afs_uint32 haddr, afs_uint16 hport, struct host **hostp)
 	    }
 	    h_Unlock_r(host);
 	    now = time(NULL);	/* always evaluate "now" */
-	    if (host->z.hcpsfailed || (host->z.cpsCall + hostaclRefresh < now)) {
+	    if (host->z.hcpsfailed) {
 		/*
-		 * Every hostaclRefresh period (def 2 hrs) get the new
-		 * membership list for the host.  Note this could be the
-		 * first time that the host is added to a group.  Also
-		 * here we also retry on previous legitimate hcps failures.
+		 * Retry on previous legitimate hcps failures; we have no
+		 * CPS to fall back on, so wait for it.
 		 *
 		 * If we get here refCount is elevated.
 		 */
 		h_gethostcps_r(host, now);
+	    } else if (host->z.cpsCall + hostaclRefresh < now
+		       && !(host->z.hostFlags & HCPS_REFRESH)) {
+		/*
+		 * Every hostaclRefresh period (def 2 hrs) get the new
+		 * membership list for the host.  Note this could be the
+		 * first time that the host is added to a group.  Keep
+		 * using the current list until the new one arrives, unless
+		 * there is nobody to fetch it in the background.
+		 */
+		if (h_QueueCPSRefresh_r(host, 0) != 0)
+		    h_gethostcps_r(host, now);
 	    }
 	    break;
 	}
@@ -2726,10 +3102,14 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
 	if (viceid == ANONYMOUSID) {
 	    client->z.CPS.prlist_len = AnonCPS.prlist_len;
 	    client->z.CPS.prlist_val = AnonCPS.prlist_val;
+	} else if (h_GetUserCPS_r(viceid, &client->z.CPS) == 0) {
+	    /* We already know a recent CPS for this user. */
 	} else {
 	    H_UNLOCK;
 	    code = hpr_GetCPS(viceid, &client->z.CPS);
 	    H_LOCK;
+	    if (code == 0)
+		h_PutUserCPS_r(viceid, &client->z.CPS);
 	    if (code) {
 		char hoststr[16];
 		ViceLog(0,
@@ -3181,6 +3561,20 @@ h_isBusy_r(struct host *host)
     return 0;
 }
 
+/* estimate the size of the saved host state, so the dump file can be
+ * sized up front.  allows for a few interfaces and a modest CPS per host;
+ * the dump file is still grown on demand if this comes up short. */
+afs_uint64
+h_stateSizeHint(void)
+{
+    afs_uint64 per_host;
+
+    per_host = sizeof(struct host_state_entry_header) +
+	sizeof(struct hostDiskEntry) + sizeof(struct Interface) +
+	(4 * sizeof(struct AddrPort)) + (32 * sizeof(afs_int32));
+    return sizeof(struct host_state_header) + hostCount * per_host;
+}
+
 /* this procedure saves all host state to disk for fast startup */
 int
 h_stateSave(struct fs_dump_state * state)
@@ -3722,7 +4116,7 @@ h_diskEntryToHost_r(struct hostDiskEntry * in, struct host * out)
 {
     out->z.host = in->host;
     out->z.port = in->port;
-    out->z.hostFlags = in->hostFlags;
+    out->z.hostFlags = in->hostFlags & ~HCPS_REFRESH;
     out->z.Console = in->Console;
     out->z.hcpsfailed = in->hcpsfailed;
     out->z.LastCall = in->LastCall;
@@ -225,6 +225,8 @@ extern void h_GetWorkStats(int *, int *, int *, afs_int32);
 extern void h_GetWorkStats64(afs_uint64 *, afs_uint64 *, afs_uint64 *, afs_int32);
 extern void h_flushhostcps(afs_uint32 hostaddr,
 			   afs_uint16 hport);
+extern void h_FlushUserCPS(afs_int32 viceid);
+extern void h_StartCPSRefresh(int nthreads, int usercache);
 extern void h_GetHostNetStats(afs_int32 * a_numHostsP, afs_int32 * a_sameNetOrSubnetP,
 		  afs_int32 * a_diffSubnetP, afs_int32 * a_diffNetworkP);
 extern int h_NBLock_r(struct host *host);
@@ -279,4 +281,5 @@ struct host *(hosttableptrs[h_MAXHOSTTABLES]);	/* Used by h_itoh */
 #define HERRORTRANS                    0x100	/* do error translation */
 #define HWHO_INPROGRESS                0x200    /* set when WhoAreYou running */
 #define HCBREAK                        0x400    /* flag for a multi CB break */
+#define HCPS_REFRESH                   0x800    /* background CPS refresh queued */
 #endif /* _AFS_VICED_HOST_H */
@@ -58,6 +58,7 @@
 
 #ifdef FS_STATE_USE_MMAP
 #define FS_STATE_INIT_FILESIZE (8 * 1024 * 1024)  /* truncate to 8MB initially */
+#define FS_STATE_CKSUM_THREADS 8	/* max threads used to checksum a section */
 #ifndef AFS_NT40_ENV
 #include <sys/mman.h>
 #endif
@@ -80,6 +81,13 @@ static int fs_stateUnmapFile(struct fs_dump_state * state);
 static int fs_stateIncCursor(struct fs_dump_state * state, size_t len);
 static int fs_stateCheckIOSafety(struct fs_dump_state * state,
 				 size_t len);
+
+static int fs_stateCksumSection(struct fs_dump_state * state,
+				afs_uint64 offset, afs_uint64 len,
+				afs_uint32 * cksum);
+static int fs_stateVerifySection(struct fs_dump_state * state, char * name,
+				 afs_uint64 offset, afs_uint64 len,
+				 afs_uint32 expected);
 #endif
 
 static int fs_stateFillHeader(struct fs_state_header * hdr);
@@ -186,6 +194,8 @@ fs_stateSave(void)
     if (!verified) {
 	state.bail = 1;
     }
+    /* only a dump whose checks ran and passed may skip them on restore */
+    state.hdr->verified = verified && fs_state.options.fs_state_verify_before_save;
 
     if (fs_stateCommitDump(&state)) {
 	ViceLog(0, ("fs_stateSave: error: dump commit failed\n"));
@@ -274,7 +284,18 @@ fs_stateRestore(void)
 
     ViceLog(0, ("fs_stateRestore: restore phase complete\n"));
 
-    if (fs_state.options.fs_state_verify_after_restore) {
+    /*
+     * walking every hash chain and callback list again is the slowest part
+     * of a restore with many callbacks.  a dump whose tables passed those
+     * checks before it was saved, and whose sections still hash to the
+     * saved checksums, holds exactly what was checked; the index remapping
+     * above has already checked every link in it.  so unless the
+     * verification was asked for explicitly, skip it for such dumps.
+     */
+    if (fs_state.options.fs_state_verify_after_restore && state.flags.intact
+	&& !fs_state.options.fs_state_verify_intact) {
+	ViceLog(0, ("fs_stateRestore: dump was verified before save and is intact; skipping state verification phase\n"));
+    } else if (fs_state.options.fs_state_verify_after_restore) {
 	ViceLog(0, ("fs_stateRestore: beginning state verification phase\n"));
 
 	if (state.flags.do_host_restore) {
@@ -402,6 +423,20 @@ fs_stateCommitDump(struct fs_dump_state * state)
 	ret = 1;
 	goto done;
     }
+
+    /* checksum the host and callback sections, so that a restore can
+     * detect a damaged dump before it starts rebuilding tables from it */
+    state->hdr->h_len = state->hdr->cb_offset - state->hdr->h_offset;
+    state->hdr->cb_len = state->eof_offset - state->hdr->cb_offset;
+    if (fs_stateCksumSection(state, state->hdr->h_offset, state->hdr->h_len,
+			     &state->hdr->h_cksum) ||
+	fs_stateCksumSection(state, state->hdr->cb_offset, state->hdr->cb_len,
+			     &state->hdr->cb_cksum)) {
+	ViceLog(0, ("fs_stateCommitDump: failed to checksum dump file '%s'\n",
+		    state->fn));
+	ret = 1;
+	goto done;
+    }
 #endif
 
     /* ensure that all pending data I/Os for the state file have been committed
@@ -488,6 +523,23 @@ fs_stateLoadDump(struct fs_dump_state * state)
 	goto done;
     }
 
+#ifdef FS_STATE_USE_MMAP
+    /* dumps older than FS_STATE_VERSION_NOCKSUM+1 carry no checksums */
+    if (state->hdr->stamp.version > FS_STATE_VERSION_NOCKSUM &&
+	(state->hdr->h_len || state->hdr->cb_len)) {
+	if (fs_stateVerifySection(state, "host", state->hdr->h_offset,
+				  state->hdr->h_len, state->hdr->h_cksum) ||
+	    fs_stateVerifySection(state, "callback", state->hdr->cb_offset,
+				  state->hdr->cb_len, state->hdr->cb_cksum)) {
+	    ViceLog(0, ("fs_stateLoadDump: checksum verification failed; not restoring '%s'\n",
+			state->fn));
+	    ret = 1;
+	    goto done;
+	}
+	state->flags.intact = (state->hdr->verified != 0);
+    }
+#endif
+
     if ((state->hdr->timestamp + HOST_STATE_VALID_WINDOW) >= now) {
 	state->flags.do_host_restore = 1;
     } else {
@@ -711,7 +763,14 @@ static int
 fs_stateSizeFile(struct fs_dump_state * state)
 {
     int ret = 0;
-    state->file_len = FS_STATE_INIT_FILESIZE;
+    afs_uint64 hint;
+
+    /* size the file for the state we expect to write, so that large dumps
+     * are not built by repeatedly unmapping, growing and remapping it */
+    hint = sizeof(struct fs_state_header) + h_stateSizeHint() +
+	cb_stateSizeHint();
+    state->file_len = ((hint / FS_STATE_INIT_FILESIZE) + 1) *
+	FS_STATE_INIT_FILESIZE;
     if (afs_ftruncate(state->fd, state->file_len) != 0)
 	ret = 1;
     return ret;
@@ -766,7 +825,7 @@ fs_stateMapFile(struct fs_dump_state * state, int preserve_flag )
 	flags = PROT_READ | PROT_WRITE;   /* loading involves a header invalidation */
 	break;
     case FS_STATE_DUMP_MODE:
-	flags = PROT_WRITE;
+	flags = PROT_READ | PROT_WRITE;   /* commit checksums what was written */
 	break;
     default:
 	ViceLog(0, ("fs_stateMapFile: invalid dump state mode\n"));
@@ -889,6 +948,103 @@ fs_stateCheckIOSafety(struct fs_dump_state * state, size_t len)
     }
     return ret;
 }
+
+struct fs_stateCksumWork {
+    char * base;
+    afs_uint64 len;
+    afs_uint32 nchunks;
+    afs_uint32 next;            /* next chunk to hand out */
+    afs_uint32 * sums;          /* per-chunk checksums */
+    opr_mutex_t lock;
+};
+
+static void *
+fs_stateCksumWorker(void * rock)
+{
+    struct fs_stateCksumWork * work = rock;
+    afs_uint32 chunk;
+
+    for (;;) {
+	opr_mutex_enter(&work->lock);
+	chunk = work->next++;
+	opr_mutex_exit(&work->lock);
+	if (chunk >= work->nchunks)
+	    break;
+	work->sums[chunk] = fs_stateCksumChunk(work->base, work->len, chunk);
+    }
+    return NULL;
+}
+
+/*
+ * checksum a section of the memory mapped dump file.
+ *
+ * the chunks of large sections are hashed by a small pool of threads; the
+ * chunk sums are then folded in order, so the result does not depend on
+ * how many threads took part.
+ */
+static int
+fs_stateCksumSection(struct fs_dump_state * state, afs_uint64 offset,
+		     afs_uint64 len, afs_uint32 * cksum)
+{
+    struct fs_stateCksumWork work;
+    pthread_t tids[FS_STATE_CKSUM_THREADS - 1];
+    int i, nthreads = 0;
+
+    if (offset > state->mmap.size || len > state->mmap.size - offset) {
+	ViceLog(0, ("fs_stateCksumSection: section extends beyond end of dump file '%s'\n",
+		    state->fn));
+	return 1;
+    }
+
+    memset(&work, 0, sizeof(work));
+    work.base = (char *)state->mmap.map + offset;
+    work.len = len;
+    work.nchunks = FS_STATE_CKSUM_NCHUNKS(len);
+    *cksum = 0;
+    if (work.nchunks == 0)
+	return 0;
+
+    work.sums = calloc(work.nchunks, sizeof(afs_uint32));
+    if (work.sums == NULL) {
+	ViceLog(0, ("fs_stateCksumSection: memory allocation failed\n"));
+	return 1;
+    }
+    opr_mutex_init(&work.lock);
+
+    /* this thread works too; if a helper cannot be started, the
+     * remaining threads simply pick up its share */
+    for (i = 0; i < FS_STATE_CKSUM_THREADS - 1 && i < work.nchunks - 1; i++) {
+	if (pthread_create(&tids[nthreads], NULL, fs_stateCksumWorker,
+			   &work) == 0)
+	    nthreads++;
+    }
+    fs_stateCksumWorker(&work);
+    for (i = 0; i < nthreads; i++)
+	opr_Verify(pthread_join(tids[i], NULL) == 0);
+
+    for (i = 0; i < work.nchunks; i++)
+	*cksum = fs_stateCksumFold(*cksum, work.sums[i]);
+
+    opr_mutex_destroy(&work.lock);
+    free(work.sums);
+    return 0;
+}
+
+static int
+fs_stateVerifySection(struct fs_dump_state * state, char * name,
+		      afs_uint64 offset, afs_uint64 len, afs_uint32 expected)
+{
+    afs_uint32 cksum;
+
+    if (fs_stateCksumSection(state, offset, len, &cksum))
+	return 1;
+    if (cksum != expected) {
+	ViceLog(0, ("fs_stateVerifySection: %s section checksum mismatch (computed 0x%x, expected 0x%x)\n",
+		    name, cksum, expected));
+	return 1;
+    }
+    return 0;
+}
 #endif /* FS_STATE_USE_MMAP */
 
 #ifdef FS_STATE_USE_MMAP
@@ -972,7 +1128,8 @@ fs_stateCheckHeader(struct fs_state_header * hdr)
 	ViceLog(0, ("fs_stateCheckHeader: invalid dump header\n"));
 	ret = 1;
     }
-    else if (hdr->stamp.version != FS_STATE_VERSION) {
+    else if (hdr->stamp.version < FS_STATE_VERSION_NOCKSUM ||
+	     hdr->stamp.version > FS_STATE_VERSION) {
 	ViceLog(0, ("fs_stateCheckHeader: unknown dump format version number\n"));
 	ret = 1;
     }
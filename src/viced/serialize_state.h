@@ -17,8 +17,11 @@
 
 #ifdef AFS_DEMAND_ATTACH_FS
 
+#include <opr/jhash.h>
+
 #define FS_STATE_MAGIC 0x62FA841C
-#define FS_STATE_VERSION 2
+#define FS_STATE_VERSION 3
+#define FS_STATE_VERSION_NOCKSUM 2	/* oldest version we can restore */
 
 #define HOST_STATE_MAGIC 0x7B8C9DAE
 #define HOST_STATE_VERSION 2
@@ -66,7 +69,12 @@ struct fs_state_header {
     afs_uint64 h_offset;              /* offset of host_state_header structure */
     afs_uint64 cb_offset;             /* offset of callback_state_header structure */
     afs_uint64 vlru_offset;           /* offset of vlru state structure */
-    afs_uint32 reserved2[56];         /* for expansion */
+    afs_uint64 h_len;                 /* length of host state data (v3) */
+    afs_uint64 cb_len;                /* length of callback state data (v3) */
+    afs_uint32 h_cksum;               /* checksum of host state data (v3) */
+    afs_uint32 cb_cksum;              /* checksum of callback state data (v3) */
+    afs_uint32 verified;              /* tables passed checks before save (v3) */
+    afs_uint32 reserved2[49];         /* for expansion */
     char server_version_string[128];  /* version string from AFS_component_version_number.c */
     afs_uint32 reserved3[128];        /* for expansion */
 };
@@ -201,6 +209,35 @@ struct AVDiskEntry {
 };
 
 
+/*
+ * section checksums
+ *
+ * each section is checksummed in fixed size chunks, and the chunk sums are
+ * folded together in order.  this lets the fileserver hash the chunks of a
+ * large section in parallel, while tools like state_analyzer can simply
+ * walk the chunks one after another and arrive at the same answer.
+ */
+#define FS_STATE_CKSUM_CHUNK (4 * 1024 * 1024)
+#define FS_STATE_CKSUM_NCHUNKS(len) \
+    (((len) + FS_STATE_CKSUM_CHUNK - 1) / FS_STATE_CKSUM_CHUNK)
+
+static_inline afs_uint32
+fs_stateCksumChunk(const char *base, afs_uint64 len, afs_uint32 chunk)
+{
+    afs_uint64 off = (afs_uint64)chunk * FS_STATE_CKSUM_CHUNK;
+    afs_uint64 clen = len - off;
+
+    if (clen > FS_STATE_CKSUM_CHUNK)
+	clen = FS_STATE_CKSUM_CHUNK;
+    return opr_jhash_opaque(base + off, clen, chunk);
+}
+
+static_inline afs_uint32
+fs_stateCksumFold(afs_uint32 cksum, afs_uint32 chunk_sum)
+{
+    return opr_jhash_int(chunk_sum, cksum);
+}
+
 /*
  * dump runtime state
  */
@@ -237,6 +274,7 @@ struct fs_dump_state {
 	byte do_host_restore;              /* whether host restore should be done */
 	byte some_steps_skipped;           /* whether some steps were skipped */
 	byte warnings_generated;           /* whether any warnings were generated during restore */
+	byte intact;                       /* checked before save, and checksums match */
     } flags;
     afs_fsize_t file_len;
     int fd;                                /* fd of the current dump file */
@@ -293,6 +331,7 @@ extern int fs_stateSeek(struct fs_dump_state * state,
 			afs_uint64 * offset);
 
 /* host.c */
+extern afs_uint64 h_stateSizeHint(void);
 extern int h_stateSave(struct fs_dump_state * state);
 extern int h_stateRestore(struct fs_dump_state * state);
 extern int h_stateRestoreIndices(struct fs_dump_state * state);
@@ -300,6 +339,7 @@ extern int h_stateVerify(struct fs_dump_state * state);
 extern int h_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new);
 
 /* callback.c */
+extern afs_uint64 cb_stateSizeHint(void);
 extern int cb_stateSave(struct fs_dump_state * state);
 extern int cb_stateRestore(struct fs_dump_state * state);
 extern int cb_stateRestoreIndices(struct fs_dump_state * state);
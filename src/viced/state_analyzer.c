@@ -73,6 +73,7 @@ static void print_fe_help(void);
 static void print_cb_help(void);
 
 static void dump_hdr(void);
+static void verify_hdr(void);
 static void dump_h_hdr(void);
 static void dump_cb_hdr(void);
 
@@ -446,6 +447,12 @@ prompt(void)
 	    default:
 		dump_hdr();
 	    }
+	} else if (!strcasecmp(tok, "verify")) {
+	    if (mode == PR_GLOBAL_MODE) {
+		verify_hdr();
+	    } else {
+		fprintf(stderr, "command not valid for this mode\n");
+	    }
 	} else if (!strcasecmp(tok, "this")) {
 	    switch(mode) {
 	    case PR_H_MODE:
@@ -650,6 +657,7 @@ static void
 print_global_help(void)
 {
     printf("\thdr      -- display the fs_state_header struct\n");
+    printf("\tverify   -- verify the host and callback section checksums\n");
 }
 
 static void
@@ -784,17 +792,78 @@ dump_hdr(void)
     DPFV2("lo", "u", lo);
     DPFSC1;
 
+    if (hdrs.hdr.stamp.version > FS_STATE_VERSION_NOCKSUM) {
+	SplitInt64(hdrs.hdr.h_len, hi, lo);
+	DPFSO1("h_len");
+	DPFV2("hi", "u", hi);
+	DPFV2("lo", "u", lo);
+	DPFSC1;
+
+	SplitInt64(hdrs.hdr.cb_len, hi, lo);
+	DPFSO1("cb_len");
+	DPFV2("hi", "u", hi);
+	DPFV2("lo", "u", lo);
+	DPFSC1;
+
+	DPFX1("h_cksum", hdrs.hdr.h_cksum);
+	DPFX1("cb_cksum", hdrs.hdr.cb_cksum);
+	DPFV1("verified", "u", hdrs.hdr.verified);
+    }
+
     DPFS1("server_version_string", hdrs.hdr.server_version_string);
     DPFSC0;
 
     if (hdrs.hdr.stamp.magic != FS_STATE_MAGIC) {
 	fprintf(stderr, "* magic check failed\n");
     }
-    if (hdrs.hdr.stamp.version != FS_STATE_VERSION) {
+    if (hdrs.hdr.stamp.version < FS_STATE_VERSION_NOCKSUM ||
+	hdrs.hdr.stamp.version > FS_STATE_VERSION) {
 	fprintf(stderr, "* version check failed\n");
     }
 }
 
+static int
+verify_section(char * name, afs_uint64 offset, afs_uint64 len,
+	       afs_uint32 expected)
+{
+    afs_uint32 chunk, cksum = 0;
+
+    if (offset > map_len || len > map_len - offset) {
+	fprintf(stderr, "* %s section extends beyond end of memory map\n", name);
+	return 1;
+    }
+    for (chunk = 0; chunk < FS_STATE_CKSUM_NCHUNKS(len); chunk++) {
+	cksum = fs_stateCksumFold(cksum,
+				  fs_stateCksumChunk((char *)map + offset,
+						     len, chunk));
+    }
+    if (cksum != expected) {
+	fprintf(stderr, "* %s checksum mismatch (computed 0x%x, expected 0x%x)\n",
+		name, cksum, expected);
+	return 1;
+    }
+    printf("%s checksum ok (0x%x)\n", name, cksum);
+    return 0;
+}
+
+static void
+verify_hdr(void)
+{
+    if (get_hdr())
+	return;
+
+    if (hdrs.hdr.stamp.version <= FS_STATE_VERSION_NOCKSUM ||
+	(!hdrs.hdr.h_len && !hdrs.hdr.cb_len)) {
+	printf("state dump does not carry checksums\n");
+	return;
+    }
+
+    verify_section("host", hdrs.hdr.h_offset, hdrs.hdr.h_len,
+		   hdrs.hdr.h_cksum);
+    verify_section("callback", hdrs.hdr.cb_offset, hdrs.hdr.cb_len,
+		   hdrs.hdr.cb_cksum);
+}
+
 static void
 dump_h_hdr(void)
 {
@@ -0,0 +1,465 @@
+/*
+ * Copyright 2026, Sine Nomine Associates and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Per-volume, per-host and per-user rate limits for the fileserver.
+ *
+ * Each limited entity has a token bucket for bytes and one for operations.
+ * Buckets refill continuously at the configured rate and hold at most one
+ * second's worth of tokens.  A request takes what it needs and may drive a
+ * bucket negative; the caller is then delayed until the debt is paid off,
+ * so a client that keeps asking is held to the configured rate over time.
+ *
+ * Charging and delaying are separate steps.  File data is charged chunk by
+ * chunk while the vnode is locked, and the delay is taken only after the
+ * RPC has put back its volume and vnodes.  A new RPC is delayed before it
+ * takes any locks, or turned away with VBUSY when too many threads are
+ * already being delayed.
+ *
+ * Limits come from the file named by the -throttle-config option, one
+ * entry per line:
+ *
+ *     volume <volume id | *> <bytes/sec> <ops/sec>
+ *     host   <ip address | *> <bytes/sec> <ops/sec>
+ *     user   <viceid | *>    <bytes/sec> <ops/sec>
+ *
+ * "*" sets the default for every volume, host or user without an entry of
+ * its own.  A rate of 0 means unlimited; byte rates may carry a k, m or g
+ * suffix.  Blank lines and lines starting with '#' are ignored.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <opr/lock.h>
+#include <opr/jhash.h>
+#include <opr/queue.h>
+#include <opr/time.h>
+#include <afs/afsint.h>
+#include <afs/nfs.h>
+#include <afs/ihandle.h>
+#include <afs/ptclient.h>
+#include <afs/afsutil.h>
+#include "viced_prototypes.h"
+#include "viced.h"
+#include "fs_stats.h"
+
+#define THROTTLE_HASH_BITS	10
+#define THROTTLE_MAX_BUCKETS	16384	/* sweep idle buckets above this */
+#define THROTTLE_IDLE_SECS	300	/* buckets idle this long are swept */
+#define THROTTLE_MAX_SLEEP_MS	5000	/* longest single delay */
+
+enum throttle_kind {
+    THROTTLE_VOLUME,
+    THROTTLE_HOST,
+    THROTTLE_USER,
+    THROTTLE_NKINDS
+};
+
+static char *throttle_kindNames[THROTTLE_NKINDS] = {
+    "volume", "host", "user"
+};
+
+struct throttle_limit {
+    afs_uint64 bytes;		/* bytes per second; 0 is unlimited */
+    afs_uint32 ops;		/* operations per second; 0 is unlimited */
+};
+
+struct throttle_bucket {
+    struct opr_queue link;	/* hash chain */
+    enum throttle_kind kind;
+    afs_uint32 id;		/* volume id, host address or viceid */
+    int pinned;			/* configured explicitly; never swept */
+    struct throttle_limit limit;
+    double bytes;		/* available byte tokens; may be negative */
+    double ops;			/* available op tokens; may be negative */
+    struct opr_time last;	/* last refill */
+};
+
+static int throttle_enabled;	/* any limit configured at all */
+static struct throttle_limit throttle_defaults[THROTTLE_NKINDS];
+static struct opr_queue throttle_hash[opr_jhash_size(THROTTLE_HASH_BITS)];
+static int throttle_nbuckets;
+static int throttle_nwaiting;	/* threads in throttle_Wait */
+static int throttle_maxWaiting;	/* most threads throttle_Wait may hold */
+static opr_mutex_t throttle_lock;
+
+static_inline int
+throttle_Hash(enum throttle_kind kind, afs_uint32 id)
+{
+    return opr_jhash_int2(kind, id, 0) & opr_jhash_mask(THROTTLE_HASH_BITS);
+}
+
+static_inline int
+throttle_Limited(struct throttle_limit *limit)
+{
+    return limit->bytes != 0 || limit->ops != 0;
+}
+
+static struct throttle_bucket *
+throttle_Lookup_r(enum throttle_kind kind, afs_uint32 id)
+{
+    struct opr_queue *cursor;
+    struct throttle_bucket *tb;
+
+    for (opr_queue_Scan(&throttle_hash[throttle_Hash(kind, id)], cursor)) {
+	tb = opr_queue_Entry(cursor, struct throttle_bucket, link);
+	if (tb->kind == kind && tb->id == id)
+	    return tb;
+    }
+    return NULL;
+}
+
+static struct throttle_bucket *
+throttle_NewBucket_r(enum throttle_kind kind, afs_uint32 id,
+		     struct throttle_limit *limit, struct opr_time *now)
+{
+    struct throttle_bucket *tb;
+
+    tb = calloc(1, sizeof(*tb));
+    if (tb == NULL)
+	return NULL;
+    tb->kind = kind;
+    tb->id = id;
+    tb->limit = *limit;
+    tb->bytes = (double)limit->bytes;
+    tb->ops = (double)limit->ops;
+    tb->last = *now;
+    opr_queue_Prepend(&throttle_hash[throttle_Hash(kind, id)], &tb->link);
+    throttle_nbuckets++;
+    return tb;
+}
+
+/* drop buckets created from the defaults that have been idle for a while,
+ * and are full again anyway */
+static void
+throttle_Sweep_r(struct opr_time *now)
+{
+    struct opr_queue *cursor, *store;
+    struct throttle_bucket *tb;
+    afs_int64 idle;
+    int i;
+
+    idle = (afs_int64)THROTTLE_IDLE_SECS * 10000000;
+    for (i = 0; i < opr_jhash_size(THROTTLE_HASH_BITS); i++) {
+	for (opr_queue_ScanSafe(&throttle_hash[i], cursor, store)) {
+	    tb = opr_queue_Entry(cursor, struct throttle_bucket, link);
+	    if (!tb->pinned && now->time - tb->last.time > idle) {
+		opr_queue_Remove(&tb->link);
+		free(tb);
+		throttle_nbuckets--;
+	    }
+	}
+    }
+}
+
+/*
+ * Charge a request against one bucket and return how long, in milliseconds,
+ * the caller should wait for the bucket to come out of debt.
+ */
+static int
+throttle_Charge_r(enum throttle_kind kind, afs_uint32 id, afs_int32 nops,
+		  afs_uint64 nbytes, struct opr_time *now)
+{
+    struct throttle_bucket *tb;
+    double elapsed, wait = 0.0;
+
+    tb = throttle_Lookup_r(kind, id);
+    if (tb == NULL) {
+	if (!throttle_Limited(&throttle_defaults[kind]))
+	    return 0;
+	if (throttle_nbuckets >= THROTTLE_MAX_BUCKETS)
+	    throttle_Sweep_r(now);
+	tb = throttle_NewBucket_r(kind, id, &throttle_defaults[kind], now);
+	if (tb == NULL)
+	    return 0;
+    }
+
+    elapsed = (double)(now->time - tb->last.time) / 10000000.0;
+    if (elapsed > 0) {
+	tb->last = *now;
+	tb->bytes += elapsed * tb->limit.bytes;
+	if (tb->bytes > tb->limit.bytes)
+	    tb->bytes = tb->limit.bytes;
+	tb->ops += elapsed * tb->limit.ops;
+	if (tb->ops > tb->limit.ops)
+	    tb->ops = tb->limit.ops;
+    }
+
+    if (tb->limit.bytes && nbytes) {
+	tb->bytes -= (double)nbytes;
+	if (tb->bytes < 0 && -tb->bytes / tb->limit.bytes > wait)
+	    wait = -tb->bytes / tb->limit.bytes;
+    }
+    if (tb->limit.ops && nops) {
+	tb->ops -= nops;
+	if (tb->ops < 0 && -tb->ops / tb->limit.ops > wait)
+	    wait = -tb->ops / tb->limit.ops;
+    }
+    return (int)(wait * 1000.0);
+}
+
+/**
+ * Account for a request against the limits for its volume, host and user.
+ *
+ * This never sleeps, so it may be called with volume or vnode locks held;
+ * the caller hands the result to throttle_Wait once it has dropped them.
+ *
+ * @param[in] hostaddr  client host address, network byte order; 0 for none
+ * @param[in] viceid    authenticated user; ANONYMOUSID is not limited per user
+ * @param[in] volid     volume being accessed; 0 for none
+ * @param[in] nops      operations to charge
+ * @param[in] nbytes    bytes to charge
+ *
+ * @return milliseconds the caller should be delayed; 0 for none
+ *
+ * @pre H_LOCK and FS_LOCK not held
+ */
+int
+throttle_Charge(afs_uint32 hostaddr, afs_int32 viceid, VolumeId volid,
+		afs_int32 nops, afs_uint64 nbytes)
+{
+    struct opr_time now;
+    int ms, wait_ms = 0;
+
+    if (!throttle_enabled)
+	return 0;
+
+    opr_time_Now(&now);
+    opr_mutex_enter(&throttle_lock);
+    if (volid) {
+	ms = throttle_Charge_r(THROTTLE_VOLUME, (afs_uint32)volid, nops,
+			       nbytes, &now);
+	if (ms > wait_ms)
+	    wait_ms = ms;
+    }
+    if (hostaddr) {
+	ms = throttle_Charge_r(THROTTLE_HOST, hostaddr, nops, nbytes, &now);
+	if (ms > wait_ms)
+	    wait_ms = ms;
+    }
+    if (viceid != ANONYMOUSID) {
+	ms = throttle_Charge_r(THROTTLE_USER, (afs_uint32)viceid, nops,
+			       nbytes, &now);
+	if (ms > wait_ms)
+	    wait_ms = ms;
+    }
+    opr_mutex_exit(&throttle_lock);
+
+    return wait_ms;
+}
+
+/**
+ * Delay the calling thread by a wait returned from throttle_Charge.
+ *
+ * Only a quarter of the server threads may be delayed at once, so that
+ * throttled clients cannot tie up the whole thread pool.  Past that the
+ * caller is not delayed at all; the debt stays in the buckets and is
+ * collected from the client's next request.
+ *
+ * @param[in] wait_ms  delay from throttle_Charge
+ * @param[in] isxfer   the delay is for file data, not an operation
+ *
+ * @return 0 if the caller was delayed or needed no delay; -1 if too many
+ *	   threads were already being delayed
+ *
+ * @pre no locks held
+ */
+int
+throttle_Wait(int wait_ms, int isxfer)
+{
+    if (wait_ms <= 0)
+	return 0;
+    /* any remaining debt is collected from the next request */
+    if (wait_ms > THROTTLE_MAX_SLEEP_MS)
+	wait_ms = THROTTLE_MAX_SLEEP_MS;
+
+    opr_mutex_enter(&throttle_lock);
+    if (throttle_nwaiting >= throttle_maxWaiting) {
+	opr_mutex_exit(&throttle_lock);
+	return -1;
+    }
+    throttle_nwaiting++;
+    opr_mutex_exit(&throttle_lock);
+
+    FS_LOCK;
+    if (isxfer)
+	afs_perfstats.fs_nThrottledXfers++;
+    else
+	afs_perfstats.fs_nThrottledOps++;
+    afs_perfstats.fs_ThrottledMSecs += wait_ms;
+    FS_UNLOCK;
+
+    ViceLog(5, ("throttle: delaying %s %d ms\n",
+		isxfer ? "transfer" : "request", wait_ms));
+#ifdef AFS_NT40_ENV
+    Sleep(wait_ms);
+#else
+    {
+	struct timespec ts;
+
+	ts.tv_sec = wait_ms / 1000;
+	ts.tv_nsec = (wait_ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	    ;
+    }
+#endif
+
+    opr_mutex_enter(&throttle_lock);
+    throttle_nwaiting--;
+    opr_mutex_exit(&throttle_lock);
+    return 0;
+}
+
+/* parse a rate, with an optional k, m or g (binary) multiplier */
+static int
+throttle_ParseRate(char *str, afs_uint64 *rate)
+{
+    char buf[32];
+    size_t len;
+    int shift = 0;
+
+    len = strlcpy(buf, str, sizeof(buf));
+    if (len == 0 || len >= sizeof(buf))
+	return -1;
+    switch (buf[len - 1]) {
+    case 'g':
+    case 'G':
+	shift = 30;
+	break;
+    case 'm':
+    case 'M':
+	shift = 20;
+	break;
+    case 'k':
+    case 'K':
+	shift = 10;
+	break;
+    }
+    if (shift)
+	buf[--len] = '\0';
+    if (len == 0 || util_GetUInt64(buf, rate) != 0)
+	return -1;
+    *rate <<= shift;
+    return 0;
+}
+
+static int
+throttle_ParseLine(char *line, int lineno, char *path)
+{
+    char *kindstr, *idstr, *bytestr, *opstr, *extra, *last = NULL;
+    struct throttle_limit limit;
+    struct throttle_bucket *tb;
+    struct opr_time now;
+    enum throttle_kind kind;
+    afs_uint32 id;
+
+    kindstr = strtok_r(line, " \t\r\n", &last);
+    if (kindstr == NULL || *kindstr == '#')
+	return 0;
+    idstr = strtok_r(NULL, " \t\r\n", &last);
+    bytestr = strtok_r(NULL, " \t\r\n", &last);
+    opstr = strtok_r(NULL, " \t\r\n", &last);
+    extra = strtok_r(NULL, " \t\r\n", &last);
+    if (opstr == NULL || extra != NULL)
+	goto bad;
+
+    for (kind = 0; kind < THROTTLE_NKINDS; kind++) {
+	if (strcasecmp(kindstr, throttle_kindNames[kind]) == 0)
+	    break;
+    }
+    if (kind == THROTTLE_NKINDS)
+	goto bad;
+
+    memset(&limit, 0, sizeof(limit));
+    if (throttle_ParseRate(bytestr, &limit.bytes) != 0 ||
+	util_GetUInt32(opstr, &limit.ops) != 0)
+	goto bad;
+
+    if (strcmp(idstr, "*") == 0) {
+	throttle_defaults[kind] = limit;
+    } else {
+	if (kind == THROTTLE_HOST) {
+	    if (inet_pton(AF_INET, idstr, &id) != 1)
+		goto bad;
+	} else if (util_GetUInt32(idstr, &id) != 0) {
+	    goto bad;
+	}
+	opr_time_Now(&now);
+	tb = throttle_Lookup_r(kind, id);
+	if (tb == NULL)
+	    tb = throttle_NewBucket_r(kind, id, &limit, &now);
+	if (tb == NULL) {
+	    ViceLog(0, ("throttle: out of memory reading %s\n", path));
+	    return -1;
+	}
+	tb->limit = limit;
+	tb->pinned = 1;
+    }
+
+    if (throttle_Limited(&limit))
+	throttle_enabled = 1;
+    return 0;
+
+  bad:
+    ViceLog(0, ("throttle: syntax error in %s, line %d\n", path, lineno));
+    return -1;
+}
+
+/**
+ * Initialize the throttle package.
+ *
+ * @param[in] path      throttle configuration file; NULL to disable throttling
+ * @param[in] nthreads  number of server threads handling RPCs
+ *
+ * @return 0 on success; -1 if the configuration could not be read
+ */
+int
+throttle_Init(char *path, int nthreads)
+{
+    char line[256];
+    FILE *fp;
+    int i, lineno = 0, code = 0;
+
+    opr_mutex_init(&throttle_lock);
+    throttle_maxWaiting = nthreads / 4;
+    if (throttle_maxWaiting < 1)
+	throttle_maxWaiting = 1;
+    for (i = 0; i < opr_jhash_size(THROTTLE_HASH_BITS); i++)
+	opr_queue_Init(&throttle_hash[i]);
+
+    if (path == NULL)
+	return 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+	ViceLog(0, ("throttle: cannot open %s: %s\n", path, strerror(errno)));
+	return -1;
+    }
+    opr_mutex_enter(&throttle_lock);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	lineno++;
+	if (throttle_ParseLine(line, lineno, path) != 0) {
+	    code = -1;
+	    break;
+	}
+    }
+    opr_mutex_exit(&throttle_lock);
+    fclose(fp);
+
+    if (code == 0) {
+	ViceLog(0, ("throttle: loaded %d explicit limits from %s; "
+		    "throttling is %s\n", throttle_nbuckets, path,
+		    throttle_enabled ? "enabled" : "disabled"));
+    }
+    return code;
+}
@@ -133,6 +133,10 @@ int stackSize = 24000;
 int fiveminutes = 300;		/* 5 minutes.  Change this for debugging only */
 int CurrentConnections = 0;
 int hostaclRefresh = 7200;	/* refresh host clients' acls every 2 hrs */
+static int cpsRefreshThreads = 2;	/* background CPS refresh threads */
+static int cacheUserCPS = 0;		/* keep user CPSs across connections */
+static char *throttleConfig = NULL;	/* rate limit configuration file */
+static int aioThreads = 0;		/* asynchronous disk I/O threads */
 #if defined(AFS_SGI_ENV)
 int SawLock;
 #endif
@@ -152,6 +156,8 @@ static int host_thread_quota;
 int rxpackets = 150;		/* 100 */
 int nSmallVns = 400;		/* 200 */
 int large = 400;		/* 200 */
+int nSmallVnsMax = 0;		/* 0 => vnode caches do not grow */
+int largeMax = 0;
 int volcache = 400;		/* 400 */
 int numberofcbs = 60000;	/* 60000 */
 int lwps = 9;			/* 6 */
@@ -897,11 +903,16 @@ enum optionsList {
     OPT_vcsize,
     OPT_lvnodes,
     OPT_svnodes,
+    OPT_lvnodesmax,
+    OPT_svnodesmax,
     OPT_sendsize,
     OPT_minspare,
     OPT_spare,
     OPT_pctspare,
     OPT_hostcpsrefresh,
+    OPT_cpsrefreshthreads,
+    OPT_cacheusercps,
+    OPT_throttleconfig,
     OPT_vattachthreads,
     OPT_abortthreshold,
     OPT_busyat,
@@ -911,6 +922,7 @@ enum optionsList {
     OPT_vhandle_setaside,
     OPT_vhandle_max_cachesize,
     OPT_vhandle_initial_cachesize,
+    OPT_aiothreads,
     OPT_fs_state_dont_save,
     OPT_fs_state_dont_restore,
     OPT_fs_state_verify,
@@ -1000,6 +1012,10 @@ ParseArgs(int argc, char *argv[])
 			CMD_OPTIONAL, "large vnodes");
     cmd_AddParmAtOffset(opts, OPT_svnodes, "-s", CMD_SINGLE,
 			CMD_OPTIONAL, "small vnodes");
+    cmd_AddParmAtOffset(opts, OPT_lvnodesmax, "-lmax", CMD_SINGLE,
+			CMD_OPTIONAL, "most large vnodes to grow to");
+    cmd_AddParmAtOffset(opts, OPT_svnodesmax, "-smax", CMD_SINGLE,
+			CMD_OPTIONAL, "most small vnodes to grow to");
     cmd_AddParmAtOffset(opts, OPT_sendsize, "-sendsize", CMD_SINGLE,
 			CMD_OPTIONAL, "size of send buffer in bytes");
 
@@ -1015,6 +1031,14 @@ ParseArgs(int argc, char *argv[])
 
     cmd_AddParmAtOffset(opts, OPT_hostcpsrefresh, "-hr", CMD_SINGLE,
 			CMD_OPTIONAL, "hours between host CPS refreshes");
+    cmd_AddParmAtOffset(opts, OPT_cpsrefreshthreads, "-cps-refresh-threads",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"# of background CPS refresh threads");
+    cmd_AddParmAtOffset(opts, OPT_cacheusercps, "-cache-user-cps", CMD_FLAG,
+			CMD_OPTIONAL, "reuse user CPSs across connections");
+    cmd_AddParmAtOffset(opts, OPT_throttleconfig, "-throttle-config",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"volume, host and user rate limit configuration file");
 
     cmd_AddParmAtOffset(opts, OPT_vattachthreads, "-vattachpar", CMD_SINGLE,
 			CMD_OPTIONAL, "# of volume attachment threads");
@@ -1043,6 +1067,9 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_vhandle_initial_cachesize,
 			"-vhandle-initial-cachesize", CMD_SINGLE,
 			CMD_OPTIONAL, "# fds reserved for cache IO");
+    cmd_AddParmAtOffset(opts, OPT_aiothreads, "-aio-threads",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"# of threads for asynchronous file data IO");
     cmd_AddParmAtOffset(opts, OPT_vhashsize, "-vhashsize",
 			CMD_SINGLE, CMD_OPTIONAL,
 			"log(2) of # of volume hash buckets");
@@ -1203,6 +1230,8 @@ ParseArgs(int argc, char *argv[])
     cmd_OptionAsInt(opts, OPT_vcsize, &volcache);
     cmd_OptionAsInt(opts, OPT_lvnodes, &large);
     cmd_OptionAsInt(opts, OPT_svnodes, &nSmallVns);
+    cmd_OptionAsInt(opts, OPT_lvnodesmax, &largeMax);
+    cmd_OptionAsInt(opts, OPT_svnodesmax, &nSmallVnsMax);
     if (cmd_OptionAsInt(opts, OPT_sendsize, &optval) == 0) {
 	if (optval < 16384) {
 	    printf("Warning:sendsize %d is less than minimum %d; ignoring\n",
@@ -1235,6 +1264,17 @@ ParseArgs(int argc, char *argv[])
 	hostaclRefresh = optval * 60 * 60;
     }
 
+    if (cmd_OptionAsInt(opts, OPT_cpsrefreshthreads, &cpsRefreshThreads) == 0) {
+	if ((cpsRefreshThreads < 0) || (cpsRefreshThreads > 16)) {
+	    printf("CPS refresh thread count %d is invalid; "
+		   "must be between 0 and 16\n", cpsRefreshThreads);
+	    return -1;
+	}
+    }
+    cmd_OptionAsFlag(opts, OPT_cacheusercps, &cacheUserCPS);
+
+    cmd_OptionAsString(opts, OPT_throttleconfig, &throttleConfig);
+
     cmd_OptionAsInt(opts, OPT_vattachthreads, &vol_attach_threads);
 
     cmd_OptionAsInt(opts, OPT_abortthreshold, &abort_threshold);
@@ -1266,6 +1306,13 @@ ParseArgs(int argc, char *argv[])
 		    &vol_io_params.fd_max_cachesize);
     cmd_OptionAsUint(opts, OPT_vhandle_initial_cachesize,
 		    &vol_io_params.fd_initial_cachesize);
+    if (cmd_OptionAsInt(opts, OPT_aiothreads, &aioThreads) == 0) {
+	if ((aioThreads < 0) || (aioThreads > 256)) {
+	    printf("Asynchronous IO thread count %d is invalid; "
+		   "must be between 0 and 256\n", aioThreads);
+	    return -1;
+	}
+    }
     if (cmd_OptionAsString(opts, OPT_sync, &sync_behavior) == 0) {
 	if (ih_SetSyncBehavior(sync_behavior)) {
 	    printf("Invalid -sync value %s\n", sync_behavior);
@@ -1293,8 +1340,9 @@ ParseArgs(int argc, char *argv[])
 	    fs_state.options.fs_state_verify_after_restore = 0;
 	} else if (strcmp(optstring, "restore") == 0) {
 	    fs_state.options.fs_state_verify_before_save = 0;
+	    fs_state.options.fs_state_verify_intact = 1;
 	} else if (strcmp(optstring, "both") == 0) {
-	    /* default */
+	    fs_state.options.fs_state_verify_intact = 1;
 	} else {
 	    fprintf(stderr, "invalid argument for -fs-state-verify\n");
 	    return -1;
@@ -2082,6 +2130,16 @@ main(int argc, char *argv[])
     InitCallBack(numberofcbs);
     ClearXStatValues();
 
+    if (throttle_Init(throttleConfig, lwps)) {
+	ViceLog(0, ("Fatal error reading rate limit configuration, exiting!!\n"));
+	exit(1);
+    }
+
+    if (ih_AsyncInit(aioThreads)) {
+	ViceLog(0, ("Could not start all %d asynchronous IO threads\n",
+		    aioThreads));
+    }
+
     code = InitVL(confDir);
     if (code && code != VL_MULTIPADDR) {
 	ViceLog(0, ("Fatal error in library initialization, exiting!!\n"));
@@ -2140,6 +2198,8 @@ main(int argc, char *argv[])
     VOptDefaults(fileServer, &opts);
     opts.nLargeVnodes = large;
     opts.nSmallVnodes = nSmallVns;
+    opts.nLargeVnodesMax = largeMax;
+    opts.nSmallVnodesMax = nSmallVnsMax;
     opts.volcache = volcache;
     opts.unsafe_attach = unsafe_attach;
     if (offline_timeout != -1) {
@@ -2201,6 +2261,7 @@ main(int argc, char *argv[])
 			      &fiveminutes) == 0);
     opr_Verify(pthread_create(&serverPid, &tattr, FsyncCheckLWP,
 			      &fiveminutes) == 0);
+    h_StartCPSRefresh(cpsRefreshThreads, cacheUserCPS);
 
     gettimeofday(&tp, 0);
 
@@ -224,6 +224,7 @@ struct fs_state {
 	byte fs_state_restore;
 	byte fs_state_verify_before_save;
 	byte fs_state_verify_after_restore;
+	byte fs_state_verify_intact;	/* also verify dumps known to be intact */
     } options;
 
     pthread_cond_t worker_done_cv;
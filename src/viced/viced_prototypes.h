@@ -23,6 +23,13 @@ extern int InitCallBack(int);
 extern int BreakLaterCallBacks(void);
 extern int BreakVolumeCallBacksLater(VolumeId);
 
+/* throttle.c */
+extern int throttle_Init(char *path, int nthreads);
+extern int throttle_Charge(afs_uint32 hostaddr, afs_int32 viceid,
+			   VolumeId volid, afs_int32 nops,
+			   afs_uint64 nbytes);
+extern int throttle_Wait(int wait_ms, int isxfer);
+
 #ifdef AFS_DEMAND_ATTACH_FS
 /*
  * demand attach fs
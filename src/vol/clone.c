@@ -54,6 +54,7 @@ int (*vol_PollProc) (void) = 0;	/* someone must init this */
 struct clone_rock {
     IHandle_t *h;
     VolId vol;
+    struct ih_linkbatch *batch;
 };
 
 #define CLONE_MAXITEMS	100
@@ -141,15 +142,44 @@ static int
 IDecProc(Inode adata, void *arock)
 {
     struct clone_rock *aparm = (struct clone_rock *)arock;
-    IH_DEC(aparm->h, adata, aparm->vol);
+    IH_BATCH_DEC(aparm->batch, aparm->h, adata, aparm->vol);
     DOPOLL;
     return 0;
 }
 
-afs_int32
-DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
+/*
+ * One contiguous run of a vnode index, cloned by a single thread.  Each
+ * range has its own file handles, link batch and list of inodes to
+ * decrement; the link batches merge into the link table when flushed.
+ */
+struct clone_range {
+    Volume *rwvp;
+    Volume *clvp;
+    VnodeClass class;
+    int reclone;
+    afs_foff_t start;		/* offset of the first vnode to clone */
+    afs_foff_t end;		/* offset to stop at; 0 for end of index */
+    afs_foff_t offset;		/* offset where cloning stopped */
+    afs_int32 filecount;
+    afs_int32 diskused;
+    struct clone_head decHead;
+    struct ih_linkbatch *linkBatch;
+    afs_int32 error;
+};
+
+/* Indexes with fewer vnodes per thread than this are cloned serially. */
+#define CLONE_MIN_RANGE	16384
+
+#ifdef AFS_PTHREAD_ENV
+int vol_clone_threads = 1;	/* threads to clone each vnode index with */
+#endif
+
+static void
+DoCloneRange(struct clone_range *cr)
 {
     afs_int32 code, error = 0;
+    Volume *rwvp = cr->rwvp;
+    Volume *clvp = cr->clvp;
     FdHandle_t *rwFd = 0, *clFdIn = 0, *clFdOut = 0;
     StreamHandle_t *rwfile = 0, *clfilein = 0, *clfileout = 0;
     IHandle_t *rwH = 0, *clHin = 0, *clHout = 0;
@@ -158,14 +188,11 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
     Inode rwinode = 0;
     Inode clinode;
-    struct clone_head decHead;
-    struct clone_rock decRock;
-    afs_foff_t offset = 0;
+    afs_foff_t offset = cr->start;
     afs_int32 dircloned, inodeinced;
-    afs_int32 filecount = 0, diskused = 0;
     afs_ino_str_t stmp;
 
-    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[cr->class];
     /*
      * The fileserver's -readonly switch should make this false, but we
      * have no useful way to know in the volserver.
@@ -173,39 +200,25 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      */
     int ReadWriteOriginal = 1;
 
-    /* Correct number of files in volume: this assumes indexes are always
-       cloned starting with vLarge */
-    if (ReadWriteOriginal && class != vLarge) {
-	filecount = V_filecount(rwvp);
-	diskused = V_diskused(rwvp);
-    }
-
-    /* Initialize list of inodes to nuke - must do this before any calls
-     * to ERROR_EXIT, as the error handler requires an initialised list
-     */
-    ci_InitHead(&decHead);
-    decRock.h = V_linkHandle(rwvp);
-    decRock.vol = V_parentId(rwvp);
-
-    /* Open the RW volume's index file and seek to beginning */
-    IH_COPY(rwH, rwvp->vnodeIndex[class].handle);
+    /* Open the RW volume's index file and seek to the start of the range */
+    IH_COPY(rwH, rwvp->vnodeIndex[cr->class].handle);
     rwFd = IH_OPEN(rwH);
     if (!rwFd)
 	ERROR_EXIT(EIO);
     rwfile = FDH_FDOPEN(rwFd, ReadWriteOriginal ? "r+" : "r");
     if (!rwfile)
 	ERROR_EXIT(EIO);
-    STREAM_ASEEK(rwfile, vcp->diskSize);	/* Will fail if no vnodes */
+    STREAM_ASEEK(rwfile, cr->start);	/* Will fail if no vnodes */
 
-    /* Open the clone volume's index file and seek to beginning */
-    IH_COPY(clHout, clvp->vnodeIndex[class].handle);
+    /* Open the clone volume's index file and seek to the start of the range */
+    IH_COPY(clHout, clvp->vnodeIndex[cr->class].handle);
     clFdOut = IH_OPEN(clHout);
     if (!clFdOut)
 	ERROR_EXIT(EIO);
     clfileout = FDH_FDOPEN(clFdOut, "a");
     if (!clfileout)
 	ERROR_EXIT(EIO);
-    code = STREAM_ASEEK(clfileout, vcp->diskSize);
+    code = STREAM_ASEEK(clfileout, cr->start);
     if (code)
 	ERROR_EXIT(EIO);
 
@@ -213,27 +226,28 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      * reading. We never read anything that we're simultaneously
      * writing, so this all works.
      */
-    if (reclone) {
-	IH_COPY(clHin, clvp->vnodeIndex[class].handle);
+    if (cr->reclone) {
+	IH_COPY(clHin, clvp->vnodeIndex[cr->class].handle);
 	clFdIn = IH_OPEN(clHin);
 	if (!clFdIn)
 	    ERROR_EXIT(EIO);
 	clfilein = FDH_FDOPEN(clFdIn, "r");
 	if (!clfilein)
 	    ERROR_EXIT(EIO);
-	STREAM_ASEEK(clfilein, vcp->diskSize);	/* Will fail if no vnodes */
+	STREAM_ASEEK(clfilein, cr->start);	/* Will fail if no vnodes */
     }
 
     /* Read each vnode in the old volume's index file */
-    for (offset = vcp->diskSize;
-	 STREAM_READ(rwvnode, vcp->diskSize, 1, rwfile) == 1;
+    for (offset = cr->start;
+	 (cr->end == 0 || offset < cr->end)
+	 && STREAM_READ(rwvnode, vcp->diskSize, 1, rwfile) == 1;
 	 offset += vcp->diskSize) {
 	dircloned = inodeinced = 0;
 
 	/* If we are recloning the volume, read the corresponding vnode
 	 * from the clone and determine its inode number.
 	 */
-	if (reclone && !STREAM_EOF(clfilein)
+	if (cr->reclone && !STREAM_EOF(clfilein)
 	    && (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1)) {
 	    clinode = VNDISK_GET_INO(clvnode);
 	} else {
@@ -246,16 +260,16 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	    if (rwvnode->vnodeMagic != vcp->magic)
 		ERROR_EXIT(-1);
 	    rwinode = VNDISK_GET_INO(rwvnode);
-	    filecount++;
+	    cr->filecount++;
 	    VNDISK_GET_LEN(ll, rwvnode);
-	    diskused += nBlocks(ll);
+	    cr->diskused += nBlocks(ll);
 
 	    /* Increment the inode if not already */
 	    if (clinode && (clinode == rwinode)) {
 		clinode = 0;	/* already cloned - don't delete later */
 	    } else if (rwinode) {
-		if (IH_INC(V_linkHandle(rwvp), rwinode, V_parentId(rwvp)) ==
-		    -1) {
+		if (IH_BATCH_INC(cr->linkBatch, V_linkHandle(rwvp), rwinode,
+				 V_parentId(rwvp)) == -1) {
 		    Log("IH_INC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
 			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
 			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
@@ -307,8 +321,8 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	  clonefailed:
 	    /* Couldn't clone, go back and decrement the inode's link count */
 	    if (inodeinced) {
-		if (IH_DEC(V_linkHandle(rwvp), rwinode, V_parentId(rwvp)) ==
-		    -1) {
+		if (IH_BATCH_DEC(cr->linkBatch, V_linkHandle(rwvp), rwinode,
+				 V_parentId(rwvp)) == -1) {
 		    Log("IH_DEC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
 			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
 			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
@@ -327,7 +341,7 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 
 	/* Removal of the old cloned inode */
 	if (clinode) {
-	    ci_AddItem(&decHead, clinode);	/* just queue it */
+	    ci_AddItem(&cr->decHead, clinode);	/* just queue it */
 	}
 
 	DOPOLL;
@@ -335,20 +349,6 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     if (STREAM_ERROR(clfileout))
 	ERROR_EXIT(EIO);
 
-    /* Clean out any junk at end of clone file */
-    if (reclone) {
-	STREAM_ASEEK(clfilein, offset);
-	while (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1) {
-	    if (clvnode->type != vNull && VNDISK_GET_INO(clvnode) != 0) {
-		ci_AddItem(&decHead, VNDISK_GET_INO(clvnode));
-	    }
-	    DOPOLL;
-	}
-    }
-
-    /* come here to finish up.  If code is non-zero, we've already run into problems,
-     * and shouldn't do the idecs.
-     */
   error_exit:
     if (rwfile)
 	STREAM_CLOSE(rwfile);
@@ -371,12 +371,160 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     if (clHin)
 	IH_RELEASE(clHin);
 
+    cr->offset = offset;
+    cr->error = error;
+}
+
+#ifdef AFS_PTHREAD_ENV
+static void *
+DoCloneRangeThread(void *arock)
+{
+    DoCloneRange(arock);
+    return NULL;
+}
+#endif
+
+afs_int32
+DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
+{
+    afs_int32 code, error = 0;
+    FdHandle_t *fdP;
+    StreamHandle_t *clfilein;
+    char dbuf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
+    struct clone_range *ranges, *cr;
+    struct clone_rock decRock;
+    afs_foff_t offset, size, per;
+    afs_int32 filecount = 0, diskused = 0;
+    int i, nranges = 1;
+#ifdef AFS_PTHREAD_ENV
+    pthread_t *tids = NULL;
+#endif
+
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    int ReadWriteOriginal = 1;	/* see DoCloneRange */
+
+    /* Correct number of files in volume: this assumes indexes are always
+       cloned starting with vLarge */
+    if (ReadWriteOriginal && class != vLarge) {
+	filecount = V_filecount(rwvp);
+	diskused = V_diskused(rwvp);
+    }
+
+    /* Split the index between up to vol_clone_threads threads, giving
+     * each at least CLONE_MIN_RANGE vnodes.
+     */
+    fdP = IH_OPEN(rwvp->vnodeIndex[class].handle);
+    if (fdP == NULL)
+	return EIO;
+    size = FDH_SIZE(fdP);
+    FDH_CLOSE(fdP);
+    per = size / vcp->diskSize - 1;
+#ifdef AFS_PTHREAD_ENV
+    if (vol_clone_threads > 1 && per >= 2 * CLONE_MIN_RANGE) {
+	nranges = per / CLONE_MIN_RANGE;
+	if (nranges > vol_clone_threads)
+	    nranges = vol_clone_threads;
+	tids = calloc(nranges, sizeof(*tids));
+	if (tids == NULL)
+	    nranges = 1;
+    }
+#endif
+    per = (per + nranges - 1) / nranges;
+
+    /* Initialize the lists of inodes to nuke - must do this before the
+     * ranges run, as the error handling requires an initialised list
+     */
+    ranges = calloc(nranges, sizeof(*ranges));
+    if (ranges == NULL) {
+#ifdef AFS_PTHREAD_ENV
+	free(tids);
+#endif
+	return ENOMEM;
+    }
+    for (i = 0; i < nranges; i++) {
+	cr = &ranges[i];
+	cr->rwvp = rwvp;
+	cr->clvp = clvp;
+	cr->class = class;
+	cr->reclone = reclone;
+	cr->start = vcp->diskSize * (1 + i * per);
+	cr->end = (i == nranges - 1) ? 0 : cr->start + per * vcp->diskSize;
+	ci_InitHead(&cr->decHead);
+
+	/* Link count changes are made in memory and written out in bulk;
+	 * see the flush below before the clone's index is synced. */
+	cr->linkBatch = IH_BATCH_BEGIN(V_linkHandle(rwvp));
+    }
+
+    if (nranges == 1) {
+	DoCloneRange(&ranges[0]);
+    } else {
+#ifdef AFS_PTHREAD_ENV
+	Log("DoCloneIndex: cloning %s index of %" AFS_VOLID_FMT " with %d threads\n",
+	    class == vLarge ? "large" : "small",
+	    afs_printable_VolumeId_lu(V_id(rwvp)), nranges);
+	for (i = 1; i < nranges; i++) {
+	    AFS_SIGSET_DECL;
+	    AFS_SIGSET_CLEAR();
+	    opr_Verify(pthread_create(&tids[i], NULL, DoCloneRangeThread,
+				      &ranges[i]) == 0);
+	    AFS_SIGSET_RESTORE();
+	}
+	DoCloneRange(&ranges[0]);
+	for (i = 1; i < nranges; i++)
+	    opr_Verify(pthread_join(tids[i], NULL) == 0);
+	free(tids);
+#endif
+    }
+
+    for (i = 0; i < nranges; i++) {
+	cr = &ranges[i];
+	if (!error)
+	    error = cr->error;
+	filecount += cr->filecount;
+	diskused += cr->diskused;
+    }
+    offset = ranges[nranges - 1].offset;
+
+    /* Clean out any junk at end of clone file */
+    if (reclone && !error) {
+	fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+	clfilein = fdP ? FDH_FDOPEN(fdP, "r") : NULL;
+	if (clfilein) {
+	    STREAM_ASEEK(clfilein, offset);
+	    while (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1) {
+		if (clvnode->type != vNull && VNDISK_GET_INO(clvnode) != 0) {
+		    ci_AddItem(&ranges[0].decHead, VNDISK_GET_INO(clvnode));
+		}
+		DOPOLL;
+	    }
+	    STREAM_CLOSE(clfilein);
+	}
+	if (fdP)
+	    FDH_CLOSE(fdP);
+    }
+
+    /* The incremented link counts must be on disk before the clone index
+     * that refers to them.
+     */
+    for (i = 0; i < nranges; i++) {
+	if (IH_BATCH_FLUSH(ranges[i].linkBatch) == -1) {
+	    Log("IH_BATCH_FLUSH failed: %p, %" AFS_VOLID_FMT " errno %d\n",
+		V_linkHandle(rwvp), afs_printable_VolumeId_lu(V_parentId(rwvp)),
+		errno);
+	    VForceOffline(rwvp);
+	    if (!error)
+		error = EIO;
+	}
+    }
+
     /* Next, we sync the disk. We have to reopen in case we're truncating,
      * since we were using stdio above, and don't know when the buffers
      * would otherwise be flushed.  There's no stdio fftruncate call.
      */
-    rwFd = IH_OPEN(clvp->vnodeIndex[class].handle);
-    if (rwFd == NULL) {
+    fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+    if (fdP == NULL) {
 	if (!error)
 	    error = EIO;
     } else {
@@ -385,11 +533,11 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	     * truncate the file to offset bytes.
 	     */
 	    if (reclone && !error) {
-		error = FDH_TRUNC(rwFd, offset);
+		error = FDH_TRUNC(fdP, offset);
 	    }
 	}
-	(void)FDH_SYNC(rwFd);
-	FDH_CLOSE(rwFd);
+	(void)FDH_SYNC(fdP);
+	FDH_CLOSE(fdP);
     }
 
     /* Now finally do the idec's.  At this point, all potential
@@ -397,10 +545,22 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      * (see above fclose and fsync). No matter what happens, we
      * no longer need to keep these references around.
      */
-    code = ci_Apply(&decHead, IDecProc, (char *)&decRock);
-    if (!error)
-	error = code;
-    ci_Destroy(&decHead);
+    decRock.h = V_linkHandle(rwvp);
+    decRock.vol = V_parentId(rwvp);
+    for (i = 0; i < nranges; i++) {
+	cr = &ranges[i];
+	decRock.batch = cr->linkBatch;
+	code = ci_Apply(&cr->decHead, IDecProc, (char *)&decRock);
+	if (!error)
+	    error = code;
+	ci_Destroy(&cr->decHead);
+	if (IH_BATCH_END(cr->linkBatch) == -1) {
+	    Log("IH_BATCH_END failed: %p, %" AFS_VOLID_FMT " errno %d\n",
+		V_linkHandle(rwvp), afs_printable_VolumeId_lu(V_parentId(rwvp)),
+		errno);
+	}
+    }
+    free(ranges);
 
     if (ReadWriteOriginal && filecount > 0)
 	V_filecount(rwvp) = filecount;
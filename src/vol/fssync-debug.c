@@ -671,6 +671,8 @@ vn_flags_to_string(afs_uint32 flags)
     FLAGCASE(flags, VN_ON_HASH, str, count);
     FLAGCASE(flags, VN_ON_LRU, str, count);
     FLAGCASE(flags, VN_ON_VVN, str, count);
+    FLAGCASE(flags, VN_HOT, str, count);
+    FLAGCASE(flags, VN_ON_HOT, str, count);
 
     return str;
 }
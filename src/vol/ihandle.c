@@ -21,6 +21,10 @@
 #ifdef HAVE_SYS_RESOURCE_H
 #include <sys/resource.h>
 #endif
+#if defined(AFS_LINUX26_ENV) && defined(HAVE_LINUX_FS_H)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #include <afs/opr.h>
 #ifdef AFS_PTHREAD_ENV
@@ -39,22 +43,55 @@ pthread_once_t ih_glock_once = PTHREAD_ONCE_INIT;
 pthread_mutex_t ih_glock_mutex;
 #endif /* AFS_PTHREAD_ENV */
 
-/* Linked list of available inode handles */
-IHandle_t *ihAvailHead;
-IHandle_t *ihAvailTail;
+/* The inode handle and descriptor caches are split into shards so that
+ * threads opening unrelated files do not all serialize on one mutex.  An
+ * inode handle, its hash bucket and every descriptor open on it belong to
+ * the shard selected by the handle's hash, and are only touched with that
+ * shard's lock held.  IH_LOCK itself now covers package initialization,
+ * the cache size and the stream handle list. */
+#ifdef AFS_PTHREAD_ENV
+# define IH_NSHARDS	16	/* power of 2, at most I_HANDLE_HASH_SIZE */
+#else
+# define IH_NSHARDS	1
+#endif
+
+struct ih_shard {
+#ifdef AFS_PTHREAD_ENV
+    pthread_mutex_t lock;
+#endif
+    IHandle_t *ihAvailHead;	/* available inode handles */
+    IHandle_t *ihAvailTail;
+    FdHandle_t *fdAvailHead;	/* available file descriptor handles */
+    FdHandle_t *fdAvailTail;
+    FdHandle_t *fdLruHead;	/* open, unused descriptors, oldest first */
+    FdHandle_t *fdLruTail;
+    int fdInUseCount;		/* open descriptors, cached or in use */
+    afs_uint32 hits;		/* opens served from the cache */
+    afs_uint32 misses;		/* opens that had to open the file */
+    afs_uint32 evictions;	/* cached descriptors closed to make room */
+};
+
+static struct ih_shard ihShards[IH_NSHARDS];
+
+#define IH_SHARD(ihash)	(&ihShards[(ihash) & (IH_NSHARDS - 1)])
+#define IH_SHARD_OF(ihP) \
+    IH_SHARD(IH_HASH((ihP)->ih_dev, (ihP)->ih_vid, (ihP)->ih_ino))
 
-/* Linked list of available file descriptor handles */
-FdHandle_t *fdAvailHead;
-FdHandle_t *fdAvailTail;
+#ifdef AFS_PTHREAD_ENV
+# define IH_SHARD_LOCK(s) \
+    do { opr_Verify(pthread_once(&ih_glock_once, ih_glock_init) == 0); \
+	opr_mutex_enter(&(s)->lock); \
+    } while (0)
+# define IH_SHARD_UNLOCK(s) opr_mutex_exit(&(s)->lock)
+#else
+# define IH_SHARD_LOCK(s)
+# define IH_SHARD_UNLOCK(s)
+#endif
 
 /* Linked list of available stream descriptor handles */
 StreamHandle_t *streamAvailHead;
 StreamHandle_t *streamAvailTail;
 
-/* LRU list for file descriptor handles */
-FdHandle_t *fdLruHead;
-FdHandle_t *fdLruTail;
-
 int ih_Inited = 0;
 int ih_PkgDefaultsSet = 0;
 
@@ -69,8 +106,23 @@ int ih_PkgDefaultsSet = 0;
 int fdMaxCacheSize = 0;
 int fdCacheSize = 0;
 
-/* Number of in use file descriptors */
-int fdInUseCount = 0;
+/* fdCacheSize adapts to the load between IH_MIN_CACHESIZE and
+ * fdCacheLimit.  Running out of descriptors (EMFILE) shrinks it to just
+ * under the number open at the time, at most once per window.  A window of IH_ADAPT_WINDOW misses on
+ * a shard in which many misses had to evict a cached descriptor, with a
+ * poor hit ratio and no EMFILE, grows it by a quarter.  The limit is the
+ * initial size unless the program asked for ih_UseLargeCache(), since the
+ * initial size may be bounded by the width of fileno in FILE. */
+#define IH_MIN_CACHESIZE	IH_NSHARDS
+#define IH_ADAPT_WINDOW		256
+static int fdCacheLimit = 0;
+static int fdCacheShrunk = 0;	/* shrunk in the current window */
+static afs_uint32 fdEmfileCount = 0;
+static ih_cache_stats_t fdAdaptLast;	/* totals at start of window */
+
+/* Per-shard share of fdCacheSize; rounded up so that a small, non-zero
+ * cache still caches something in every shard. */
+#define IH_SHARD_CACHESIZE() ((fdCacheSize + IH_NSHARDS - 1) / IH_NSHARDS)
 
 /* Hash table for inode handles */
 IHashBucket_t ihashTable[I_HANDLE_HASH_SIZE];
@@ -125,11 +177,15 @@ ih_SetSyncBehavior(const char *behavior)
 }
 
 #ifdef AFS_PTHREAD_ENV
-/* Initialize the global ihandle mutex */
+/* Initialize the global ihandle mutex and the shard locks */
 void
 ih_glock_init(void)
 {
+    int i;
+
     opr_mutex_init(&ih_glock_mutex);
+    for (i = 0; i < IH_NSHARDS; i++)
+	opr_mutex_init(&ihShards[i].lock);
 }
 #endif /* AFS_PTHREAD_ENV */
 
@@ -140,9 +196,11 @@ ih_Initialize(void)
     int i;
     opr_Assert(!ih_Inited);
     ih_Inited = 1;
-    DLL_INIT_LIST(ihAvailHead, ihAvailTail);
-    DLL_INIT_LIST(fdAvailHead, fdAvailTail);
-    DLL_INIT_LIST(fdLruHead, fdLruTail);
+    for (i = 0; i < IH_NSHARDS; i++) {
+	DLL_INIT_LIST(ihShards[i].ihAvailHead, ihShards[i].ihAvailTail);
+	DLL_INIT_LIST(ihShards[i].fdAvailHead, ihShards[i].fdAvailTail);
+	DLL_INIT_LIST(ihShards[i].fdLruHead, ihShards[i].fdLruTail);
+    }
     for (i = 0; i < I_HANDLE_HASH_SIZE; i++) {
 	DLL_INIT_LIST(ihashTable[i].ihash_head, ihashTable[i].ihash_tail);
     }
@@ -180,6 +238,7 @@ ih_Initialize(void)
     }
 #endif
     fdCacheSize = min(fdMaxCacheSize, vol_io_params.fd_initial_cachesize);
+    fdCacheLimit = fdCacheSize;
 }
 
 /* Make the file descriptor cache as big as possible. Don't this call
@@ -201,23 +260,94 @@ ih_UseLargeCache(void)
     }
 
     fdCacheSize = fdMaxCacheSize;
+    fdCacheLimit = fdMaxCacheSize;
 
     IH_UNLOCK;
 }
 
-/* Allocate a chunk of inode handles */
+/* Collect the descriptor cache counters from all shards. */
 void
-iHandleAllocateChunk(void)
+ih_GetCacheStats(ih_cache_stats_t *stats)
+{
+    struct ih_shard *s;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < IH_NSHARDS; i++) {
+	s = &ihShards[i];
+	IH_SHARD_LOCK(s);
+	stats->inUse += s->fdInUseCount;
+	stats->hits += s->hits;
+	stats->misses += s->misses;
+	stats->evictions += s->evictions;
+	IH_SHARD_UNLOCK(s);
+    }
+    IH_LOCK;
+    stats->size = fdCacheSize;
+    stats->emfile = fdEmfileCount;
+    IH_UNLOCK;
+}
+
+/* Called every IH_ADAPT_WINDOW misses on a shard, with no locks held:
+ * grow the descriptor cache if the last window shows it is too small. */
+static void
+ih_AdaptCacheSize(void)
+{
+    ih_cache_stats_t now;
+    afs_uint32 hits, misses, evictions;
+
+    ih_GetCacheStats(&now);
+
+    IH_LOCK;
+    hits = now.hits - fdAdaptLast.hits;
+    misses = now.misses - fdAdaptLast.misses;
+    evictions = now.evictions - fdAdaptLast.evictions;
+    if (now.emfile == fdAdaptLast.emfile && fdCacheSize < fdCacheLimit
+	&& evictions > misses / 4 && hits < 4 * misses) {
+	fdCacheSize = min(fdCacheSize + max(fdCacheSize / 4, IH_NSHARDS),
+			  fdCacheLimit);
+    }
+    fdCacheShrunk = 0;
+    fdAdaptLast = now;
+    IH_UNLOCK;
+}
+
+/* An open failed with EMFILE: the cache is bigger than the descriptors
+ * the process can actually get.  Shrink it below the number we managed
+ * to hold, which the counts read here without the shard locks are close
+ * enough to. */
+static void
+ih_ShrinkCacheSize(void)
+{
+    int i, inUse = 0;
+
+    for (i = 0; i < IH_NSHARDS; i++)
+	inUse += ihShards[i].fdInUseCount;
+
+    IH_LOCK;
+    fdEmfileCount++;
+    if (!fdCacheShrunk && fdCacheSize > IH_MIN_CACHESIZE) {
+	fdCacheSize = min(fdCacheSize, inUse) - min(fdCacheSize, inUse) / 8;
+	fdCacheSize = max(fdCacheSize, IH_MIN_CACHESIZE);
+	fdCacheShrunk = 1;
+    }
+    IH_UNLOCK;
+}
+
+/* Allocate a chunk of inode handles */
+static void
+iHandleAllocateChunk(struct ih_shard *s)
 {
     int i;
     IHandle_t *ihP;
 
-    opr_Assert(ihAvailHead == NULL);
+    opr_Assert(s->ihAvailHead == NULL);
     ihP = malloc(I_HANDLE_MALLOCSIZE * sizeof(IHandle_t));
     opr_Assert(ihP != NULL);
     for (i = 0; i < I_HANDLE_MALLOCSIZE; i++) {
 	ihP[i].ih_refcnt = 0;
-	DLL_INSERT_TAIL(&ihP[i], ihAvailHead, ihAvailTail, ih_next, ih_prev);
+	DLL_INSERT_TAIL(&ihP[i], s->ihAvailHead, s->ihAvailTail,
+			ih_next, ih_prev);
     }
 }
 
@@ -226,33 +356,39 @@ IHandle_t *
 ih_init(int dev, int vid, Inode ino)
 {
     int ihash = IH_HASH(dev, vid, ino);
+    struct ih_shard *s = IH_SHARD(ihash);
     IHandle_t *ihP;
 
     if (!ih_PkgDefaultsSet) {
         ih_PkgDefaults();
     }
 
-    IH_LOCK;
     if (!ih_Inited) {
-        ih_Initialize();
+	IH_LOCK;
+	if (!ih_Inited) {
+	    ih_Initialize();
+	}
+	IH_UNLOCK;
     }
 
+    IH_SHARD_LOCK(s);
+
     /* Do we already have a handle for this Inode? */
     for (ihP = ihashTable[ihash].ihash_head; ihP; ihP = ihP->ih_next) {
 	if (ihP->ih_ino == ino && ihP->ih_vid == vid && ihP->ih_dev == dev) {
 	    ihP->ih_refcnt++;
-	    IH_UNLOCK;
+	    IH_SHARD_UNLOCK(s);
 	    return ihP;
 	}
     }
 
     /* Allocate and initialize a new Inode handle */
-    if (ihAvailHead == NULL) {
-	iHandleAllocateChunk();
+    if (s->ihAvailHead == NULL) {
+	iHandleAllocateChunk(s);
     }
-    ihP = ihAvailHead;
+    ihP = s->ihAvailHead;
     opr_Assert(ihP->ih_refcnt == 0);
-    DLL_DELETE(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_DELETE(ihP, s->ihAvailHead, s->ihAvailTail, ih_next, ih_prev);
     ihP->ih_dev = dev;
     ihP->ih_vid = vid;
     ihP->ih_ino = ino;
@@ -262,7 +398,7 @@ ih_init(int dev, int vid, Inode ino)
     DLL_INIT_LIST(ihP->ih_fdhead, ihP->ih_fdtail);
     DLL_INSERT_TAIL(ihP, ihashTable[ihash].ihash_head,
 		    ihashTable[ihash].ihash_tail, ih_next, ih_prev);
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
     return ihP;
 }
 
@@ -270,22 +406,24 @@ ih_init(int dev, int vid, Inode ino)
 IHandle_t *
 ih_copy(IHandle_t * ihP)
 {
-    IH_LOCK;
+    struct ih_shard *s = IH_SHARD_OF(ihP);
+
+    IH_SHARD_LOCK(s);
     opr_Assert(ih_Inited);
     opr_Assert(ihP->ih_refcnt > 0);
     ihP->ih_refcnt++;
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
     return ihP;
 }
 
 /* Allocate a chunk of file descriptor handles */
-void
-fdHandleAllocateChunk(void)
+static void
+fdHandleAllocateChunk(struct ih_shard *s)
 {
     int i;
     FdHandle_t *fdP;
 
-    opr_Assert(fdAvailHead == NULL);
+    opr_Assert(s->fdAvailHead == NULL);
     fdP = malloc(FD_HANDLE_MALLOCSIZE * sizeof(FdHandle_t));
     opr_Assert(fdP != NULL);
     for (i = 0; i < FD_HANDLE_MALLOCSIZE; i++) {
@@ -295,7 +433,8 @@ fdHandleAllocateChunk(void)
 	fdP[i].fd_fd = INVALID_FD;
         fdP[i].fd_ihnext = NULL;
         fdP[i].fd_ihprev = NULL;
-	DLL_INSERT_TAIL(&fdP[i], fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(&fdP[i], s->fdAvailHead, s->fdAvailTail,
+			fd_next, fd_prev);
     }
 }
 
@@ -319,54 +458,37 @@ streamHandleAllocateChunk(void)
 
 /*
  * Get a file descriptor handle given an Inode handle
- * Takes the given file descriptor, and creates a new FdHandle_t for it,
- * attached to the given IHandle_t. If fdLruHead is not NULL, fd can be
- * INVALID_FD, indicating that the caller failed to open the relevant file
- * because we had too many FDs open; ih_attachfd_r will then just evict/close
- * an existing fd in the cache, and return NULL. You must not call this
- * function with an invalid fd while fdLruHead is NULL; instead, error out.
+ * Takes the given, valid file descriptor, and creates a new FdHandle_t
+ * for it, attached to the given IHandle_t. Called with the shard lock of
+ * ihP held; the caller has already counted fd in the shard's fdInUseCount.
  */
 static FdHandle_t *
-ih_attachfd_r(IHandle_t *ihP, FD_t fd)
+ih_attachfd_r(struct ih_shard *s, IHandle_t *ihP, FD_t fd)
 {
     FD_t closeFd;
     FdHandle_t *fdP;
 
-    /* If the given fd is invalid, we must have an available fd to close.
-     * Otherwise, the caller must have realized this before calling
-     * ih_attachfd_r and yielded an error before getting here. */
-    opr_Assert(fd != INVALID_FD || fdLruHead != NULL);
+    opr_Assert(fd != INVALID_FD);
 
     /* fdCacheSize limits the size of the descriptor cache, but
      * we permit the number of open files to exceed fdCacheSize.
      * We only recycle open file descriptors when the number
      * of open files reaches the size of the cache */
-    if ((fdInUseCount > fdCacheSize || fd == INVALID_FD)  && fdLruHead != NULL) {
-	fdP = fdLruHead;
+    if (s->fdInUseCount > IH_SHARD_CACHESIZE() && s->fdLruHead != NULL) {
+	fdP = s->fdLruHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_OPEN);
-	DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, s->fdLruHead, s->fdLruTail, fd_next, fd_prev);
 	DLL_DELETE(fdP, fdP->fd_ih->ih_fdhead, fdP->fd_ih->ih_fdtail,
 		   fd_ihnext, fd_ihprev);
 	closeFd = fdP->fd_fd;
-	if (fd == INVALID_FD) {
-	    fdCacheSize--;          /* reduce in order to not run into here too often */
-	    DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
-	    fdP->fd_status = FD_HANDLE_AVAIL;
-	    fdP->fd_ih = NULL;
-	    fdP->fd_fd = INVALID_FD;
-	    IH_UNLOCK;
-	    OS_CLOSE(closeFd);
-	    IH_LOCK;
-	    fdInUseCount -= 1;
-	    return NULL;
-	}
+	s->evictions++;
     } else {
-	if (fdAvailHead == NULL) {
-	    fdHandleAllocateChunk();
+	if (s->fdAvailHead == NULL) {
+	    fdHandleAllocateChunk(s);
 	}
-	fdP = fdAvailHead;
+	fdP = s->fdAvailHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_AVAIL);
-	DLL_DELETE(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, s->fdAvailHead, s->fdAvailTail, fd_next, fd_prev);
 	closeFd = INVALID_FD;
     }
 
@@ -382,32 +504,76 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
 		    fd_ihprev);
 
     if (closeFd != INVALID_FD) {
-	IH_UNLOCK;
+	IH_SHARD_UNLOCK(s);
 	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	IH_SHARD_LOCK(s);
+	s->fdInUseCount -= 1;
     }
 
     return fdP;
 }
 
+/*
+ * Close one cached, unused descriptor after an open failed with EMFILE.
+ * Descriptors are process-wide, so any shard will do; the opener's own
+ * shard is tried first. Called with no shard lock held. Returns 0 if
+ * there was nothing to close.
+ */
+static int
+ih_evictfd(struct ih_shard *first)
+{
+    struct ih_shard *s;
+    FdHandle_t *fdP;
+    FD_t closeFd;
+    int i;
+
+    for (i = 0; i < IH_NSHARDS; i++) {
+	s = &ihShards[((first - ihShards) + i) & (IH_NSHARDS - 1)];
+	IH_SHARD_LOCK(s);
+	fdP = s->fdLruHead;
+	if (fdP == NULL) {
+	    IH_SHARD_UNLOCK(s);
+	    continue;
+	}
+	opr_Assert(fdP->fd_status == FD_HANDLE_OPEN);
+	DLL_DELETE(fdP, s->fdLruHead, s->fdLruTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, fdP->fd_ih->ih_fdhead, fdP->fd_ih->ih_fdtail,
+		   fd_ihnext, fd_ihprev);
+	closeFd = fdP->fd_fd;
+	DLL_INSERT_TAIL(fdP, s->fdAvailHead, s->fdAvailTail, fd_next, fd_prev);
+	fdP->fd_status = FD_HANDLE_AVAIL;
+	fdP->fd_ih = NULL;
+	fdP->fd_fd = INVALID_FD;
+	s->evictions++;
+	IH_SHARD_UNLOCK(s);
+	OS_CLOSE(closeFd);
+	IH_SHARD_LOCK(s);
+	s->fdInUseCount -= 1;
+	IH_SHARD_UNLOCK(s);
+	return 1;
+    }
+    return 0;
+}
+
 FdHandle_t *
 ih_attachfd(IHandle_t *ihP, FD_t fd)
 {
+    struct ih_shard *s;
     FdHandle_t *fdP;
 
     if (fd == INVALID_FD) {
 	return NULL;
     }
 
-    IH_LOCK;
+    s = IH_SHARD_OF(ihP);
+    IH_SHARD_LOCK(s);
 
-    fdInUseCount += 1;
+    s->fdInUseCount += 1;
 
-    fdP = ih_attachfd_r(ihP, fd);
+    fdP = ih_attachfd_r(s, ihP, fd);
     opr_Assert(fdP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
 
     return fdP;
 }
@@ -418,13 +584,16 @@ ih_attachfd(IHandle_t *ihP, FD_t fd)
 FdHandle_t *
 ih_open(IHandle_t * ihP)
 {
+    struct ih_shard *s;
     FdHandle_t *fdP;
     FD_t fd;
+    int adapt;
 
     if (!ihP)			/* XXX should log here in the fileserver */
 	return NULL;
 
-    IH_LOCK;
+    s = IH_SHARD_OF(ihP);
+    IH_SHARD_LOCK(s);
 
     /* Do we already have an open file handle for this Inode? */
     for (fdP = ihP->ih_fdtail; fdP != NULL; fdP = fdP->fd_ihprev) {
@@ -449,35 +618,46 @@ ih_open(IHandle_t * ihP)
 	fdP->fd_refcnt++;
 	if (fdP->fd_status == FD_HANDLE_OPEN) {
 	    fdP->fd_status = FD_HANDLE_INUSE;
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, s->fdLruHead, s->fdLruTail, fd_next, fd_prev);
 	}
 	ihP->ih_refcnt++;
-	IH_UNLOCK;
+	s->hits++;
+	IH_SHARD_UNLOCK(s);
 	return fdP;
     }
 
     /*
      * Try to open the Inode, return NULL on error.
      */
-    fdInUseCount += 1;
-    IH_UNLOCK;
-ih_open_retry:
-    fd = OS_IOPEN(ihP);
-    IH_LOCK;
-    if (fd == INVALID_FD && (errno != EMFILE || fdLruHead == NULL) ) {
-	fdInUseCount -= 1;
-	IH_UNLOCK;
-	return NULL;
+    s->fdInUseCount += 1;
+    s->misses++;
+    adapt = (s->misses % IH_ADAPT_WINDOW) == 0;
+    IH_SHARD_UNLOCK(s);
+
+    if (adapt)
+	ih_AdaptCacheSize();
+
+    for (;;) {
+	fd = OS_IOPEN(ihP);
+	if (fd != INVALID_FD || errno != EMFILE)
+	    break;
+	ih_ShrinkCacheSize();
+	if (!ih_evictfd(s)) {
+	    errno = EMFILE;
+	    break;
+	}
     }
 
-    fdP = ih_attachfd_r(ihP, fd);
-    if (!fdP) {
-	opr_Assert(fd == INVALID_FD);
-	IH_UNLOCK;
-	goto ih_open_retry;
+    IH_SHARD_LOCK(s);
+    if (fd == INVALID_FD) {
+	s->fdInUseCount -= 1;
+	IH_SHARD_UNLOCK(s);
+	return NULL;
     }
 
-    IH_UNLOCK;
+    fdP = ih_attachfd_r(s, ihP, fd);
+
+    IH_SHARD_UNLOCK(s);
 
     return fdP;
 }
@@ -488,27 +668,30 @@ ih_open_retry:
 int
 fd_close(FdHandle_t * fdP)
 {
+    struct ih_shard *s;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    ihP = fdP->fd_ih;
+    s = IH_SHARD_OF(ihP);
+
+    IH_SHARD_LOCK(s);
+    opr_Assert(s->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
-
     /* Call fd_reallyclose to really close the unused file handles if
      * the previous attempt to close (ih_reallyclose()) all file handles
      * failed (this is determined by checking the ihandle for the flag
      * IH_REALLY_CLOSED) or we have too many open files.
      */
     if (fdP->fd_status == FD_HANDLE_CLOSING ||
-        ihP->ih_flags & IH_REALLY_CLOSED || fdInUseCount > fdCacheSize) {
-	IH_UNLOCK;
+        ihP->ih_flags & IH_REALLY_CLOSED ||
+	s->fdInUseCount > IH_SHARD_CACHESIZE()) {
+	IH_SHARD_UNLOCK(s);
 	return fd_reallyclose(fdP);
     }
 
@@ -516,7 +699,7 @@ fd_close(FdHandle_t * fdP)
     if (fdP->fd_refcnt == 0) {
 	/* Put this descriptor back into the cache */
 	fdP->fd_status = FD_HANDLE_OPEN;
-	DLL_INSERT_TAIL(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, s->fdLruHead, s->fdLruTail, fd_next, fd_prev);
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -527,7 +710,7 @@ fd_close(FdHandle_t * fdP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
 
     return 0;
 }
@@ -539,25 +722,28 @@ fd_close(FdHandle_t * fdP)
 int
 fd_reallyclose(FdHandle_t * fdP)
 {
+    struct ih_shard *s;
     FD_t closeFd;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    ihP = fdP->fd_ih;
+    s = IH_SHARD_OF(ihP);
+
+    IH_SHARD_LOCK(s);
+    opr_Assert(s->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
     closeFd = fdP->fd_fd;
     fdP->fd_refcnt--;
 
     if (fdP->fd_refcnt == 0) {
 	DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext, fd_ihprev);
-	DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, s->fdAvailHead, s->fdAvailTail, fd_next, fd_prev);
 
 	fdP->fd_status = FD_HANDLE_AVAIL;
 	fdP->fd_refcnt = 0;
@@ -588,10 +774,10 @@ fd_reallyclose(FdHandle_t * fdP)
     }
 
     if (fdP->fd_refcnt == 0) {
-	IH_UNLOCK;
+	IH_SHARD_UNLOCK(s);
 	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	IH_SHARD_LOCK(s);
+	s->fdInUseCount -= 1;
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -601,7 +787,7 @@ fd_reallyclose(FdHandle_t * fdP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
 
     return 0;
 }
@@ -842,13 +1028,14 @@ stream_close(StreamHandle_t * streamP, int reallyClose)
 }
 
 /* Close all unused file descriptors associated with the inode
- * handle. Called with IH_LOCK held. May drop and reacquire
- * IH_LOCK. Sets the IH_REALLY_CLOSED flag in the inode handle
+ * handle. Called with the handle's shard lock held. May drop and
+ * reacquire it. Sets the IH_REALLY_CLOSED flag in the inode handle
  * if it fails to close all file handles.
  */
 static int
 ih_fdclose(IHandle_t * ihP)
 {
+    struct ih_shard *s = IH_SHARD_OF(ihP);
     int closeCount, closedAll;
     FdHandle_t *fdP, *head, *tail, *next;
 
@@ -876,7 +1063,7 @@ ih_fdclose(IHandle_t * ihP)
 	     * off here. */
 	    DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext,
 		       fd_ihprev);
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, s->fdLruHead, s->fdLruTail, fd_next, fd_prev);
 	    DLL_INSERT_TAIL(fdP, head, tail, fd_next, fd_prev);
 	} else {
 	    closedAll = 0;
@@ -898,7 +1085,7 @@ ih_fdclose(IHandle_t * ihP)
 	return 0;		/* No file descriptors closed */
     }
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
     /*
      * Close the file descriptors
      */
@@ -912,20 +1099,20 @@ ih_fdclose(IHandle_t * ihP)
 	closeCount++;
     }
 
-    IH_LOCK;
-    opr_Assert(fdInUseCount >= closeCount);
-    fdInUseCount -= closeCount;
+    IH_SHARD_LOCK(s);
+    opr_Assert(s->fdInUseCount >= closeCount);
+    s->fdInUseCount -= closeCount;
 
     /*
      * Append the temporary queue to the list of available descriptors
      */
-    if (fdAvailHead == NULL) {
-	fdAvailHead = head;
-	fdAvailTail = tail;
+    if (s->fdAvailHead == NULL) {
+	s->fdAvailHead = head;
+	s->fdAvailTail = tail;
     } else {
-	fdAvailTail->fd_next = head;
-	head->fd_prev = fdAvailTail;
-	fdAvailTail = tail;
+	s->fdAvailTail->fd_next = head;
+	head->fd_prev = s->fdAvailTail;
+	s->fdAvailTail = tail;
     }
 
     return 0;
@@ -935,17 +1122,20 @@ ih_fdclose(IHandle_t * ihP)
 int
 ih_reallyclose(IHandle_t * ihP)
 {
+    struct ih_shard *s;
+
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
+    s = IH_SHARD_OF(ihP);
+    IH_SHARD_LOCK(s);
     ihP->ih_refcnt++;   /* must not disappear over unlock */
     if (ihP->ih_synced) {
 	FdHandle_t *fdP;
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_ALWAYS);
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_NEVER);
         ihP->ih_synced = 0;
-	IH_UNLOCK;
+	IH_SHARD_UNLOCK(s);
 
 	fdP = IH_OPEN(ihP);
 	if (fdP) {
@@ -953,7 +1143,7 @@ ih_reallyclose(IHandle_t * ihP)
 	    FDH_CLOSE(fdP);
 	}
 
-	IH_LOCK;
+	IH_SHARD_LOCK(s);
     }
 
     opr_Assert(ihP->ih_refcnt > 0);
@@ -965,7 +1155,7 @@ ih_reallyclose(IHandle_t * ihP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
     return 0;
 }
 
@@ -975,6 +1165,7 @@ ih_reallyclose(IHandle_t * ihP)
 static int
 _ih_release_r(IHandle_t * ihP)
 {
+    struct ih_shard *s;
     int ihash;
 
     if (!ihP)
@@ -988,6 +1179,7 @@ _ih_release_r(IHandle_t * ihP)
     }
 
     ihash = IH_HASH(ihP->ih_dev, ihP->ih_vid, ihP->ih_ino);
+    s = IH_SHARD(ihash);
     DLL_DELETE(ihP, ihashTable[ihash].ihash_head,
 	       ihashTable[ihash].ihash_tail, ih_next, ih_prev);
 
@@ -995,7 +1187,7 @@ _ih_release_r(IHandle_t * ihP)
 
     ihP->ih_refcnt--;
 
-    DLL_INSERT_TAIL(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_INSERT_TAIL(ihP, s->ihAvailHead, s->ihAvailTail, ih_next, ih_prev);
 
     return 0;
 }
@@ -1006,14 +1198,16 @@ _ih_release_r(IHandle_t * ihP)
 int
 ih_release(IHandle_t * ihP)
 {
+    struct ih_shard *s;
     int ret;
 
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
+    s = IH_SHARD_OF(ihP);
+    IH_SHARD_LOCK(s);
     ret = _ih_release_r(ihP);
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(s);
     return ret;
 }
 
@@ -1114,6 +1308,99 @@ ih_pwrite(int fd, const void * buf, size_t count, afs_foff_t offset)
 }
 #endif /* !AFS_IHANDLE_PIO_ENV */
 
+/*
+ * Copy len bytes at offset off of one open file to the same offset of
+ * another, letting the kernel do the copy where it knows how.  On
+ * filesystems with reflink support (btrfs, xfs, ...) the destination then
+ * shares the source's data blocks, so nothing is copied until one side is
+ * written.  The range must not run past the end of the source.  Returns
+ * the number of bytes copied, which may be short, or 0 if the kernel cannot
+ * help; the caller copies any remainder itself.
+ */
+afs_sfsize_t
+ih_copyrange(FD_t src, FD_t dst, afs_foff_t off, afs_fsize_t len)
+{
+    afs_fsize_t done = 0;
+
+#if defined(AFS_LINUX26_ENV) && defined(FICLONERANGE)
+    {
+	struct file_clone_range fcr;
+
+	/* fails unless the range is block aligned or runs to EOF */
+	memset(&fcr, 0, sizeof(fcr));
+	fcr.src_fd = src;
+	fcr.src_offset = off;
+	fcr.src_length = len;
+	fcr.dest_offset = off;
+	if (ioctl(dst, FICLONERANGE, &fcr) == 0)
+	    return len;
+    }
+#endif
+#if defined(AFS_LINUX26_ENV) && defined(HAVE_COPY_FILE_RANGE)
+    while (done < len) {
+	loff_t inoff = off + done;
+	loff_t outoff = off + done;
+	size_t chunk = len - done > 0x40000000 ? 0x40000000 : len - done;
+	ssize_t code;
+
+	code = copy_file_range(src, &inoff, dst, &outoff, chunk, 0);
+	if (code <= 0)
+	    break;
+	done += code;
+    }
+#endif
+    return done;
+}
+
+/*
+ * Find out whether files in the given directory can share data extents
+ * (reflinks), by cloning a scratch file.  When they can, ih_copyrange()
+ * leaves a copy-on-write sharing every extent the writer does not touch.
+ */
+int
+ih_canreflink(char *dir)
+{
+    int ok = 0;
+#if defined(AFS_LINUX26_ENV) && defined(FICLONE)
+    char src[MAXPATHLEN], dst[MAXPATHLEN];
+    char buf[4096];
+    FD_t sfd, dfd;
+
+    snprintf(src, sizeof(src), "%s" OS_DIRSEP ".reflink.%d.a", dir,
+	     (int)getpid());
+    snprintf(dst, sizeof(dst), "%s" OS_DIRSEP ".reflink.%d.b", dir,
+	     (int)getpid());
+    sfd = OS_OPEN(src, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    dfd = OS_OPEN(dst, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (sfd != INVALID_FD && dfd != INVALID_FD) {
+	memset(buf, 0, sizeof(buf));
+	if (OS_WRITE(sfd, buf, sizeof(buf)) == sizeof(buf)
+	    && ioctl(dfd, FICLONE, sfd) == 0)
+	    ok = 1;
+    }
+    if (sfd != INVALID_FD)
+	OS_CLOSE(sfd);
+    if (dfd != INVALID_FD)
+	OS_CLOSE(dfd);
+    OS_UNLINK(src);
+    OS_UNLINK(dst);
+#endif
+    return ok;
+}
+
+/*
+ * Tell the kernel that len bytes at offset off of an open file will be
+ * read soon, so that it can start reading them in.  Only a hint; on
+ * systems without posix_fadvise() it does nothing.
+ */
+void
+ih_prefetch(FD_t fd, afs_foff_t off, afs_fsize_t len)
+{
+#ifdef HAVE_POSIX_FADVISE
+    (void)posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 #ifndef AFS_NT40_ENV
 int
 ih_isunlinked(int fd)
@@ -1129,6 +1416,159 @@ ih_isunlinked(int fd)
 }
 #endif /* !AFS_NT40_ENV */
 
+/*
+ * Asynchronous I/O.  ih_AsyncInit starts a pool of threads which carry
+ * out FDH_APREAD and FDH_APWRITE requests in the order they were started,
+ * so that the caller can keep the disk busy while it does something else,
+ * such as moving the previous chunk of a file over the network.  Without
+ * the pool, the default and the only choice under LWP, ih_aio_start does
+ * the I/O itself before returning.
+ */
+#ifdef AFS_PTHREAD_ENV
+static pthread_mutex_t ih_aioMutex;
+static pthread_cond_t ih_aioCV;
+static ih_aio_t *ih_aioHead;
+static ih_aio_t *ih_aioTail;
+#endif
+static int ih_aioThreads = 0;
+
+static void
+ih_aio_do(ih_aio_t *req)
+{
+    if (req->aio_write)
+	req->aio_result = OS_PWRITE(req->aio_fd, req->aio_buf, req->aio_len,
+				    req->aio_off);
+    else
+	req->aio_result = OS_PREAD(req->aio_fd, req->aio_buf, req->aio_len,
+				   req->aio_off);
+    req->aio_errno = (req->aio_result < 0) ? errno : 0;
+}
+
+#ifdef AFS_PTHREAD_ENV
+static void *
+ih_aio_thread(void *rock)
+{
+    ih_aio_t *req;
+
+    opr_mutex_enter(&ih_aioMutex);
+    for (;;) {
+	while (ih_aioHead == NULL)
+	    opr_cv_wait(&ih_aioCV, &ih_aioMutex);
+	req = ih_aioHead;
+	ih_aioHead = req->aio_next;
+	if (ih_aioHead == NULL)
+	    ih_aioTail = NULL;
+	opr_mutex_exit(&ih_aioMutex);
+
+	ih_aio_do(req);
+
+	opr_mutex_enter(&ih_aioMutex);
+	req->aio_done = 1;
+	opr_cv_signal(&req->aio_cv);
+    }
+    AFS_UNREACHED(return(NULL));
+}
+#endif
+
+/**
+ * start the asynchronous I/O threads.
+ *
+ * @param[in] nthreads  number of threads; 0 leaves I/O synchronous
+ *
+ * @return status
+ *   @retval 0 success
+ *   @retval -1 not all threads could be started; requests use those
+ *              that were
+ */
+int
+ih_AsyncInit(int nthreads)
+{
+#ifdef AFS_PTHREAD_ENV
+    pthread_attr_t attrs;
+    pthread_t tid;
+    int i;
+
+    if (nthreads <= 0 || ih_aioThreads > 0)
+	return 0;
+
+    opr_mutex_init(&ih_aioMutex);
+    opr_cv_init(&ih_aioCV);
+    opr_Verify(pthread_attr_init(&attrs) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&attrs,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    for (i = 0; i < nthreads; i++) {
+	int code;
+	AFS_SIGSET_DECL;
+
+	AFS_SIGSET_CLEAR();
+	code = pthread_create(&tid, &attrs, ih_aio_thread, NULL);
+	AFS_SIGSET_RESTORE();
+	if (code != 0)
+	    break;
+    }
+    opr_Verify(pthread_attr_destroy(&attrs) == 0);
+    ih_aioThreads = i;
+    return (i == nthreads) ? 0 : -1;
+#else
+    return 0;
+#endif
+}
+
+/* Start a pread (write == 0) or pwrite of len bytes at off; see
+ * FDH_APREAD. */
+void
+ih_aio_start(ih_aio_t *req, FD_t fd, void *buf, size_t len, afs_foff_t off,
+	     int write)
+{
+    req->aio_fd = fd;
+    req->aio_buf = buf;
+    req->aio_len = len;
+    req->aio_off = off;
+    req->aio_write = write;
+    req->aio_queued = 0;
+    req->aio_done = 0;
+    req->aio_next = NULL;
+
+#ifdef AFS_PTHREAD_ENV
+    if (ih_aioThreads > 0) {
+	req->aio_queued = 1;
+	opr_cv_init(&req->aio_cv);
+	opr_mutex_enter(&ih_aioMutex);
+	if (ih_aioTail != NULL)
+	    ih_aioTail->aio_next = req;
+	else
+	    ih_aioHead = req;
+	ih_aioTail = req;
+	opr_cv_signal(&ih_aioCV);
+	opr_mutex_exit(&ih_aioMutex);
+	return;
+    }
+#endif
+    ih_aio_do(req);
+    req->aio_done = 1;
+}
+
+/* Wait for a request started by ih_aio_start and return its result; errno
+ * is set if it failed. */
+ssize_t
+ih_aio_wait(ih_aio_t *req)
+{
+#ifdef AFS_PTHREAD_ENV
+    if (req->aio_queued) {
+	opr_mutex_enter(&ih_aioMutex);
+	while (!req->aio_done)
+	    opr_cv_wait(&req->aio_cv, &ih_aioMutex);
+	opr_mutex_exit(&ih_aioMutex);
+	opr_cv_destroy(&req->aio_cv);
+	req->aio_queued = 0;
+    }
+#endif
+    opr_Assert(req->aio_done);
+    if (req->aio_result < 0)
+	errno = req->aio_errno;
+    return req->aio_result;
+}
+
 int
 ih_fdsync(FdHandle_t *fdP)
 {
@@ -56,6 +56,9 @@
  *	file descriptor.
  * IH_IREAD/IH_IWRITE - read/write an Inode.
  * IH_INC/IH_DEC - increment/decrement the link count.
+ * IH_BATCH_BEGIN/IH_BATCH_END - start/finish a batch of link count changes.
+ * IH_BATCH_INC/IH_BATCH_DEC - IH_INC/IH_DEC, deferred to the batch's flush.
+ * IH_BATCH_FLUSH - write out and sync a batch's pending changes.
  *
  * Replacements for C runtime file operations
  * FDH_READ/FDH_WRITE - read/write using the file descriptor.
@@ -63,10 +66,16 @@
  * FDH_SEEK - set file handle's read/write position
  * FDH_CLOSE - return a file descriptor to the cache
  * FDH_REALLYCLOSE - Close a file descriptor, do not return to the cache
+ * FDH_APREAD/FDH_APWRITE - start an asynchronous pread/pwrite.
+ * FDH_AWAIT - wait for an asynchronous pread/pwrite to finish.
+ * FDH_PREFETCH - start reading part of a file into the page cache.
  * FDH_SYNC - Unconditionally sync an open file.
  * FDH_TRUNC - Truncate a file
  * FDH_LOCKFILE - Lock a whole file
  * FDH_UNLOCKFILE - Unlock a whole file
+ * FDH_LOCKRANGE - Lock a byte range; the whole file where ranges are not
+ *                 supported
+ * FDH_UNLOCKRANGE - Unlock a byte range locked with FDH_LOCKRANGE
  *
  * status information:
  * FDH_SIZE - returns the size of the file.
@@ -187,7 +196,7 @@ typedef struct FdHandle_s {
 					 * used for subsequent opens. */
 
 /* buffered file descriptor handle */
-#define STREAM_HANDLE_BUFSIZE	2048	/* buffer size for STR_READ/STR_WRITE */
+#define STREAM_HANDLE_BUFSIZE	(16 * 1024)	/* buffer size for STR_READ/STR_WRITE */
 typedef struct StreamHandle_s {
     FD_t str_fd;		/* file descriptor */
     int str_direction;		/* current read/write direction */
@@ -308,6 +317,19 @@ typedef struct IHashBucket_s {
     IHandle_t *ihash_tail;
 } IHashBucket_t;
 
+/* File descriptor cache counters; see ih_GetCacheStats. */
+typedef struct ih_cache_stats {
+    afs_uint32 size;		/* current target size of the cache */
+    afs_uint32 inUse;		/* open descriptors, cached or in use */
+    afs_uint32 hits;		/* opens served from the cache */
+    afs_uint32 misses;		/* opens that had to open the file */
+    afs_uint32 evictions;	/* cached descriptors closed to make room */
+    afs_uint32 emfile;		/* opens that ran out of descriptors */
+} ih_cache_stats_t;
+
+/* Pending link count changes; see namei_BeginLinkBatch. */
+struct ih_linkbatch;
+
 /* Prototypes for handle support routines. */
 #ifdef AFS_NAMEI_ENV
 # ifdef AFS_NT40_ENV
@@ -327,6 +349,7 @@ extern FD_t *ih_fdopen(FdHandle_t * h, char *fdperms);
 extern void ih_PkgDefaults(void);
 extern void ih_Initialize(void);
 extern void ih_UseLargeCache(void);
+extern void ih_GetCacheStats(ih_cache_stats_t *stats);
 extern int ih_SetSyncBehavior(const char *behavior);
 extern IHandle_t *ih_init(int /*@alt Device@ */ dev, int /*@alt VolId@ */ vid,
 			  Inode ino);
@@ -413,6 +436,8 @@ extern ssize_t ih_pwrite(FD_t fd, const void * buf, size_t count, afs_foff_t off
 #ifdef AFS_NT40_ENV
 # define OS_LOCKFILE(FD, O) (!LockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), 2, 0))
 # define OS_UNLOCKFILE(FD, O) (!UnlockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), 2, 0))
+# define OS_LOCKRANGE(FD, O, L) (!LockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), (DWORD)(L), 0))
+# define OS_UNLOCKRANGE(FD, O, L) (!UnlockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), (DWORD)(L), 0))
 # define OS_ERROR(X) nterr_nt2unix(GetLastError(), X)
 # define OS_UNLINK(X) nt_unlink(X)
 /* we can't have a file unlinked out from under us on NT */
@@ -422,6 +447,8 @@ extern ssize_t ih_pwrite(FD_t fd, const void * buf, size_t count, afs_foff_t off
 #else
 # define OS_LOCKFILE(FD, O) flock(FD, LOCK_EX)
 # define OS_UNLOCKFILE(FD, O) flock(FD, LOCK_UN)
+# define OS_LOCKRANGE(FD, O, L) flock(FD, LOCK_EX)
+# define OS_UNLOCKRANGE(FD, O, L) flock(FD, LOCK_UN)
 # define OS_ERROR(X) X
 # define OS_UNLINK(X) unlink(X)
 # define OS_ISUNLINKED(X) ih_isunlinked(X)
@@ -507,6 +534,13 @@ extern int OS_TRUNC(FD_t FD, OFFT L);
 # endif /* AFS_NT40_ENV */
 # define IH_INC(H, I, P) namei_inc(H, I, P)
 # define IH_DEC(H, I, P) namei_dec(H, I, P)
+# define IH_BATCH_BEGIN(H) namei_BeginLinkBatch(H)
+# define IH_BATCH_INC(B, H, I, P) \
+	 ((B) ? namei_BatchInc(B, I, P) : namei_inc(H, I, P))
+# define IH_BATCH_DEC(B, H, I, P) \
+	 ((B) ? namei_BatchDec(B, I, P) : namei_dec(H, I, P))
+# define IH_BATCH_FLUSH(B) ((B) ? namei_FlushLinkBatch(B) : 0)
+# define IH_BATCH_END(B) ((B) ? namei_EndLinkBatch(B) : 0)
 # define IH_IREAD(H, O, B, S) namei_iread(H, O, B, S)
 # define IH_IWRITE(H, O, B, S) namei_iwrite(H, O, B, S)
 # define IH_CREATE(H, D, P, N, P1, P2, P3, P4) \
@@ -559,6 +593,14 @@ extern Inode ih_icreate(IHandle_t * ih, int dev, char *part, Inode nI, int p1,
           inode_write((H)->ih_dev, (H)->ih_ino, (H)->ih_vid, O, B, S)
 # endif /* AFS_LINUX22_ENV */
 
+
+/* Link counts live in the inodes themselves; there is nothing to batch. */
+# define IH_BATCH_BEGIN(H) ((struct ih_linkbatch *)NULL)
+# define IH_BATCH_INC(B, H, I, P) IH_INC(H, I, P)
+# define IH_BATCH_DEC(B, H, I, P) IH_DEC(H, I, P)
+# define IH_BATCH_FLUSH(B) 0
+# define IH_BATCH_END(B) 0
+
 #endif /* AFS_NAMEI_ENV */
 
 #define OS_SIZE(FD) ih_size(FD)
@@ -590,9 +632,48 @@ extern afs_sfsize_t ih_size(FD_t);
 #define FDH_SIZE(H) OS_SIZE((H)->fd_fd)
 #define FDH_LOCKFILE(H, O) OS_LOCKFILE((H)->fd_fd, O)
 #define FDH_UNLOCKFILE(H, O) OS_UNLOCKFILE((H)->fd_fd, O)
+#define FDH_LOCKRANGE(H, O, L) OS_LOCKRANGE((H)->fd_fd, O, L)
+#define FDH_UNLOCKRANGE(H, O, L) OS_UNLOCKRANGE((H)->fd_fd, O, L)
 #define FDH_ISUNLINKED(H) OS_ISUNLINKED((H)->fd_fd)
 
+#define FDH_COPYRANGE(S, D, O, L) ih_copyrange((S)->fd_fd, (D)->fd_fd, O, L)
+#define FDH_PREFETCH(H, O, L) ih_prefetch((H)->fd_fd, O, L)
+
+/* Asynchronous positional I/O.  FDH_APREAD/FDH_APWRITE start a request
+ * and FDH_AWAIT waits for it and returns what FDH_PREAD/FDH_PWRITE would
+ * have.  The request, the buffer and the descriptor handle must stay
+ * valid until then.  Requests run synchronously unless ih_AsyncInit has
+ * started I/O threads. */
+typedef struct ih_aio_s {
+    FD_t aio_fd;
+    void *aio_buf;
+    size_t aio_len;
+    afs_foff_t aio_off;
+    int aio_write;		/* pwrite rather than pread */
+    int aio_queued;		/* handed to an I/O thread */
+    int aio_done;
+    ssize_t aio_result;
+    int aio_errno;
+    struct ih_aio_s *aio_next;	/* I/O thread queue */
+#ifdef AFS_PTHREAD_ENV
+    pthread_cond_t aio_cv;
+#endif
+} ih_aio_t;
+
+#define FDH_APREAD(R, H, B, S, O) ih_aio_start(R, (H)->fd_fd, B, S, O, 0)
+#define FDH_APWRITE(R, H, B, S, O) ih_aio_start(R, (H)->fd_fd, B, S, O, 1)
+#define FDH_AWAIT(R) ih_aio_wait(R)
+
+extern int ih_AsyncInit(int nthreads);
+extern void ih_aio_start(ih_aio_t *req, FD_t fd, void *buf, size_t len,
+			 afs_foff_t off, int write);
+extern ssize_t ih_aio_wait(ih_aio_t *req);
+
 extern int ih_fdsync(FdHandle_t *fdP);
+extern afs_sfsize_t ih_copyrange(FD_t src, FD_t dst, afs_foff_t off,
+				 afs_fsize_t len);
+extern int ih_canreflink(char *dir);
+extern void ih_prefetch(FD_t fd, afs_foff_t off, afs_fsize_t len);
 
 #ifdef AFS_NT40_ENV
 # define afs_stat_st     __stat64
@@ -61,13 +61,6 @@
 #define   LOCK_UN   8    /* unlock */
 #endif
 
-#ifdef AFS_SALSRV_ENV
-#include <pthread.h>
-#include <afs/work_queue.h>
-#include <afs/thread_pool.h>
-#include <vol/vol-salvage.h>
-#endif
-
 int Testing=0;
 
 static void namei_UnlockLinkCount(FdHandle_t * fdP, Inode ino);
@@ -1331,20 +1324,31 @@ namei_copy_on_write(IHandle_t *h)
 	    FDH_CLOSE(fdP);
 	    return EIO;
 	}
-	buf = malloc(8192);
-	if (!buf) {
-	    OS_CLOSE(fd);
-	    OS_UNLINK(path);
-	    FDH_CLOSE(fdP);
-	    return ENOMEM;
-	}
 	size = tstat.st_size;
 	offset = 0;
+	/* reflink or kernel copy if we can, then copy whatever is left */
+	if (size > 0) {
+	    afs_sfsize_t copied = ih_copyrange(fdP->fd_fd, fd, 0, size);
+	    if (copied > 0) {
+		size -= copied;
+		offset += copied;
+	    }
+	}
+	buf = NULL;
+	if (size) {
+	    buf = malloc(8192);
+	    if (!buf) {
+		OS_CLOSE(fd);
+		OS_UNLINK(path);
+		FDH_CLOSE(fdP);
+		return ENOMEM;
+	    }
+	}
 	while (size) {
 	    tlen = size > 8192 ? 8192 : size;
 	    if (FDH_PREAD(fdP, buf, tlen, offset) != tlen)
 		break;
-	    if (OS_WRITE(fd, buf, tlen) != tlen)
+	    if (OS_PWRITE(fd, buf, tlen, offset) != tlen)
 		break;
 	    size -= tlen;
 	    offset += tlen;
@@ -1734,9 +1738,345 @@ namei_UnlockLinkCount(FdHandle_t * fdP, Inode ino)
 }
 
 
+/*
+ * Batched link count updates.
+ *
+ * Cloning or purging a volume changes the link count of every file in it,
+ * and namei_inc/namei_dec pay for a lock, a read, a write and an fsync of
+ * the link table on each call.  A link batch reads the table into memory
+ * once and applies the changes there.  namei_FlushLinkBatch merges them
+ * back with the affected rows locked: they are re-read so that updates
+ * made meanwhile by anyone else are kept, written back a bounded run at a
+ * time and synced, and only then are files whose count dropped to zero
+ * unlinked.
+ *
+ * Callers flush before making anything that relies on the new counts
+ * durable, where they would previously have relied on the fsync in each
+ * IH_INC.  A crash before the flush leaves the counts as an interrupted
+ * unbatched clone or purge would, for the salvager to correct.
+ */
+struct ih_linkbatch {
+    IHandle_t *lb_lh;		/* link table */
+    int lb_nrows;		/* rows read from the link table */
+    unsigned short *lb_rows;	/* rows with pending changes applied */
+    unsigned short *lb_orig;	/* rows as last read from disk */
+    int lb_lo;			/* first row with pending changes */
+    int lb_hi;			/* last row with pending changes */
+    Inode *lb_zero;		/* inodes whose count dropped to zero */
+    int lb_nzero;
+    int lb_maxzero;
+};
+
+/**
+ * start a batch of link count updates.
+ *
+ * @param[in]  lh  link table handle
+ *
+ * @return link batch
+ *    @retval NULL the link table could not be read; callers fall back to
+ *                 IH_INC and IH_DEC
+ */
+struct ih_linkbatch *
+namei_BeginLinkBatch(IHandle_t * lh)
+{
+    struct ih_linkbatch *lb;
+    FdHandle_t *fdP;
+    afs_sfsize_t size;
+    size_t len;
+
+    fdP = IH_OPEN(lh);
+    if (fdP == NULL)
+	return NULL;
+    size = FDH_SIZE(fdP);
+    if (size < 8) {
+	FDH_CLOSE(fdP);
+	return NULL;
+    }
+
+    lb = calloc(1, sizeof(*lb));
+    if (lb == NULL) {
+	FDH_CLOSE(fdP);
+	return NULL;
+    }
+    lb->lb_nrows = (int)((size - 8) >> LINKTABLE_SHIFT);
+    len = lb->lb_nrows * sizeof(unsigned short);
+    lb->lb_rows = malloc(len + sizeof(unsigned short));
+    lb->lb_orig = malloc(len + sizeof(unsigned short));
+    if (lb->lb_rows == NULL || lb->lb_orig == NULL
+	|| FDH_PREAD(fdP, (char *)lb->lb_orig, len, 8) != len) {
+	FDH_CLOSE(fdP);
+	free(lb->lb_rows);
+	free(lb->lb_orig);
+	free(lb);
+	return NULL;
+    }
+    FDH_CLOSE(fdP);
+
+    memcpy(lb->lb_rows, lb->lb_orig, len);
+    lb->lb_lo = lb->lb_nrows;
+    lb->lb_hi = -1;
+    IH_COPY(lb->lb_lh, lh);
+    return lb;
+}
+
+/* Locate the batched row and bit offset for ino; -1 if it is not batched. */
+static int
+namei_BatchRow(struct ih_linkbatch *lb, Inode ino, int *row, int *index)
+{
+    afs_foff_t offset;
+
+    if ((ino & NAMEI_INODESPECIAL) == NAMEI_INODESPECIAL)
+	return -1;
+    namei_GetLCOffsetAndIndexFromIno(ino, &offset, index);
+    *row = (int)((offset - 8) >> LINKTABLE_SHIFT);
+    if (*row >= lb->lb_nrows)
+	return -1;
+    return 0;
+}
+
+static void
+namei_BatchSetCount(struct ih_linkbatch *lb, int row, int index, int count)
+{
+    lb->lb_rows[row] &= (unsigned short)~(NAMEI_TAGMASK << index);
+    lb->lb_rows[row] |= (unsigned short)(count << index);
+    if (row < lb->lb_lo)
+	lb->lb_lo = row;
+    if (row > lb->lb_hi)
+	lb->lb_hi = row;
+}
+
+/**
+ * increment a link count within a batch.
+ *
+ * Special inodes, and rows the link table did not have when the batch was
+ * started, are passed straight to namei_inc.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int
+namei_BatchInc(struct ih_linkbatch *lb, Inode ino, int p1)
+{
+    int row, index, count;
+
+    if (namei_BatchRow(lb, ino, &row, &index) < 0)
+	return namei_inc(lb->lb_lh, ino, p1);
+
+    count = (lb->lb_rows[row] >> index) & NAMEI_TAGMASK;
+    if (count >= 7) {
+	errno = OS_ERROR(EINVAL);
+	return -1;
+    }
+    namei_BatchSetCount(lb, row, index, count + 1);
+    return 0;
+}
+
+/**
+ * decrement a link count within a batch.
+ *
+ * A file whose count drops to zero is unlinked by the next flush, after
+ * the link table has been synced.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int
+namei_BatchDec(struct ih_linkbatch *lb, Inode ino, int p1)
+{
+    int row, index, count;
+    Inode *zero;
+
+    if (namei_BatchRow(lb, ino, &row, &index) < 0)
+	return namei_dec(lb->lb_lh, ino, p1);
+
+    count = (lb->lb_rows[row] >> index) & NAMEI_TAGMASK;
+    if (count == 0) {
+	Log("Warning: Lost ref on ihandle dev %d vid %" AFS_VOLID_FMT " ino %lld\n",
+	    lb->lb_lh->ih_dev, afs_printable_VolumeId_lu(lb->lb_lh->ih_vid),
+	    (afs_int64)ino);
+	return 0;
+    }
+    if (count == 1) {
+	if (lb->lb_nzero >= lb->lb_maxzero) {
+	    int n = lb->lb_maxzero ? lb->lb_maxzero * 2 : 64;
+
+	    zero = realloc(lb->lb_zero, n * sizeof(Inode));
+	    if (zero == NULL) {
+		errno = OS_ERROR(ENOMEM);
+		return -1;
+	    }
+	    lb->lb_zero = zero;
+	    lb->lb_maxzero = n;
+	}
+	lb->lb_zero[lb->lb_nzero++] = ino;
+    }
+    namei_BatchSetCount(lb, row, index, count - 1);
+    return 0;
+}
+
+/* rows merged back per pass of namei_FlushLinkBatch */
+#define LINKBATCH_FLUSH_ROWS 8192
+
+/**
+ * write the pending changes of a batch to the link table.
+ *
+ * The changed range is merged back LINKBATCH_FLUSH_ROWS rows at a time.
+ * Each pass locks every byte it re-reads and rewrites, so on platforms
+ * with byte-range locks it excludes a namei_inc or namei_dec on any row in
+ * the pass, not only the first.
+ *
+ * @return 0 on success, -1 with errno set if the table could not be
+ *         updated, a count would have exceeded 7, or a file could not be
+ *         unlinked
+ */
+int
+namei_FlushLinkBatch(struct ih_linkbatch *lb)
+{
+    FdHandle_t *fdP;
+    unsigned short *disk = NULL;
+    afs_foff_t offset;
+    size_t len;
+    int i, col, index, count, row, lo, hi;
+    int code = 0;
+    namei_t name;
+    IHandle_t *th;
+
+    if (lb->lb_hi < lb->lb_lo)
+	return 0;
+
+    i = lb->lb_hi - lb->lb_lo + 1;
+    if (i > LINKBATCH_FLUSH_ROWS)
+	i = LINKBATCH_FLUSH_ROWS;
+    disk = malloc(i * sizeof(unsigned short));
+    if (disk == NULL) {
+	errno = OS_ERROR(ENOMEM);
+	return -1;
+    }
+
+    fdP = IH_OPEN(lb->lb_lh);
+    if (fdP == NULL) {
+	free(disk);
+	return -1;
+    }
+
+    for (lo = lb->lb_lo; lo <= lb->lb_hi; lo = hi + 1) {
+	hi = lo + LINKBATCH_FLUSH_ROWS - 1;
+	if (hi > lb->lb_hi)
+	    hi = lb->lb_hi;
+	for (row = lo; row <= hi; row++) {
+	    if (lb->lb_rows[row] != lb->lb_orig[row])
+		break;
+	}
+	if (row > hi)
+	    continue;		/* nothing changed in this pass */
+
+	len = (hi - lo + 1) * sizeof(unsigned short);
+	offset = ((afs_foff_t)lo << LINKTABLE_SHIFT) + 8;
+	if (FDH_LOCKRANGE(fdP, offset, len) != 0) {
+	    FDH_REALLYCLOSE(fdP);
+	    free(disk);
+	    return -1;
+	}
+	if (FDH_PREAD(fdP, (char *)disk, len, offset) != len) {
+	    errno = OS_ERROR(EBADF);
+	    goto bad_FlushLinkBatch;
+	}
+
+	/* Apply our net change to each column on top of what is on disk. */
+	for (i = 0, row = lo; row <= hi; i++, row++) {
+	    if (lb->lb_rows[row] != lb->lb_orig[row]) {
+		for (col = 0; col < NAMEI_MAXVOLS; col++) {
+		    index = (col << 1) + col;
+		    count = (disk[i] >> index) & NAMEI_TAGMASK;
+		    count += (lb->lb_rows[row] >> index) & NAMEI_TAGMASK;
+		    count -= (lb->lb_orig[row] >> index) & NAMEI_TAGMASK;
+		    if (count < 0) {
+			count = 0;
+		    } else if (count > 7) {
+			errno = OS_ERROR(EINVAL);
+			code = -1;
+			count = 7;
+		    }
+		    disk[i] &= (unsigned short)~(NAMEI_TAGMASK << index);
+		    disk[i] |= (unsigned short)(count << index);
+		}
+	    }
+	    lb->lb_rows[row] = lb->lb_orig[row] = disk[i];
+	}
+
+	if (FDH_PWRITE(fdP, (char *)disk, len, offset) != len) {
+	    errno = OS_ERROR(EBADF);
+	    goto bad_FlushLinkBatch;
+	}
+	(void)FDH_SYNC(fdP);
+	FDH_UNLOCKRANGE(fdP, offset, len);
+    }
+    FDH_CLOSE(fdP);
+    free(disk);
+    lb->lb_lo = lb->lb_nrows;
+    lb->lb_hi = -1;
+
+    /* The zero counts are on disk; the files can go. */
+    for (i = 0; i < lb->lb_nzero; i++) {
+	namei_BatchRow(lb, lb->lb_zero[i], &row, &index);
+	if ((lb->lb_rows[row] >> index) & NAMEI_TAGMASK)
+	    continue;		/* referenced again since */
+	IH_INIT(th, lb->lb_lh->ih_dev, lb->lb_lh->ih_vid, lb->lb_zero[i]);
+	namei_HandleToName(&name, th);
+	IH_RELEASE(th);
+	if (OS_UNLINK(name.n_path) < 0 && errno != ENOENT)
+	    code = -1;
+    }
+    lb->lb_nzero = 0;
+    return code;
+
+  bad_FlushLinkBatch:
+    FDH_UNLOCKRANGE(fdP, offset, len);
+    FDH_REALLYCLOSE(fdP);
+    free(disk);
+    return -1;
+}
+
+/**
+ * flush and free a link batch.
+ *
+ * @return result of the final namei_FlushLinkBatch
+ */
+int
+namei_EndLinkBatch(struct ih_linkbatch *lb)
+{
+    int code;
+
+    code = namei_FlushLinkBatch(lb);
+    IH_RELEASE(lb->lb_lh);
+    free(lb->lb_rows);
+    free(lb->lb_orig);
+    free(lb->lb_zero);
+    free(lb);
+    return code;
+}
+
 /* ListViceInodes - write inode data to a results file. */
 static int DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
 		       IHandle_t *myIH);
+#ifdef AFS_NT40_ENV
+# define DecodeInodeAt(dirfd, dpath, name, info, myIH) \
+	 DecodeInode(dpath, name, info, myIH)
+#else
+static int DecodeInodeAt(int dirfd, char *dpath, char *name,
+			 struct ViceInodeInfo *info, IHandle_t *myIH);
+#endif
+
+/* While listing, files are looked up relative to their open directory,
+ * so that the kernel does not walk the whole path again for each one. */
+#if !defined(AFS_NT40_ENV) && defined(AT_FDCWD) && defined(HAVE_DIRFD)
+# define NAMEI_DIRFD(dirp)	dirfd(dirp)
+# ifdef O_LARGEFILE
+#  define afs_fstatat		fstatat64
+# else
+#  define afs_fstatat		fstatat
+# endif
+#else
+# define NAMEI_DIRFD(dirp)	(-1)
+#endif
 static int DecodeVolumeName(char *name, VolumeId *vid);
 static int namei_ListAFSSubDirs(IHandle_t * dirIH,
 				int (*write_fun) (FD_t,
@@ -1849,107 +2189,61 @@ ListViceInodes(char *devname, char *mountedOn, FD_t inodeFile,
     return 0;
 }
 
-
 /**
- * Collect all the matching AFS files on the drive.
- * If singleVolumeNumber is non-zero, just return files for that volume.
- *
- * @param[in] dev                 vice partition path
- * @param[in] writeFun            function pointer to a function which
- *                                writes inode information to FILE fp
- * @param[in] fp                  file stream where inode metadata is sent
- * @param[in] judgeFun            filter function pointer.  if not NULL,
- *                                only entries for which a non-zero value
- *                                is returned are written to fp
- * @param[in] singleVolumeNumber  volume id filter.  if nonzero, only
- *                                process files for that specific volume id
- * @param[in] rock                opaque pointer passed into writeFun and
- *                                judgeFun
+ * Fill the results file with the inode information of a whole partition,
+ * handing over each volume group as soon as it is complete.
+ *
+ * @param[in]   devname     device name string
+ * @param[in]   mountedOn   vice partition mount point
+ * @param[in]   resultFile  result file in which to write inode metadata
+ * @param[in]   judgeInode  filter function pointer.  if not NULL, only
+ *                          inodes for which this routine returns non-zero
+ *                          will be written to the results file.
+ * @param[in]   groupFun    called after each volume group has been listed;
+ *                          see namei_ListAFSFilesByGroup
+ * @param[in]   rock        opaque pointer passed to judgeInode and groupFun
  *
  * @return operation status
- *    @retval <0 error
- *    @retval >=0 number of matching files found
+ *    @retval 0   success
+ *    @retval -1  complete failure, salvage should terminate.
+ *    @retval -2  not enough space on partition, salvager has error message
+ *                for this.
  */
 int
-namei_ListAFSFiles(char *dev,
-		   int (*writeFun) (FD_t, struct ViceInodeInfo *, char *,
-				    char *),
-		   FD_t fp,
-		   int (*judgeFun) (struct ViceInodeInfo *, VolumeId, void *),
-		   VolumeId singleVolumeNumber, void *rock)
+ListViceInodesByGroup(char *devname, char *mountedOn, FD_t inodeFile,
+		      int (*judgeInode) (struct ViceInodeInfo * info,
+					 VolumeId vid, void *rock),
+		      int (*groupFun) (VolumeId rwid, int ninodes, void *rock),
+		      void *rock)
 {
-    IHandle_t ih;
-    namei_t name;
-    int ninodes = 0;
-    DIR *dirp1;
-    struct dirent *dp1;
-#ifndef AFS_NT40_ENV
-    DIR *dirp2;
-    struct dirent *dp2;
-    char path2[512];
-#endif
-#ifdef DELETE_ZLC
-    static void FreeZLCList(void);
-#endif
+    int ninodes;
 
-    memset((void *)&ih, 0, sizeof(IHandle_t));
-#ifdef AFS_NT40_ENV
-    ih.ih_dev = nt_DriveToDev(dev);
-#else
-    ih.ih_dev = volutil_GetPartitionID(dev);
-#endif
+    /* Verify protections on directories. */
+    mode_errors = 0;
+    VerifyDirPerms(mountedOn);
 
-    if (singleVolumeNumber) {
-	ih.ih_vid = singleVolumeNumber;
-	namei_HandleToVolDir(&name, &ih);
-	ninodes =
-	    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
-				 singleVolumeNumber, rock);
-	if (ninodes < 0)
-	    return ninodes;
-    } else {
-	/* Find all volume data directories and descend through them. */
-	namei_HandleToInodeDir(&name, &ih);
-	ninodes = 0;
-	dirp1 = opendir(name.n_path);
-	if (!dirp1)
-	    return 0;
-	while ((dp1 = readdir(dirp1))) {
-#ifdef AFS_NT40_ENV
-	    /* Heirarchy is one level on Windows */
-	    if (!DecodeVolumeName(dp1->d_name, &ih.ih_vid)) {
-		ninodes +=
-		    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
-					 0, rock);
-	    }
-#else
-	    if (*dp1->d_name == '.')
-		continue;
-	    snprintf(path2, sizeof(path2), "%s" OS_DIRSEP "%s", name.n_path,
-		     dp1->d_name);
-	    dirp2 = opendir(path2);
-	    if (dirp2) {
-		while ((dp2 = readdir(dirp2))) {
-		    if (*dp2->d_name == '.')
-			continue;
-		    if (!DecodeVolumeName(dp2->d_name, &ih.ih_vid)) {
-			ninodes +=
-			    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
-						 0, rock);
-		    }
-		}
-		closedir(dirp2);
-	    }
-#endif
-	}
-	closedir(dirp1);
+    ninodes =
+	namei_ListAFSFilesByGroup(mountedOn, WriteInodeInfo, inodeFile,
+				  judgeInode, groupFun, rock);
+    if (ninodes < 0) {
+	return ninodes;
     }
-#ifdef DELETE_ZLC
-    FreeZLCList();
-#endif
-    return ninodes;
+
+    if (OS_SYNC(inodeFile) == -1) {
+	Log("Unable to successfully fsync inode file for %s\n", mountedOn);
+	return -2;
+    }
+    if (OS_SIZE(inodeFile) != ninodes * sizeof(struct ViceInodeInfo)) {
+	Log("Wrong size (%d instead of %lu) in inode file for %s\n",
+	    (int) OS_SIZE(inodeFile),
+	    (long unsigned int) ninodes * sizeof(struct ViceInodeInfo),
+	    mountedOn);
+	return -2;
+    }
+    return 0;
 }
 
+
 #ifdef DELETE_ZLC
 static void AddToZLCDeleteList(char dir, char *name);
 static void DeleteZLCFiles(char *path);
@@ -1959,186 +2253,115 @@ static void DeleteZLCFiles(char *path);
  * examine a namei volume special file.
  *
  * @param[in] path1               volume special directory path
+ * @param[in] dirfd               open descriptor for path1, or -1
  * @param[in] dname               directory entry name
  * @param[in] myIH                inode handle to volume directory
  * @param[out] linkHandle         namei link count fd handle.  if
  *                                the inode in question is the link
  *                                table, then the FdHandle is populated
- * @param[in] writeFun            metadata write function pointer
- * @param[in] fp                  file pointer where inode metadata
- *                                is written by (*writeFun)()
- * @param[in] judgeFun            inode filter function pointer.  if
- *                                not NULL, only inodes for which this
- *                                function returns non-zero are recorded
- *                                into fp by writeFun
- * @param[in] singleVolumeNumer   volume id filter.  if non-zero, only
- *                                inodes associated with this volume id
- *                                are recorded by writeFun
- * @param[in] rock                opaque pointer passed to writeFun and
- *                                judgeFun
+ * @param[out] info               inode metadata
  *
  * @return operation status
- *    @retval 1 count this inode
+ *    @retval 1 info describes this inode
  *    @retval 0 don't count this inode
- *    @retval -1 failure
  *
  * @internal
  */
 static int
 _namei_examine_special(char * path1,
+		       int dirfd,
 		       char * dname,
 		       IHandle_t * myIH,
 		       FdHandle_t * linkHandle,
-		       int (*writeFun) (FD_t, struct ViceInodeInfo *, char *,
-					char *),
-		       FD_t fp,
-		       int (*judgeFun) (struct ViceInodeInfo *, VolumeId, void *),
-		       VolumeId singleVolumeNumber,
-		       void *rock)
-{
-    int ret = 0;
-    struct ViceInodeInfo info;
-
-    if (DecodeInode(path1, dname, &info, myIH) < 0) {
-	ret = 0;
-	goto error;
+		       struct ViceInodeInfo *info)
+{
+    if (DecodeInodeAt(dirfd, path1, dname, info, myIH) < 0) {
+	return 0;
     }
 
-    if (info.u.param[2] != VI_LINKTABLE) {
-	info.linkCount = 1;
-    } else if (info.u.param[0] != myIH->ih_vid) {
+    if (info->u.param[2] != VI_LINKTABLE) {
+	info->linkCount = 1;
+    } else if (info->u.param[0] != myIH->ih_vid) {
 	/* VGID encoded in linktable filename and/or OGM data isn't
 	 * consistent with VGID encoded in namei path */
 	Log("namei_ListAFSSubDirs: warning: inconsistent linktable "
 	    "filename \"%s" OS_DIRSEP "%s\"; salvager will delete it "
 	    "(dir_vgid=%" AFS_VOLID_FMT ", inode_vgid=%" AFS_VOLID_FMT ")\n",
 	    path1, dname, afs_printable_VolumeId_lu(myIH->ih_vid),
-	    afs_printable_VolumeId_lu(info.u.param[0]));
+	    afs_printable_VolumeId_lu(info->u.param[0]));
 	/* We need to set the linkCount to _something_, so linkCount
 	 * doesn't just contain stack garbage. Set it to 0, so in case
 	 * the salvager or whatever our caller is does try to process
 	 * this like a normal file, we won't try to INC or DEC it. */
-	info.linkCount = 0;
+	info->linkCount = 0;
     } else {
 	char path2[512];
 	/* Open this handle */
 	snprintf(path2, sizeof(path2),
 		 "%s" OS_DIRSEP "%s", path1, dname);
 	linkHandle->fd_fd = OS_OPEN(path2, Testing ? O_RDONLY : O_RDWR, 0666);
-	info.linkCount =
+	info->linkCount =
 	    namei_GetLinkCount(linkHandle, (Inode) 0, 1, 1, Testing);
     }
 
-    if (!judgeFun ||
-	(*judgeFun) (&info, singleVolumeNumber, rock)) {
-	ret = (*writeFun) (fp, &info, path1, dname);
-	if (ret < 0) {
-	    Log("_namei_examine_special: writeFun returned %d\n", ret);
-	    ret = -1;
-	} else {
-	    ret = 1;
-	}
-    }
-
- error:
-    return ret;
+    return 1;
 }
 
 /**
  * examine a namei file.
  *
  * @param[in] path3               volume special directory path
+ * @param[in] dirfd               open descriptor for path3, or -1
  * @param[in] dname               directory entry name
  * @param[in] myIH                inode handle to volume directory
  * @param[in] linkHandle          namei link count fd handle.
- * @param[in] writeFun            metadata write function pointer
- * @param[in] fp                  file pointer where inode metadata
- *                                is written by (*writeFun)()
- * @param[in] judgeFun            inode filter function pointer.  if
- *                                not NULL, only inodes for which this
- *                                function returns non-zero are recorded
- *                                into fp by writeFun
- * @param[in] singleVolumeNumer   volume id filter.  if non-zero, only
- *                                inodes associated with this volume id
- *                                are recorded by writeFun
- * @param[in] rock                opaque pointer passed to writeFun and
- *                                judgeFun
+ * @param[out] info               inode metadata
  *
  * @return operation status
- *    @retval 1 count this inode
+ *    @retval 1 info describes this inode
  *    @retval 0 don't count this inode
- *    @retval -1 failure
- *    @retval -2 request ZLC delete
  *
  * @internal
  */
 static int
 _namei_examine_reg(char * path3,
+		   int dirfd,
 		   char * dname,
 		   IHandle_t * myIH,
 		   FdHandle_t * linkHandle,
-		   int (*writeFun) (FD_t, struct ViceInodeInfo *, char *,
-				    char *),
-		   FD_t fp,
-		   int (*judgeFun) (struct ViceInodeInfo *, VolumeId, void *),
-		   VolumeId singleVolumeNumber,
-		   void *rock)
+		   struct ViceInodeInfo *info)
 {
-    int ret = 0;
-    struct ViceInodeInfo info;
 #ifdef DELETE_ZLC
     int dirl; /* Windows-only (one level hash dir) */
 #endif
 
-    if (DecodeInode(path3, dname, &info, myIH) < 0) {
-	goto error;
+    if (DecodeInodeAt(dirfd, path3, dname, info, myIH) < 0) {
+	return 0;
     }
 
-    info.linkCount =
+    info->linkCount =
 	namei_GetLinkCount(linkHandle,
-			    info.inodeNumber, 1, 1, Testing);
-    if (info.linkCount == 0) {
+			    info->inodeNumber, 1, 1, Testing);
+    if (info->linkCount == 0) {
 #ifdef DELETE_ZLC
 	Log("Found 0 link count file %s" OS_DIRSEP "%s, deleting it.\n", path3, dname);
-#ifdef AFS_SALSRV_ENV
-	/* defer -- the AddToZLCDeleteList() interface is not MT-safe */
-	ret = -2;
-#else /* !AFS_SALSRV_ENV */
         dirl = path3[strlen(path3)-1];
 	AddToZLCDeleteList((char)dirl, dname);
-#endif /* !AFS_SALSRV_ENV */
 #else /* !DELETE_ZLC */
 	Log("Found 0 link count file %s" OS_DIRSEP "%s.\n", path3,
 	    dname);
 #endif
-	goto error;
-    }
-
-    if (!judgeFun ||
-	(*judgeFun) (&info, singleVolumeNumber, rock)) {
-	ret = (*writeFun) (fp, &info, path3, dname);
-	if (ret < 0) {
-	    Log("_namei_examine_reg: writeFun returned %d\n", ret);
-	    ret = -1;
-	} else {
-	    ret = 1;
-	}
+	return 0;
     }
 
- error:
-    return ret;
+    return 1;
 }
 
 /**
- * listsubdirs work queue node.
+ * listsubdirs work node: the arguments for examining the files of one
+ * volume group.
  */
 struct listsubdirs_work_node {
-#ifdef AFS_SALSRV_ENV
-    int *error;                         /**< *error set if an error was
-                                         *   encountered in any listsubdirs
-                                         *   thread. */
-#endif
-
     IHandle_t * IH;                     /**< volume directory handle */
     FdHandle_t *linkHandle;             /**< namei link count fd handle. when
                                          *   examinining the link table special
@@ -2154,17 +2377,22 @@ struct listsubdirs_work_node {
     int (*judgeFun) (struct ViceInodeInfo *, VolumeId, void *);
     VolumeId singleVolumeNumber;             /**< volume id filter */
     void * rock;                        /**< pointer passed to writeFun and judgeFun */
-    int code;                           /**< return code from examine function */
     int special;                        /**< asserted when this is a volume
 					 *   special file */
+#ifdef AFS_PTHREAD_ENV
+    pthread_mutex_t *lock;              /**< if not NULL, held around judgeFun
+                                         *   and writeFun, for listings that
+                                         *   examine files in several threads */
+#endif
 };
 
 /**
- * simple wrapper around _namei_examine_special and _namei_examine_reg.
+ * examine a file and pass it through judgeFun and writeFun.
  *
  * @param[in] work  the struct listsubdirs_work_node for the associated
  *                  "list subdirs" job
  * @param[in] dir   the directory to examine
+ * @param[in] dirfd open descriptor for dir, or -1
  * @param[in] filename  the filename in 'dir' to examine
  *
  * @return operation status
@@ -2172,281 +2400,83 @@ struct listsubdirs_work_node {
  *   @retval 0  don't count this inode
  *   @retval -1 failure
  */
-static_inline int
+static int
 _namei_examine_file(const struct listsubdirs_work_node *work, char *dir,
-                    char *filename)
+                    int dirfd, char *filename)
 {
+    struct ViceInodeInfo info;
+    int ret;
+
     if (work->special) {
-	return _namei_examine_special(dir, filename, work->IH,
-	                              work->linkHandle, work->writeFun, work->fp,
-	                              work->judgeFun, work->singleVolumeNumber,
-	                              work->rock);
+	ret = _namei_examine_special(dir, dirfd, filename, work->IH,
+	                             work->linkHandle, &info);
     } else {
-	return _namei_examine_reg(dir, filename, work->IH,
-	                          work->linkHandle, work->writeFun, work->fp,
-	                          work->judgeFun, work->singleVolumeNumber,
-	                          work->rock);
+	ret = _namei_examine_reg(dir, dirfd, filename, work->IH,
+	                         work->linkHandle, &info);
     }
-}
-
-
-#ifdef AFS_SALSRV_ENV
-/** @addtogroup afs_vol_salsrv_pario */
-/*@{*/
-
-/**
- * arguments for the _namei_examine_file_cbk callback function.
- */
-struct listsubdirs_args {
-    const struct listsubdirs_work_node *work; /**< arguments that are the same
-                                               *   for all invocations of
-                                               *   _namei_examine_file_cbk, in
-                                               *   threads */
-    int *result;        /**< where we can store the return code of _namei_examine_file */
-
-    char dir[512];      /**< directory to examine */
-    char filename[256]; /**< filename in 'dir' to examine */
-};
-
-/**
- * a node in the list of results of listsubdir jobs.
- */
-struct listsubdirs_result {
-    struct rx_queue q;
-    int inodes;        /**< return value from _namei_examine_file */
-};
-
-/**
- * clean up a list of 'struct listsubdirs_result's and interpret the results.
- *
- * @param[in] resultlist  a list of 'struct listsubdirs_result's
- *
- * @return number of inodes found
- *   @retval -1  error
- */
-static int
-_namei_listsubdirs_cleanup_results(struct rx_queue *resultlist)
-{
-    struct listsubdirs_result *res, *nres;
-    int ret = 0;
+    if (ret <= 0)
+	return ret;
 
-    for(queue_Scan(resultlist, res, nres, listsubdirs_result)) {
+    ret = 0;
+#ifdef AFS_PTHREAD_ENV
+    if (work->lock)
+	opr_mutex_enter(work->lock);
+#endif
+    if (!work->judgeFun ||
+	(*work->judgeFun) (&info, work->singleVolumeNumber, work->rock)) {
+	ret = (*work->writeFun) (work->fp, &info, dir, filename);
 	if (ret < 0) {
-	    /* noop, retain erroneous error code */
-	} else if (res->inodes < 0) {
+	    Log("_namei_examine_file: writeFun returned %d\n", ret);
 	    ret = -1;
 	} else {
-	    ret += res->inodes;
+	    ret = 1;
 	}
-
-	queue_Remove(res);
-	free(res);
-	res = NULL;
     }
-
+#ifdef AFS_PTHREAD_ENV
+    if (work->lock)
+	opr_mutex_exit(work->lock);
+#endif
     return ret;
 }
 
 /**
- * wait for the spawned listsubdirs jobs to finish, and return how many inodes
- * they found.
- *
- * @param[in] queue    queue to wait to finish
- * @param[in] resultlist list of 'struct listsubdirs_result's that the queued
- *                       jobs are storing their results in
- *
- * @return number of inodes found
- *   @retval -1  error
- */
-static int
-_namei_listsubdirs_wait(struct afs_work_queue *queue, struct rx_queue *resultlist)
-{
-    int code;
-
-    code = afs_wq_wait_all(queue);
-    if (code) {
-	return -1;
-    }
-
-    return _namei_listsubdirs_cleanup_results(resultlist);
-}
-
-/**
- * work queue entry point for examining namei files.
- *
- * @param[in] queue        pointer to struct Vwork_queue
- * @param[in] node         pointer to struct Vwork_queue_node
- * @param[in] queue_rock   opaque pointer to struct salsrv_pool_state
- * @param[in] node_rock    opaque pointer to struct listsubdirs_work_node
- * @param[in] caller_rock  opaque pointer to struct salsrv_worker_thread_state
- *
- * @return operation status
- *
- * @see Vwork_queue_callback_func_t
- *
- * @internal
- */
-static int
-_namei_examine_file_cbk(struct afs_work_queue *queue,
-                        struct afs_work_queue_node *node,
-                        void *queue_rock,
-                        void *node_rock,
-                        void *caller_rock)
-{
-    int code;
-    struct listsubdirs_args *args = node_rock;
-    const struct listsubdirs_work_node * work = args->work;
-    char *dir = args->dir;
-    char *filename = args->filename;
-
-    code = _namei_examine_file(work, dir, filename);
-
-    *(args->result) = code;
-
-    if (code < 0) {
-	*(work->error) = 1;
-	/* we've errored, so no point in letting more jobs continue */
-	afs_wq_shutdown(queue);
-    }
-
-    return 0;
-}
-
-static pthread_once_t wq_once = PTHREAD_ONCE_INIT;
-static pthread_key_t wq_key;
-
-/**
- * create the wq_key key for storing a work queue.
- */
-static void
-_namei_wq_keycreate(void)
-{
-    opr_Verify(pthread_key_create(&wq_key, NULL) == 0);
-}
-
-/**
- * set the work queue for this thread to use for backgrounding namei ops.
+ * examine all the files in one directory of a volume group.
  *
- * The work queue will be used in ListAFSSubdirs (called indirectly by
- * ListViceInodes) to examine files in parallel.
- *
- * @param[in] wq  the work queue to use
- */
-void
-namei_SetWorkQueue(struct afs_work_queue *wq)
-{
-    opr_Verify(pthread_once(&wq_once, _namei_wq_keycreate) == 0);
-
-    opr_Verify(pthread_setspecific(wq_key, wq) == 0);
-}
-
-/**
- * enqueue an examine file work unit.
- *
- * @param[in] work     the _namei_examine_file arguments that are common to
- *                     all callers within the same ListAFSFiles operation
- * @param[in] dir      the specific directory to look at (string will be
- *                     copied; can be stack/temporary memory)
- * @param[in] filename the filename to look at (string will be copied; can be
- *                     stack/temporary memory)
- * @param[in] wq       work queue to enqueue this work unit to
- * @param[in] resultlist the list to append the 'struct listsubdirs_result' to
- *                       for the enqueued work unit
+ * @param[in] work  examine arguments for the volume group
+ * @param[in] path  the directory to examine
  *
  * @return operation status
- *    @retval 0 success
- *    @retval -1 fatal error
- *
- * @note errors MUST be indicated by a -1 error code and nothing else, to be
- *       compatible with _namei_examine_reg and _namei_examine_special
+ *    @retval <0 error
+ *    @retval >=0 number of matching inodes found
  *
  * @internal
  */
 static int
-_namei_examine_file_spawn(const struct listsubdirs_work_node *work,
-                          const char *dir, const char *filename,
-                          struct afs_work_queue *wq,
-                          struct rx_queue *resultlist)
+_namei_examine_dir(const struct listsubdirs_work_node *work, char *path)
 {
-    int code, ret = 0;
-    struct listsubdirs_args *args = NULL;
-    struct listsubdirs_result *result = NULL;
-    struct afs_work_queue_node *node = NULL;
-    struct afs_work_queue_add_opts opts;
-
-    args = malloc(sizeof(*args));
-    if (args == NULL) {
-	ret = -1;
-	goto error;
-    }
-
-    result = malloc(sizeof(*result));
-    if (result == NULL) {
-	ret = -1;
-	goto error;
-    }
-
-    code = afs_wq_node_alloc(&node);
-    if (code) {
-	ret = -1;
-	goto error;
-    }
-    code = afs_wq_node_set_detached(node);
-    if (code) {
-	ret = -1;
-	goto error;
-    }
-
-    args->work = work;
-    args->result = &result->inodes;
-    strlcpy(args->dir, dir, sizeof(args->dir));
-    strlcpy(args->filename, filename, sizeof(args->filename));
-
-    code = afs_wq_node_set_callback(node,
-					 &_namei_examine_file_cbk,
-					 args, &free);
-    if (code) {
-	ret = -1;
-	goto error;
-    }
-    args = NULL;
-
-    afs_wq_add_opts_init(&opts);
-    opts.donate = 1;
-
-    code = afs_wq_add(wq, node, &opts);
-    if (code) {
-	ret = -1;
-	goto error;
-    }
-    node = NULL;
-
-    queue_Append(resultlist, result);
-    result = NULL;
+    DIR *dirp;
+    struct dirent *dp;
+    int code, ninodes = 0;
 
- error:
-    if (node) {
-	afs_wq_node_put(node);
-	node = NULL;
-    }
-    if (args) {
-	free(args);
-	args = NULL;
-    }
-    if (result) {
-	free(result);
-	result = NULL;
+    dirp = opendir(path);
+    if (dirp == NULL)
+	return 0;
+    while ((dp = readdir(dirp))) {
+#ifndef AFS_NT40_ENV
+	if (*dp->d_name == '.')
+	    continue;
+#endif
+	code = _namei_examine_file(work, path, NAMEI_DIRFD(dirp), dp->d_name);
+	if (code < 0) {
+	    ninodes = -1;
+	    break;
+	}
+	ninodes += code;
     }
-
-    return ret;
+    closedir(dirp);
+    return ninodes;
 }
 
-/*@}*/
-#else /* !AFS_SALSRV_ENV */
-# define _namei_examine_file_spawn(work, dir, file, wq, resultlist) \
-         _namei_examine_file(work, dir, file)
-#endif /* !AFS_SALSRV_ENV */
-
 /**
  * traverse and check inodes.
  *
@@ -2466,11 +2496,6 @@ _namei_examine_file_spawn(const struct listsubdirs_work_node *work,
  *    @retval <0 error
  *    @retval >=0 number of matching inodes found
  *
- * @todo the salsrv implementation may consume a lot of
- *       memory for a large volume.  at some point we should
- *       probably write a background thread to asynchronously
- *       clean up the resultlist nodes to reduce memory footprint
- *
  * @internal
  */
 static int
@@ -2485,22 +2510,16 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     IHandle_t myIH = *dirIH;
     namei_t name;
     char path1[512], path3[512];
-    DIR *dirp1, *dirp3;
+    DIR *dirp1;
 #ifndef AFS_NT40_ENV
     DIR *dirp2;
     struct dirent *dp2;
     char path2[512];
 #endif
-    struct dirent *dp1, *dp3;
+    struct dirent *dp1;
     FdHandle_t linkHandle;
     int ninodes = 0;
     struct listsubdirs_work_node work;
-#ifdef AFS_SALSRV_ENV
-    int error = 0;
-    struct afs_work_queue *wq;
-    int wq_up = 0;
-    struct rx_queue resultlist;
-#endif
 
     namei_HandleToVolDir(&name, &myIH);
     strlcpy(path1, name.n_path, sizeof(path1));
@@ -2512,17 +2531,6 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     (void)strcat(path1, NAMEI_SPECDIR);
 
     linkHandle.fd_fd = INVALID_FD;
-#ifdef AFS_SALSRV_ENV
-    opr_Verify(pthread_once(&wq_once, _namei_wq_keycreate) == 0);
-
-    wq = pthread_getspecific(wq_key);
-    if (!wq) {
-	ret = -1;
-	goto error;
-    }
-    wq_up = 1;
-    queue_Init(&resultlist);
-#endif
 
     memset(&work, 0, sizeof(work));
     work.linkHandle = &linkHandle;
@@ -2533,54 +2541,13 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     work.singleVolumeNumber = singleVolumeNumber;
     work.rock = rock;
     work.special = 1;
-#ifdef AFS_SALSRV_ENV
-    work.error = &error;
-#endif
-
-    dirp1 = opendir(path1);
-    if (dirp1) {
-	while ((dp1 = readdir(dirp1))) {
-	    if (*dp1->d_name == '.')
-		continue;
-
-#ifdef AFS_SALSRV_ENV
-	    if (error) {
-		closedir(dirp1);
-		ret = -1;
-		goto error;
-	    }
-#endif /* AFS_SALSRV_ENV */
-
-	    code = _namei_examine_file_spawn(&work, path1, dp1->d_name, wq, &resultlist);
-
-	    switch (code) {
-	    case -1:
-		/* fatal error */
-		closedir(dirp1);
-		ret = -1;
-		goto error;
-
-	    case 1:
-		/* count this inode */
-#ifndef AFS_SALSRV_ENV
-		ninodes++;
-#endif
-		break;
-	    }
-	}
-	closedir(dirp1);
-    }
 
-#ifdef AFS_SALSRV_ENV
-    /* effectively a barrier */
-    code = _namei_listsubdirs_wait(wq, &resultlist);
-    if (code < 0 || error) {
+    code = _namei_examine_dir(&work, path1);
+    if (code < 0) {
 	ret = -1;
 	goto error;
     }
-    error = 0;
     ninodes += code;
-#endif
 
     if (linkHandle.fd_fd == INVALID_FD) {
 	Log("namei_ListAFSSubDirs: warning: VG %" AFS_VOLID_FMT " does not have a link table; "
@@ -2636,49 +2603,16 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
 			ret = -1;
 			goto error;
 		    }
-		    dirp3 = opendir(path3);
-		    if (dirp3) {
-			while ((dp3 = readdir(dirp3))) {
-#ifndef AFS_NT40_ENV
-			    if (*dp3->d_name == '.')
-				continue;
-#endif
-
-#ifdef AFS_SALSRV_ENV
-			    if (error) {
-				closedir(dirp3);
+		    code = _namei_examine_dir(&work, path3);
+		    if (code < 0) {
 #ifndef AFS_NT40_ENV
-				closedir(dirp2);
-#endif
-				closedir(dirp1);
-				ret = -1;
-				goto error;
-			    }
-#endif /* AFS_SALSRV_ENV */
-
-			    code = _namei_examine_file_spawn(&work, path3,
-			                                     dp3->d_name, wq,
-			                                     &resultlist);
-
-			    switch (code) {
-			    case -1:
-				closedir(dirp3);
-#ifndef AFS_NT40_ENV
-				closedir(dirp2);
-#endif
-				closedir(dirp1);
-				ret = -1;
-				goto error;
-
-			    case 1:
-#ifndef AFS_SALSRV_ENV
-				ninodes++;
+			closedir(dirp2);
 #endif
-				break;
-			    }
-			}
-			closedir(dirp3);
+			closedir(dirp1);
+			ret = -1;
+			goto error;
 		    }
+		    ninodes += code;
 #ifndef AFS_NT40_ENV /* This level missing on Windows */
 		}
 		closedir(dirp2);
@@ -2688,18 +2622,6 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
 	closedir(dirp1);
     }
 
-#ifdef AFS_SALSRV_ENV
-    /* effectively a barrier */
-    code = _namei_listsubdirs_wait(wq, &resultlist);
-    if (code < 0 || error) {
-	ret = -1;
-	goto error;
-    }
-    error = 0;
-    ninodes += code;
-    wq_up = 0;
-#endif
-
     if (!ninodes) {
 	/* Then why does this directory exist? Blow it away. */
 	namei_HandleToVolDir(&name, dirIH);
@@ -2707,12 +2629,6 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     }
 
  error:
-#ifdef AFS_SALSRV_ENV
-    if (wq_up) {
-	afs_wq_wait_all(wq);
-    }
-    _namei_listsubdirs_cleanup_results(&resultlist);
-#endif
     if (linkHandle.fd_fd != INVALID_FD)
 	OS_CLOSE(linkHandle.fd_fd);
 
@@ -2722,41 +2638,750 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     return ret;
 }
 
-/*@}*/
-
-#ifdef AFS_NT40_ENV
-static int
-DecodeVolumeName(char *name, VolumeId *vid)
-{
-    /* Name begins with "Vol_" and ends with .data.  See nt_HandleToVolDir() */
-    char stmp[32];
-    size_t len;
+#if defined(AFS_PTHREAD_ENV) && !defined(AFS_NT40_ENV)
+/*
+ * Parallel listing.
+ *
+ * The directories of the listing are handed out to namei_listThreads
+ * threads.  Each thread has its own queue, which it works on from the
+ * back, so that a thread finishes the subtree it is in before it starts
+ * on anything else.  A thread whose queue is empty steals from the front
+ * of the longest other queue, which is where the largest pieces of
+ * unstarted work (whole volume groups, or first level hash directories)
+ * are.  The queues are protected by a single mutex; every item is a whole
+ * directory, so the lock is taken rarely compared to the work done.
+ */
 
-    len = strlen(name);
-    if (len <= 9)
-        return -1;
-    if (strncmp(name, "Vol_", 4))
-        return -1;
-    if (strcmp(name + len - 5, ".data"))
-        return -1;
-    strcpy(stmp, name);
-    stmp[len - 5] = '\0';
-    *vid = base32_to_int(stmp + 4);
-    return 0;
-}
-#else
-static int
-DecodeVolumeName(char *name, VolumeId *vid)
-{
-    if (strlen(name) < 1)
-	return -1;
-    *vid = (unsigned int)flipbase64_to_int64(name);
-    return 0;
-}
-#endif
+/**
+ * a volume group being listed in parallel.
+ */
+struct namei_walk_vg {
+    IHandle_t ih;               /**< volume group directory handle */
+    FdHandle_t linkHandle;      /**< the volume group's link table */
+    struct listsubdirs_work_node work; /**< examine arguments for its files */
+    int ninodes;                /**< matching inodes found so far */
+    int pending;                /**< directories queued or being listed */
+};
 
+/**
+ * a directory waiting to be listed.
+ */
+struct namei_walk_item {
+    struct namei_walk_vg *vg;   /**< volume group the directory belongs to */
+    int depth;                  /**< 0 for the volume group directory itself,
+                                 *   1 for a first level hash directory, and
+                                 *   2 for a directory holding files */
+    char *sub;                  /**< path relative to the volume group
+                                 *   directory; NULL at depth 0 */
+};
 
-/* DecodeInode
+/**
+ * one thread's queue of directories.
+ */
+struct namei_walk_queue {
+    struct namei_walk_item **items;
+    int head;                   /**< next item to steal */
+    int tail;                   /**< one past the next item to work on */
+    int size;                   /**< room in items */
+};
+
+/**
+ * state of a parallel listing.
+ */
+struct namei_walk {
+    struct listsubdirs_work_node work; /**< writeFun, judgeFun and friends */
+    pthread_mutex_t lock;       /**< protects the queues and counters */
+    pthread_mutex_t outlock;    /**< serializes judgeFun and writeFun */
+    pthread_cond_t cv;          /**< signalled when work is queued, or when
+                                 *   the last directory has been listed */
+    struct namei_walk_queue *queues;
+    int nthreads;
+    int outstanding;            /**< directories queued or being listed */
+    int ninodes;                /**< inodes found in finished volume groups */
+    int error;                  /**< set when any directory failed */
+};
+
+/**
+ * arguments for a parallel listing thread.
+ */
+struct namei_walk_thread {
+    struct namei_walk *walk;
+    int id;                     /**< index of the thread's own queue */
+};
+
+static int namei_listThreads = 1;
+
+/**
+ * set the number of threads ListViceInodes lists a partition with.
+ *
+ * @param[in] nthreads  number of threads; 1 lists in the calling thread
+ *
+ * @note only has an effect in pthreaded programs
+ */
+void
+namei_SetListThreads(int nthreads)
+{
+    if (nthreads < 1)
+	nthreads = 1;
+    if (nthreads > NAMEI_MAXLISTTHREADS)
+	nthreads = NAMEI_MAXLISTTHREADS;
+    namei_listThreads = nthreads;
+}
+
+/**
+ * queue a directory for listing.
+ *
+ * @param[in] walk  the listing
+ * @param[in] q     queue to add it to
+ * @param[in] vg    the volume group it belongs to
+ * @param[in] depth its depth below the volume group directory
+ * @param[in] sub   its path relative to the volume group directory; is
+ *                  copied
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 out of memory
+ *
+ * @pre walk->lock held
+ *
+ * @internal
+ */
+static int
+_namei_walk_push(struct namei_walk *walk, int q, struct namei_walk_vg *vg,
+		 int depth, const char *sub)
+{
+    struct namei_walk_queue *queue = &walk->queues[q];
+    struct namei_walk_item *item, **items;
+
+    if (queue->tail == queue->size) {
+	if (queue->head > 0) {
+	    memmove(queue->items, queue->items + queue->head,
+		    (queue->tail - queue->head) * sizeof(*items));
+	    queue->tail -= queue->head;
+	    queue->head = 0;
+	} else {
+	    items = realloc(queue->items,
+			    (queue->size ? 2 * queue->size : 64)
+			    * sizeof(*items));
+	    if (items == NULL)
+		return -1;
+	    queue->items = items;
+	    queue->size = queue->size ? 2 * queue->size : 64;
+	}
+    }
+
+    item = calloc(1, sizeof(*item));
+    if (item == NULL)
+	return -1;
+    item->vg = vg;
+    item->depth = depth;
+    if (sub != NULL) {
+	item->sub = strdup(sub);
+	if (item->sub == NULL) {
+	    free(item);
+	    return -1;
+	}
+    }
+    queue->items[queue->tail++] = item;
+    vg->pending++;
+    walk->outstanding++;
+    return 0;
+}
+
+/**
+ * take the next directory to list.
+ *
+ * @param[in] walk  the listing
+ * @param[in] q     the calling thread's own queue
+ *
+ * @return the directory, or NULL if all queues are empty
+ *
+ * @pre walk->lock held
+ *
+ * @internal
+ */
+static struct namei_walk_item *
+_namei_walk_pop(struct namei_walk *walk, int q)
+{
+    struct namei_walk_queue *queue = &walk->queues[q];
+    int i, victim = -1, most = 0;
+
+    if (queue->tail > queue->head)
+	return queue->items[--queue->tail];
+
+    for (i = 0; i < walk->nthreads; i++) {
+	queue = &walk->queues[i];
+	if (queue->tail - queue->head > most) {
+	    most = queue->tail - queue->head;
+	    victim = i;
+	}
+    }
+    if (victim < 0)
+	return NULL;
+    queue = &walk->queues[victim];
+    return queue->items[queue->head++];
+}
+
+/**
+ * list one directory, queueing the directories found in it.
+ *
+ * @param[in] walk  the listing
+ * @param[in] q     the calling thread's own queue
+ * @param[in] item  the directory
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 error
+ *
+ * @internal
+ */
+static int
+_namei_walk_dir(struct namei_walk *walk, int q, struct namei_walk_item *item)
+{
+    struct namei_walk_vg *vg = item->vg;
+    namei_t name;
+    char path[512], sub[512];
+    DIR *dirp;
+    struct dirent *dp;
+    int code, ret = 0;
+
+    namei_HandleToVolDir(&name, &vg->ih);
+    if (item->depth == 2) {
+	code = snprintf(path, sizeof(path), "%s" OS_DIRSEP "%s",
+			name.n_path, item->sub);
+	if (code < 0 || code >= sizeof(path))
+	    return -1;
+	code = _namei_examine_dir(&vg->work, path);
+	if (code < 0)
+	    return -1;
+	opr_mutex_enter(&walk->lock);
+	vg->ninodes += code;
+	opr_mutex_exit(&walk->lock);
+	return 0;
+    }
+
+    if (item->depth == 0) {
+	/* the special files come first, for the link table */
+	code = snprintf(path, sizeof(path), "%s" OS_DIRSEP "%s",
+			name.n_path, NAMEI_SPECDIR);
+	if (code < 0 || code >= sizeof(path))
+	    return -1;
+	code = _namei_examine_dir(&vg->work, path);
+	if (code < 0)
+	    return -1;
+	vg->ninodes += code;
+	if (vg->linkHandle.fd_fd == INVALID_FD) {
+	    Log("namei_ListAFSSubDirs: warning: VG %" AFS_VOLID_FMT " does not have a link table; "
+		"salvager will recreate it.\n",
+		afs_printable_VolumeId_lu(vg->ih.ih_vid));
+	}
+	vg->work.special = 0;
+	strlcpy(path, name.n_path, sizeof(path));
+    } else {
+	code = snprintf(path, sizeof(path), "%s" OS_DIRSEP "%s",
+			name.n_path, item->sub);
+	if (code < 0 || code >= sizeof(path))
+	    return -1;
+    }
+
+    dirp = opendir(path);
+    if (dirp == NULL)
+	return 0;
+    while ((dp = readdir(dirp))) {
+	if (*dp->d_name == '.')
+	    continue;
+	if (item->depth == 0) {
+	    if (!strcmp(dp->d_name, NAMEI_SPECDIR))
+		continue;
+	    strlcpy(sub, dp->d_name, sizeof(sub));
+	} else {
+	    code = snprintf(sub, sizeof(sub), "%s" OS_DIRSEP "%s",
+			    item->sub, dp->d_name);
+	    if (code < 0 || code >= sizeof(sub)) {
+		ret = -1;
+		break;
+	    }
+	}
+	opr_mutex_enter(&walk->lock);
+	code = _namei_walk_push(walk, q, vg, item->depth + 1, sub);
+	opr_cv_signal(&walk->cv);
+	opr_mutex_exit(&walk->lock);
+	if (code) {
+	    ret = -1;
+	    break;
+	}
+    }
+    closedir(dirp);
+    return ret;
+}
+
+/**
+ * parallel listing thread.
+ *
+ * @param[in] rock  struct namei_walk_thread
+ *
+ * @return NULL
+ *
+ * @internal
+ */
+static void *
+_namei_walk_thread(void *rock)
+{
+    struct namei_walk_thread *thread = rock;
+    struct namei_walk *walk = thread->walk;
+    struct namei_walk_item *item;
+    struct namei_walk_vg *vg;
+    namei_t name;
+    int code;
+
+    opr_mutex_enter(&walk->lock);
+    for (;;) {
+	item = _namei_walk_pop(walk, thread->id);
+	if (item == NULL) {
+	    if (walk->outstanding == 0)
+		break;
+	    opr_cv_wait(&walk->cv, &walk->lock);
+	    continue;
+	}
+	code = 0;
+	if (!walk->error) {
+	    opr_mutex_exit(&walk->lock);
+	    code = _namei_walk_dir(walk, thread->id, item);
+	    opr_mutex_enter(&walk->lock);
+	}
+	if (code)
+	    walk->error = 1;
+
+	vg = item->vg;
+	free(item->sub);
+	free(item);
+	if (--vg->pending == 0) {
+	    /* the volume group is done */
+	    walk->ninodes += vg->ninodes;
+	    if (!vg->ninodes && !walk->error) {
+		/* Then why does this directory exist? Blow it away. */
+		opr_mutex_exit(&walk->lock);
+		namei_HandleToVolDir(&name, &vg->ih);
+		namei_RemoveDataDirectories(&name);
+		opr_mutex_enter(&walk->lock);
+	    }
+	    if (vg->linkHandle.fd_fd != INVALID_FD)
+		OS_CLOSE(vg->linkHandle.fd_fd);
+	    free(vg);
+	}
+	if (--walk->outstanding == 0)
+	    opr_cv_broadcast(&walk->cv);
+    }
+    opr_mutex_exit(&walk->lock);
+    return NULL;
+}
+
+/**
+ * queue a volume group for parallel listing.
+ *
+ * @param[in] walk  the listing
+ * @param[in] ih    volume group directory handle
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 out of memory
+ *
+ * @internal
+ */
+static int
+_namei_walk_add_vg(struct namei_walk *walk, IHandle_t *ih)
+{
+    struct namei_walk_vg *vg;
+    int code;
+
+    vg = calloc(1, sizeof(*vg));
+    if (vg == NULL)
+	return -1;
+    vg->ih = *ih;
+    vg->linkHandle.fd_fd = INVALID_FD;
+    vg->work = walk->work;
+    vg->work.IH = &vg->ih;
+    vg->work.linkHandle = &vg->linkHandle;
+    vg->work.special = 1;
+
+    /* spread the volume groups over the threads to start with */
+    opr_mutex_enter(&walk->lock);
+    code = _namei_walk_push(walk, ih->ih_vid % walk->nthreads, vg, 0, NULL);
+    opr_mutex_exit(&walk->lock);
+    if (code)
+	free(vg);
+    return code;
+}
+
+/**
+ * Collect all the matching AFS files on the drive, with several threads.
+ *
+ * @see namei_ListAFSFiles
+ *
+ * @internal
+ */
+static int
+namei_ListAFSFilesParallel(IHandle_t *ih,
+			   int (*writeFun) (FD_t, struct ViceInodeInfo *,
+					    char *, char *),
+			   FD_t fp,
+			   int (*judgeFun) (struct ViceInodeInfo *, VolumeId,
+					    void *),
+			   VolumeId singleVolumeNumber, void *rock)
+{
+    struct namei_walk walk;
+    struct namei_walk_thread *threads;
+    pthread_t *tids;
+    pthread_attr_t tattr;
+    namei_t name;
+    DIR *dirp1, *dirp2;
+    struct dirent *dp1, *dp2;
+    char path2[512];
+    int i, nstarted = 0, ret = 0;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.work.fp = fp;
+    walk.work.writeFun = writeFun;
+    walk.work.judgeFun = judgeFun;
+    walk.work.singleVolumeNumber = singleVolumeNumber;
+    walk.work.rock = rock;
+    walk.work.lock = &walk.outlock;
+    walk.nthreads = namei_listThreads;
+    opr_mutex_init(&walk.lock);
+    opr_mutex_init(&walk.outlock);
+    opr_cv_init(&walk.cv);
+    walk.queues = calloc(walk.nthreads, sizeof(*walk.queues));
+    threads = calloc(walk.nthreads, sizeof(*threads));
+    tids = calloc(walk.nthreads, sizeof(*tids));
+    if (walk.queues == NULL || threads == NULL || tids == NULL) {
+	ret = -1;
+	goto done;
+    }
+
+    /* queue the volume groups; their directories are listed by the
+     * threads */
+    if (singleVolumeNumber) {
+	ih->ih_vid = singleVolumeNumber;
+	if (_namei_walk_add_vg(&walk, ih))
+	    walk.error = 1;
+    } else {
+	namei_HandleToInodeDir(&name, ih);
+	dirp1 = opendir(name.n_path);
+	if (dirp1) {
+	    while (!walk.error && (dp1 = readdir(dirp1))) {
+		if (*dp1->d_name == '.')
+		    continue;
+		snprintf(path2, sizeof(path2), "%s" OS_DIRSEP "%s",
+			 name.n_path, dp1->d_name);
+		dirp2 = opendir(path2);
+		if (dirp2) {
+		    while ((dp2 = readdir(dirp2))) {
+			if (*dp2->d_name == '.')
+			    continue;
+			if (!DecodeVolumeName(dp2->d_name, &ih->ih_vid)
+			    && _namei_walk_add_vg(&walk, ih)) {
+			    walk.error = 1;
+			    break;
+			}
+		    }
+		    closedir(dirp2);
+		}
+	    }
+	    closedir(dirp1);
+	}
+    }
+
+    /* on error, the threads just drop what has been queued */
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_JOINABLE) == 0);
+    for (i = 0; i < walk.nthreads; i++) {
+	threads[i].walk = &walk;
+	threads[i].id = i;
+	if (i > 0) {
+	    if (pthread_create(&tids[i], &tattr, _namei_walk_thread,
+			       &threads[i]) != 0)
+		break;
+	    nstarted++;
+	}
+    }
+    opr_Verify(pthread_attr_destroy(&tattr) == 0);
+    if (nstarted < walk.nthreads - 1) {
+	Log("namei_ListAFSFiles: warning: could only start %d of %d "
+	    "listing threads\n", nstarted + 1, walk.nthreads);
+    }
+
+    /* the calling thread lists too; it works on the queues of any threads
+     * that could not be started by stealing from them */
+    _namei_walk_thread(&threads[0]);
+    for (i = 1; i <= nstarted; i++)
+	opr_Verify(pthread_join(tids[i], NULL) == 0);
+
+    ret = walk.error ? -1 : walk.ninodes;
+
+ done:
+    if (walk.queues) {
+	for (i = 0; i < walk.nthreads; i++)
+	    free(walk.queues[i].items);
+	free(walk.queues);
+    }
+    free(threads);
+    free(tids);
+    opr_cv_destroy(&walk.cv);
+    opr_mutex_destroy(&walk.outlock);
+    opr_mutex_destroy(&walk.lock);
+    return ret;
+}
+#else /* !AFS_PTHREAD_ENV || AFS_NT40_ENV */
+void
+namei_SetListThreads(int nthreads)
+{
+}
+#endif /* !AFS_PTHREAD_ENV || AFS_NT40_ENV */
+
+/**
+ * Collect all the matching AFS files on the drive.
+ * If singleVolumeNumber is non-zero, just return files for that volume.
+ *
+ * The volume group directories are listed with the number of threads set
+ * by namei_SetListThreads.
+ *
+ * @param[in] dev                 vice partition path
+ * @param[in] writeFun            function pointer to a function which
+ *                                writes inode information to FILE fp
+ * @param[in] fp                  file stream where inode metadata is sent
+ * @param[in] judgeFun            filter function pointer.  if not NULL,
+ *                                only entries for which a non-zero value
+ *                                is returned are written to fp
+ * @param[in] singleVolumeNumber  volume id filter.  if nonzero, only
+ *                                process files for that specific volume id
+ * @param[in] rock                opaque pointer passed into writeFun and
+ *                                judgeFun
+ *
+ * @return operation status
+ *    @retval <0 error
+ *    @retval >=0 number of matching files found
+ */
+int
+namei_ListAFSFiles(char *dev,
+		   int (*writeFun) (FD_t, struct ViceInodeInfo *, char *,
+				    char *),
+		   FD_t fp,
+		   int (*judgeFun) (struct ViceInodeInfo *, VolumeId, void *),
+		   VolumeId singleVolumeNumber, void *rock)
+{
+    IHandle_t ih;
+    namei_t name;
+    int ninodes = 0;
+    DIR *dirp1;
+    struct dirent *dp1;
+#ifndef AFS_NT40_ENV
+    DIR *dirp2;
+    struct dirent *dp2;
+    char path2[512];
+#endif
+#ifdef DELETE_ZLC
+    static void FreeZLCList(void);
+#endif
+
+    memset((void *)&ih, 0, sizeof(IHandle_t));
+#ifdef AFS_NT40_ENV
+    ih.ih_dev = nt_DriveToDev(dev);
+#else
+    ih.ih_dev = volutil_GetPartitionID(dev);
+#endif
+
+#if defined(AFS_PTHREAD_ENV) && !defined(AFS_NT40_ENV)
+    if (namei_listThreads > 1)
+	return namei_ListAFSFilesParallel(&ih, writeFun, fp, judgeFun,
+					  singleVolumeNumber, rock);
+#endif
+
+    if (singleVolumeNumber) {
+	ih.ih_vid = singleVolumeNumber;
+	namei_HandleToVolDir(&name, &ih);
+	ninodes =
+	    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
+				 singleVolumeNumber, rock);
+	if (ninodes < 0)
+	    return ninodes;
+    } else {
+	/* Find all volume data directories and descend through them. */
+	namei_HandleToInodeDir(&name, &ih);
+	ninodes = 0;
+	dirp1 = opendir(name.n_path);
+	if (!dirp1)
+	    return 0;
+	while ((dp1 = readdir(dirp1))) {
+#ifdef AFS_NT40_ENV
+	    /* Heirarchy is one level on Windows */
+	    if (!DecodeVolumeName(dp1->d_name, &ih.ih_vid)) {
+		ninodes +=
+		    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
+					 0, rock);
+	    }
+#else
+	    if (*dp1->d_name == '.')
+		continue;
+	    snprintf(path2, sizeof(path2), "%s" OS_DIRSEP "%s", name.n_path,
+		     dp1->d_name);
+	    dirp2 = opendir(path2);
+	    if (dirp2) {
+		while ((dp2 = readdir(dirp2))) {
+		    if (*dp2->d_name == '.')
+			continue;
+		    if (!DecodeVolumeName(dp2->d_name, &ih.ih_vid)) {
+			ninodes +=
+			    namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun,
+						 0, rock);
+		    }
+		}
+		closedir(dirp2);
+	    }
+#endif
+	}
+	closedir(dirp1);
+    }
+#ifdef DELETE_ZLC
+    FreeZLCList();
+#endif
+    return ninodes;
+}
+
+/**
+ * Collect all the matching AFS files on the drive, a volume group at a time.
+ *
+ * The volume group directories are listed one after the other, whatever
+ * namei_SetListThreads was given, and groupFun is called as soon as each
+ * one is done; the inodes written for that group are the last ones
+ * written to fp.
+ *
+ * @param[in] dev       vice partition path
+ * @param[in] writeFun  function pointer to a function which writes inode
+ *                      information to FILE fp
+ * @param[in] fp        file stream where inode metadata is sent
+ * @param[in] judgeFun  filter function pointer.  if not NULL, only entries
+ *                      for which a non-zero value is returned are written
+ *                      to fp
+ * @param[in] groupFun  called with the volume group id and the number of
+ *                      inodes written for it, after each volume group
+ *                      directory.  a non-zero return ends the listing
+ *                      with an error
+ * @param[in] rock      opaque pointer passed into judgeFun and groupFun
+ *
+ * @return operation status
+ *    @retval <0 error
+ *    @retval >=0 number of matching files found
+ */
+int
+namei_ListAFSFilesByGroup(char *dev,
+			  int (*writeFun) (FD_t, struct ViceInodeInfo *,
+					   char *, char *),
+			  FD_t fp,
+			  int (*judgeFun) (struct ViceInodeInfo *, VolumeId,
+					   void *),
+			  int (*groupFun) (VolumeId, int, void *),
+			  void *rock)
+{
+    IHandle_t ih;
+    namei_t name;
+    int code, ninodes = 0;
+    DIR *dirp1;
+    struct dirent *dp1;
+#ifndef AFS_NT40_ENV
+    DIR *dirp2;
+    struct dirent *dp2;
+    char path2[512];
+#endif
+#ifdef DELETE_ZLC
+    static void FreeZLCList(void);
+#endif
+
+    memset((void *)&ih, 0, sizeof(IHandle_t));
+#ifdef AFS_NT40_ENV
+    ih.ih_dev = nt_DriveToDev(dev);
+#else
+    ih.ih_dev = volutil_GetPartitionID(dev);
+#endif
+
+    namei_HandleToInodeDir(&name, &ih);
+    dirp1 = opendir(name.n_path);
+    if (!dirp1)
+	return 0;
+    while (ninodes >= 0 && (dp1 = readdir(dirp1))) {
+#ifdef AFS_NT40_ENV
+	/* Heirarchy is one level on Windows */
+	if (!DecodeVolumeName(dp1->d_name, &ih.ih_vid)) {
+	    code = namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun, 0, rock);
+	    if (code < 0 || (*groupFun) (ih.ih_vid, code, rock))
+		ninodes = -1;
+	    else
+		ninodes += code;
+	}
+#else
+	if (*dp1->d_name == '.')
+	    continue;
+	snprintf(path2, sizeof(path2), "%s" OS_DIRSEP "%s", name.n_path,
+		 dp1->d_name);
+	dirp2 = opendir(path2);
+	if (dirp2) {
+	    while ((dp2 = readdir(dirp2))) {
+		if (*dp2->d_name == '.')
+		    continue;
+		if (DecodeVolumeName(dp2->d_name, &ih.ih_vid))
+		    continue;
+		code = namei_ListAFSSubDirs(&ih, writeFun, fp, judgeFun, 0,
+					    rock);
+		if (code < 0 || (*groupFun) (ih.ih_vid, code, rock)) {
+		    ninodes = -1;
+		    break;
+		}
+		ninodes += code;
+	    }
+	    closedir(dirp2);
+	}
+#endif
+    }
+    closedir(dirp1);
+#ifdef DELETE_ZLC
+    FreeZLCList();
+#endif
+    return ninodes;
+}
+
+#ifdef AFS_NT40_ENV
+static int
+DecodeVolumeName(char *name, VolumeId *vid)
+{
+    /* Name begins with "Vol_" and ends with .data.  See nt_HandleToVolDir() */
+    char stmp[32];
+    size_t len;
+
+    len = strlen(name);
+    if (len <= 9)
+        return -1;
+    if (strncmp(name, "Vol_", 4))
+        return -1;
+    if (strcmp(name + len - 5, ".data"))
+        return -1;
+    strcpy(stmp, name);
+    stmp[len - 5] = '\0';
+    *vid = base32_to_int(stmp + 4);
+    return 0;
+}
+#else
+static int
+DecodeVolumeName(char *name, VolumeId *vid)
+{
+    if (strlen(name) < 1)
+	return -1;
+    *vid = (unsigned int)flipbase64_to_int64(name);
+    return 0;
+}
+#endif
+
+
+/* DecodeInode
  *
  * Get the inode number from the name.
  *
@@ -2842,6 +3467,15 @@ DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
 static int
 DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
 	    IHandle_t *myIH)
+{
+    return DecodeInodeAt(-1, dpath, name, info, myIH);
+}
+
+/* As DecodeInode, for a name in the open directory dirfd (or -1, to look
+ * it up by its full path). */
+static int
+DecodeInodeAt(int dirfd, char *dpath, char *name, struct ViceInodeInfo *info,
+	      IHandle_t *myIH)
 {
     char fpath[512];
     struct afs_stat_st status;
@@ -2854,6 +3488,12 @@ DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
 
     snprintf(fpath, sizeof(fpath), "%s" OS_DIRSEP "%s", dpath, name);
 
+#ifdef afs_fstatat
+    if (dirfd >= 0) {
+	if (afs_fstatat(dirfd, name, &status, 0) < 0)
+	    return -1;
+    } else
+#endif
     if (afs_stat(fpath, &status) < 0) {
 	return -1;
     }
@@ -2872,9 +3512,11 @@ DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
     tmpih.ih_vid = myIH->ih_vid;
     tmpih.ih_ino = info->inodeNumber;
     namei_HandleToName(&nameiname, &tmpih);
-    if ((afs_stat(nameiname.n_path, &checkstatus) < 0) ||
-        checkstatus.st_ino != status.st_ino ||
-        checkstatus.st_size != status.st_size) {
+    /* if we got here by that very path, there is nothing to check */
+    if (strcmp(nameiname.n_path, fpath) != 0 &&
+	((afs_stat(nameiname.n_path, &checkstatus) < 0) ||
+	 checkstatus.st_ino != status.st_ino ||
+	 checkstatus.st_size != status.st_size)) {
 	static int logged;
 	/* log something for this case, since this means the filename looks
 	 * like a valid inode, but it's just in the wrong place. That's pretty
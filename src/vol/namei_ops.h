@@ -35,6 +35,11 @@ extern int namei_dec(IHandle_t * h, Inode ino, int p1);
 extern int namei_inc(IHandle_t * h, Inode ino, int p1);
 extern int namei_GetLinkCount(FdHandle_t * h, Inode ino, int lockit, int fixup, int nowrite);
 extern int namei_SetLinkCount(FdHandle_t * h, Inode ino, int count, int locked);
+extern struct ih_linkbatch *namei_BeginLinkBatch(IHandle_t * lh);
+extern int namei_BatchInc(struct ih_linkbatch *lb, Inode ino, int p1);
+extern int namei_BatchDec(struct ih_linkbatch *lb, Inode ino, int p1);
+extern int namei_FlushLinkBatch(struct ih_linkbatch *lb);
+extern int namei_EndLinkBatch(struct ih_linkbatch *lb);
 extern int namei_ViceREADME(char *partition);
 extern int namei_FixSpecialOGM(FdHandle_t *h, int check);
 #include "nfs.h"
@@ -51,6 +56,22 @@ int ListViceInodes(char *devname, char *mountedOn, FD_t inodeFile,
 				      void *rock),
 		   VolumeId singleVolumeNumber, int *forcep, int forceR,
 		   char *wpath, void *rock);
+int namei_ListAFSFilesByGroup(char *dev,
+			      int (*write_fun) (FD_t fp,
+						struct ViceInodeInfo * info,
+						char *dir, char *file),
+			      FD_t fp,
+			      int (*judge_fun) (struct ViceInodeInfo * info,
+						VolumeId vid, void *rock),
+			      int (*group_fun) (VolumeId rwid, int ninodes,
+						void *rock),
+			      void *rock);
+int ListViceInodesByGroup(char *devname, char *mountedOn, FD_t inodeFile,
+			  int (*judgeInode) (struct ViceInodeInfo * info,
+					     VolumeId vid, void *rock),
+			  int (*groupFun) (VolumeId rwid, int ninodes,
+					   void *rock),
+			  void *rock);
 
 #define NAMEI_LCOMP_LEN 32
 #define NAMEI_PATH_LEN 256
@@ -83,10 +104,8 @@ void namei_HandleToName(namei_t * name, IHandle_t * h);
 int namei_ConvertROtoRWvolume(char *pname, VolumeId volumeId);
 int namei_replace_file_by_hardlink(IHandle_t *hLink, IHandle_t *hTarget);
 
-# ifdef AFS_SALSRV_ENV
-#  include <afs/work_queue.h>
-extern void namei_SetWorkQueue(struct afs_work_queue *wq);
-# endif
+#define NAMEI_MAXLISTTHREADS 64	/* most threads listing a partition */
+extern void namei_SetListThreads(int nthreads);
 
 int namei_RemoveDirectories(char *pname, afs_int32 vid);
 
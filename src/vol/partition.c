@@ -224,8 +224,14 @@ VInitPartition_r(char *path, char *devname, Device dev)
     dp->flags = 0;
     dp->f_files = 1;		/* just a default value */
 #if defined(AFS_NAMEI_ENV) && !defined(AFS_NT40_ENV)
-    if (programType == fileServer)
+    if (programType == fileServer) {
 	(void)namei_ViceREADME(VPartitionPath(dp));
+	if (ih_canreflink(VPartitionPath(dp))) {
+	    dp->flags |= PART_REFLINK;
+	    Log("Partition %s supports reflinks; copy-on-write of cloned "
+		"files will share unmodified extents\n", path);
+	}
+    }
 #endif
     VSetPartitionDiskUsage_r(dp);
 #ifdef AFS_DEMAND_ATTACH_FS
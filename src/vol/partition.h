@@ -160,6 +160,9 @@ struct DiskPartitionStats64 {
 				 * using the same drive. Will be dumped before
 				 * all partitions attached.
 				 */
+#define PART_REFLINK	4	/* copy-on-write can share data extents
+				 * with the clone (reflink) rather than
+				 * copying them */
 
 #ifdef AFS_NT40_ENV
 #include <WINNT/vptab.h>
@@ -45,7 +45,8 @@
 
 /* forward declarations */
 static int ObliterateRegion(Volume * avp, VnodeClass aclass, StreamHandle_t * afile,
-			    afs_foff_t * aoffset);
+			    afs_foff_t * aoffset,
+			    struct ih_linkbatch *abatch);
 
 static void PurgeIndex_r(Volume * vp, VnodeClass class);
 static void PurgeHeader_r(Volume * vp);
@@ -95,7 +96,7 @@ VPurgeVolume(Error * ec, Volume * vp)
    and otherwise doesn't touch it */
 static int
 ObliterateRegion(Volume * avp, VnodeClass aclass, StreamHandle_t * afile,
-		 afs_foff_t * aoffset)
+		 afs_foff_t * aoffset, struct ih_linkbatch *abatch)
 {
     struct VnodeClassInfo *vcp;
     Inode inodes[MAXOBLITATONCE];
@@ -146,11 +147,12 @@ ObliterateRegion(Volume * avp, VnodeClass aclass, StreamHandle_t * afile,
     STREAM_FLUSH(afile);	/* ensure 0s are on the disk */
     OS_SYNC(afile->str_fd);
 
-    /* finally, do the idec's */
+    /* finally, do the idec's, syncing the link table once for the lot */
     for (i = 0; i < iindex; i++) {
-	IH_DEC(V_linkHandle(avp), inodes[i], V_parentId(avp));
+	IH_BATCH_DEC(abatch, V_linkHandle(avp), inodes[i], V_parentId(avp));
 	DOPOLL;
     }
+    IH_BATCH_FLUSH(abatch);
 
     /* return the new offset */
     *aoffset = offset;
@@ -168,6 +170,7 @@ PurgeIndex_r(Volume * vp, VnodeClass class)
     afs_foff_t offset;
     afs_int32 code;
     FdHandle_t *fdP;
+    struct ih_linkbatch *batch;
 
 
     fdP = IH_OPEN(vp->vnodeIndex[class].handle);
@@ -181,11 +184,13 @@ PurgeIndex_r(Volume * vp, VnodeClass class)
     }
 
     offset = vcp->diskSize;
+    batch = IH_BATCH_BEGIN(V_linkHandle(vp));
     while (1) {
-	code = ObliterateRegion(vp, class, ifile, &offset);
+	code = ObliterateRegion(vp, class, ifile, &offset, batch);
 	if (code)
 	    break;		/* if error or hit EOF */
     }
+    IH_BATCH_END(batch);
     STREAM_CLOSE(ifile);
     FDH_CLOSE(fdP);
 }
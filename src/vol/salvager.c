@@ -234,6 +234,30 @@ handleit(struct cmd_syndesc *as, void *arock)
 	    }
 	}
     }
+    if ((ti = as->parms[22].items)) {	/* -vgparallel # */
+	ParallelGroups = atoi(ti->data);
+	if (ParallelGroups < 1)
+	    ParallelGroups = 1;
+	if (ParallelGroups > MAXPARALLEL) {
+	    printf("Setting parallel volume group salvages to maximum of %d \n",
+		   MAXPARALLEL);
+	    ParallelGroups = MAXPARALLEL;
+	}
+    }
+#ifdef AFS_NAMEI_ENV
+    if ((ti = as->parms[23].items)) {	/* -listthreads # */
+	int nthreads = atoi(ti->data);
+
+	if (nthreads > NAMEI_MAXLISTTHREADS) {
+	    printf("Setting inode listing threads to maximum of %d \n",
+		   NAMEI_MAXLISTTHREADS);
+	}
+	namei_SetListThreads(nthreads);
+#ifdef AFS_PTHREAD_ENV
+	ListThreads = nthreads;
+#endif
+    }
+#endif
     if ((ti = as->parms[11].items)) {	/* -tmpdir */
 	DIR *dirp;
 
@@ -540,6 +564,10 @@ main(int argc, char **argv)
 #endif /* FAST_RESTART */
     cmd_Seek(ts, 21); /* skip DontSalvage and forceDAFS if needed */
     cmd_AddParm(ts, "-f", CMD_FLAG, CMD_OPTIONAL, "Alias for -force");
+    cmd_AddParm(ts, "-vgparallel", CMD_SINGLE, CMD_OPTIONAL,
+		"# of max parallel volume group salvaging per partition");
+    cmd_AddParm(ts, "-listthreads", CMD_SINGLE, CMD_OPTIONAL,
+		"# of threads listing the inodes of a partition");
     err = cmd_Dispatch(argc, argv);
     Exit(err);
     AFS_UNREACHED(return 0);
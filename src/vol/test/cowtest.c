@@ -0,0 +1,190 @@
+/*
+ * Copyright 2026, Sine Nomine Associates and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Time copy-on-write of a large cloned file.
+ *
+ * Creates a file of the requested size, hard links it the way a clone
+ * does, and then breaks the sharing twice: once through ih_copyrange(),
+ * which reflinks or kernel-copies where the partition supports it, and
+ * once through the plain read/write loop the fileserver falls back to.
+ * Both copies are checked against the original.
+ *
+ * usage: cowtest [-d directory] [-s size-in-MB]
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <afs/afsint.h>
+#include <afs/nfs.h>
+#include <afs/ihandle.h>
+
+#define COWBUFSIZE 8192
+
+static char srcPath[MAXPATHLEN], linkPath[MAXPATHLEN];
+static char fastPath[MAXPATHLEN], slowPath[MAXPATHLEN];
+
+static double
+Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+Cleanup(void)
+{
+    unlink(srcPath);
+    unlink(linkPath);
+    unlink(fastPath);
+    unlink(slowPath);
+}
+
+static void
+Fail(const char *what, const char *path)
+{
+    fprintf(stderr, "cowtest: %s %s: %s\n", what, path, strerror(errno));
+    Cleanup();
+    exit(1);
+}
+
+static int
+SlowCopy(int src, int dst, afs_foff_t off, afs_fsize_t size)
+{
+    char buf[COWBUFSIZE];
+    ssize_t len;
+
+    while (size > 0) {
+	len = size > COWBUFSIZE ? COWBUFSIZE : size;
+	if (pread(src, buf, len, off) != len
+	    || pwrite(dst, buf, len, off) != len)
+	    return -1;
+	size -= len;
+	off += len;
+    }
+    return 0;
+}
+
+static int
+Compare(const char *path, afs_fsize_t size)
+{
+    char abuf[COWBUFSIZE], bbuf[COWBUFSIZE];
+    afs_foff_t off = 0;
+    ssize_t len;
+    int a, b, code = 0;
+
+    a = open(srcPath, O_RDONLY);
+    b = open(path, O_RDONLY);
+    if (a < 0 || b < 0)
+	Fail("open", path);
+    while (size > 0 && code == 0) {
+	len = size > COWBUFSIZE ? COWBUFSIZE : size;
+	if (pread(a, abuf, len, off) != len || pread(b, bbuf, len, off) != len
+	    || memcmp(abuf, bbuf, len) != 0)
+	    code = -1;
+	size -= len;
+	off += len;
+    }
+    close(a);
+    close(b);
+    return code;
+}
+
+int
+main(int argc, char **argv)
+{
+    char *dir = ".";
+    afs_fsize_t size = 1024;
+    afs_sfsize_t copied;
+    char buf[COWBUFSIZE];
+    double start, fastTime, slowTime;
+    afs_foff_t off;
+    int src, dst, c, i;
+
+    while ((c = getopt(argc, argv, "d:s:")) != -1) {
+	switch (c) {
+	case 'd':
+	    dir = optarg;
+	    break;
+	case 's':
+	    size = strtoul(optarg, NULL, 10);
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-d directory] [-s size-in-MB]\n",
+		    argv[0]);
+	    exit(1);
+	}
+    }
+    size *= 1024 * 1024;
+
+    snprintf(srcPath, sizeof(srcPath), "%s/cowtest.src", dir);
+    snprintf(linkPath, sizeof(linkPath), "%s/cowtest.lnk", dir);
+    snprintf(fastPath, sizeof(fastPath), "%s/cowtest.fast", dir);
+    snprintf(slowPath, sizeof(slowPath), "%s/cowtest.slow", dir);
+    Cleanup();
+
+    /* the "cloned" file: a non-repeating pattern, shared through a link */
+    src = open(srcPath, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (src < 0)
+	Fail("create", srcPath);
+    for (off = 0; off < size; off += sizeof(buf)) {
+	for (i = 0; i < sizeof(buf); i += sizeof(afs_uint32))
+	    *(afs_uint32 *)&buf[i] = (afs_uint32)(off + i) * 2654435761U;
+	if (write(src, buf, sizeof(buf)) != sizeof(buf))
+	    Fail("write", srcPath);
+    }
+    if (ftruncate(src, size) < 0 || fsync(src) < 0)
+	Fail("sync", srcPath);
+    if (link(srcPath, linkPath) < 0)
+	Fail("link", linkPath);
+
+    /* kernel-assisted copy, finishing off by hand as the fileserver does */
+    dst = open(fastPath, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (dst < 0)
+	Fail("create", fastPath);
+    start = Now();
+    copied = ih_copyrange(src, dst, 0, size);
+    if (copied < 0)
+	copied = 0;
+    if (SlowCopy(src, dst, copied, size - copied) < 0 || fsync(dst) < 0)
+	Fail("copy to", fastPath);
+    fastTime = Now() - start;
+    close(dst);
+
+    /* the old read/write loop */
+    dst = open(slowPath, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (dst < 0)
+	Fail("create", slowPath);
+    start = Now();
+    if (SlowCopy(src, dst, 0, size) < 0 || fsync(dst) < 0)
+	Fail("copy to", slowPath);
+    slowTime = Now() - start;
+    close(dst);
+    close(src);
+
+    printf("size %llu MB, reflinks %s: ih_copyrange %.3f sec "
+	   "(%llu bytes by kernel), read/write %.3f sec\n",
+	   (unsigned long long)(size >> 20),
+	   ih_canreflink(dir) ? "yes" : "no", fastTime,
+	   (unsigned long long)copied, slowTime);
+
+    if (Compare(fastPath, size) != 0 || Compare(slowPath, size) != 0) {
+	fprintf(stderr, "cowtest: copy does not match the original\n");
+	Cleanup();
+	exit(1);
+    }
+    Cleanup();
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2026, Sine Nomine Associates and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Time the namei inode listing the salvager starts with.
+ *
+ * Lists all the inodes on a vice partition once for each -t argument,
+ * with that many threads, the way ListViceInodes does for the salvager,
+ * and checks that every run finds the same inodes.  The partition is only
+ * read, except that the link tables are opened for writing as the
+ * salvager does.  Do not run it next to a fileserver.
+ *
+ * usage: listbench -p partition [-t threads]...
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <rx/rx_queue.h>
+#include <lock.h>
+#include <afs/afsint.h>
+#include <afs/afsutil.h>
+#include <afs/nfs.h>
+#include <afs/ihandle.h>
+#include <afs/viceinode.h>
+
+#define BENCH_MAXRUNS	16
+
+static double
+Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void
+Die(const char *msg)
+{
+    fprintf(stderr, "listbench: %s\n", msg);
+    abort();
+}
+
+/* compare field by field; the structure has padding */
+static int
+CompareInfo(const void *a, const void *b)
+{
+    const struct ViceInodeInfo *x = a, *y = b;
+    int i;
+
+    if (x->inodeNumber != y->inodeNumber)
+	return x->inodeNumber < y->inodeNumber ? -1 : 1;
+    if (x->byteCount != y->byteCount)
+	return x->byteCount < y->byteCount ? -1 : 1;
+    if (x->linkCount != y->linkCount)
+	return x->linkCount < y->linkCount ? -1 : 1;
+    for (i = 0; i < 4; i++) {
+	if (x->u.param[i] != y->u.param[i])
+	    return x->u.param[i] < y->u.param[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/* read back and sort a listing, so that runs can be compared */
+static struct ViceInodeInfo *
+ReadListing(int fd, int *ninodes)
+{
+    struct ViceInodeInfo *info;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+	perror("listbench: fstat");
+	exit(1);
+    }
+    *ninodes = st.st_size / sizeof(*info);
+    info = malloc(st.st_size + 1);
+    if (info == NULL
+	|| pread(fd, info, st.st_size, 0) != st.st_size) {
+	fprintf(stderr, "listbench: cannot read back the listing\n");
+	exit(1);
+    }
+    qsort(info, *ninodes, sizeof(*info), CompareInfo);
+    return info;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct logOptions logopts;
+    struct ViceInodeInfo *first = NULL, *info;
+    char *partition = NULL;
+    char tmpname[] = "/tmp/listbench.XXXXXX";
+    int runs[BENCH_MAXRUNS];
+    int nruns = 0, nfirst = 0, ninodes, force;
+    double start, elapsed;
+    int c, i, fd;
+
+    while ((c = getopt(argc, argv, "p:t:")) != -1) {
+	switch (c) {
+	case 'p':
+	    partition = optarg;
+	    break;
+	case 't':
+	    if (nruns < BENCH_MAXRUNS)
+		runs[nruns++] = atoi(optarg);
+	    break;
+	default:
+	    partition = NULL;
+	    break;
+	}
+    }
+    if (partition == NULL) {
+	fprintf(stderr, "usage: %s -p partition [-t threads]...\n", argv[0]);
+	exit(1);
+    }
+    if (nruns == 0) {
+	runs[0] = 1;
+	runs[1] = 4;
+	nruns = 2;
+    }
+
+    memset(&logopts, 0, sizeof(logopts));
+    logopts.lopt_dest = logDest_file;
+    logopts.lopt_filename = "/dev/stderr";
+    OpenLog(&logopts);
+
+    for (i = 0; i < nruns; i++) {
+	fd = mkstemp(tmpname);
+	if (fd < 0) {
+	    perror("listbench: mkstemp");
+	    exit(1);
+	}
+	unlink(tmpname);
+	strcpy(tmpname + strlen(tmpname) - 6, "XXXXXX");
+
+	namei_SetListThreads(runs[i]);
+	start = Now();
+	if (ListViceInodes(partition, partition, fd, NULL, 0, &force, 0, NULL,
+			   NULL) < 0) {
+	    fprintf(stderr, "listbench: cannot list %s\n", partition);
+	    exit(1);
+	}
+	elapsed = Now() - start;
+	info = ReadListing(fd, &ninodes);
+	printf("listed %d inodes with %d threads in %.3f sec\n", ninodes,
+	       runs[i], elapsed);
+	close(fd);
+
+	if (first == NULL) {
+	    first = info;
+	    nfirst = ninodes;
+	    continue;
+	}
+	for (c = 0; c < ninodes && ninodes == nfirst; c++) {
+	    if (CompareInfo(&first[c], &info[c]) != 0)
+		break;
+	}
+	if (ninodes != nfirst || c < ninodes) {
+	    fprintf(stderr, "listbench: listing with %d threads differs\n",
+		    runs[i]);
+	    exit(1);
+	}
+	free(info);
+    }
+    free(first);
+    return 0;
+}
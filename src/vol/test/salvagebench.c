@@ -0,0 +1,282 @@
+/*
+ * Copyright 2026, Sine Nomine Associates and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Time a forced salvage of a synthetic partition.
+ *
+ * Fills a scratch vice partition with the requested number of volume
+ * groups, each a read-write volume whose root directory holds the
+ * requested number of files, and then salvages the whole partition once
+ * for each -j argument, with that many volume groups salvaged in
+ * parallel.  The volumes are removed again at the end.  The salvager's
+ * own log goes to the file named by -l (by default it is discarded).
+ * Do not run it next to a fileserver or against a partition holding
+ * real volumes.
+ *
+ * usage: salvagebench -p partition [-g groups] [-f files] [-l logfile]
+ *                     [-j parallel]...
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <rx/rx_queue.h>
+#include <lock.h>
+#include <afs/afsint.h>
+#include <afs/afsutil.h>
+#include <afs/acl.h>
+#include <afs/prs_fs.h>
+#include <afs/dir.h>
+#include <afs/nfs.h>
+#include <afs/ihandle.h>
+#include <afs/vnode.h>
+#include <afs/volume.h>
+#include <afs/partition.h>
+#include <afs/viceinode.h>
+
+#include "vol-salvage.h"
+#include "vol_internal.h"
+#include "vol_prototypes.h"
+
+#define BENCH_BASEID	1900000000	/* first volume id used */
+#define BENCH_MAXFILES	16000		/* keeps the root directory in bounds */
+#define BENCH_MAXRUNS	16
+#define BENCH_FILESIZE	1024
+
+int VolumeChanged;		/* to satisfy library libdir use */
+
+static FILE *out;		/* stdout, from before OpenLog() took it */
+
+static double
+Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+WriteVnode(Volume *vp, VnodeClass class, VnodeId vnode,
+	   struct VnodeDiskObject *vd)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+
+    vd->vnodeMagic = vcp->magic;
+    if (IH_IWRITE(vp->vnodeIndex[class].handle,
+		  vnodeIndexOffset(vcp, vnode), (char *)vd,
+		  vcp->diskSize) != vcp->diskSize) {
+	fprintf(out, "salvagebench: cannot write vnode %u: %s\n",
+		(unsigned)vnode, strerror(errno));
+	exit(1);
+    }
+}
+
+/*
+ * Create a volume holding a root directory full of small files, writing
+ * the inodes, directory and vnode indexes directly, the way the salvager
+ * itself recreates a missing root directory.
+ */
+static void
+MakeVolume(struct DiskPartition64 *dp, VolumeId vid, int nfiles)
+{
+    char buf[BENCH_FILESIZE];
+    char name[32];
+    struct VnodeDiskObject *vd;
+    struct acl_accessList *acl;
+    DirHandle dir;
+    AFSFid fid;
+    Volume *vp;
+    Error ec;
+    Inode ino;
+    IHandle_t *h;
+    afs_fsize_t length;
+    int i;
+
+    vp = VCreateVolume(&ec, dp->name, vid, vid);
+    if (vp == NULL) {
+	fprintf(out, "salvagebench: cannot create volume %u on %s: %d\n",
+		(unsigned)vid, dp->name, ec);
+	exit(1);
+    }
+    vd = calloc(1, SIZEOF_LARGEDISKVNODE);
+    opr_Assert(vd != NULL);
+
+    /* the files: small vnodes 2, 4, ..., all in the root directory */
+    ino = IH_CREATE(V_linkHandle(vp), V_device(vp), VPartitionPath(dp), 0,
+		    vid, 1, 1, 1);
+    if (!VALID_INO(ino)) {
+	fprintf(out, "salvagebench: cannot create root directory inode\n");
+	exit(1);
+    }
+    SetSalvageDirHandle(&dir, vid, V_device(vp), ino, &VolumeChanged);
+    fid.Volume = vid;
+    fid.Vnode = 1;
+    fid.Unique = 1;
+    opr_Verify(afs_dir_MakeDir(&dir, (afs_int32 *)&fid,
+			       (afs_int32 *)&fid) == 0);
+    for (i = 0; i < nfiles; i++) {
+	fid.Vnode = bitNumberToVnodeNumber(i + 1, vSmall);
+	fid.Unique = i + 2;
+	ino = IH_CREATE(V_linkHandle(vp), V_device(vp), VPartitionPath(dp), 0,
+			vid, fid.Vnode, fid.Unique, 1);
+	if (!VALID_INO(ino)) {
+	    fprintf(out, "salvagebench: cannot create file inode\n");
+	    exit(1);
+	}
+	memset(buf, 'a' + i % 26, sizeof(buf));
+	IH_INIT(h, V_device(vp), vid, ino);
+	opr_Verify(IH_IWRITE(h, 0, buf, sizeof(buf)) == sizeof(buf));
+	IH_RELEASE(h);
+
+	snprintf(name, sizeof(name), "file.%d", i);
+	opr_Verify(afs_dir_Create(&dir, name, &fid) == 0);
+
+	memset(vd, 0, SIZEOF_SMALLDISKVNODE);
+	vd->type = vFile;
+	vd->modeBits = 0644;
+	vd->linkCount = 1;
+	VNDISK_SET_LEN(vd, sizeof(buf));
+	vd->uniquifier = fid.Unique;
+	vd->dataVersion = 1;
+	VNDISK_SET_INO(vd, ino);
+	vd->unixModifyTime = vd->serverModifyTime = time(NULL);
+	vd->parent = 1;
+	WriteVnode(vp, vSmall, fid.Vnode, vd);
+    }
+    DFlush();
+    length = afs_dir_Length(&dir);
+    ino = dir.dirh_inode;
+    DZap(&dir);
+
+    /* the root directory: large vnode 1, open to everyone */
+    memset(vd, 0, SIZEOF_LARGEDISKVNODE);
+    acl = VVnodeDiskACL(vd);
+    acl->size = sizeof(struct acl_accessList);
+    acl->version = ACL_ACLVERSION;
+    acl->total = 1;
+    acl->positive = 1;
+    acl->entries[0].id = -1;	/* system:anyuser */
+    acl->entries[0].rights = PRSFS_READ | PRSFS_LOOKUP;
+    vd->type = vDirectory;
+    vd->modeBits = 0777;
+    vd->linkCount = 2;
+    VNDISK_SET_LEN(vd, length);
+    vd->uniquifier = 1;
+    vd->dataVersion = 1;
+    VNDISK_SET_INO(vd, ino);
+    vd->unixModifyTime = vd->serverModifyTime = time(NULL);
+    WriteVnode(vp, vLarge, 1, vd);
+    free(vd);
+
+    V_destroyMe(vp) = 0;
+    V_inService(vp) = V_blessed(vp) = 1;
+    V_type(vp) = readwriteVolume;
+    V_uniquifier(vp) = nfiles + 2;
+    V_creationDate(vp) = V_copyDate(vp);
+    V_diskused(vp) = nBlocks(length) + nfiles * nBlocks(BENCH_FILESIZE);
+    snprintf(V_name(vp), VNAMESIZE, "salvagebench.%u", (unsigned)vid);
+    VUpdateVolume(&ec, vp);
+    VDetachVolume(&ec, vp);
+}
+
+int
+main(int argc, char **argv)
+{
+    VolumePackageOptions opts;
+    struct logOptions logopts;
+    struct DiskPartition64 *dp;
+    char *partition = NULL, *logfile = "/dev/null";
+    int runs[BENCH_MAXRUNS];
+    int nruns = 0, groups = 100, files = 100;
+    double start;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "p:g:f:l:j:")) != -1) {
+	switch (c) {
+	case 'p':
+	    partition = optarg;
+	    break;
+	case 'g':
+	    groups = atoi(optarg);
+	    break;
+	case 'f':
+	    files = atoi(optarg);
+	    break;
+	case 'l':
+	    logfile = optarg;
+	    break;
+	case 'j':
+	    if (nruns < BENCH_MAXRUNS)
+		runs[nruns++] = atoi(optarg);
+	    break;
+	default:
+	    partition = NULL;
+	    break;
+	}
+    }
+    if (partition == NULL || groups < 1 || files < 0
+	|| files > BENCH_MAXFILES) {
+	fprintf(stderr, "usage: %s -p partition [-g groups] [-f files] "
+		"[-l logfile] [-j parallel]...\n", argv[0]);
+	exit(1);
+    }
+    if (nruns == 0) {
+	runs[0] = 1;
+	runs[1] = 4;
+	nruns = 2;
+    }
+
+    /* OpenLog() points stdout and stderr at the log file */
+    out = fdopen(dup(1), "w");
+    if (out == NULL) {
+	perror("salvagebench: dup");
+	exit(1);
+    }
+    memset(&logopts, 0, sizeof(logopts));
+    logopts.lopt_dest = logDest_file;
+    logopts.lopt_filename = logfile;
+    OpenLog(&logopts);
+
+    VOptDefaults(salvager, &opts);
+    if (VInitVolumePackage2(salvager, &opts)) {
+	fprintf(out, "salvagebench: cannot initialize volume package\n");
+	exit(1);
+    }
+    DInit(10);
+    dp = VGetPartition(partition, 0);
+    if (dp == NULL) {
+	fprintf(out, "salvagebench: no vice partition %s\n", partition);
+	exit(1);
+    }
+
+    start = Now();
+    for (i = 0; i < groups; i++)
+	MakeVolume(dp, BENCH_BASEID + i, files);
+    fprintf(out, "created %d volume groups of %d files in %.3f sec\n", groups,
+	   files, Now() - start);
+    fflush(out);		/* before the salvager forks */
+
+    ForceSalvage = 1;
+    for (i = 0; i < nruns; i++) {
+	ParallelGroups = runs[i] < 1 ? 1 : runs[i];
+	start = Now();
+	SalvageFileSys1(dp, 0);
+	fprintf(out, "salvaged %d volume groups, %d in parallel, in %.3f sec\n",
+	       groups, ParallelGroups, Now() - start);
+	fflush(out);
+    }
+
+    for (i = 0; i < groups; i++)
+	nuke(dp->name, BENCH_BASEID + i);
+    return 0;
+}
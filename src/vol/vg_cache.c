@@ -101,6 +101,8 @@ VVGCache_PkgInit(void)
     for (i = 0; i <= VOLMAXPARTS; i++) {
 	VVGCache.part[i].state = VVGC_PART_STATE_INVALID;
 	VVGCache.part[i].dlist_hash_buckets = NULL;
+	VVGCache.part[i].use_persist = 0;
+	VVGCache.part[i].persist_fd = -1;
 	CV_INIT(&VVGCache.part[i].cv, "cache part", CV_DEFAULT, 0);
 	if (code) {
 	    goto error;
@@ -132,6 +134,10 @@ VVGCache_PkgShutdown(void)
 
     /* destroy per-partition VVGC state */
     for (i = 0; i <= VOLMAXPARTS; i++) {
+	if (VVGCache.part[i].persist_fd >= 0) {
+	    close(VVGCache.part[i].persist_fd);
+	    VVGCache.part[i].persist_fd = -1;
+	}
 	VVGCache.part[i].state = VVGC_PART_STATE_INVALID;
 	CV_DESTROY(&VVGCache.part[i].cv);
     }
@@ -697,6 +703,12 @@ VVGCache_entry_add_r(struct DiskPartition64 * dp,
 	*newvg = 0;
     }
 
+    /* the change is dropped until the partition is scanned, so the scan
+     * must not load a cache file that predates it */
+    if (VVGCache.part[dp->index].state == VVGC_PART_STATE_INVALID) {
+	_VVGC_persist_discard_r(dp);
+    }
+
     /* check for existing entries */
     res = _VVGC_lookup(dp, child, &child_ent, NULL);
     if (res && res != ENOENT) {
@@ -791,6 +803,10 @@ VVGCache_entry_add_r(struct DiskPartition64 * dp,
 	}
     }
 
+    if (code == 0) {
+	_VVGC_persist_log_r(dp, VVGC_PERSIST_ADD, parent, child);
+    }
+
     return code;
 }
 
@@ -840,14 +856,22 @@ int
 VVGCache_entry_del_r(struct DiskPartition64 * dp,
 		     VolumeId parent, VolumeId child)
 {
+    int code;
+
+    if (VVGCache.part[dp->index].state == VVGC_PART_STATE_INVALID) {
+	_VVGC_persist_discard_r(dp);
+    }
     if (VVGCache.part[dp->index].state == VVGC_PART_STATE_UPDATING) {
-	int code;
 	code = _VVGC_dlist_add_r(dp, parent, child);
 	if (code) {
 	    return code;
 	}
     }
-    return _VVGC_entry_purge_r(dp, parent, child);
+    code = _VVGC_entry_purge_r(dp, parent, child);
+    if (code == 0) {
+	_VVGC_persist_log_r(dp, VVGC_PERSIST_DEL, parent, child);
+    }
+    return code;
 }
 
 /**
@@ -952,9 +976,10 @@ VVGCache_query_r(struct DiskPartition64 * dp,
     int code = 0;
     VVGCache_entry_t * ent;
 
-    /* If cache for this partition doesn't exist; start a scan */
+    /* If cache for this partition doesn't exist; start a scan.  This
+     * scan may use the cache file saved by an earlier run. */
     if (VVGCache.part[dp->index].state == VVGC_PART_STATE_INVALID) {
-	code = VVGCache_scanStart_r(dp);
+	code = _VVGC_scan_start(dp, 1);
 	if (code == 0 || code == -3) {
 	    /* -3 means another thread already started scanning */
 	    return EAGAIN;
@@ -999,6 +1024,9 @@ VVGCache_query(struct DiskPartition64 * dp,
 /**
  * begin asynchronous scan of on-disk volume group metadata.
  *
+ * An explicit scan always reads every volume header; a cache file saved
+ * on the partition by an earlier run is discarded.
+ *
  * @param[in] dp       disk partition object
  *
  * @pre VOL_LOCK held
@@ -1012,11 +1040,11 @@ VVGCache_scanStart_r(struct DiskPartition64 * dp)
     int code = 0, res;
 
     if (dp) {
-	code = _VVGC_scan_start(dp);
+	code = _VVGC_scan_start(dp, 0);
     } else {
 	/* start a scanner thread on each partition */
 	for (dp = DiskPartitionList; dp; dp = dp->next) {
-	    res = _VVGC_scan_start(dp);
+	    res = _VVGC_scan_start(dp, 0);
 	    if (res) {
 		code = res;
 	    }
@@ -17,6 +17,11 @@
 
 #define VVGC_SCAN_TBL_LEN 4096  /**< thread-local partition scan table size */
 
+#define VVGC_PERSIST_MAGIC    0x56474331  /**< "VGC1" */
+#define VVGC_PERSIST_VERSION  1
+#define VVGC_PERSIST_MIN_RECS 1024  /**< changes to append to a cache file
+				     *   before rewriting its snapshot */
+
 #include "vg_cache_impl_types.h"
 
 extern VVGCache_hash_table_t VVGCache_hash_table;
@@ -24,7 +29,7 @@ extern VVGCache_t VVGCache;
 
 extern int _VVGC_flush_part(struct DiskPartition64 * part);
 extern int _VVGC_flush_part_r(struct DiskPartition64 * part);
-extern int _VVGC_scan_start(struct DiskPartition64 * dp);
+extern int _VVGC_scan_start(struct DiskPartition64 * dp, int use_persist);
 extern int _VVGC_state_change(struct DiskPartition64 * part,
 			      VVGCache_part_state_t state);
 extern int _VVGC_entry_purge_r(struct DiskPartition64 * dp,
@@ -33,6 +38,11 @@ extern int _VVGC_dlist_add_r(struct DiskPartition64 *dp,
                              VolumeId parent, VolumeId child);
 extern int _VVGC_dlist_del_r(struct DiskPartition64 *dp,
                              VolumeId parent, VolumeId child);
+extern void _VVGC_persist_log_r(struct DiskPartition64 *dp,
+                                VVGCache_persist_op_t op,
+                                VolumeId parent, VolumeId child);
+extern void _VVGC_persist_close_r(struct DiskPartition64 *dp);
+extern void _VVGC_persist_discard_r(struct DiskPartition64 *dp);
 
 #define VVGC_HASH(volumeId) (volumeId&(VolumeHashTable.Mask))
 
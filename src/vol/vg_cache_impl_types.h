@@ -79,6 +79,34 @@ typedef struct VVGCache_scan_table {
 /**
  * VVGC partition state enumeration.
  */
+/**
+ * persistent VG cache file header.
+ *
+ * The header is followed by nentries VVGCache_scan_entry_t's, a snapshot
+ * of the partition's cache, and then by any number of
+ * VVGCache_persist_rec_t's recording the changes made since the snapshot
+ * was written.  Everything is in host byte order; the file never leaves
+ * the server.
+ */
+typedef struct VVGCache_persist_header {
+    afs_uint32 magic;           /**< VVGC_PERSIST_MAGIC */
+    afs_uint32 version;         /**< VVGC_PERSIST_VERSION */
+    afs_uint32 nentries;        /**< number of snapshot entries */
+    afs_uint32 cksum;           /**< checksum of the snapshot entries */
+} VVGCache_persist_header_t;
+
+typedef enum VVGCache_persist_op {
+    VVGC_PERSIST_ADD = 1,       /**< VVGCache_entry_add_r succeeded */
+    VVGC_PERSIST_DEL = 2        /**< VVGCache_entry_del_r succeeded */
+} VVGCache_persist_op_t;
+
+typedef struct VVGCache_persist_rec {
+    afs_uint32 op;              /**< VVGCache_persist_op_t */
+    afs_uint32 parent;          /**< parent volume id, 0 for any */
+    afs_uint32 child;           /**< child volume id */
+    afs_uint32 cksum;           /**< checksum of the fields above */
+} VVGCache_persist_rec_t;
+
 typedef enum VVGCache_part_state {
     VVGC_PART_STATE_VALID,      /**< vvgc data for partition is valid */
     VVGC_PART_STATE_INVALID,    /**< vvgc data for partition is known to be invalid */
@@ -107,6 +135,12 @@ typedef struct VVGCache_part {
 					  *   VVGCache_dlist_entry_t's.
 					  *   This is NULL when we are not
 					  *   scanning. */
+    int use_persist;              /**< next scan may load the cache file
+				   *   instead of reading every header */
+    int persist_fd;               /**< cache file open for appending, or
+				   *   -1 */
+    afs_uint32 persist_nentries;  /**< entries in the cache file snapshot */
+    afs_uint32 persist_nrecs;     /**< changes appended since the snapshot */
 } VVGCache_part_t;
 
 /**
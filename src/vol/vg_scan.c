@@ -27,6 +27,7 @@
 #include <afs/opr.h>
 #include <rx/rx_queue.h>
 #include <opr/lock.h>
+#include <opr/jhash.h>
 #include <lock.h>
 #include <afs/afsutil.h>
 #include "nfs.h"
@@ -57,6 +58,10 @@ static VVGCache_dlist_entry_t * _VVGC_dlist_lookup_r(struct DiskPartition64 *dp,
                                                      VolumeId parent,
                                                      VolumeId child);
 static void _VVGC_flush_dlist(struct DiskPartition64 *dp);
+static int _VVGC_persist_stash(struct DiskPartition64 *dp);
+static int _VVGC_persist_load(struct DiskPartition64 *dp,
+			      VVGCache_scan_table_t *tbl);
+static void _VVGC_persist_save_r(struct DiskPartition64 *dp);
 
 /**
  * init a thread-local scan table.
@@ -264,6 +269,7 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
     DIR *dirp = NULL;
     VVGCache_scan_table_t tbl;
     char *part_path = NULL;
+    int loaded = 0;
 
     code = _VVGC_scan_table_init(&tbl);
     if (code) {
@@ -298,13 +304,24 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
 	goto done;
     }
 
-    ViceLog(5, ("VVGC_scan_partition: scanning partition %s for VG cache\n",
-                 part_path));
+    if (VVGCache.part[part->index].use_persist) {
+	code = _VVGC_persist_load(part, &tbl);
+	if (code < 0) {
+	    goto done;
+	}
+	loaded = (code == 0);
+	code = 0;
+    }
 
-    code = VWalkVolumeHeaders(part, part_path, _VVGC_RecordHeader,
-                              _VVGC_UnlinkHeader, &tbl);
-    if (code < 0) {
-	goto done;
+    if (!loaded) {
+	ViceLog(5, ("VVGC_scan_partition: scanning partition %s for VG cache\n",
+		    part_path));
+
+	code = VWalkVolumeHeaders(part, part_path, _VVGC_RecordHeader,
+				  _VVGC_UnlinkHeader, &tbl);
+	if (code < 0) {
+	    goto done;
+	}
     }
 
     _VVGC_scan_table_flush(&tbl, part);
@@ -317,6 +334,10 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
     if (code) {
 	ViceLog(0, ("VVGC_scan_partition: error %d while scanning %s\n",
 	            code, part_path));
+    } else if (loaded) {
+	ViceLog(0, ("VVGC_scan_partition: loaded VG cache for %s from "
+		    VVGC_FILE ": %lu volumes in %lu groups\n",
+		    part_path, tbl.newvols, tbl.newvgs));
     } else {
 	ViceLog(0, ("VVGC_scan_partition: finished scanning %s: %lu volumes in %lu groups\n",
 	             part_path, tbl.newvols, tbl.newvgs));
@@ -332,6 +353,7 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
 	_VVGC_state_change(part, VVGC_PART_STATE_INVALID);
     } else {
 	_VVGC_state_change(part, VVGC_PART_STATE_VALID);
+	_VVGC_persist_save_r(part);
     }
 
     VOL_UNLOCK;
@@ -360,7 +382,12 @@ _VVGC_scanner_thread(void * args)
 /**
  * start a background scan.
  *
- * @param[in] dp  disk partition object
+ * @param[in] dp           disk partition object
+ * @param[in] use_persist  whether the scan may load the cache file saved
+ *                         on the partition instead of reading every
+ *                         volume header
+ *
+ * @pre VOL_LOCK held
  *
  * @return operation status
  *    @retval 0 success
@@ -370,7 +397,7 @@ _VVGC_scanner_thread(void * args)
  * @internal
  */
 int
-_VVGC_scan_start(struct DiskPartition64 * dp)
+_VVGC_scan_start(struct DiskPartition64 * dp, int use_persist)
 {
     int code = 0;
     pthread_t tid;
@@ -398,6 +425,13 @@ _VVGC_scan_start(struct DiskPartition64 * dp)
 	queue_Init(&VVGCache.part[dp->index].dlist_hash_buckets[i]);
     }
 
+    /* Changes made while we scan are not logged to the cache file, so take
+     * it out of the way; a crash before the scan saves a new one must not
+     * leave a stale file behind. */
+    _VVGC_persist_close_r(dp);
+    VVGCache.part[dp->index].use_persist =
+	use_persist && _VVGC_persist_stash(dp) == 0;
+
     code = pthread_attr_init(&attrs);
     if (code) {
 	goto error;
@@ -571,4 +605,566 @@ _VVGC_dlist_del_r(struct DiskPartition64 *dp, VolumeId parent,
     return 0;
 }
 
+/**
+ * build the path name of a partition's VG cache file.
+ *
+ * @param[in]  dp      disk partition object
+ * @param[in]  suffix  "" for the cache file itself, or the suffix of one
+ *                     of its temporary names
+ * @param[out] path    path name buffer
+ * @param[in]  len     size of path
+ *
+ * @internal
+ */
+static void
+_VVGC_persist_path(struct DiskPartition64 *dp, const char *suffix,
+		   char *path, size_t len)
+{
+    snprintf(path, len, "%s" OS_DIRSEP VVGC_FILE "%s", VPartitionPath(dp),
+	     suffix);
+}
+
+static afs_uint32
+_VVGC_persist_entries_cksum(VVGCache_scan_entry_t *entries, afs_uint32 n)
+{
+    return opr_jhash((afs_uint32 *)entries,
+		     n * sizeof(*entries) / sizeof(afs_uint32),
+		     VVGC_PERSIST_MAGIC ^ n);
+}
+
+static afs_uint32
+_VVGC_persist_rec_cksum(VVGCache_persist_rec_t *rec)
+{
+    return opr_jhash(&rec->op, 3, VVGC_PERSIST_MAGIC);
+}
+
+/**
+ * stop logging changes to a partition's VG cache file.
+ *
+ * @param[in] dp  disk partition object
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal VGC use only
+ */
+void
+_VVGC_persist_close_r(struct DiskPartition64 *dp)
+{
+    VVGCache_part_t *part = &VVGCache.part[dp->index];
+
+    if (part->persist_fd >= 0) {
+	close(part->persist_fd);
+	part->persist_fd = -1;
+    }
+    part->persist_nentries = 0;
+    part->persist_nrecs = 0;
+}
+
+/**
+ * throw away a partition's VG cache file.
+ *
+ * Used when a change to the partition's volume groups arrives while there
+ * is no cache to apply it to.  A file saved by an earlier run would not
+ * know about the change, so the next scan must read the volume headers
+ * instead.
+ *
+ * @param[in] dp  disk partition object
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal VGC use only
+ */
+void
+_VVGC_persist_discard_r(struct DiskPartition64 *dp)
+{
+    char path[MAXPATHLEN];
+
+    _VVGC_persist_close_r(dp);
+    _VVGC_persist_path(dp, "", path, sizeof(path));
+    if (unlink(path) == 0) {
+	ViceLog(0, ("VVGC_persist_discard: VG changed on %s before its cache "
+		    "was loaded; removed " VVGC_FILE "\n",
+		    VPartitionPath(dp)));
+    }
+}
+
+/**
+ * move a partition's VG cache file aside for the scanner to load.
+ *
+ * The file is renamed so that it is gone from its usual place while the
+ * scan runs.  Any leftover from an earlier scan is removed.
+ *
+ * @param[in] dp  disk partition object
+ *
+ * @pre VOL_LOCK held
+ *
+ * @return operation status
+ *    @retval 0 the scanner may load the file
+ *    @retval -1 there is no cache file
+ *
+ * @internal
+ */
+static int
+_VVGC_persist_stash(struct DiskPartition64 *dp)
+{
+    char path[MAXPATHLEN], loadpath[MAXPATHLEN];
+
+    _VVGC_persist_path(dp, "", path, sizeof(path));
+    _VVGC_persist_path(dp, ".load", loadpath, sizeof(loadpath));
+
+    if (rename(path, loadpath) == 0) {
+	return 0;
+    }
+    unlink(path);
+    unlink(loadpath);
+    return -1;
+}
+
+/**
+ * write a new VG cache file for a partition.
+ *
+ * Writes a snapshot of the partition's cache entries to a temporary file,
+ * renames it into place, and keeps it open so that later changes can be
+ * appended to it.  Failures are logged and leave the partition without a
+ * cache file; the next startup then scans the volume headers.
+ *
+ * @param[in] dp  disk partition object
+ *
+ * @pre VOL_LOCK held
+ * @pre VVGCache.part[dp->index].state == VVGC_PART_STATE_VALID
+ *
+ * @internal
+ */
+static void
+_VVGC_persist_save_r(struct DiskPartition64 *dp)
+{
+    VVGCache_part_t *part = &VVGCache.part[dp->index];
+    char path[MAXPATHLEN], newpath[MAXPATHLEN];
+    VVGCache_persist_header_t *hdr;
+    VVGCache_scan_entry_t *entries;
+    VVGCache_hash_entry_t *hent, *nhent;
+    afs_uint32 n = 0, max = 1024;
+    char *buf = NULL;
+    size_t len;
+    int fd = -1;
+    int i, j;
+
+    _VVGC_persist_close_r(dp);
+    _VVGC_persist_path(dp, "", path, sizeof(path));
+    _VVGC_persist_path(dp, ".new", newpath, sizeof(newpath));
+
+    buf = malloc(sizeof(*hdr) + max * sizeof(*entries));
+    if (buf == NULL) {
+	goto error;
+    }
+
+    /* one entry for every volume with a header: volumes that are only
+     * known as the parent of other volumes are left out */
+    for (i = 0; i < VolumeHashTable.Size; i++) {
+	for (queue_Scan(&VVGCache_hash_table.hash_buckets[i],
+			hent, nhent, VVGCache_hash_entry)) {
+	    if (hent->dp != dp) {
+		continue;
+	    }
+	    for (j = 0; j < VOL_VG_MAX_VOLS; j++) {
+		if (hent->entry->children[j] == hent->volid) {
+		    break;
+		}
+	    }
+	    if (j == VOL_VG_MAX_VOLS) {
+		continue;
+	    }
+	    if (n == max) {
+		char *nbuf;
+
+		max *= 2;
+		nbuf = realloc(buf, sizeof(*hdr) + max * sizeof(*entries));
+		if (nbuf == NULL) {
+		    goto error;
+		}
+		buf = nbuf;
+	    }
+	    entries = (VVGCache_scan_entry_t *)(buf + sizeof(*hdr));
+	    entries[n].volid = hent->volid;
+	    entries[n].parent = hent->entry->rw;
+	    n++;
+	}
+    }
+
+    hdr = (VVGCache_persist_header_t *)buf;
+    entries = (VVGCache_scan_entry_t *)(buf + sizeof(*hdr));
+    hdr->magic = VVGC_PERSIST_MAGIC;
+    hdr->version = VVGC_PERSIST_VERSION;
+    hdr->nentries = n;
+    hdr->cksum = _VVGC_persist_entries_cksum(entries, n);
+    len = sizeof(*hdr) + n * sizeof(*entries);
+
+    fd = open(newpath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0) {
+	goto error;
+    }
+    if (write(fd, buf, len) != len) {
+	goto error;
+    }
+    if (rename(newpath, path) < 0) {
+	goto error;
+    }
+
+    part->persist_fd = fd;
+    part->persist_nentries = n;
+    part->persist_nrecs = 0;
+    free(buf);
+
+    ViceLog(125, ("VVGC_persist_save: wrote %lu entries to %s\n",
+		  afs_printable_uint32_lu(n), path));
+    return;
+
+ error:
+    ViceLog(0, ("VVGC_persist_save: cannot write %s (errno %d); the VG cache "
+		"will be rebuilt from the volume headers at the next start\n",
+		path, errno));
+    if (fd >= 0) {
+	close(fd);
+	unlink(newpath);
+    }
+    unlink(path);
+    free(buf);
+}
+
+/**
+ * record a change to a partition's VG cache in its cache file.
+ *
+ * Appends a change record to the file.  Once as many changes have been
+ * appended as the snapshot has entries, the file is rewritten instead.
+ *
+ * @param[in] dp      disk partition object
+ * @param[in] op      the change made
+ * @param[in] parent  parent volume id, 0 for any
+ * @param[in] child   child volume id
+ *
+ * @pre VOL_LOCK held
+ * @pre the change has been made to the in-memory cache
+ *
+ * @internal VGC use only
+ */
+void
+_VVGC_persist_log_r(struct DiskPartition64 *dp, VVGCache_persist_op_t op,
+		    VolumeId parent, VolumeId child)
+{
+    VVGCache_part_t *part = &VVGCache.part[dp->index];
+    VVGCache_persist_rec_t rec;
+    struct stat status;
+    char path[MAXPATHLEN];
+
+    if (part->state != VVGC_PART_STATE_VALID || part->persist_fd < 0) {
+	return;
+    }
+
+    if (part->persist_nrecs >= part->persist_nentries
+	&& part->persist_nrecs >= VVGC_PERSIST_MIN_RECS) {
+	/* A volume utility that could not report a header change to us
+	 * removes the file, and we must not bring it back. */
+	if (fstat(part->persist_fd, &status) < 0 || status.st_nlink == 0) {
+	    ViceLog(0, ("VVGC_persist_log: " VVGC_FILE " on %s was removed; "
+			"the VG cache will be rebuilt from the volume headers "
+			"at the next start\n", VPartitionPath(dp)));
+	    _VVGC_persist_close_r(dp);
+	    return;
+	}
+	_VVGC_persist_save_r(dp);
+	return;
+    }
+
+    rec.op = op;
+    rec.parent = parent;
+    rec.child = child;
+    rec.cksum = _VVGC_persist_rec_cksum(&rec);
+
+    if (write(part->persist_fd, &rec, sizeof(rec)) != sizeof(rec)) {
+	_VVGC_persist_path(dp, "", path, sizeof(path));
+	ViceLog(0, ("VVGC_persist_log: cannot append to %s (errno %d); the VG "
+		    "cache will be rebuilt from the volume headers at the "
+		    "next start\n", path, errno));
+	_VVGC_persist_close_r(dp);
+	unlink(path);
+	return;
+    }
+    part->persist_nrecs++;
+}
+
+struct VVGC_persist_change {
+    VolumeId child;
+    VolumeId parent;
+    afs_uint32 seq;             /**< 0 for the snapshot, then in log order */
+    afs_uint32 op;              /**< VVGCache_persist_op_t */
+};
+
+static int
+_VVGC_persist_change_cmp(const void *a, const void *b)
+{
+    const struct VVGC_persist_change *x = a, *y = b;
+
+    if (x->child != y->child) {
+	return x->child < y->child ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static int
+_VVGC_volid_cmp(const void *a, const void *b)
+{
+    VolumeId x = *(const VolumeId *)a, y = *(const VolumeId *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/**
+ * read a VG cache file and replay its change log.
+ *
+ * @param[in]  path     cache file path
+ * @param[out] ents     the volumes in the cache, sorted by volume id;
+ *                      free with free()
+ * @param[out] nents    number of entries in *ents
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 the file is missing, damaged or was cut short
+ *
+ * @internal
+ */
+static int
+_VVGC_persist_read(const char *path, VVGCache_scan_entry_t **ents,
+		   afs_uint32 *nents)
+{
+    VVGCache_persist_header_t hdr;
+    VVGCache_scan_entry_t *entries = NULL;
+    VVGCache_persist_rec_t *recs = NULL;
+    struct VVGC_persist_change *changes = NULL;
+    struct stat status;
+    size_t nrecs = 0, len;
+    afs_uint32 i, n;
+    int fd, code = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	return -1;
+    }
+    if (fstat(fd, &status) < 0 || status.st_size < sizeof(hdr)
+	|| read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	|| hdr.magic != VVGC_PERSIST_MAGIC
+	|| hdr.version != VVGC_PERSIST_VERSION
+	|| status.st_size < sizeof(hdr) + (afs_uint64)hdr.nentries *
+			    sizeof(*entries)) {
+	goto done;
+    }
+
+    /* a record cut short by a crash leaves the tail in doubt; the
+     * header walk is the safe answer */
+    len = status.st_size - sizeof(hdr) - hdr.nentries * sizeof(*entries);
+    if (len % sizeof(*recs) != 0) {
+	goto done;
+    }
+    nrecs = len / sizeof(*recs);
+
+    entries = malloc(hdr.nentries * sizeof(*entries) + 1);
+    recs = malloc(len + 1);
+    changes = malloc((hdr.nentries + nrecs) * sizeof(*changes) + 1);
+    if (entries == NULL || recs == NULL || changes == NULL) {
+	goto done;
+    }
+    if (read(fd, entries, hdr.nentries * sizeof(*entries))
+	    != hdr.nentries * sizeof(*entries)
+	|| read(fd, recs, len) != len
+	|| _VVGC_persist_entries_cksum(entries, hdr.nentries) != hdr.cksum) {
+	goto done;
+    }
+
+    for (i = 0; i < hdr.nentries; i++) {
+	changes[i].child = entries[i].volid;
+	changes[i].parent = entries[i].parent;
+	changes[i].seq = 0;
+	changes[i].op = VVGC_PERSIST_ADD;
+    }
+    for (i = 0; i < nrecs; i++) {
+	if (recs[i].cksum != _VVGC_persist_rec_cksum(&recs[i])
+	    || (recs[i].op != VVGC_PERSIST_ADD
+		&& recs[i].op != VVGC_PERSIST_DEL)) {
+	    goto done;
+	}
+	changes[hdr.nentries + i].child = recs[i].child;
+	changes[hdr.nentries + i].parent = recs[i].parent;
+	changes[hdr.nentries + i].seq = i + 1;
+	changes[hdr.nentries + i].op = recs[i].op;
+    }
+
+    /* the last change to each volume decides whether it is in the cache,
+     * and with which parent */
+    qsort(changes, hdr.nentries + nrecs, sizeof(*changes),
+	  _VVGC_persist_change_cmp);
+    free(entries);
+    entries = malloc((hdr.nentries + nrecs) * sizeof(*entries) + 1);
+    if (entries == NULL) {
+	goto done;
+    }
+    for (i = 0, n = 0; i < hdr.nentries + nrecs; i++) {
+	if (i + 1 < hdr.nentries + nrecs
+	    && changes[i + 1].child == changes[i].child) {
+	    continue;
+	}
+	if (changes[i].op == VVGC_PERSIST_ADD) {
+	    entries[n].volid = changes[i].child;
+	    entries[n].parent = changes[i].parent;
+	    n++;
+	}
+    }
+
+    *ents = entries;
+    *nents = n;
+    entries = NULL;
+    code = 0;
+
+ done:
+    close(fd);
+    free(entries);
+    free(recs);
+    free(changes);
+    return code;
+}
+
+/**
+ * check a loaded VG cache against a partition's volume headers.
+ *
+ * Only the directory is read, not the headers: the volumes with headers on
+ * the partition must be exactly the volumes in the cache.  Parent changes
+ * do not show in the directory; volume utilities report them to the
+ * fileserver, or remove the cache file when they cannot.
+ *
+ * @param[in] dp     disk partition object
+ * @param[in] ents   cache entries, sorted by volume id
+ * @param[in] nents  number of cache entries
+ *
+ * @return operation status
+ *    @retval 0 the cache matches the partition
+ *    @retval -1 it does not, or the partition could not be read
+ *
+ * @internal
+ */
+static int
+_VVGC_persist_check(struct DiskPartition64 *dp, VVGCache_scan_entry_t *ents,
+		    afs_uint32 nents)
+{
+    DIR *dirp;
+    struct dirent *dentry;
+    VolumeId *ids = NULL, *nids;
+    afs_uint32 n = 0, max = 1024, i;
+    int code = -1;
+
+    dirp = opendir(VPartitionPath(dp));
+    if (dirp == NULL) {
+	return -1;
+    }
+    ids = malloc(max * sizeof(*ids));
+    if (ids == NULL) {
+	goto done;
+    }
+
+    while ((dentry = readdir(dirp)) != NULL) {
+	char *p, *end;
+
+	p = strrchr(dentry->d_name, '.');
+	if (p == NULL || strcmp(p, VHDREXT) != 0) {
+	    continue;
+	}
+	/* the walk reads the volume id from the header itself; we can only
+	 * trust names in the usual form */
+	if (dentry->d_name[0] != 'V') {
+	    goto done;
+	}
+	if (n == max) {
+	    max *= 2;
+	    nids = realloc(ids, max * sizeof(*ids));
+	    if (nids == NULL) {
+		goto done;
+	    }
+	    ids = nids;
+	}
+	ids[n] = strtoul(dentry->d_name + 1, &end, 10);
+	if (end == dentry->d_name + 1 || end != p) {
+	    goto done;
+	}
+	n++;
+    }
+
+    if (n != nents) {
+	goto done;
+    }
+    qsort(ids, n, sizeof(*ids), _VVGC_volid_cmp);
+    for (i = 0; i < n; i++) {
+	if (ids[i] != ents[i].volid) {
+	    goto done;
+	}
+    }
+    code = 0;
+
+ done:
+    closedir(dirp);
+    free(ids);
+    return code;
+}
+
+/**
+ * load a partition's VG cache from the file saved by an earlier run.
+ *
+ * @param[in] dp   disk partition object
+ * @param[in] tbl  scan table to add the cached volumes to
+ *
+ * @pre VOL_LOCK is NOT held
+ * @pre _VVGC_persist_stash() moved the file aside
+ *
+ * @return operation status
+ *    @retval 0 the cache was loaded
+ *    @retval 1 there is no usable cache file; the headers must be read
+ *    @retval -1 fatal error adding volumes to the scan table
+ *
+ * @internal
+ */
+static int
+_VVGC_persist_load(struct DiskPartition64 *dp, VVGCache_scan_table_t *tbl)
+{
+    char loadpath[MAXPATHLEN];
+    VVGCache_scan_entry_t *ents = NULL;
+    afs_uint32 nents = 0, i;
+    int code;
+
+    _VVGC_persist_path(dp, ".load", loadpath, sizeof(loadpath));
+    code = _VVGC_persist_read(loadpath, &ents, &nents);
+    unlink(loadpath);
+    if (code) {
+	ViceLog(0, ("VVGC_persist_load: no usable " VVGC_FILE " on %s; "
+		    "scanning the volume headers\n", VPartitionPath(dp)));
+	return 1;
+    }
+
+    if (_VVGC_persist_check(dp, ents, nents)) {
+	ViceLog(0, ("VVGC_persist_load: " VVGC_FILE " on %s does not match "
+		    "the volume headers; scanning them\n", VPartitionPath(dp)));
+	free(ents);
+	return 1;
+    }
+
+    for (i = 0; i < nents; i++) {
+	code = _VVGC_scan_table_add(tbl, dp, ents[i].volid, ents[i].parent);
+	if (code) {
+	    ViceLog(0, ("VVGC_persist_load: error %d adding volume %lu to "
+			"scan table\n", code,
+			afs_printable_uint32_lu(ents[i].volid)));
+	    free(ents);
+	    return -1;
+	}
+    }
+
+    free(ents);
+    return 0;
+}
+
 #endif /* AFS_DEMAND_ATTACH_FS */
@@ -86,19 +86,70 @@ VNLog(afs_int32 aop, afs_int32 anparms, ... )
  * with the volume ID as an initval because it's there.  (That will
  * make the same vnode number in different volumes hash to a different
  * value, which would probably not even be a big deal anyway.)
+ *
+ * The table is sized for about two vnodes per chain, and is rebuilt
+ * larger when the vnode caches grow.  hashIndex is 16 bits wide, which
+ * caps the table size.
  */
 
-#define VNODE_HASH_TABLE_BITS 11
-#define VNODE_HASH_TABLE_SIZE opr_jhash_size(VNODE_HASH_TABLE_BITS)
-#define VNODE_HASH_TABLE_MASK opr_jhash_mask(VNODE_HASH_TABLE_BITS)
-private Vnode *VnodeHashTable[VNODE_HASH_TABLE_SIZE];
+#define VNODE_HASH_TABLE_MIN_BITS 11
+#define VNODE_HASH_TABLE_MAX_BITS 16
+private Vnode **VnodeHashTable;
+private int VnodeHashBits;
 #define VNODE_HASH(volumeptr,vnodenumber)\
-    (opr_jhash_int((vnodenumber), V_id((volumeptr))) & VNODE_HASH_TABLE_MASK)
+    (opr_jhash_int((vnodenumber), V_id((volumeptr))) & \
+     opr_jhash_mask(VnodeHashBits))
+
+/* Once the vnodes used only once take up more than 1/VNODE_COLD_FRACTION
+ * of a class's cache, they are reused before any hot vnode is. */
+#define VNODE_COLD_FRACTION	4
+
+/* How often (in gets) a growable vnode cache checks whether to grow, and
+ * the share of gets that must have pushed out a hot vnode for it to do so.
+ * Each growth adds 1/VNODE_GROW_FRACTION of the current size. */
+#define VNODE_GROW_WINDOW	8192
+#define VNODE_GROW_HOT_EVICTS	(VNODE_GROW_WINDOW / 32)
+#define VNODE_GROW_FRACTION	4
 
 
 
 #define BAD_IGET	-1000
 
+/* largest index span VPrefetchVnodes will read in one pass */
+#define VNODE_PREFETCH_MAX	(256 * 1024)
+
+/* Vnode index page cache.  VnLoad reads the vnode index a page at a time
+ * and keeps recently read pages, so loading the neighbours of a vnode
+ * (the entries of a directory, the rest of a bulk status) needs no more
+ * I/O.  VnStore writes through to disk and updates any cached copy.
+ * Pages are keyed by the volume's cacheCheck, which is unique to each
+ * attachment of a volume, and are dropped when the volume's vnodes are
+ * invalidated on the way offline.  All of it is under VOL_LOCK.
+ */
+#define VNODE_PAGE_SIZE		(16 * 1024)
+#define VNODE_PAGE_COUNT	256
+#define VNODE_PAGE_HASH_BITS	9
+#define VNODE_PAGE_HASH(cc, class, off) \
+    (opr_jhash_int2((cc), (afs_uint32)((off) / VNODE_PAGE_SIZE), (class)) \
+     & opr_jhash_mask(VNODE_PAGE_HASH_BITS))
+
+struct VnodeIndexPage {
+    struct rx_queue lru;	/* must be first */
+    struct VnodeIndexPage *hashNext;
+    bit32 cacheCheck;		/* volume attachment; 0 if page unused */
+    VnodeClass class;
+    afs_foff_t offset;		/* offset of page in index file */
+    int valid;			/* bytes of page read from disk */
+    char data[VNODE_PAGE_SIZE];
+};
+
+private struct VnodeIndexPage *VnodePages;
+private struct VnodeIndexPage *VnodePageHash[opr_jhash_size(VNODE_PAGE_HASH_BITS)];
+/* bumped on each store to a bucket, so a page read from disk without
+ * VOL_LOCK is not cached if a store may have raced with the read */
+private afs_uint32 VnodePageGen[opr_jhash_size(VNODE_PAGE_HASH_BITS)];
+private struct rx_queue VnodePageLRU;
+
 /* There are two separate vnode queue types defined here:
  * Each hash conflict chain -- is singly linked, with a single head
  * pointer. New entries are added at the beginning. Old
@@ -107,8 +158,48 @@ private Vnode *VnodeHashTable[VNODE_HASH_TABLE_SIZE];
  * LRU chain -- is doubly linked, single head pointer.
  * Entries are added at the head, reclaimed from the tail,
  * or removed from anywhere in the queue.
+ *
+ * Each vnode class has two LRU chains, which together implement a
+ * simplified 2Q replacement policy.  A vnode read in from disk goes on
+ * the cold chain (lruHead) when it is put back; once it has been found
+ * in the cache again it goes on the hot chain (hotHead) instead.  Free
+ * vnodes are taken from the cold chain while it holds more than its
+ * share of the cache, so a single pass over a volume (a dump, a backup
+ * clone, a salvage) cycles through the cold chain and leaves the hot
+ * working set alone.
  */
 
+/* insert vnp at the head of the circular list *headp */
+static_inline void
+VnLRUInsert(Vnode ** headp, Vnode * vnp)
+{
+    if (*headp == NULL) {
+	vnp->lruNext = vnp->lruPrev = vnp;
+    } else {
+	vnp->lruNext = *headp;
+	vnp->lruPrev = (*headp)->lruPrev;
+	(*headp)->lruPrev = vnp;
+	vnp->lruPrev->lruNext = vnp;
+    }
+    *headp = vnp;
+}
+
+/* remove vnp from the circular list *headp */
+static_inline void
+VnLRURemove(Vnode ** headp, Vnode * vnp)
+{
+    if (vnp->lruNext == vnp) {
+	if (*headp != vnp)
+	    Abort("DeleteFromVnLRU: lru chain addled!\n");
+	*headp = NULL;
+	return;
+    }
+    if (vnp == *headp)
+	*headp = vnp->lruNext;
+    vnp->lruPrev->lruNext = vnp->lruNext;
+    vnp->lruNext->lruPrev = vnp->lruPrev;
+}
+
 /**
  * add a vnode to the volume's vnode list.
  *
@@ -170,21 +261,19 @@ AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
-    /* Add it to the circular LRU list */
-    if (vcp->lruHead == NULL)
-	Abort("VPutVnode: vcp->lruHead==NULL");
-    else {
-	vnp->lruNext = vcp->lruHead;
-	vnp->lruPrev = vcp->lruHead->lruPrev;
-	vcp->lruHead->lruPrev = vnp;
-	vnp->lruPrev->lruNext = vnp;
-	vcp->lruHead = vnp;
-    }
+    if ((Vn_stateFlags(vnp) & VN_HOT) && !vnp->delete) {
+	VnLRUInsert(&vcp->hotHead, vnp);
+	vcp->nHot++;
+	Vn_stateFlags(vnp) |= VN_ON_HOT;
+    } else {
+	VnLRUInsert(&vcp->lruHead, vnp);
+	vcp->nCold++;
 
-    /* If the vnode was just deleted, put it at the end of the chain so it
-     * will be reused immediately */
-    if (vnp->delete)
-	vcp->lruHead = vnp->lruNext;
+	/* If the vnode was just deleted, put it at the end of the chain so
+	 * it will be reused immediately */
+	if (vnp->delete)
+	    vcp->lruHead = vnp->lruNext;
+    }
 
     Vn_stateFlags(vnp) |= VN_ON_LRU;
 }
@@ -204,17 +293,15 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
-    if (vnp == vcp->lruHead)
-	vcp->lruHead = vcp->lruHead->lruNext;
-
-    if ((vnp == vcp->lruHead) ||
-	(vcp->lruHead == NULL))
-	Abort("DeleteFromVnLRU: lru chain addled!\n");
-
-    vnp->lruPrev->lruNext = vnp->lruNext;
-    vnp->lruNext->lruPrev = vnp->lruPrev;
+    if (Vn_stateFlags(vnp) & VN_ON_HOT) {
+	VnLRURemove(&vcp->hotHead, vnp);
+	vcp->nHot--;
+    } else {
+	VnLRURemove(&vcp->lruHead, vnp);
+	vcp->nCold--;
+    }
 
-    Vn_stateFlags(vnp) &= ~(VN_ON_LRU);
+    Vn_stateFlags(vnp) &= ~(VN_ON_LRU | VN_ON_HOT);
 }
 
 /**
@@ -234,6 +321,7 @@ AddToVnHash(Vnode * vnp)
     unsigned int newHash;
 
     if (!(Vn_stateFlags(vnp) & VN_ON_HASH)) {
+	opr_Assert(VnodeHashTable != NULL);
 	newHash = VNODE_HASH(Vn_volume(vnp), Vn_id(vnp));
 	vnp->hashNext = VnodeHashTable[newHash];
 	VnodeHashTable[newHash] = vnp;
@@ -278,6 +366,145 @@ DeleteFromVnHash(Vnode * vnp)
 }
 
 
+/**
+ * find a page of a vnode index in the page cache.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal vnode package internal use only
+ */
+static struct VnodeIndexPage *
+VnPageLookup_r(Volume * vp, VnodeClass class, afs_foff_t offset)
+{
+    struct VnodeIndexPage *pp;
+    unsigned int bucket = VNODE_PAGE_HASH(vp->cacheCheck, class, offset);
+
+    for (pp = VnodePageHash[bucket]; pp; pp = pp->hashNext) {
+	if (pp->cacheCheck == vp->cacheCheck && pp->class == class
+	    && pp->offset == offset)
+	    return pp;
+    }
+    return NULL;
+}
+
+/**
+ * remove a page from the page cache, making it the next to be reused.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnPageDrop_r(struct VnodeIndexPage *pp)
+{
+    struct VnodeIndexPage **ppp;
+    unsigned int bucket = VNODE_PAGE_HASH(pp->cacheCheck, pp->class,
+					  pp->offset);
+
+    for (ppp = &VnodePageHash[bucket]; *ppp; ppp = &(*ppp)->hashNext) {
+	if (*ppp == pp) {
+	    *ppp = pp->hashNext;
+	    break;
+	}
+    }
+    pp->hashNext = NULL;
+    pp->cacheCheck = 0;
+    queue_Remove(&pp->lru);
+    queue_Append(&VnodePageLRU, &pp->lru);
+}
+
+/**
+ * cache a page of a vnode index read from disk.
+ *
+ * @param[in] vp      volume object pointer
+ * @param[in] class   vnode class of the index
+ * @param[in] offset  page offset in the index file
+ * @param[in] buf     page data
+ * @param[in] valid   number of bytes of buf read from disk
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnPageInsert_r(Volume * vp, VnodeClass class, afs_foff_t offset,
+	       char *buf, int valid)
+{
+    struct VnodeIndexPage *pp;
+    unsigned int bucket;
+    int i;
+
+    if (VnodePages == NULL) {
+	VnodePages = calloc(VNODE_PAGE_COUNT, sizeof(*VnodePages));
+	if (VnodePages == NULL)
+	    return;
+	queue_Init(&VnodePageLRU);
+	for (i = 0; i < VNODE_PAGE_COUNT; i++)
+	    queue_Append(&VnodePageLRU, &VnodePages[i].lru);
+    }
+
+    pp = VnPageLookup_r(vp, class, offset);
+    if (pp == NULL) {
+	pp = queue_Last(&VnodePageLRU, VnodeIndexPage);
+	if (pp->cacheCheck != 0)
+	    VnPageDrop_r(pp);
+	bucket = VNODE_PAGE_HASH(vp->cacheCheck, class, offset);
+	pp->cacheCheck = vp->cacheCheck;
+	pp->class = class;
+	pp->offset = offset;
+	pp->hashNext = VnodePageHash[bucket];
+	VnodePageHash[bucket] = pp;
+    }
+    memcpy(pp->data, buf, valid);
+    pp->valid = valid;
+    queue_Remove(&pp->lru);
+    queue_Prepend(&VnodePageLRU, &pp->lru);
+}
+
+/**
+ * bring any cached copy of a vnode in line with what was just stored.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnPageStore_r(Volume * vp, VnodeClass class, afs_foff_t offset,
+	      void *data, int len)
+{
+    struct VnodeIndexPage *pp;
+    afs_foff_t pageoff = offset & ~((afs_foff_t)VNODE_PAGE_SIZE - 1);
+
+    VnodePageGen[VNODE_PAGE_HASH(vp->cacheCheck, class, pageoff)]++;
+    if (VnodePages == NULL || (pp = VnPageLookup_r(vp, class, pageoff)) == NULL)
+	return;
+    if (offset - pageoff + len <= pp->valid)
+	memcpy(pp->data + (offset - pageoff), data, len);
+    else
+	VnPageDrop_r(pp);
+}
+
+/**
+ * drop all cached index pages of a volume.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnPageInvalidate_r(Volume * vp)
+{
+    int i;
+
+    if (VnodePages == NULL)
+	return;
+    for (i = 0; i < VNODE_PAGE_COUNT; i++) {
+	if (VnodePages[i].cacheCheck == vp->cacheCheck)
+	    VnPageDrop_r(&VnodePages[i]);
+    }
+}
+
+
 /**
  * invalidate a vnode cache entry.
  *
@@ -305,6 +532,96 @@ VInvalidateVnode_r(struct Vnode *avnode)
 }
 
 
+/**
+ * size the vnode hash table for the current vnode caches.
+ *
+ * @pre VOL_LOCK held, or vnode package not yet in use
+ *
+ * @post hash table has room for about two vnodes per chain, and any
+ *       vnodes on the old table have been moved to the new one
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VResizeVnodeHash_r(void)
+{
+    int total = VnodeClassInfo[vLarge].cacheSize
+	+ VnodeClassInfo[vSmall].cacheSize;
+    int bits = VNODE_HASH_TABLE_MIN_BITS;
+    Vnode **newTable, **oldTable = VnodeHashTable;
+    Vnode *vnp, *next;
+    int i, oldBits = VnodeHashBits;
+
+    while (bits < VNODE_HASH_TABLE_MAX_BITS && opr_jhash_size(bits) * 2 < total)
+	bits++;
+    if (oldTable != NULL && bits <= oldBits)
+	return;
+
+    newTable = calloc(opr_jhash_size(bits), sizeof(Vnode *));
+    opr_Assert(newTable != NULL);
+    VnodeHashTable = newTable;
+    VnodeHashBits = bits;
+    if (oldTable == NULL)
+	return;
+
+    for (i = 0; i < opr_jhash_size(oldBits); i++) {
+	for (vnp = oldTable[i]; vnp; vnp = next) {
+	    next = vnp->hashNext;
+	    Vn_stateFlags(vnp) &= ~VN_ON_HASH;
+	    AddToVnHash(vnp);
+	}
+    }
+    free(oldTable);
+}
+
+/**
+ * add vnode objects to a vnode class's cache.
+ *
+ * @param[in] vcp      vnode class info object pointer
+ * @param[in] nVnodes  number of vnodes to add
+ *
+ * @post vnodes allocated, initialized and put on the cold lru chain
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VAddVnodes(struct VnodeClassInfo *vcp, int nVnodes)
+{
+    byte *va;
+
+    va = (byte *) calloc(nVnodes, vcp->residentSize);
+    opr_Assert(va != NULL);
+    vcp->cacheSize += nVnodes;
+    while (nVnodes--) {
+	Vnode *vnp = (Vnode *) va;
+	Vn_refcount(vnp) = 0;	/* no context switches */
+	Vn_stateFlags(vnp) |= VN_ON_LRU;
+#ifdef AFS_DEMAND_ATTACH_FS
+	CV_INIT(&Vn_stateCV(vnp), "vnode state", CV_DEFAULT, 0);
+	Vn_state(vnp) = VN_STATE_INVALID;
+	Vn_readers(vnp) = 0;
+#else /* !AFS_DEMAND_ATTACH_FS */
+	Lock_Init(&vnp->lock);
+#endif /* !AFS_DEMAND_ATTACH_FS */
+	vnp->changed_oldTime = 0;
+	vnp->changed_newTime = 0;
+	Vn_volume(vnp) = NULL;
+	Vn_cacheCheck(vnp) = 0;
+	vnp->delete = Vn_id(vnp) = 0;
+#ifdef AFS_PTHREAD_ENV
+	vnp->writer = (pthread_t) 0;
+#else /* AFS_PTHREAD_ENV */
+	vnp->writer = (PROCESS) 0;
+#endif /* AFS_PTHREAD_ENV */
+	vnp->hashIndex = 0;
+	vnp->handle = NULL;
+	Vn_class(vnp) = vcp;
+	VnLRUInsert(&vcp->lruHead, vnp);
+	vcp->nCold++;
+	va += vcp->residentSize;
+    }
+}
+
 /**
  * initialize vnode cache for a given vnode class.
  *
@@ -322,21 +639,22 @@ VInvalidateVnode_r(struct Vnode *avnode)
 int
 VInitVnodes(VnodeClass class, int nVnodes)
 {
-    byte *va;
     struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
 
     vcp->allocs = vcp->gets = vcp->reads = vcp->writes = 0;
-    vcp->cacheSize = nVnodes;
+    vcp->hotEvicts = vcp->lastGets = vcp->lastHotEvicts = 0;
+    vcp->pageHits = 0;
+    vcp->cacheSize = vcp->maxSize = 0;
+    vcp->lruHead = vcp->hotHead = NULL;
+    vcp->nCold = vcp->nHot = 0;
     switch (class) {
     case vSmall:
 	opr_Assert(CHECKSIZE_SMALLVNODE);
-	vcp->lruHead = NULL;
 	vcp->residentSize = SIZEOF_SMALLVNODE;
 	vcp->diskSize = SIZEOF_SMALLDISKVNODE;
 	vcp->magic = SMALLVNODEMAGIC;
 	break;
     case vLarge:
-	vcp->lruHead = NULL;
 	vcp->residentSize = SIZEOF_LARGEVNODE;
 	vcp->diskSize = SIZEOF_LARGEDISKVNODE;
 	vcp->magic = LARGEVNODEMAGIC;
@@ -353,46 +671,76 @@ VInitVnodes(VnodeClass class, int nVnodes)
     if (nVnodes == 0)
 	return 0;
 
-    va = (byte *) calloc(nVnodes, vcp->residentSize);
-    opr_Assert(va != NULL);
-    while (nVnodes--) {
-	Vnode *vnp = (Vnode *) va;
-	Vn_refcount(vnp) = 0;	/* no context switches */
-	Vn_stateFlags(vnp) |= VN_ON_LRU;
-#ifdef AFS_DEMAND_ATTACH_FS
-	CV_INIT(&Vn_stateCV(vnp), "vnode state", CV_DEFAULT, 0);
-	Vn_state(vnp) = VN_STATE_INVALID;
-	Vn_readers(vnp) = 0;
-#else /* !AFS_DEMAND_ATTACH_FS */
-	Lock_Init(&vnp->lock);
-#endif /* !AFS_DEMAND_ATTACH_FS */
-	vnp->changed_oldTime = 0;
-	vnp->changed_newTime = 0;
-	Vn_volume(vnp) = NULL;
-	Vn_cacheCheck(vnp) = 0;
-	vnp->delete = Vn_id(vnp) = 0;
-#ifdef AFS_PTHREAD_ENV
-	vnp->writer = (pthread_t) 0;
-#else /* AFS_PTHREAD_ENV */
-	vnp->writer = (PROCESS) 0;
-#endif /* AFS_PTHREAD_ENV */
-	vnp->hashIndex = 0;
-	vnp->handle = NULL;
-	Vn_class(vnp) = vcp;
-	if (vcp->lruHead == NULL)
-	    vcp->lruHead = vnp->lruNext = vnp->lruPrev = vnp;
-	else {
-	    vnp->lruNext = vcp->lruHead;
-	    vnp->lruPrev = vcp->lruHead->lruPrev;
-	    vcp->lruHead->lruPrev = vnp;
-	    vnp->lruPrev->lruNext = vnp;
-	    vcp->lruHead = vnp;
-	}
-	va += vcp->residentSize;
-    }
+    VAddVnodes(vcp, nVnodes);
+    VResizeVnodeHash_r();
     return 0;
 }
 
+/**
+ * grow the vnode cache for a given vnode class.
+ *
+ * @param[in] class    vnode class
+ * @param[in] nVnodes  new size of cache
+ *
+ * @pre VOL_LOCK held
+ *
+ * @post cache holds at least nVnodes vnodes; the vnode hash table has
+ *       been resized to match
+ *
+ * @note vnode objects are never freed, so the cache cannot shrink.
+ *
+ * @return 0 on success, EINVAL if nVnodes is smaller than the cache
+ *
+ * @internal volume package internal use only
+ */
+int
+VGrowVnodes_r(VnodeClass class, int nVnodes)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    int old = vcp->cacheSize;
+
+    if (nVnodes < old)
+	return EINVAL;
+    if (nVnodes == old)
+	return 0;
+    VAddVnodes(vcp, nVnodes - old);
+    VResizeVnodeHash_r();
+    Log("%s vnode cache grown from %d to %d entries\n",
+	class == vLarge ? "Large" : "Small", old, vcp->cacheSize);
+    return 0;
+}
+
+/**
+ * grow a vnode class's cache if its hot vnodes no longer fit.
+ *
+ * @param[in] vcp  vnode class info object pointer
+ *
+ * @pre VOL_LOCK held
+ *
+ * @note Only reuse of hot vnodes counts towards growth; vnodes that are
+ *       used once and then reused, as in a scan over a volume, do not.
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VCheckGrowVnodes_r(struct VnodeClassInfo *vcp)
+{
+    int size;
+
+    if (vcp->maxSize <= vcp->cacheSize
+	|| vcp->gets - vcp->lastGets < VNODE_GROW_WINDOW)
+	return;
+
+    if (vcp->hotEvicts - vcp->lastHotEvicts >= VNODE_GROW_HOT_EVICTS) {
+	size = vcp->cacheSize + vcp->cacheSize / VNODE_GROW_FRACTION + 1;
+	if (size > vcp->maxSize)
+	    size = vcp->maxSize;
+	VGrowVnodes_r(vcp == &VnodeClassInfo[vLarge] ? vLarge : vSmall, size);
+    }
+    vcp->lastGets = vcp->gets;
+    vcp->lastHotEvicts = vcp->hotEvicts;
+}
+
 
 /**
  * allocate an unused vnode from the lru chain.
@@ -430,7 +778,20 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
 {
     Vnode *vnp;
 
-    vnp = vcp->lruHead->lruPrev;
+    VCheckGrowVnodes_r(vcp);
+
+    /* reuse a cold vnode unless the hot ones have been squeezed into
+     * less than their share of the cache */
+    if (vcp->lruHead != NULL
+	&& (vcp->hotHead == NULL
+	    || vcp->nCold * VNODE_COLD_FRACTION > vcp->cacheSize)) {
+	vnp = vcp->lruHead->lruPrev;
+    } else if (vcp->hotHead != NULL) {
+	vnp = vcp->hotHead->lruPrev;
+	vcp->hotEvicts++;
+    } else {
+	Abort("VGetFreeVnode_r: no free vnodes in cache\n");
+    }
 #ifdef AFS_DEMAND_ATTACH_FS
     if (Vn_refcount(vnp) != 0 || VnIsExclusiveState(Vn_state(vnp)) ||
 	Vn_readers(vnp) != 0)
@@ -452,6 +813,7 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
     if (Vn_volume(vnp)) {
 	DeleteFromVVnList(vnp);
     }
+    Vn_stateFlags(vnp) &= ~VN_HOT;
 
     /* we must re-hash the vnp _before_ we drop the glock again; otherwise,
      * someone else might try to grab the same vnode id, and we'll both alloc
@@ -514,6 +876,9 @@ VLookupVnode(Volume * vp, VnodeId vnodeId)
     Vnode * vnp;
     unsigned int newHash;
 
+    if (VnodeHashTable == NULL)
+	return NULL;
+
     newHash = VNODE_HASH(vp, vnodeId);
     for (vnp = VnodeHashTable[newHash];
 	 (vnp &&
@@ -915,8 +1280,12 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
     int dosalv = 1;
     ssize_t nBytes;
     IHandle_t *ihP = vp->vnodeIndex[class].handle;
-    FdHandle_t *fdP;
+    FdHandle_t *fdP = NULL;
     afs_ino_str_t stmp;
+    afs_foff_t offset, pageoff;
+    struct VnodeIndexPage *pp;
+    afs_uint32 gen;
+    char *page;
 
     *ec = 0;
     vcp->reads++;
@@ -928,15 +1297,55 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
     /* This will never block */
     VnLock(vnp, WRITE_LOCK, VOL_LOCK_HELD, WILL_NOT_DEADLOCK);
 
+    offset = vnodeIndexOffset(vcp, Vn_id(vnp));
+    pageoff = offset & ~((afs_foff_t)VNODE_PAGE_SIZE - 1);
+    if (VnodePages != NULL
+	&& (pp = VnPageLookup_r(vp, class, pageoff)) != NULL
+	&& offset - pageoff + vcp->diskSize <= pp->valid) {
+	memcpy(&vnp->disk, pp->data + (offset - pageoff), vcp->diskSize);
+	queue_Remove(&pp->lru);
+	queue_Prepend(&VnodePageLRU, &pp->lru);
+	vcp->pageHits++;
+	goto loaded;
+    }
+    gen = VnodePageGen[VNODE_PAGE_HASH(vp->cacheCheck, class, pageoff)];
+
     VOL_UNLOCK;
+    page = malloc(VNODE_PAGE_SIZE);
     fdP = IH_OPEN(ihP);
     if (fdP == NULL) {
 	Log("VnLoad: can't open index dev=%u, i=%s\n", vp->device,
 	    PrintInode(stmp, vp->vnodeIndex[class].handle->ih_ino));
 	*ec = VIO;
+	free(page);
 	goto error_encountered_nolock;
-    } else if ((nBytes = FDH_PREAD(fdP, (char *)&vnp->disk, vcp->diskSize, vnodeIndexOffset(vcp, Vn_id(vnp))))
-	       != vcp->diskSize) {
+    }
+    if (page != NULL) {
+	/* read the whole page, and pick our vnode out of it */
+	ssize_t pageBytes = FDH_PREAD(fdP, page, VNODE_PAGE_SIZE, pageoff);
+	nBytes = pageBytes;
+	if (nBytes >= 0) {
+	    nBytes -= offset - pageoff;
+	    if (nBytes < 0)
+		nBytes = 0;
+	    else if (nBytes > vcp->diskSize)
+		nBytes = vcp->diskSize;
+	    memcpy(&vnp->disk, page + (offset - pageoff), nBytes);
+	}
+	if (nBytes == vcp->diskSize) {
+	    FDH_CLOSE(fdP);
+	    VOL_LOCK;
+	    if (gen == VnodePageGen[VNODE_PAGE_HASH(vp->cacheCheck, class,
+						     pageoff)])
+		VnPageInsert_r(vp, class, pageoff, page, pageBytes);
+	    free(page);
+	    goto loaded;
+	}
+	free(page);
+    } else {
+	nBytes = FDH_PREAD(fdP, (char *)&vnp->disk, vcp->diskSize, offset);
+    }
+    if (nBytes != vcp->diskSize) {
 	/* Don't take volume off line if the inumber is out of range
 	 * or the inode table is full. */
 	if (nBytes == BAD_IGET) {
@@ -960,6 +1369,7 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
     FDH_CLOSE(fdP);
     VOL_LOCK;
 
+ loaded:
     /* Quick check to see that the data is reasonable */
     if (vnp->disk.vnodeMagic != vcp->magic || vnp->disk.type == vNull) {
 	if (vnp->disk.type == vNull) {
@@ -1094,6 +1504,7 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
     }
 
     VOL_LOCK;
+    VnPageStore_r(vp, class, offset, &vnp->disk, vcp->diskSize);
 #ifdef AFS_DEMAND_ATTACH_FS
     VnChangeState_r(vnp, vn_state_save);
 #endif
@@ -1113,6 +1524,96 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
 #endif
 }
 
+/**
+ * warm the vnode index page cache for a batch of vnodes.
+ *
+ * callers about to fetch a number of vnodes from one volume (such as a
+ * bulk status request for a directory listing) may use this to replace
+ * the index read done for each uncached vnode with one read per vnode
+ * class.  the pages read go into the index page cache, from which
+ * VGetVnode then loads the vnodes as usual.
+ *
+ * @param[in] vp       volume object
+ * @param[in] vnodes   vnode ids about to be fetched
+ * @param[in] nvnodes  number of vnode ids
+ *
+ * @pre heavyweight ref held on volume object; VOL_LOCK not held.
+ */
+void
+VPrefetchVnodes(Volume * vp, VnodeId * vnodes, int nvnodes)
+{
+    VnodeClass class;
+    struct VnodeClassInfo *vcp;
+    IHandle_t *ihP;
+    FdHandle_t *fdP;
+    afs_foff_t off, lo = 0, hi = 0;
+    afs_uint32 gens[VNODE_PREFETCH_MAX / VNODE_PAGE_SIZE + 2];
+    ssize_t nBytes;
+    int i, nmiss, npages, valid;
+    char *buf;
+
+    for (class = 0; class < nVNODECLASSES; class++) {
+	vcp = &VnodeClassInfo[class];
+	nmiss = 0;
+
+	VOL_LOCK;
+	ihP = vp->vnodeIndex[class].handle;
+	for (i = 0; ihP && i < nvnodes; i++) {
+	    if (vnodes[i] == 0 || vnodeIdToClass(vnodes[i]) != class)
+		continue;
+	    if (VLookupVnode(vp, vnodes[i]))
+		continue;
+	    off = vnodeIndexOffset(vcp, vnodes[i]);
+	    if (nmiss == 0 || off < lo)
+		lo = off;
+	    if (nmiss == 0 || off > hi)
+		hi = off;
+	    nmiss++;
+	}
+
+	/* a lone miss is read by VnLoad anyway, and a widely scattered
+	 * batch is not worth reading all the gaps for */
+	if (nmiss < 2 || hi - lo >= VNODE_PREFETCH_MAX) {
+	    VOL_UNLOCK;
+	    continue;
+	}
+	lo &= ~((afs_foff_t)VNODE_PAGE_SIZE - 1);
+	hi = (hi + vcp->diskSize + VNODE_PAGE_SIZE - 1)
+	    & ~((afs_foff_t)VNODE_PAGE_SIZE - 1);
+	npages = (hi - lo) / VNODE_PAGE_SIZE;
+
+	/* as in VnLoad, a page a store may have raced with is not cached */
+	for (i = 0; i < npages; i++)
+	    gens[i] = VnodePageGen[VNODE_PAGE_HASH(vp->cacheCheck, class,
+						   lo + i * VNODE_PAGE_SIZE)];
+	VOL_UNLOCK;
+
+	buf = malloc(hi - lo);
+	if (buf == NULL)
+	    continue;
+	nBytes = -1;
+	fdP = IH_OPEN(ihP);
+	if (fdP != NULL) {
+	    nBytes = FDH_PREAD(fdP, buf, hi - lo, lo);
+	    FDH_CLOSE(fdP);
+	}
+
+	VOL_LOCK;
+	for (i = 0; i < npages && nBytes > (ssize_t)i * VNODE_PAGE_SIZE; i++) {
+	    off = lo + i * VNODE_PAGE_SIZE;
+	    if (gens[i] != VnodePageGen[VNODE_PAGE_HASH(vp->cacheCheck, class,
+							 off)])
+		continue;
+	    valid = nBytes - i * VNODE_PAGE_SIZE;
+	    if (valid > VNODE_PAGE_SIZE)
+		valid = VNODE_PAGE_SIZE;
+	    VnPageInsert_r(vp, class, off, buf + i * VNODE_PAGE_SIZE, valid);
+	}
+	VOL_UNLOCK;
+	free(buf);
+    }
+}
+
 /**
  * get a handle to a vnode object.
  *
@@ -1214,6 +1715,7 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 
 	VNLog(101, 2, vnodeNumber, (intptr_t)vnp, 0, 0);
 	VnCreateReservation_r(vnp);
+	Vn_stateFlags(vnp) |= VN_HOT;
 
 #ifdef AFS_DEMAND_ATTACH_FS
 	/*
@@ -1615,8 +2117,10 @@ VInvalidateVnodesByVolume_r(Volume * vp,
 #ifdef AFS_DEMAND_ATTACH_FS
     VOL_LOCK;
 #endif
-    if (ih_vec == NULL)
+    if (ih_vec == NULL) {
+	VnPageInvalidate_r(vp);
 	return ENOMEM;
+    }
 
     /*
      * Traverse the volume's vnode list.  Pull all the ihandles out into a
@@ -1660,6 +2164,7 @@ restart_traversal:
     }
 
  done:
+    VnPageInvalidate_r(vp);
     *vec_out = ih_vec;
     *vec_len_out = i;
 
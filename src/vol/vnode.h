@@ -66,7 +66,11 @@ typedef int VnodeClass;
 #define nVNODECLASSES	(VNODECLASSMASK+1)
 
 struct VnodeClassInfo {
-    struct Vnode *lruHead;	/* Head of list of vnodes of this class */
+    struct Vnode *lruHead;	/* Head of list of unused vnodes of this
+				 * class that were used only once */
+    struct Vnode *hotHead;	/* Head of list of unused vnodes of this
+				 * class that were used more than once */
+    int nCold, nHot;		/* Lengths of the two lists */
     int diskSize;		/* size of vnode disk object, power of 2 */
     int logSize;		/* log 2 diskSize */
     int residentSize;		/* resident size of vnode */
@@ -80,6 +84,11 @@ struct VnodeClassInfo {
     int gets, reads;		/* Number of VGetVnodes and corresponding
 				 * reads */
     int writes;			/* Number of vnode writes */
+    int pageHits;		/* Number of reads found in the index
+				 * page cache */
+    int maxSize;		/* Largest cacheSize may grow to */
+    int hotEvicts;		/* Number of hot vnodes reused */
+    int lastGets, lastHotEvicts; /* Counters as of the last resize check */
 };
 
 extern struct VnodeClassInfo VnodeClassInfo[nVNODECLASSES];
@@ -220,6 +229,9 @@ enum VnFlags {
     VN_ON_HASH            = 0x1,        /**< vnode is on hash table */
     VN_ON_LRU             = 0x2,        /**< vnode is on lru list */
     VN_ON_VVN             = 0x4,        /**< vnode is on volume vnode list */
+    VN_HOT                = 0x8,        /**< vnode was found in the cache at
+					 *   least once since it was loaded */
+    VN_ON_HOT             = 0x10,       /**< vnode is on the hot lru list */
     VN_FLAGS_END
 };
 
@@ -327,12 +339,14 @@ typedef struct Vnode {
 /*extern int VolumeHashOffset(); */
 extern int VolumeHashOffset_r(void);
 extern int VInitVnodes(VnodeClass class, int nVnodes);
+extern int VGrowVnodes_r(VnodeClass class, int nVnodes);
 /*extern VInitVnodes_r();*/
 extern Vnode *VGetVnode(Error * ec, struct Volume *vp, VnodeId vnodeNumber,
 			int locktype);
 extern Vnode *VGetVnode_r(Error * ec, struct Volume *vp, VnodeId vnodeNumber,
 			  int locktype);
 extern void VPutVnode(Error * ec, Vnode * vnp);
+extern void VPrefetchVnodes(struct Volume *vp, VnodeId * vnodes, int nvnodes);
 extern void VPutVnode_r(Error * ec, Vnode * vnp);
 extern int VVnodeWriteToRead(Error * ec, Vnode * vnp);
 extern int VVnodeWriteToRead_r(Error * ec, Vnode * vnp);
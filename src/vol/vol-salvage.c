@@ -197,6 +197,8 @@ int ListInodeOption;		/* -i flag */
 int ShowRootFiles;		/* -r flag */
 int RebuildDirs;		/* -sal flag */
 int Parallel = 4;		/* -para X flag */
+int ParallelGroups = 1;		/* -vgparallel X flag */
+int ListThreads = 1;		/* -listthreads X flag */
 int PartsPerDisk = 8;		/* Salvage up to 8 partitions on same disk sequentially */
 int forceR = 0;			/* -b flag */
 int ShowLog = 0;		/* -showlog flag */
@@ -263,6 +265,11 @@ struct SalvInfo {
                                                 *   at */
     int useFSYNC; /**< 0 if the fileserver is unavailable; 1 if we should try
                    *   to contact the fileserver over FSYNC */
+    int nGroupJobs; /**< Number of forked volume group salvages that have
+                     *   not been waited for yet */
+    struct InodeMerge *inodeMerge; /**< merge of the sorted inode runs, which
+                                    *   produces inodeSummary a volume at a
+                                    *   time */
 };
 
 char *tmpdir = NULL;
@@ -277,6 +284,12 @@ static int AskVolumeSummary(struct SalvInfo *salvinfo,
                             VolumeId singleVolumeNumber);
 static void MaybeAskOnline(struct SalvInfo *salvinfo, VolumeId volumeId);
 static void AskError(struct SalvInfo *salvinfo, VolumeId volumeId);
+static void WaitGroupJob(struct SalvInfo *salvinfo);
+static int GetVolumeInodeSummary(struct SalvInfo *salvinfo, int i);
+static void ReleaseInodeMerge(struct SalvInfo *salvinfo);
+#ifdef AFS_NAMEI_ENV
+static int ListAndSalvageGroups(struct SalvInfo *salvinfo, FD_t inodeFile);
+#endif
 
 #ifdef AFS_DEMAND_ATTACH_FS
 static int LockVolume(struct SalvInfo *salvinfo, VolumeId volumeId);
@@ -706,6 +719,8 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
     struct SalvInfo *salvinfo = &l_salvinfo;
 
  retry:
+    if (tries > 0)
+	ReleaseInodeMerge(salvinfo);
     memset(salvinfo, 0, sizeof(*salvinfo));
 
     tries++;
@@ -834,15 +849,36 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 	Log("Error %d when trying to unlink %s\n", errno, inodeListPath);
     }
 
+#ifdef AFS_NAMEI_ENV
+    if (!singleVolumeNumber && !ListInodeOption && ListThreads <= 1) {
+	/* salvage each volume group as soon as it has been listed; see
+	 * ListAndSalvageGroups */
+	if (GetVolumeSummary(salvinfo, singleVolumeNumber)) {
+	    goto retry;
+	}
+	vsp = salvinfo->volumeSummaryp;
+	esp = vsp + salvinfo->nVolumes;
+	if (ListAndSalvageGroups(salvinfo, inodeFile) < 0) {
+	    while (salvinfo->nGroupJobs > 0)
+		WaitGroupJob(salvinfo);
+	    OS_CLOSE(inodeFile);
+	    return;
+	}
+	goto salvaged;
+    }
+#endif
+
     if (GetInodeSummary(salvinfo, inodeFile, singleVolumeNumber) < 0) {
+	ReleaseInodeMerge(salvinfo);
 	OS_CLOSE(inodeFile);
 	return;
     }
-    salvinfo->inodeFd = inodeFile;
     if (salvinfo->inodeFd == INVALID_FD)
 	Abort("Temporary file %s is missing...\n", inodeListPath);
-    OS_SEEK(salvinfo->inodeFd, 0L, SEEK_SET);
     if (ListInodeOption) {
+	/* the listing wants the whole merged file */
+	GetVolumeInodeSummary(salvinfo, INT_MAX);
+	OS_SEEK(salvinfo->inodeFd, 0L, SEEK_SET);
 	PrintInodeList(salvinfo);
 	if (singleVolumeNumber) {
 	    /* We've checked out the volume from the fileserver, and we need
@@ -852,6 +888,8 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 	     * AskOnline if it is readable. */
 	    MaybeAskOnline(salvinfo, singleVolumeNumber);
 	}
+	ReleaseInodeMerge(salvinfo);
+	OS_CLOSE(inodeFile);
 	return;
     }
     /* enumerate volumes in the partition.
@@ -874,11 +912,13 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 	canfork = 0;
     }
 
+    /* The inode summaries are merged in as the loop asks for them, so the
+     * volume groups salvaged so far run while the rest are being merged. */
     for (i = j = 0, vsp = salvinfo->volumeSummaryp, esp = vsp + salvinfo->nVolumes;
-	 i < salvinfo->nVolumesInInodeFile; i = j) {
+	 GetVolumeInodeSummary(salvinfo, i); i = j) {
 	VolumeId rwvid = salvinfo->inodeSummary[i].RWvolumeId;
 	for (j = i;
-	     j < salvinfo->nVolumesInInodeFile && salvinfo->inodeSummary[j].RWvolumeId == rwvid;
+	     GetVolumeInodeSummary(salvinfo, j) && salvinfo->inodeSummary[j].RWvolumeId == rwvid;
 	     j++) {
 	    VolumeId vid = salvinfo->inodeSummary[j].volumeId;
 	    struct VolumeSummary *tsp;
@@ -911,6 +951,15 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 #endif /* AFS_NT40_ENV */
 
     }
+    Log("%d nVolumesInInodeFile %lu \n", salvinfo->nVolumesInInodeFile,
+	(unsigned long)(salvinfo->nVolumesInInodeFile
+			* sizeof(struct InodeSummary)));
+
+#ifdef AFS_NAMEI_ENV
+  salvaged:
+#endif
+    while (salvinfo->nGroupJobs > 0)
+	WaitGroupJob(salvinfo);
 
     /* Delete any additional volumes that were listed in the partition but which didn't have any corresponding inodes */
     for (; vsp < esp; vsp++) {
@@ -966,6 +1015,7 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 		salvinfo->fileSysPartition->name, (Testing ? " (READONLY mode)" : ""));
     }
 
+    ReleaseInodeMerge(salvinfo);
     OS_CLOSE(inodeFile);		/* SalvageVolumeGroup was the last which needed it. */
 }
 
@@ -1141,6 +1191,329 @@ OnlyOneVolume(struct ViceInodeInfo *inodeinfo, VolumeId singleVolumeNumber, void
     return (inodeinfo->u.vnode.volumeId == singleVolumeNumber);
 }
 
+/*
+ * GetInodeSummary sorts the partition's inode list in runs of at most
+ * SALV_SORT_RUN inodes, each sorted in memory and written back in place.
+ * The runs are merged into a second file one volume at a time, as the
+ * salvage asks for the next volume's summary, so memory use does not grow
+ * with the number of inodes on the partition and the first volume groups
+ * are salvaged while later ones are still being merged.  A list that fits
+ * in a single run is simply read back in order.
+ */
+#define SALV_SORT_RUN	(1024 * 1024)	/* inodes sorted in memory at once */
+#define SALV_MERGE_BUF	1024		/* inodes buffered per run */
+
+struct InodeRun {
+    afs_foff_t next;		/* index of the next inode to read */
+    afs_foff_t end;		/* index just past the run's last inode */
+    struct ViceInodeInfo *buf;	/* inodes read ahead from the run */
+    int pos;			/* next inode in buf */
+    int len;			/* number of inodes in buf */
+};
+
+struct InodeMerge {
+    FD_t inFd;			/* the inode list, sorted in runs */
+    FD_t outFd;			/* the merged list; inFd if only one run */
+    int nRuns;
+    struct InodeRun *runs;
+    int *heap;			/* unfinished runs, lowest head inode first */
+    int nHeap;
+    struct ViceInodeInfo *out;	/* merged inodes not yet written */
+    int nOut;
+    int nMerged;		/* inodes merged so far */
+    int nSummaries;		/* room in salvinfo->inodeSummary */
+};
+
+static_inline struct ViceInodeInfo *
+RunHead(struct InodeMerge *m, int r)
+{
+    return &m->runs[r].buf[m->runs[r].pos];
+}
+
+/* refill the read ahead buffer of run r; returns the number of inodes read */
+static int
+FillRun(struct InodeMerge *m, int r)
+{
+    struct InodeRun *run = &m->runs[r];
+    size_t size;
+
+    run->pos = 0;
+    run->len = 0;
+    if (run->next < run->end) {
+	run->len = run->end - run->next;
+	if (run->len > SALV_MERGE_BUF)
+	    run->len = SALV_MERGE_BUF;
+	size = run->len * sizeof(struct ViceInodeInfo);
+	if (OS_PREAD(m->inFd, run->buf, size,
+		     run->next * sizeof(struct ViceInodeInfo)) != size)
+	    Abort("Unable to read inode table\n");
+	run->next += run->len;
+    }
+    return run->len;
+}
+
+static void
+SiftDown(struct InodeMerge *m, int i)
+{
+    int child, r = m->heap[i];
+
+    while ((child = 2 * i + 1) < m->nHeap) {
+	if (child + 1 < m->nHeap
+	    && CompareInodes(RunHead(m, m->heap[child + 1]),
+			     RunHead(m, m->heap[child])) < 0)
+	    child++;
+	if (CompareInodes(RunHead(m, m->heap[child]), RunHead(m, r)) >= 0)
+	    break;
+	m->heap[i] = m->heap[child];
+	i = child;
+    }
+    m->heap[i] = r;
+}
+
+static void
+FlushMerged(struct InodeMerge *m)
+{
+    size_t size = m->nOut * sizeof(struct ViceInodeInfo);
+
+    if (m->nOut == 0)
+	return;
+    if (OS_PWRITE(m->outFd, m->out, size,
+		  (afs_foff_t)(m->nMerged - m->nOut)
+		  * sizeof(struct ViceInodeInfo)) != size)
+	Abort("Unable to write merged inode table\n");
+    m->nOut = 0;
+}
+
+/**
+ * sort the inode list in runs and set up their merge.
+ *
+ * @param[in] salvinfo   salvage state; salvinfo->inodeFd is the inode list
+ * @param[in] base       index of the first inode to sort
+ * @param[in] nInodes    number of inodes to sort from there
+ * @param[in] mergeFile  file to merge into, or INVALID_FD if nInodes fits
+ *                       in a single run; the merged inodes keep their
+ *                       indices
+ *
+ * @return operation status
+ *  @retval 0 success; summaries are produced by GetVolumeInodeSummary
+ *  @retval -1 out of memory or I/O error
+ *
+ * @post salvinfo->inodeFd is the file the sorted inodes will be in
+ */
+static int
+SortInodeRuns(struct SalvInfo *salvinfo, int base, int nInodes,
+	      FD_t mergeFile)
+{
+    struct InodeMerge *m;
+    struct ViceInodeInfo *buf;
+    afs_foff_t off;
+    size_t size;
+    int r, n;
+
+    m = calloc(1, sizeof(*m));
+    if (m == NULL)
+	return -1;
+    salvinfo->inodeMerge = m;
+    m->inFd = salvinfo->inodeFd;
+    m->outFd = (mergeFile != INVALID_FD) ? mergeFile : m->inFd;
+    m->nMerged = base;
+    m->nRuns = (nInodes + SALV_SORT_RUN - 1) / SALV_SORT_RUN;
+    m->runs = calloc(m->nRuns, sizeof(*m->runs));
+    m->heap = calloc(m->nRuns, sizeof(*m->heap));
+    m->out = malloc(SALV_MERGE_BUF * sizeof(*m->out));
+    n = (nInodes < SALV_SORT_RUN) ? nInodes : SALV_SORT_RUN;
+    buf = malloc(n * sizeof(*buf));
+    if (m->runs == NULL || m->heap == NULL || m->out == NULL || buf == NULL) {
+	free(buf);
+	return -1;
+    }
+
+    for (r = 0; r < m->nRuns; r++) {
+	off = (afs_foff_t)r * SALV_SORT_RUN;
+	n = nInodes - off;
+	off += base;
+	if (n > SALV_SORT_RUN)
+	    n = SALV_SORT_RUN;
+	size = n * sizeof(*buf);
+	if (OS_PREAD(m->inFd, buf, size, off * sizeof(*buf)) != size) {
+	    free(buf);
+	    return -1;
+	}
+	qsort(buf, n, sizeof(*buf), CompareInodes);
+	if (OS_PWRITE(m->inFd, buf, size, off * sizeof(*buf)) != size) {
+	    free(buf);
+	    return -1;
+	}
+
+	m->runs[r].next = off;
+	m->runs[r].end = off + n;
+	m->runs[r].buf = malloc(SALV_MERGE_BUF * sizeof(*buf));
+	if (m->runs[r].buf == NULL) {
+	    free(buf);
+	    return -1;
+	}
+	FillRun(m, r);
+	m->heap[m->nHeap++] = r;
+    }
+    free(buf);
+    for (r = m->nHeap / 2 - 1; r >= 0; r--)
+	SiftDown(m, r);
+
+    salvinfo->inodeFd = m->outFd;
+    if (m->nRuns > 1)
+	Log("Merging %d sorted runs of %d inodes\n", m->nRuns, SALV_SORT_RUN);
+    return 0;
+}
+
+/**
+ * merge the inodes of the next volume and summarize them.
+ *
+ * @param[in] salvinfo  salvage state
+ *
+ * @return whether another volume was summarized
+ */
+static int
+MergeNextVolume(struct SalvInfo *salvinfo)
+{
+    struct InodeMerge *m = salvinfo->inodeMerge;
+    struct InodeSummary *summary;
+    struct ViceInodeInfo *ip;
+    VolumeId volume;
+    int r;
+
+    if (m == NULL || m->nHeap == 0)
+	return 0;
+
+    if (salvinfo->nVolumesInInodeFile == m->nSummaries) {
+	m->nSummaries = m->nSummaries ? 2 * m->nSummaries : 64;
+	salvinfo->inodeSummary = realloc(salvinfo->inodeSummary,
+					 m->nSummaries * sizeof(*summary));
+	opr_Assert(salvinfo->inodeSummary != NULL);
+    }
+    summary = &salvinfo->inodeSummary[salvinfo->nVolumesInInodeFile++];
+    memset(summary, 0, sizeof(*summary));
+    summary->index = m->nMerged;
+
+    /* as CountVolumeInodes, but one inode at a time */
+    volume = RunHead(m, m->heap[0])->u.vnode.volumeId;
+    summary->volumeId = summary->RWvolumeId = volume;
+    while (m->nHeap > 0
+	   && (ip = RunHead(m, (r = m->heap[0])))->u.vnode.volumeId == volume) {
+	summary->nInodes++;
+	if (ip->u.vnode.vnodeNumber == INODESPECIAL) {
+	    summary->nSpecialInodes++;
+	    summary->RWvolumeId = ip->u.special.parentId;
+	} else if (summary->maxUniquifier < ip->u.vnode.vnodeUniquifier) {
+	    summary->maxUniquifier = ip->u.vnode.vnodeUniquifier;
+	}
+
+	if (m->outFd != m->inFd) {
+	    m->out[m->nOut++] = *ip;
+	    m->nMerged++;
+	    if (m->nOut == SALV_MERGE_BUF)
+		FlushMerged(m);
+	} else {
+	    m->nMerged++;
+	}
+
+	if (++m->runs[r].pos == m->runs[r].len && FillRun(m, r) == 0) {
+	    m->heap[0] = m->heap[--m->nHeap];
+	    free(m->runs[r].buf);
+	    m->runs[r].buf = NULL;
+	}
+	if (m->nHeap > 0)
+	    SiftDown(m, 0);
+    }
+    /* a volume group salvage may read these inodes as soon as we return */
+    FlushMerged(m);
+    return 1;
+}
+
+/**
+ * make sure the summary of the i'th volume in the inode list is available.
+ *
+ * @param[in] salvinfo  salvage state
+ * @param[in] i         index into salvinfo->inodeSummary
+ *
+ * @return whether the inode list has an i'th volume
+ *
+ * @note salvinfo->inodeSummary may move; do not keep pointers into it
+ *       across calls
+ */
+static int
+GetVolumeInodeSummary(struct SalvInfo *salvinfo, int i)
+{
+    while (i >= salvinfo->nVolumesInInodeFile) {
+	if (!MergeNextVolume(salvinfo))
+	    return 0;
+    }
+    return 1;
+}
+
+/**
+ * free the inode merge state, and close the merged inode file.
+ *
+ * @param[in] salvinfo  salvage state
+ */
+static void
+ReleaseInodeMerge(struct SalvInfo *salvinfo)
+{
+    struct InodeMerge *m = salvinfo->inodeMerge;
+    int r;
+
+    if (m == NULL)
+	return;
+    if (m->runs != NULL) {
+	for (r = 0; r < m->nRuns; r++)
+	    free(m->runs[r].buf);
+	free(m->runs);
+    }
+    if (m->outFd != m->inFd && m->outFd != INVALID_FD)
+	OS_CLOSE(m->outFd);
+    free(m->heap);
+    free(m->out);
+    free(m);
+    salvinfo->inodeMerge = NULL;
+}
+
+/**
+ * create the unlinked temporary file sorted inode runs are merged into.
+ *
+ * @param[in] salvinfo  salvage state
+ *
+ * @return the open merge file
+ */
+static FD_t
+CreateMergeFile(struct SalvInfo *salvinfo)
+{
+    char mergeFileName[50];
+    char *tdir = (tmpdir ? tmpdir : salvinfo->fileSysPath);
+    FD_t mergeFile;
+    int code;
+
+#ifdef AFS_NT40_ENV
+    (void)_putenv("TMP=");	/* If "TMP" is set, then that overrides tdir. */
+    (void)strcpy(mergeFileName, _tempnam(tdir, "salvage.temp."));
+#else
+    snprintf(mergeFileName, sizeof mergeFileName,
+	     "%s" OS_DIRSEP "salvage.temp.%d", tdir, getpid());
+#endif
+    mergeFile = OS_OPEN(mergeFileName, O_RDWR|O_TRUNC|O_CREAT, 0666);
+    if (mergeFile == INVALID_FD) {
+	Abort("Unable to create merged inode file\n");
+    }
+#ifdef AFS_NT40_ENV
+    /* see the comment on the unlink of the inode file */
+    code = nt_unlink(mergeFileName);
+#else
+    code = unlink(mergeFileName);
+#endif
+    if (code < 0) {
+	Log("Error %d when trying to unlink %s\n", errno, mergeFileName);
+    }
+    return mergeFile;
+}
+
 /* GetInodeSummary
  *
  * Collect list of inodes in file named by path. If a truly fatal error,
@@ -1151,11 +1524,6 @@ int
 GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolumeNumber)
 {
     int forceSal, err;
-    int code;
-    struct ViceInodeInfo *ip, *ip_save;
-    struct InodeSummary summary;
-    char summaryFileName[50];
-    FD_t summaryFile = INVALID_FD;
 #ifdef AFS_NT40_ENV
     char *dev = salvinfo->fileSysPath;
     char *wpath = salvinfo->fileSysPath;
@@ -1163,12 +1531,11 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
     char *dev = salvinfo->fileSysDeviceName;
     char *wpath = salvinfo->filesysfulldev;
 #endif
-    char *part = salvinfo->fileSysPath;
-    char *tdir;
-    int i;
+    int nInodes;
     int retcode = 0;
     int deleted = 0;
     afs_sfsize_t st_size;
+    FD_t mergeFile = INVALID_FD;
 
     /* This file used to come from vfsck; cobble it up ourselves now... */
     if ((err =
@@ -1192,145 +1559,57 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
         (st_size = OS_SIZE(salvinfo->inodeFd)) == -1) {
 	Abort("No inode description file for \"%s\"; not salvaged\n", dev);
     }
-    tdir = (tmpdir ? tmpdir : part);
-#ifdef AFS_NT40_ENV
-    (void)_putenv("TMP=");	/* If "TMP" is set, then that overrides tdir. */
-    (void)strcpy(summaryFileName, _tempnam(tdir, "salvage.temp."));
-#else
-    snprintf(summaryFileName, sizeof summaryFileName,
-	     "%s" OS_DIRSEP "salvage.temp.%d", tdir, getpid());
-#endif
-    summaryFile = OS_OPEN(summaryFileName, O_RDWR|O_APPEND|O_CREAT, 0666);
-    if (summaryFile == INVALID_FD) {
-	Abort("Unable to create inode summary file\n");
-    }
+    nInodes = st_size / sizeof(struct ViceInodeInfo);
+    if (nInodes == 0) {
+	if (!singleVolumeNumber)	/* Remove the FORCESALVAGE file */
+	    RemoveTheForce(salvinfo->fileSysPath);
+	else {
+	    struct VolumeSummary *vsp;
+	    int i;
+	    int foundSVN = 0;
 
-#ifdef AFS_NT40_ENV
-    /* Using nt_unlink here since we're really using the delete on close
-     * semantics of unlink. In most places in the salvager, we really do
-     * mean to unlink the file at that point. Those places have been
-     * modified to actually do that so that the NT crt can be used there.
-     *
-     * jaltman - As commented elsewhere, this cannot work because fopen()
-     * does not open files with DELETE and FILE_SHARE_DELETE.
-     */
-    code = nt_unlink(summaryFileName);
-#else
-    code = unlink(summaryFileName);
-#endif
-    if (code < 0) {
-	Log("Error %d when trying to unlink %s\n", errno, summaryFileName);
-    }
+	    GetVolumeSummary(salvinfo, singleVolumeNumber);
 
-    if (!canfork || debug || Fork() == 0) {
-	int nInodes = st_size / sizeof(struct ViceInodeInfo);
-	if (nInodes == 0) {
-	    OS_CLOSE(summaryFile);
-	    if (!singleVolumeNumber)	/* Remove the FORCESALVAGE file */
-		RemoveTheForce(salvinfo->fileSysPath);
-	    else {
-		struct VolumeSummary *vsp;
-		int i;
-		int foundSVN = 0;
-
-		GetVolumeSummary(salvinfo, singleVolumeNumber);
-
-		for (i = 0, vsp = salvinfo->volumeSummaryp; i < salvinfo->nVolumes; i++) {
-		    if (vsp->unused) {
-			if (vsp->header.id == singleVolumeNumber) {
-			    foundSVN = 1;
-			}
-			DeleteExtraVolumeHeaderFile(salvinfo, vsp);
+	    for (i = 0, vsp = salvinfo->volumeSummaryp; i < salvinfo->nVolumes; i++) {
+		if (vsp->unused) {
+		    if (vsp->header.id == singleVolumeNumber) {
+			foundSVN = 1;
 		    }
+		    DeleteExtraVolumeHeaderFile(salvinfo, vsp);
 		}
+	    }
 
-		if (!foundSVN) {
-		    if (Testing) {
-			MaybeAskOnline(salvinfo, singleVolumeNumber);
-		    } else {
-			/* make sure we get rid of stray .vol headers, even if
-			 * they're not in our volume summary (might happen if
-			 * e.g. something else created them and they're not in the
-			 * fileserver VGC) */
-			VDestroyVolumeDiskHeader(salvinfo->fileSysPartition,
-			                         singleVolumeNumber, 0 /*parent*/);
-			AskDelete(salvinfo, singleVolumeNumber);
-		    }
+	    if (!foundSVN) {
+		if (Testing) {
+		    MaybeAskOnline(salvinfo, singleVolumeNumber);
+		} else {
+		    /* make sure we get rid of stray .vol headers, even if
+		     * they're not in our volume summary (might happen if
+		     * e.g. something else created them and they're not in the
+		     * fileserver VGC) */
+		    VDestroyVolumeDiskHeader(salvinfo->fileSysPartition,
+		                             singleVolumeNumber, 0 /*parent*/);
+		    AskDelete(salvinfo, singleVolumeNumber);
 		}
 	    }
-	    Log("%s vice inodes on %s; not salvaged\n",
-		singleVolumeNumber ? "No applicable" : "No", dev);
-	    retcode = -1;
-	    deleted = 1;
-	    goto error;
-	}
-	ip = malloc(nInodes*sizeof(struct ViceInodeInfo));
-	if (ip == NULL) {
-	    OS_CLOSE(summaryFile);
-	    Abort
-		("Unable to allocate enough space to read inode table; %s not salvaged\n",
-		 dev);
-	}
-	if (OS_READ(salvinfo->inodeFd, ip, st_size) != st_size) {
-	    OS_CLOSE(summaryFile);
-	    Abort("Unable to read inode table; %s not salvaged\n", dev);
-	}
-	qsort(ip, nInodes, sizeof(struct ViceInodeInfo), CompareInodes);
-	if (OS_SEEK(salvinfo->inodeFd, 0, SEEK_SET) == -1
-	    || OS_WRITE(salvinfo->inodeFd, ip, st_size) != st_size) {
-	    OS_CLOSE(summaryFile);
-	    Abort("Unable to rewrite inode table; %s not salvaged\n", dev);
-	}
-	summary.index = 0;
-	ip_save = ip;
-	while (nInodes) {
-	    CountVolumeInodes(ip, nInodes, &summary);
-	    if (OS_WRITE(summaryFile, &summary, sizeof(summary)) != sizeof(summary)) {
-		Log("Difficulty writing summary file (errno = %d); %s not salvaged\n", errno, dev);
-		OS_CLOSE(summaryFile);
-		retcode = -1;
-		goto error;
-	    }
-	    summary.index += (summary.nInodes);
-	    nInodes -= summary.nInodes;
-	    ip += summary.nInodes;
-	}
-	free(ip_save);
-	ip = ip_save = NULL;
-	/* Following fflush is not fclose, because if it was debug mode would not work */
-	if (OS_SYNC(summaryFile) == -1) {
-	    Log("Unable to write summary file (errno = %d); %s not salvaged\n", errno, dev);
-	    OS_CLOSE(summaryFile);
-	    retcode = -1;
-	    goto error;
-	}
-	if (canfork && !debug) {
-	    QuietExit(0);
-	}
-    } else {
-	if (Wait("Inode summary") == -1) {
-	    OS_CLOSE(summaryFile);
-	    Exit(1);		/* salvage of this partition aborted */
 	}
+	Log("%s vice inodes on %s; not salvaged\n",
+	    singleVolumeNumber ? "No applicable" : "No", dev);
+	retcode = -1;
+	deleted = 1;
+	goto error;
     }
 
-    st_size = OS_SIZE(summaryFile);
-    opr_Assert(st_size >= 0);
-    if (st_size != 0) {
-	int ret;
-	salvinfo->inodeSummary = malloc(st_size);
-	opr_Assert(salvinfo->inodeSummary != NULL);
-	/* For GNU we need to do lseek to get the file pointer moved. */
-	opr_Assert(OS_SEEK(summaryFile, 0, SEEK_SET) == 0);
-	ret = OS_READ(summaryFile, salvinfo->inodeSummary, st_size);
-	opr_Assert(ret == st_size);
+    if (nInodes > SALV_SORT_RUN) {
+	/* more than one sorted run; they are merged into a file of
+	 * their own */
+	mergeFile = CreateMergeFile(salvinfo);
     }
-    salvinfo->nVolumesInInodeFile = st_size / sizeof(struct InodeSummary);
-    for (i = 0; i < salvinfo->nVolumesInInodeFile; i++) {
-	salvinfo->inodeSummary[i].volSummary = NULL;
+    if (SortInodeRuns(salvinfo, 0, nInodes, mergeFile) < 0) {
+	Log("Unable to sort inode table; %s not salvaged\n", dev);
+	retcode = -1;
+	goto error;
     }
-    Log("%d nVolumesInInodeFile %lu \n",salvinfo->nVolumesInInodeFile,(unsigned long)st_size);
-    OS_CLOSE(summaryFile);
 
  error:
     if (retcode && singleVolumeNumber && !deleted) {
@@ -1340,6 +1619,170 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
     return retcode;
 }
 
+#ifdef AFS_NAMEI_ENV
+/*
+ * On namei, all of a volume group's inodes are in its own directory, so
+ * once that directory has been listed the group is complete.  A whole
+ * partition can then be salvaged a volume group at a time as it is being
+ * listed: each group's inodes are sorted and summarized on their own, and
+ * their volume headers are looked up in the volume summary, which is read
+ * first, instead of being merged against it in volume id order.  With
+ * -vgparallel the groups listed so far are salvaged in forked children
+ * while the listing goes on.
+ */
+
+/**
+ * state of a partition being listed and salvaged a volume group at a time.
+ */
+struct GroupListing {
+    struct SalvInfo *salvinfo;
+    FD_t inodeFile;		/* the inode list being written */
+    int nListed;		/* inodes listed before the current group */
+};
+
+/**
+ * find a volume's header in the volume summary, and mark it used.
+ *
+ * @param[in] salvinfo  salvage state; the volume summary is sorted by
+ *                      CompareVolumes
+ * @param[in] rwvid     the volume's group
+ * @param[in] vid       the volume
+ *
+ * @return the volume's summary, or NULL if it has no header
+ */
+static struct VolumeSummary *
+FindVolumeSummary(struct SalvInfo *salvinfo, VolumeId rwvid, VolumeId vid)
+{
+    struct VolumeSummary *vsp = salvinfo->volumeSummaryp;
+    int lo = 0, hi = salvinfo->nVolumes, mid;
+
+    /* find the group's first header */
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (vsp[mid].header.parent < rwvid)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    for (; lo < salvinfo->nVolumes && vsp[lo].header.parent == rwvid; lo++) {
+	if (vsp[lo].header.id == vid) {
+	    vsp[lo].unused = 0;
+	    return &vsp[lo];
+	}
+    }
+    return NULL;
+}
+
+/**
+ * salvage a volume group whose directory has just been listed.
+ *
+ * @param[in] rwid     the volume group
+ * @param[in] ninodes  number of inodes listed for it; they are the last
+ *                     ones in the inode file
+ * @param[in] rock     struct GroupListing
+ *
+ * @return 0 to go on listing, nonzero to stop
+ */
+static int
+SalvageListedGroup(VolumeId rwid, int ninodes, void *rock)
+{
+    struct GroupListing *gl = rock;
+    struct SalvInfo *salvinfo = gl->salvinfo;
+    FD_t mergeFile = INVALID_FD;
+    int base = gl->nListed;
+    int code = 0;
+    int i, j;
+
+    gl->nListed += ninodes;
+    if (ninodes == 0)
+	return 0;
+
+    /* the summaries only have to last until the group has been handed
+     * to DoSalvageVolumeGroup */
+    salvinfo->inodeFd = gl->inodeFile;
+    salvinfo->nVolumesInInodeFile = 0;
+    if (ninodes > SALV_SORT_RUN)
+	mergeFile = CreateMergeFile(salvinfo);
+    if (SortInodeRuns(salvinfo, base, ninodes, mergeFile) < 0) {
+	Log("Unable to sort the inodes of volume group %" AFS_VOLID_FMT "\n",
+	    afs_printable_VolumeId_lu(rwid));
+	if (salvinfo->inodeMerge == NULL && mergeFile != INVALID_FD)
+	    OS_CLOSE(mergeFile);
+	code = -1;
+	goto done;
+    }
+
+    /* a directory normally holds a single group, but group its volumes by
+     * their special inodes as the whole partition salvage does */
+    for (i = j = 0; GetVolumeInodeSummary(salvinfo, i); i = j) {
+	VolumeId rwvid = salvinfo->inodeSummary[i].RWvolumeId;
+	for (j = i;
+	     GetVolumeInodeSummary(salvinfo, j)
+	     && salvinfo->inodeSummary[j].RWvolumeId == rwvid;
+	     j++) {
+	    salvinfo->inodeSummary[j].volSummary =
+		FindVolumeSummary(salvinfo, rwvid,
+				  salvinfo->inodeSummary[j].volumeId);
+	}
+#ifdef AFS_NT40_ENV
+	nt_SalvageVolumeGroup(salvinfo, &salvinfo->inodeSummary[i], j - i);
+#else
+	DoSalvageVolumeGroup(salvinfo, &salvinfo->inodeSummary[i], j - i);
+#endif /* AFS_NT40_ENV */
+    }
+
+ done:
+    ReleaseInodeMerge(salvinfo);
+    salvinfo->inodeFd = gl->inodeFile;
+    return code;
+}
+
+/**
+ * list a whole partition's inodes, salvaging each volume group as soon as
+ * it has been listed.
+ *
+ * @param[in] salvinfo   salvage state; the volume summary has been read
+ * @param[in] inodeFile  file to list the inodes into
+ *
+ * @return operation status
+ *  @retval 0 success; forked group salvages may still be running
+ *  @retval -1 the partition has no inodes, or the inode file could not be
+ *             written; the error has been logged
+ */
+static int
+ListAndSalvageGroups(struct SalvInfo *salvinfo, FD_t inodeFile)
+{
+    struct GroupListing gl;
+#ifdef AFS_NT40_ENV
+    char *dev = salvinfo->fileSysPath;
+#else
+    char *dev = salvinfo->fileSysDeviceName;
+#endif
+    int err;
+
+    memset(&gl, 0, sizeof(gl));
+    gl.salvinfo = salvinfo;
+    gl.inodeFile = inodeFile;
+    salvinfo->inodeFd = inodeFile;
+
+    err = ListViceInodesByGroup(dev, salvinfo->fileSysPath, inodeFile, NULL,
+				SalvageListedGroup, &gl);
+    if (err < 0) {
+	if (err == -2) {
+	    Log("*** I/O error %d when writing a tmp inode file; Not salvaged %s ***\nIncrease space on partition or use '-tmpdir'\n", errno, dev);
+	    return -1;
+	}
+	Abort("Unable to get inodes for \"%s\"; not salvaged\n", dev);
+    }
+    if (gl.nListed == 0) {
+	RemoveTheForce(salvinfo->fileSysPath);
+	Log("No vice inodes on %s; not salvaged\n", dev);
+	return -1;
+    }
+    return 0;
+}
+#endif /* AFS_NAMEI_ENV */
+
 /* Comparison routine for volume sort.
    This is setup so that a read-write volume comes immediately before
    any read-only clones of that volume */
@@ -1964,6 +2407,20 @@ nt_SalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int n
 }
 #endif /* AFS_NT40_ENV */
 
+/**
+ * wait for one forked volume group salvage to finish.
+ *
+ * @param[in] salvinfo  salvage state for the partition
+ *
+ * @pre salvinfo->nGroupJobs > 0
+ */
+static void
+WaitGroupJob(struct SalvInfo *salvinfo)
+{
+    (void)Wait("Salvage volume group");
+    salvinfo->nGroupJobs--;
+}
+
 void
 DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nVols)
 {
@@ -1986,7 +2443,12 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
     if (ShowMounts && !haveRWvolume)
 	return;
     if (canfork && !debug && Fork() != 0) {
-	(void)Wait("Salvage volume group");
+	/* Volume groups share nothing on disk, so up to ParallelGroups
+	 * of them may be salvaged at once; SalvageFileSys1 reaps the
+	 * stragglers when the partition is done. */
+	salvinfo->nGroupJobs++;
+	while (salvinfo->nGroupJobs >= ParallelGroups)
+	    WaitGroupJob(salvinfo);
 	return;
     }
     for (i = 0, totalInodes = 0; i < nVols; i++)
@@ -1996,10 +2458,9 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
     allInodes = inodes - isp->index;	/* this would the base of all the inodes
 					 * for the partition, if all the inodes
 					 * had been read into memory */
-    opr_Verify(OS_SEEK
-	   (salvinfo->inodeFd, isp->index * sizeof(struct ViceInodeInfo),
-	    SEEK_SET) != -1);
-    opr_Verify(OS_READ(salvinfo->inodeFd, inodes, size) == size);
+    /* the inode file offset is shared with any sibling group salvages */
+    opr_Verify(OS_PREAD(salvinfo->inodeFd, inodes, size,
+			isp->index * sizeof(struct ViceInodeInfo)) == size);
 
     /* Don't try to salvage a read write volume if there isn't one on this
      * partition */
@@ -4737,7 +5198,7 @@ PrintInodeSummary(struct SalvInfo *salvinfo)
     int i;
     struct InodeSummary *isp;
 
-    for (i = 0; i < salvinfo->nVolumesInInodeFile; i++) {
+    for (i = 0; GetVolumeInodeSummary(salvinfo, i); i++) {
 	isp = &salvinfo->inodeSummary[i];
 	Log("VID:%" AFS_VOLID_FMT ", RW:%" AFS_VOLID_FMT ", index:%d, nInodes:%d, nSpecialInodes:%d, maxUniquifier:%u, volSummary\n", afs_printable_VolumeId_lu(isp->volumeId), afs_printable_VolumeId_lu(isp->RWvolumeId), isp->index, isp->nInodes, isp->nSpecialInodes, isp->maxUniquifier);
     }
@@ -125,6 +125,8 @@ extern int ListInodeOption;		/* -i flag */
 extern int ShowRootFiles;		/* -r flag */
 extern int RebuildDirs;		        /* -sal flag */
 extern int Parallel;		        /* -para X flag */
+extern int ParallelGroups;		/* -vgparallel X flag */
+extern int ListThreads;			/* -listthreads X flag */
 extern int PartsPerDisk;		/* Salvage up to 8 partitions on same disk sequentially */
 extern int forceR;			/* -b flag */
 extern int ShowLog;		        /* -showlog flag */
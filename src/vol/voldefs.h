@@ -71,6 +71,10 @@
 /* Maximum length (including trailing NUL) of a volume external path name. */
 #define VMAXPATHLEN 512
 
+/* File at the top of a vice partition in which the demand attach
+ * fileserver keeps its volume group cache across restarts. */
+#define VVGC_FILE "VGCache"
+
 #if defined(AFS_NAMEI_ENV) && !defined(AFS_NT40_ENV)
 
 /* INODEDIR holds all the inodes. Since it's name does not begin with "V"
@@ -239,12 +239,49 @@ typedef struct diskpartition_queue_t {
 
 #ifndef AFS_DEMAND_ATTACH_FS
 
+/**
+ * volumes found on one partition, to be attached at startup
+ */
+struct vinit_attach_part {
+    struct DiskPartition64 *diskP;     /**< disk partition table entry */
+    char **names;                      /**< volume header file names */
+    int nnames;                        /**< number of names found */
+    int next;                          /**< index of next name to attach */
+    int nAttached;                     /**< volumes attached */
+    int nUnattached;                   /**< volumes not attached */
+};
+
+/**
+ * startup attach scheduler state, protected by VOL_LOCK
+ *
+ * Each thread first takes a partition still to be scanned, if any, and
+ * reads the names of its volume headers.  After that it attaches volumes
+ * one at a time from its home partition, and steals from the partition
+ * with the most volumes left once its own runs out, so that every thread
+ * stays busy until the last volume on the last partition is attached.
+ */
 typedef struct vinitvolumepackage_thread_t {
-    struct rx_queue queue;
+    struct vinit_attach_part *parts;   /**< one entry per partition */
+    int nparts;                        /**< number of partitions */
+    int nextScan;                      /**< next partition to scan */
+    int nScanning;                     /**< scans in progress */
+    pthread_cond_t work_cv;            /**< signalled when a scan is done */
     pthread_cond_t thread_done_cv;
+    int n_threads_started;
     int n_threads_complete;
+    int nFound;                        /**< volumes found so far */
+    int nAttached;                     /**< volumes attached */
+    int nUnattached;                   /**< volumes not attached */
+    afs_uint64 attachUSecs;            /**< total time spent attaching */
+    afs_uint64 maxUSecs;               /**< longest single attach */
+    char *maxName;                     /**< ... and its header name */
+    time_t lastProgress;               /**< time of last progress report */
 } vinitvolumepackage_thread_t;
 static void * VInitVolumePackageThread(void * args);
+static int VInitScanPartition(struct vinit_attach_part *ap);
+
+/* seconds between progress reports while attaching volumes at startup */
+#define VINIT_PROGRESS_INTERVAL 10
 
 #else  /* !AFS_DEMAND_ATTTACH_FS */
 #define VINIT_BATCH_MAX_SIZE 512
@@ -296,10 +333,10 @@ static int VInitPreAttachVolumes(int nthreads, struct volume_init_queue *vq);
 #endif /* !AFS_DEMAND_ATTACH_FS */
 #endif /* AFS_PTHREAD_ENV */
 
-#ifndef AFS_DEMAND_ATTACH_FS
+#if !defined(AFS_DEMAND_ATTACH_FS) && !defined(AFS_PTHREAD_ENV)
 static int VAttachVolumesByPartition(struct DiskPartition64 *diskP,
 				     int * nAttached, int * nUnattached);
-#endif /* AFS_DEMAND_ATTACH_FS */
+#endif /* !AFS_DEMAND_ATTACH_FS && !AFS_PTHREAD_ENV */
 
 
 #ifdef AFS_DEMAND_ATTACH_FS
@@ -460,6 +497,7 @@ void
 VOptDefaults(ProgramType pt, VolumePackageOptions *opts)
 {
     opts->nLargeVnodes = opts->nSmallVnodes = 5;
+    opts->nLargeVnodesMax = opts->nSmallVnodesMax = 0;
     opts->volcache = 0;
 
     opts->canScheduleSalvage = 0;
@@ -611,6 +649,8 @@ VInitVolumePackage2(ProgramType pt, VolumePackageOptions * opts)
 
     VInitVnodes(vLarge, opts->nLargeVnodes);
     VInitVnodes(vSmall, opts->nSmallVnodes);
+    VnodeClassInfo[vLarge].maxSize = opts->nLargeVnodesMax;
+    VnodeClassInfo[vSmall].maxSize = opts->nSmallVnodesMax;
 
 
     errors = VAttachPartitions();
@@ -681,7 +721,9 @@ VInitAttachVolumes(ProgramType pt)
  * @param[in]  pt         calling program type
  *
  * @return 0
- * @note Threaded version of attach parititions.
+ * @note Threaded version of attach parititions.  Volumes are attached
+ *       by vol_attach_threads threads working across all partitions;
+ *       see vinitvolumepackage_thread_t.
  *
  * @post VInit state is 2
  */
@@ -692,24 +734,25 @@ VInitAttachVolumes(ProgramType pt)
     if (pt == fileServer) {
 	struct DiskPartition64 *diskP;
 	struct vinitvolumepackage_thread_t params;
-	struct diskpartition_queue_t * dpq;
-	int i, threads, parts;
+	int i, j, threads, parts;
 	pthread_t tid;
 	pthread_attr_t attrs;
+	time_t start;
 
+	memset(&params, 0, sizeof(params));
 	opr_cv_init(&params.thread_done_cv);
-	queue_Init(&params);
-	params.n_threads_complete = 0;
+	opr_cv_init(&params.work_cv);
 
-	/* create partition work queue */
-	for (parts=0, diskP = DiskPartitionList; diskP; diskP = diskP->next, parts++) {
-	    dpq = malloc(sizeof(struct diskpartition_queue_t));
-	    opr_Assert(dpq != NULL);
-	    dpq->diskP = diskP;
-	    queue_Append(&params,dpq);
-	}
+	for (parts = 0, diskP = DiskPartitionList; diskP; diskP = diskP->next)
+	    parts++;
+	params.parts = calloc(parts ? parts : 1, sizeof(*params.parts));
+	opr_Assert(params.parts != NULL);
+	for (i = 0, diskP = DiskPartitionList; diskP; diskP = diskP->next, i++)
+	    params.parts[i].diskP = diskP;
+	params.nparts = parts;
 
-	threads = min(parts, vol_attach_threads);
+	threads = max(vol_attach_threads, 1);
+	start = params.lastProgress = time(NULL);
 
 	if (threads > 1) {
 	    /* spawn off a bunch of initialization threads */
@@ -748,6 +791,26 @@ VInitAttachVolumes(ProgramType pt)
 	    VInitVolumePackageThread(&params);
 	}
 
+	Log("VInitVolumePackage: attached %d volumes; %d volumes not attached; "
+	    "%d seconds\n", params.nAttached, params.nUnattached,
+	    (int)(time(NULL) - start));
+	if (params.nAttached + params.nUnattached > 0) {
+	    Log("VInitVolumePackage: volume attach time average %d usec, "
+		"maximum %d usec (%s)\n",
+		(int)(params.attachUSecs /
+		      (params.nAttached + params.nUnattached)),
+		(int)params.maxUSecs,
+		params.maxName ? params.maxName : "-");
+	}
+
+	for (i = 0; i < parts; i++) {
+	    for (j = 0; j < params.parts[i].nnames; j++)
+		free(params.parts[i].names[j]);
+	    free(params.parts[i].names);
+	}
+	free(params.parts);
+	free(params.maxName);
+	opr_cv_destroy(&params.work_cv);
 	opr_cv_destroy(&params.thread_done_cv);
     }
     VOL_LOCK;
@@ -757,36 +820,170 @@ VInitAttachVolumes(ProgramType pt)
     return 0;
 }
 
+/**
+ * read the names of the volume headers on a partition
+ *
+ * @param[in] ap  partition entry; names and nnames are filled in
+ *
+ * @return 0 on success, 1 if the partition could not be read
+ */
+static int
+VInitScanPartition(struct vinit_attach_part *ap)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    int maxnames = 0;
+
+    Log("Partition %s: attaching volumes\n", ap->diskP->name);
+    dirp = opendir(VPartitionPath(ap->diskP));
+    if (!dirp) {
+	Log("opendir on Partition %s failed!\n", ap->diskP->name);
+	return 1;
+    }
+
+    while ((dp = readdir(dirp))) {
+	char *p;
+	p = strrchr(dp->d_name, '.');
+	if (p == NULL || strcmp(p, VHDREXT) != 0)
+	    continue;
+	if (ap->nnames == maxnames) {
+	    maxnames = maxnames ? maxnames * 2 : 256;
+	    ap->names = realloc(ap->names, maxnames * sizeof(char *));
+	    opr_Assert(ap->names != NULL);
+	}
+	ap->names[ap->nnames] = strdup(dp->d_name);
+	opr_Assert(ap->names[ap->nnames] != NULL);
+	ap->nnames++;
+    }
+
+    closedir(dirp);
+    return 0;
+}
+
+/**
+ * pick the partition to attach a volume from
+ *
+ * @param[in] params  scheduler state
+ * @param[in] home    this thread's home partition
+ *
+ * @return the home partition if it has volumes left, otherwise the
+ *         partition with the most volumes left, or NULL if none has any
+ *
+ * @pre VOL_LOCK held
+ */
+static struct vinit_attach_part *
+VInitNextAttachPart(struct vinitvolumepackage_thread_t *params, int home)
+{
+    struct vinit_attach_part *ap, *best = NULL;
+    int i;
+
+    ap = &params->parts[home];
+    if (ap->next < ap->nnames)
+	return ap;
+    for (i = 0; i < params->nparts; i++) {
+	ap = &params->parts[i];
+	if (ap->next < ap->nnames
+	    && (best == NULL
+		|| ap->nnames - ap->next > best->nnames - best->next))
+	    best = ap;
+    }
+    return best;
+}
+
 static void *
 VInitVolumePackageThread(void * args) {
 
-    struct DiskPartition64 *diskP;
     struct vinitvolumepackage_thread_t * params;
-    struct diskpartition_queue_t * dpq;
+    struct vinit_attach_part *ap;
+    struct timeval start, end;
+    afs_uint64 usecs;
+    Volume *vp;
+    Error error;
+    char *name;
+    time_t now;
+    int home;
 
     params = (vinitvolumepackage_thread_t *) args;
 
-
     VOL_LOCK;
-    /* Attach all the volumes in this partition */
-    while (queue_IsNotEmpty(params)) {
-        int nAttached = 0, nUnattached = 0;
+    home = params->nparts ? params->n_threads_started % params->nparts : 0;
+    params->n_threads_started++;
 
+    while (params->nparts > 0) {
         if (vinit_attach_abort) {
             Log("Aborting initialization\n");
             goto done;
         }
 
-        dpq = queue_First(params,diskpartition_queue_t);
-	queue_Remove(dpq);
+	/* Scan partitions first, so that there is work for every thread. */
+	if (params->nextScan < params->nparts) {
+	    ap = &params->parts[params->nextScan++];
+	    params->nScanning++;
+	    VOL_UNLOCK;
+	    opr_Verify(VInitScanPartition(ap) == 0);
+	    VOL_LOCK;
+	    params->nScanning--;
+	    params->nFound += ap->nnames;
+	    if (ap->nnames == 0)
+		Log("Partition %s: attached 0 volumes; 0 volumes not attached\n",
+		    ap->diskP->name);
+	    opr_cv_broadcast(&params->work_cv);
+	    continue;
+	}
+
+	ap = VInitNextAttachPart(params, home);
+	if (ap == NULL) {
+	    if (params->nScanning == 0)
+		break;
+	    /* others are still scanning; wait for their volumes */
+	    VOL_CV_WAIT(&params->work_cv);
+	    continue;
+	}
+	name = ap->names[ap->next++];
 	VOL_UNLOCK;
-	diskP = dpq->diskP;
-	free(dpq);
 
-	opr_Verify(VAttachVolumesByPartition(diskP, &nAttached,
-					     &nUnattached) == 0);
+	gettimeofday(&start, NULL);
+	vp = VAttachVolumeByName(&error, ap->diskP->name, name, V_VOLUPD);
+	gettimeofday(&end, NULL);
+	usecs = (end.tv_sec - start.tv_sec) * 1000000
+	    + (end.tv_usec - start.tv_usec);
+	if (error == VOFFLINE)
+	    Log("Volume %d stays offline (/vice/offline/%s exists)\n",
+		VolumeNumber(name), name);
+	else if (GetLogLevel() >= 5) {
+	    Log("Partition %s: attached volume %d (%s) in %d ms\n",
+		ap->diskP->name, VolumeNumber(name), name,
+		(int)(usecs / 1000));
+	}
+	if (vp) {
+	    VPutVolume(vp);
+	}
 
 	VOL_LOCK;
+	if (vp) {
+	    ap->nAttached++;
+	    params->nAttached++;
+	} else {
+	    ap->nUnattached++;
+	    params->nUnattached++;
+	}
+	params->attachUSecs += usecs;
+	if (usecs > params->maxUSecs) {
+	    params->maxUSecs = usecs;
+	    free(params->maxName);
+	    params->maxName = strdup(name);
+	}
+	if (ap->nAttached + ap->nUnattached == ap->nnames) {
+	    Log("Partition %s: attached %d volumes; %d volumes not attached\n",
+		ap->diskP->name, ap->nAttached, ap->nUnattached);
+	}
+	now = time(NULL);
+	if (now - params->lastProgress >= VINIT_PROGRESS_INTERVAL) {
+	    params->lastProgress = now;
+	    Log("VInitVolumePackage: %d of %d volumes found so far attached; "
+		"%d not attached\n", params->nAttached, params->nFound,
+		params->nUnattached);
+	}
     }
 
 done:
@@ -1077,7 +1274,7 @@ VInitPreAttachVolumes(int nthreads, struct volume_init_queue *vq)
 }
 #endif /* AFS_DEMAND_ATTACH_FS */
 
-#if !defined(AFS_DEMAND_ATTACH_FS)
+#if !defined(AFS_DEMAND_ATTACH_FS) && !defined(AFS_PTHREAD_ENV)
 /*
  * attach all volumes on a given disk partition
  */
@@ -1128,7 +1325,7 @@ done:
   closedir(dirp);
   return ret;
 }
-#endif /* !AFS_DEMAND_ATTACH_FS */
+#endif /* !AFS_DEMAND_ATTACH_FS && !AFS_PTHREAD_ENV */
 
 /***************************************************/
 /* Shutdown routines                               */
@@ -8901,8 +9098,10 @@ VPrintCacheStats_r(void)
     struct VnodeClassInfo *vcp;
     vcp = &VnodeClassInfo[vLarge];
     Log("Large vnode cache, %d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, vcp->gets, vcp->reads, vcp->writes);
+    Log("Large vnode cache, %d free hot, %d free cold, %d hot reused, %d index page hits\n", vcp->nHot, vcp->nCold, vcp->hotEvicts, vcp->pageHits);
     vcp = &VnodeClassInfo[vSmall];
     Log("Small vnode cache,%d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, vcp->gets, vcp->reads, vcp->writes);
+    Log("Small vnode cache, %d free hot, %d free cold, %d hot reused, %d index page hits\n", vcp->nHot, vcp->nCold, vcp->hotEvicts, vcp->pageHits);
     Log("Volume header cache, %d entries, %"AFS_INT64_FMT" gets, "
         "%"AFS_INT64_FMT" replacements\n",
 	VStats.hdr_cache_size, VStats.hdr_gets, VStats.hdr_loads);
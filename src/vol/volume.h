@@ -67,6 +67,7 @@ extern pthread_cond_t vol_sleep_cond;
 extern pthread_cond_t vol_vinit_cond;
 extern ih_init_params vol_io_params;
 extern int vol_attach_threads;
+extern int vol_clone_threads;
 #ifdef VOL_LOCK_DEBUG
 extern pthread_t vol_glock_holder;
 #define VOL_LOCK \
@@ -240,6 +241,10 @@ extern VThreadOptions_t VThread_defaults;
 typedef struct VolumePackageOptions {
     afs_uint32 nLargeVnodes;      /**< size of large vnode cache */
     afs_uint32 nSmallVnodes;      /**< size of small vnode cache */
+    afs_uint32 nLargeVnodesMax;   /**< size the large vnode cache may grow
+				   *   to (0 or nLargeVnodes means fixed) */
+    afs_uint32 nSmallVnodesMax;   /**< size the small vnode cache may grow
+				   *   to (0 or nSmallVnodes means fixed) */
     afs_uint32 volcache;          /**< size of volume header cache */
 
     afs_int32 canScheduleSalvage; /**< can we schedule salvages? (DAFS) */
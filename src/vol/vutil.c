@@ -98,6 +98,30 @@ RemoveInodes(struct afs_inode_info *stuff, Device dev, VolumeId parent,
     IH_RELEASE(handle);
 }
 
+#ifdef AFS_DEMAND_ATTACH_FS
+/**
+ * discard the volume group cache file saved on a partition.
+ *
+ * Called when a volume header change could not be reported to the
+ * fileserver, so that it rebuilds the partition's volume group cache from
+ * the headers instead of loading a file that misses the change.
+ *
+ * @param[in] dp  disk partition object
+ */
+static void
+VInvalidateVGCacheFile(struct DiskPartition64 *dp)
+{
+    char path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s" OS_DIRSEP VVGC_FILE,
+	     VPartitionPath(dp));
+    if (unlink(path) == 0) {
+	Log("Removed %s; the fileserver will rebuild its volume group cache "
+	    "for %s from the volume headers\n", path, VPartitionPath(dp));
+    }
+}
+#endif /* AFS_DEMAND_ATTACH_FS */
+
 Volume *
 VCreateVolume(Error * ec, char *partname, VolumeId volumeId, VolumeId parentId)
 {				/* Should be the same as volumeId if there is
@@ -593,6 +617,7 @@ VWriteVolumeDiskHeader(VolumeDiskHeader_t * hdr,
 	        afs_printable_uint32_lu(oldhdr.id),
 	        afs_printable_int32_ld(code),
 	        afs_printable_int32_ld(res.hdr.reason));
+	    VInvalidateVGCacheFile(dp);
 	}
 
     }
@@ -606,6 +631,7 @@ VWriteVolumeDiskHeader(VolumeDiskHeader_t * hdr,
 	        afs_printable_uint32_lu(hdr->id),
 	        afs_printable_int32_ld(code),
 		afs_printable_int32_ld(res.hdr.reason));
+	    VInvalidateVGCacheFile(dp);
 	}
     }
 
@@ -652,6 +678,7 @@ VCreateVolumeDiskHeader(VolumeDiskHeader_t * hdr,
 	    afs_printable_uint32_lu(hdr->id),
 	    afs_printable_int32_ld(code),
 	    afs_printable_int32_ld(res.hdr.reason));
+	VInvalidateVGCacheFile(dp);
     }
 #endif /* AFS_DEMAND_ATTACH_FS */
 
@@ -702,6 +729,9 @@ VDestroyVolumeDiskHeader(struct DiskPartition64 * dp,
 	    afs_printable_VolumeId_lu(volid),
 	    afs_printable_int32_ld(code),
 	    afs_printable_int32_ld(res.hdr.reason));
+	if (res.hdr.reason != FSYNC_UNKNOWN_VOLID) {
+	    VInvalidateVGCacheFile(dp);
+	}
     }
 #endif /* AFS_DEMAND_ATTACH_FS */
 
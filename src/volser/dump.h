@@ -70,7 +70,12 @@ struct DumpHeader {
  *     'n'     0x6e    V_name
  *     't'     0x74    fromtime, V_backupDate
  *     'v'     0x76    V_id / V_parentId               *
+ *     'z'     0x7a    compression method              *
  *     126     0x7e    next tag critical               *
+ *
+ * A critical 'z' tag ends the dump header; the rest of the dump is
+ * compressed with the method it names, VOLDUMPCOMPRESS_DEFLATE (a zlib
+ * stream) being the only one so far.
  */
 /*
  *  List of known tags in the volume header section (section 1)
@@ -13,8 +13,17 @@
 #include <roken.h>
 
 #include <ctype.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include <afs/opr.h>
+#ifdef AFS_PTHREAD_ENV
+# include <opr/lock.h>
+#else
+# include <opr/lockstub.h>
+#endif
+#include <hcrypto/md5.h>
 #include <rx/rx.h>
 #include <rx/rx_queue.h>
 #include <afs/afsint.h>
@@ -51,6 +60,7 @@
 
 extern int DoLogging;
 extern int DoPreserveVolumeStats;
+extern int RestoreThreads;
 
 
 /* Forward Declarations */
@@ -64,12 +74,23 @@ static int DumpVnodeIndex(struct iod *iodp, Volume * vp,
 static int DumpVnode(struct iod *iodp, struct VnodeDiskObject *v,
 		     VolumeId volid, int vnodeNumber, int dumpEverything);
 static int ReadDumpHeader(struct iod *iodp, struct DumpHeader *hp);
+static int WaitRestoreStreams(struct rx_call *call,
+			      struct restoreStreams *streams, int error);
 static int ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf,
                       afs_int32 s1, afs_foff_t * Sbuf, afs_int32 s2,
                       afs_int32 delo);
+struct restorePool;
+static int ParseVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf,
+		       afs_int32 s1, afs_foff_t * Sbuf, afs_int32 s2,
+		       afs_int32 delo, struct restorePool *pool);
+static int ReadFileLength(struct iod *iodp, int tag, afs_fsize_t *lengthp);
 static afs_fsize_t volser_WriteFile(int vn, struct iod *iodp,
-				    FdHandle_t * handleP, int tag,
-				    Error * status);
+				    FdHandle_t * handleP,
+				    afs_fsize_t filesize, Error * status);
+static afs_fsize_t volser_WriteDelta(Volume * vp, int vn,
+				     struct VnodeDiskObject *vnode,
+				     struct iod *iodp, FdHandle_t * handleP,
+				     afs_size_t taglen, Error * status);
 
 static int SizeDumpDumpHeader(struct iod *iodp, Volume * vp,
 			      afs_int32 fromtime,
@@ -129,6 +150,44 @@ initNonStandardTags(void)
     oldtagsInited = 1;
 }
 
+/* the time in microseconds, for the dump counters */
+static afs_uint64
+DumpNow(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (afs_uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Log the counters of a dump started at start.  Disk reads and network
+ * writes overlap, so a dump waits mostly on whichever is slower, and the
+ * two waits together come to less than the elapsed time.
+ */
+static void
+DumpLogStats(struct iod *iodp, Volume * vp, afs_uint64 start)
+{
+    struct dumpStats *s = &iodp->stats;
+    double elapsed = (DumpNow() - start) / 1000000.0;
+    char stream[32] = "";
+
+    if (!DoLogging)
+	return;
+    if (elapsed <= 0)
+	elapsed = 0.000001;
+    if (iodp->nstreams > 1)
+	snprintf(stream, sizeof(stream), " stream %d", iodp->stream);
+    Log("1 Volser: Dump of volume %" AFS_VOLID_FMT "%s: %.3f sec, "
+	"%u files (%u read ahead); disk %llu bytes, %.1f MB/s, "
+	"%.3f sec waited; network %llu bytes, %.1f MB/s, %.3f sec waited\n",
+	afs_printable_VolumeId_lu(V_id(vp)), stream, elapsed, s->files,
+	s->prefetched, (unsigned long long)s->readBytes,
+	s->readBytes / elapsed / (1024 * 1024), s->readWait / 1000000.0,
+	(unsigned long long)s->sendBytes,
+	s->sendBytes / elapsed / (1024 * 1024), s->sendWait / 1000000.0);
+}
+
 static void
 iod_Init(struct iod *iodp, struct rx_call *call)
 {
@@ -136,6 +195,13 @@ iod_Init(struct iod *iodp, struct rx_call *call)
     iodp->haveOldChar = 0;
     iodp->ncalls = 1;
     iodp->calls = (struct rx_call **)0;
+    iodp->deltaTrans = NULL;
+    iodp->stream = 0;
+    iodp->nstreams = 1;
+    iodp->zmethod = VOLDUMPCOMPRESS_NONE;
+    iodp->zlevel = 0;
+    iodp->z = NULL;
+    memset(&iodp->stats, 0, sizeof(iodp->stats));
 }
 
 static void
@@ -148,10 +214,122 @@ iod_InitMulti(struct iod *iodp, struct rx_call **calls, int ncalls,
     iodp->ncalls = ncalls;
     iodp->codes = codes;
     iodp->call = (struct rx_call *)0;
+    iodp->deltaTrans = NULL;
+    iodp->stream = 0;
+    iodp->nstreams = 1;
+    iodp->zmethod = VOLDUMPCOMPRESS_NONE;
+    iodp->zlevel = 0;
+    iodp->z = NULL;
+    memset(&iodp->stats, 0, sizeof(iodp->stats));
 }
 
-/* N.B. iod_Read doesn't check for oldchar (see previous comment) */
-#define iod_Read(iodp, buf, nbytes) rx_Read((iodp)->call, buf, nbytes)
+/*
+ * Dump compression.  A dump header ending in a critical 'z' tag is
+ * followed by the rest of the dump compressed with the method the tag
+ * names; the other calls of a split dump are compressed from their first
+ * byte.  Compressed bytes pass through zbuf on their way to or from the
+ * calls, and when expanding, the bytes they expand to through buf.
+ */
+#define IOD_ZBUFSIZE	(64 * 1024)
+
+struct iodCompress {
+#ifdef HAVE_ZLIB
+    z_stream zs;
+#endif
+    int inflating;		/* expanding a dump, not compressing one */
+    int eof;			/* no more to expand */
+    char *zbuf;			/* compressed bytes */
+    char *buf;			/* expanded bytes not yet read */
+    char *next;
+    int avail;
+};
+
+/* Whether we can compress dumps this way; level 0 is the method's default */
+int
+CheckDumpCompression(afs_int32 method, afs_int32 level)
+{
+    switch (method) {
+    case VOLDUMPCOMPRESS_NONE:
+	return 0;
+#ifdef HAVE_ZLIB
+    case VOLDUMPCOMPRESS_DEFLATE:
+	return (level >= 0 && level <= 9) ? 0 : EINVAL;
+#endif
+    default:
+	return VOLSERBADOP;
+    }
+}
+
+static void
+iod_EndCompress(struct iod *iodp)
+{
+    struct iodCompress *z = iodp->z;
+
+    if (z == NULL)
+	return;
+#ifdef HAVE_ZLIB
+    if (z->inflating)
+	inflateEnd(&z->zs);
+    else
+	deflateEnd(&z->zs);
+#endif
+    free(z->zbuf);
+    free(z->buf);
+    free(z);
+    iodp->z = NULL;
+}
+
+/*
+ * Compress what is written to the calls from now on with iodp's method,
+ * or if inflating, expand what is read from them.
+ */
+static int
+iod_StartCompress(struct iod *iodp, int inflating)
+{
+#ifdef HAVE_ZLIB
+    struct iodCompress *z;
+    int code;
+
+    if (iodp->zmethod != VOLDUMPCOMPRESS_DEFLATE)
+	return VOLSERBADOP;
+    z = calloc(1, sizeof(*z));
+    if (z == NULL)
+	return ENOMEM;
+    z->inflating = inflating;
+    z->zbuf = malloc(IOD_ZBUFSIZE);
+    if (inflating)
+	z->buf = malloc(IOD_ZBUFSIZE);
+    if (z->zbuf == NULL || (inflating && z->buf == NULL)) {
+	free(z->zbuf);
+	free(z->buf);
+	free(z);
+	return ENOMEM;
+    }
+    if (inflating) {
+	code = inflateInit(&z->zs);
+    } else {
+	code = deflateInit(&z->zs, iodp->zlevel ? iodp->zlevel :
+			   Z_DEFAULT_COMPRESSION);
+	z->zs.next_out = (Bytef *)z->zbuf;
+	z->zs.avail_out = IOD_ZBUFSIZE;
+    }
+    if (code != Z_OK) {
+	Log("1 Volser: cannot set up dump compression: %d\n", code);
+	free(z->zbuf);
+	free(z->buf);
+	free(z);
+	return VOLSERBADOP;
+    }
+    iodp->z = z;
+    return 0;
+#else
+    return VOLSERBADOP;
+#endif
+}
+
+/* Writes smaller than this are tags and headers, which rx copies into the
+ * call's current packet without waiting; only larger writes are timed. */
+#define IOD_MIN_TIMED_WRITE	1024
 
 /* For the single dump case, it's ok to just return the "bytes written"
  * that rx_Write returns, since all the callers of iod_Write abort when
@@ -160,35 +338,152 @@ iod_InitMulti(struct iod *iodp, struct rx_call **calls, int ncalls,
  * connection timed out, but if they all time out, then we should give up.
  */
 static int
-iod_Write(struct iod *iodp, char *buf, int nbytes)
+iod_WriteRaw(struct iod *iodp, char *buf, int nbytes)
 {
     int code, i;
     int one_success = 0;
+    afs_uint64 start = 0;
+
+    if (DoLogging && nbytes >= IOD_MIN_TIMED_WRITE)
+	start = DumpNow();
 
     opr_Assert((iodp->call && iodp->ncalls == 1 && !iodp->calls)
 	   || (!iodp->call && iodp->ncalls >= 1 && iodp->calls));
 
     if (iodp->call) {
 	code = rx_Write(iodp->call, buf, nbytes);
-	return code;
+    } else {
+	for (i = 0; i < iodp->ncalls; i++) {
+	    if (iodp->calls[i] && !iodp->codes[i]) {
+		code = rx_Write(iodp->calls[i], buf, nbytes);
+		if (code != nbytes) {	/* everything gets merged into a single error */
+		    iodp->codes[i] = VOLSERDUMPERROR;	/* but that's exactly what the */
+		} /* standard dump does, anyways */
+		else {
+		    one_success = TRUE;
+		}
+	    }
+	}			/* for all calls */
+	code = one_success ? nbytes : 0;
     }
 
-    for (i = 0; i < iodp->ncalls; i++) {
-	if (iodp->calls[i] && !iodp->codes[i]) {
-	    code = rx_Write(iodp->calls[i], buf, nbytes);
-	    if (code != nbytes) {	/* everything gets merged into a single error */
-		iodp->codes[i] = VOLSERDUMPERROR;	/* but that's exactly what the */
-	    } /* standard dump does, anyways */
-	    else {
-		one_success = TRUE;
+    if (start)
+	iodp->stats.sendWait += DumpNow() - start;
+    if (code > 0)
+	iodp->stats.sendBytes += code;
+    return code;
+}
+
+#ifdef HAVE_ZLIB
+/*
+ * Compress nbytes into zbuf, writing it out to the calls whenever it
+ * fills, and all of it at the end of the dump.  Returns 0, or -1 if the
+ * calls cannot be written.
+ */
+static int
+iod_Deflate(struct iod *iodp, char *buf, int nbytes, int flush)
+{
+    struct iodCompress *z = iodp->z;
+    int code, n;
+
+    z->zs.next_in = (Bytef *)buf;
+    z->zs.avail_in = nbytes;
+    for (;;) {
+	code = deflate(&z->zs, flush);
+	if (code == Z_STREAM_ERROR)
+	    return -1;
+	n = IOD_ZBUFSIZE - z->zs.avail_out;
+	if (n == IOD_ZBUFSIZE || (code == Z_STREAM_END && n > 0)) {
+	    if (iod_WriteRaw(iodp, z->zbuf, n) != n)
+		return -1;
+	    z->zs.next_out = (Bytef *)z->zbuf;
+	    z->zs.avail_out = IOD_ZBUFSIZE;
+	}
+	if (flush == Z_FINISH ? code == Z_STREAM_END : z->zs.avail_in == 0)
+	    return 0;
+    }
+}
+
+/* Expand more of the dump into buf.  Returns how much; 0 at its end. */
+static int
+iod_Inflate(struct iod *iodp)
+{
+    struct iodCompress *z = iodp->z;
+    int code, n;
+
+    z->zs.next_out = (Bytef *)z->buf;
+    z->zs.avail_out = IOD_ZBUFSIZE;
+    while (z->zs.avail_out == IOD_ZBUFSIZE && !z->eof) {
+	if (z->zs.avail_in == 0) {
+	    n = rx_Read(iodp->call, z->zbuf, IOD_ZBUFSIZE);
+	    if (n <= 0) {
+		z->eof = 1;	/* cut short; the dump end will be missing */
+		break;
 	    }
+	    z->zs.next_in = (Bytef *)z->zbuf;
+	    z->zs.avail_in = n;
 	}
-    }				/* for all calls */
+	code = inflate(&z->zs, Z_NO_FLUSH);
+	if (code == Z_STREAM_END) {
+	    z->eof = 1;
+	} else if (code != Z_OK && code != Z_BUF_ERROR) {
+	    Log("1 Volser: cannot expand compressed dump: %s\n",
+		z->zs.msg ? z->zs.msg : "corrupt data");
+	    z->eof = 1;
+	}
+    }
+    z->next = z->buf;
+    z->avail = IOD_ZBUFSIZE - z->zs.avail_out;
+    return z->avail;
+}
+#endif /* HAVE_ZLIB */
 
-    if (one_success)
-	return nbytes;
-    else
-	return 0;
+static int
+iod_Write(struct iod *iodp, char *buf, int nbytes)
+{
+#ifdef HAVE_ZLIB
+    if (iodp->z)
+	return iod_Deflate(iodp, buf, nbytes, Z_NO_FLUSH) ? 0 : nbytes;
+#endif
+    return iod_WriteRaw(iodp, buf, nbytes);
+}
+
+/* Write out the end of a compressed dump */
+static int
+iod_FinishCompress(struct iod *iodp)
+{
+#ifdef HAVE_ZLIB
+    if (iodp->z && iod_Deflate(iodp, NULL, 0, Z_FINISH))
+	return VOLSERDUMPERROR;
+#endif
+    return 0;
+}
+
+/* N.B. iod_Read doesn't check for oldchar (see previous comment) */
+static int
+iod_Read(struct iod *iodp, char *buf, int nbytes)
+{
+#ifdef HAVE_ZLIB
+    struct iodCompress *z = iodp->z;
+    int n, total = 0;
+
+    if (z == NULL)
+	return rx_Read(iodp->call, buf, nbytes);
+    while (nbytes > 0) {
+	if (z->avail == 0 && iod_Inflate(iodp) == 0)
+	    break;
+	n = (nbytes < z->avail) ? nbytes : z->avail;
+	memcpy(buf, z->next, n);
+	z->next += n;
+	z->avail -= n;
+	buf += n;
+	nbytes -= n;
+	total += n;
+    }
+    return total;
+#else
+    return rx_Read(iodp->call, buf, nbytes);
+#endif
 }
 
 static void
@@ -665,7 +960,6 @@ DumpStandardTag(struct iod *iodp, char tag, afs_uint32 section)
     return 0;
 }
 
-AFS_UNUSED
 static afs_int32
 DumpStandardTagLen(struct iod *iodp, char tag, afs_uint32 section,
                         afs_size_t length)
@@ -700,6 +994,17 @@ DumpStandardTagLen(struct iod *iodp, char tag, afs_uint32 section,
     return 0;
 }
 
+/*
+ * File data is read in chunks of at least DUMPFILE_CHUNKSIZE, the next
+ * chunk being read while the current one is sent, so that with I/O
+ * threads (-aio-threads) a dump keeps the disk and the network busy at
+ * once.  DumpVnodeIndex also asks for the start of the next few files to
+ * be read in ahead of time, which hides the seek to each new file.
+ */
+#define DUMPFILE_CHUNKSIZE	(256 * 1024)
+#define DUMP_PREFETCH		8		/* files read ahead */
+#define DUMP_PREFETCHSIZE	(1024 * 1024)	/* of each, at most */
+
 static int
 DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 {
@@ -707,10 +1012,14 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
     afs_int32 pad = 0;
     afs_foff_t offset = 0;
     afs_sfsize_t nbytes, howBig;
-    ssize_t n;
+    ssize_t n, len;
     size_t howMany;
     afs_foff_t howFar = 0;
-    byte *p;
+    char *buf[2];		/* one being sent, one being read into */
+    int cur = 0;
+    ih_aio_t aio;
+    int reading = 0;
+    afs_uint64 start;
     afs_uint32 hi, lo;
     afs_ino_str_t stmp;
 #ifndef AFS_NT40_ENV
@@ -770,19 +1079,34 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 	return VOLSERDUMPERROR;
     }
 
-    p = malloc(howMany);
-    if (!p) {
+    /* read in whole blocks, but not too few at a time */
+    if (howMany < DUMPFILE_CHUNKSIZE)
+	howMany = (DUMPFILE_CHUNKSIZE + howMany - 1) / howMany * howMany;
+    buf[0] = malloc(howMany);
+    buf[1] = malloc(howMany);
+    if (!buf[0] || !buf[1]) {
 	Log("1 Volser: DumpFile: not enough memory to allocate %u bytes\n", (unsigned)howMany);
+	free(buf[0]);
+	free(buf[1]);
 	return VOLSERDUMPERROR;
     }
+    iodp->stats.files++;
 
-    for (nbytes = howBig; (nbytes && !error); nbytes -= howMany) {
-	if (nbytes < howMany)
-	    howMany = nbytes;
+    if (howBig > 0) {
+	FDH_APREAD(&aio, handleP, buf[cur],
+		   (howBig > howMany) ? howMany : howBig, 0);
+	reading = 1;
+    }
+    for (nbytes = howBig; (nbytes && !error); nbytes -= len) {
+	len = (nbytes < howMany) ? nbytes : howMany;
 
-	/* Read the data */
-	n = FDH_PREAD(handleP, p, howMany, howFar);
-	howFar += n;
+	/* Wait for the data */
+	start = DumpNow();
+	n = FDH_AWAIT(&aio);
+	reading = 0;
+	iodp->stats.readWait += DumpNow() - start;
+	if (n > 0)
+	    iodp->stats.readBytes += n;
 
 	/* If read any good data and we null padded previously, log the
 	 * amount that we had null padded.
@@ -796,7 +1120,7 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 	 * can happen if, for instance, the media has some bad spots. We don't
 	 * want to quit the dump, so we start null padding.
 	 */
-	if (n < howMany) {
+	if (n < len) {
 	    /* Record the read error */
 	    if (n < 0) {
 		n = 0;
@@ -808,34 +1132,333 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 	    /* Pad the rest of the buffer with zeros. Remember offset we started
 	     * padding. Keep total tally of padding.
 	     */
-	    memset(p + n, 0, howMany - n);
+	    memset(buf[cur] + n, 0, len - n);
 	    if (!pad)
 		offset = (howBig - nbytes) + n;
-	    pad += (howMany - n);
+	    pad += (len - n);
+	}
 
-	    /* Now seek over the data we could not get. An error here means we
-	     * can't do the next read.
-	     */
-	    howFar = (size_t)((howBig - nbytes) + howMany);
+	/* The next read starts after this chunk, even if we could not get
+	 * all of it, and goes on while this one is sent.
+	 */
+	howFar = (howBig - nbytes) + len;
+	if (nbytes > len) {
+	    FDH_APREAD(&aio, handleP, buf[!cur],
+		       (nbytes - len > howMany) ? howMany : nbytes - len,
+		       howFar);
+	    reading = 1;
 	}
 
 	/* Now write the data out */
-	if (iod_Write(iodp, (char *)p, howMany) != howMany)
+	if (iod_Write(iodp, buf[cur], len) != len)
 	    error = VOLSERDUMPERROR;
+	cur = !cur;
 #ifndef AFS_PTHREAD_ENV
 	IOMGR_Poll();
 #endif
     }
+    if (reading)
+	(void)FDH_AWAIT(&aio);
 
     if (pad) {			/* Any padding we hadn't reported yet */
 	Log("1 Volser: DumpFile: Null padding file: %d bytes at offset %lld\n",
 	    pad, (long long)offset);
     }
 
-    free(p);
+    free(buf[0]);
+    free(buf[1]);
     return error;
 }
 
+/*
+ * Block deltas.  When an incremental dump is forwarded to volservers that
+ * already hold an older copy of the volume, as by vos release, a large
+ * changed file need not be sent whole.  Each destination is asked for
+ * checksums of the blocks of its copy of the file, and only the blocks
+ * that differ go into the dump, inside a critical 'D' tag which the
+ * destination merges with its copy.  A stream going to several
+ * destinations carries a delta only when they all hold the same copy;
+ * destinations that do not know GetBlockSums always get whole files.
+ */
+#define DELTA_MINSIZE	(1024 * 1024)	/* smaller files are sent whole */
+#define DELTA_BLOCKSIZE	(64 * 1024)	/* smallest block compared */
+#define DELTA_WHOLE	(-1)		/* DumpFileDelta: send the whole file */
+
+/* the end of a run of blocks ending before block j */
+#define DELTA_RUNEND(j, blockSize, length) \
+    (((afs_foff_t)(j) * (blockSize) < (length)) ? \
+     (afs_foff_t)(j) * (blockSize) : (length))
+
+static afs_int32
+DeltaBlockSize(afs_sfsize_t length)
+{
+    afs_int32 blockSize = DELTA_BLOCKSIZE;
+
+    while ((length + blockSize - 1) / blockSize > VOLMAXBLOCKSUMS)
+	blockSize <<= 1;
+    return blockSize;
+}
+
+/*
+ * MD5 one block of a file into sum, reading it through buf, which holds
+ * DELTA_BLOCKSIZE bytes.  Returns 0, or -1 if the block cannot be read.
+ */
+static int
+SumBlock(FdHandle_t * fdP, afs_foff_t off, afs_sfsize_t len, char *buf,
+	 afs_uint32 * sum)
+{
+    MD5_CTX md5;
+    ssize_t n;
+
+    MD5_Init(&md5);
+    while (len > 0) {
+	n = (len > DELTA_BLOCKSIZE) ? DELTA_BLOCKSIZE : len;
+	if (FDH_PREAD(fdP, buf, n, off) != n)
+	    return -1;
+	MD5_Update(&md5, buf, n);
+	off += n;
+	len -= n;
+    }
+    MD5_Final((unsigned char *)sum, &md5);
+    return 0;
+}
+
+/*
+ * Return the block checksums of a file vnode of a volume, for a source
+ * volserver deciding which blocks of its newer copy to send.
+ */
+int
+GetBlockSums(Volume * vp, afs_uint32 vnodeNumber, afs_uint32 unique,
+	     afs_int32 blockSize, afs_uint32 * dataVersion,
+	     afs_uint64 * length, blockSums * sums)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[vSmall];
+    struct VnodeDiskObject vnode;
+    IHandle_t *ihP;
+    FdHandle_t *fdP;
+    afs_sfsize_t size, vnodeLength, nblocks, i;
+    char *buf = NULL;
+    int code = 0;
+
+    if (vnodeIdToClass(vnodeNumber) != vSmall || blockSize < DELTA_BLOCKSIZE
+	|| (blockSize & (blockSize - 1)) != 0)
+	return EINVAL;
+
+    fdP = IH_OPEN(vp->vnodeIndex[vSmall].handle);
+    if (fdP == NULL)
+	return EIO;
+    if (FDH_PREAD(fdP, &vnode, sizeof(vnode),
+		  vnodeIndexOffset(vcp, vnodeNumber)) != sizeof(vnode))
+	code = ENOENT;
+    FDH_CLOSE(fdP);
+    if (code || vnode.type != vFile || vnode.uniquifier != unique
+	|| !VALID_INO(VNDISK_GET_INO(&vnode)))
+	return ENOENT;
+
+    IH_INIT(ihP, V_device(vp), V_parentId(vp), VNDISK_GET_INO(&vnode));
+    fdP = IH_OPEN(ihP);
+    if (fdP == NULL) {
+	IH_RELEASE(ihP);
+	return EIO;
+    }
+    size = FDH_SIZE(fdP);
+    VNDISK_GET_LEN(vnodeLength, &vnode);
+    nblocks = (size + blockSize - 1) / blockSize;
+    if (size <= 0 || size != vnodeLength) {
+	code = EIO;
+	goto done;
+    }
+    if (nblocks > VOLMAXBLOCKSUMS) {
+	code = EINVAL;
+	goto done;
+    }
+    sums->blockSums_val =
+	malloc(nblocks * VOLBLOCKSUMWORDS * sizeof(afs_uint32));
+    buf = malloc(DELTA_BLOCKSIZE);
+    if (sums->blockSums_val == NULL || buf == NULL) {
+	code = ENOMEM;
+	goto done;
+    }
+    for (i = 0; i < nblocks; i++) {
+	if (SumBlock(fdP, i * blockSize,
+		     (size - i * blockSize < blockSize) ?
+		     size - i * blockSize : blockSize, buf,
+		     &sums->blockSums_val[i * VOLBLOCKSUMWORDS]) < 0) {
+	    code = EIO;
+	    goto done;
+	}
+    }
+    sums->blockSums_len = nblocks * VOLBLOCKSUMWORDS;
+    *dataVersion = vnode.dataVersion;
+    *length = size;
+
+  done:
+    free(buf);
+    FDH_CLOSE(fdP);
+    IH_RELEASE(ihP);
+    return code;
+}
+
+/*
+ * Ask every destination still in the dump for the block checksums of its
+ * copy of a file.  Returns them if all destinations hold the same copy,
+ * or NULL.
+ */
+static afs_uint32 *
+FetchBlockSums(struct iod *iodp, int vnodeNumber, afs_uint32 unique,
+	       afs_int32 blockSize, afs_uint32 * baseVersion,
+	       afs_int32 * nbase)
+{
+    blockSums sums, base;
+    afs_uint32 dataVersion;
+    afs_uint64 length, baseLength = 0;
+    afs_int32 code;
+    int i;
+
+    memset(&base, 0, sizeof(base));
+    for (i = 0; i < iodp->ncalls; i++) {
+	if (!iodp->calls[i] || iodp->codes[i])
+	    continue;
+	if (!iodp->deltaTrans[i])
+	    goto whole;
+	memset(&sums, 0, sizeof(sums));
+	code = AFSVolGetBlockSums(rx_ConnectionOf(iodp->calls[i]),
+				  iodp->deltaTrans[i], vnodeNumber, unique,
+				  blockSize, &dataVersion, &length, &sums);
+	if (code == RXGEN_OPCODE)
+	    iodp->deltaTrans[i] = 0;	/* an older volserver */
+	if (code)
+	    goto whole;
+	if (base.blockSums_val == NULL) {
+	    base = sums;
+	    *baseVersion = dataVersion;
+	    baseLength = length;
+	    continue;
+	}
+	code = (dataVersion != *baseVersion || length != baseLength
+		|| sums.blockSums_len != base.blockSums_len
+		|| memcmp(sums.blockSums_val, base.blockSums_val,
+			  sums.blockSums_len * sizeof(afs_uint32)) != 0);
+	free(sums.blockSums_val);
+	if (code)
+	    goto whole;
+    }
+    *nbase = base.blockSums_len / VOLBLOCKSUMWORDS;
+    return base.blockSums_val;
+
+  whole:
+    free(base.blockSums_val);
+    return NULL;
+}
+
+/*
+ * Dump the blocks of a file which differ from the destinations' copy.
+ * Returns DELTA_WHOLE if the file should be dumped whole instead.
+ */
+static int
+DumpFileDelta(struct iod *iodp, int vnodeNumber, struct VnodeDiskObject *v,
+	      FdHandle_t * fdP, afs_sfsize_t length)
+{
+    afs_int32 blockSize = DeltaBlockSize(length);
+    afs_int32 nblocks = (length + blockSize - 1) / blockSize;
+    afs_int32 nbase = 0, nsame = 0, i, j;
+    afs_uint32 baseVersion = 0, hi, lo, count;
+    afs_uint32 *base, sum[VOLBLOCKSUMWORDS];
+    afs_foff_t off, end;
+    afs_size_t taglen;
+    ssize_t n;
+    char *same = NULL, *buf = NULL;
+    char tbuffer[16];
+    byte *p;
+    int code = DELTA_WHOLE;
+
+    base = FetchBlockSums(iodp, vnodeNumber, v->uniquifier, blockSize,
+			  &baseVersion, &nbase);
+    if (base == NULL)
+	return DELTA_WHOLE;
+    same = calloc(nblocks, 1);
+    buf = malloc(DELTA_BLOCKSIZE);
+    if (same == NULL || buf == NULL)
+	goto done;
+
+    /* find the unchanged blocks */
+    for (i = 0; i < nblocks && i < nbase; i++) {
+	off = (afs_foff_t)i * blockSize;
+	n = (length - off < blockSize) ? length - off : blockSize;
+	if (SumBlock(fdP, off, n, buf, sum) < 0)
+	    goto done;		/* DumpFile pads out what it cannot read */
+	if (memcmp(sum, &base[i * VOLBLOCKSUMWORDS], sizeof(sum)) == 0) {
+	    same[i] = 1;
+	    nsame++;
+	}
+    }
+    if (nsame == 0)
+	goto done;
+
+    /* a header, then a header and any data for each run of blocks */
+    taglen = 16;
+    for (i = 0; i < nblocks; i = j) {
+	for (j = i; j < nblocks && same[j] == same[i]; j++)
+	    ;
+	taglen += 5;
+	if (!same[i])
+	    taglen += DELTA_RUNEND(j, blockSize, length)
+		- (afs_foff_t)i * blockSize;
+    }
+
+    code = DumpTag(iodp, 0x7e);
+    if (!code)
+	code = DumpStandardTagLen(iodp, 'D', 2, taglen);
+    SplitInt64(length, hi, lo);
+    p = (byte *)tbuffer;
+    afs_putint32(p, blockSize);
+    afs_putint32(p, baseVersion);
+    afs_putint32(p, hi);
+    afs_putint32(p, lo);
+    if (!code && iod_Write(iodp, tbuffer, 16) != 16)
+	code = VOLSERDUMPERROR;
+
+    /* runs of blocks to keep ('c') and to replace ('d') */
+    for (i = 0; i < nblocks && !code; i = j) {
+	for (j = i; j < nblocks && same[j] == same[i]; j++)
+	    ;
+	count = j - i;
+	p = (byte *)tbuffer;
+	*p++ = same[i] ? 'c' : 'd';
+	afs_putint32(p, count);
+	if (iod_Write(iodp, tbuffer, 5) != 5) {
+	    code = VOLSERDUMPERROR;
+	    break;
+	}
+	if (same[i])
+	    continue;
+	off = (afs_foff_t)i * blockSize;
+	end = DELTA_RUNEND(j, blockSize, length);
+	for (; off < end; off += n) {
+	    n = (end - off > DELTA_BLOCKSIZE) ? DELTA_BLOCKSIZE : end - off;
+	    if (FDH_PREAD(fdP, buf, n, off) != n) {
+		Log("1 Volser: DumpFileDelta: Error reading vnode %d; "
+		    "null padding %ld bytes at offset %lld\n", vnodeNumber,
+		    (long)n, (long long)off);
+		memset(buf, 0, n);
+	    }
+	    if (iod_Write(iodp, buf, n) != n) {
+		code = VOLSERDUMPERROR;
+		break;
+	    }
+	}
+#ifndef AFS_PTHREAD_ENV
+	IOMGR_Poll();
+#endif
+    }
+
+  done:
+    free(base);
+    free(same);
+    free(buf);
+    return code;
+}
+
 static int
 DumpVolumeHeader(struct iod *iodp, Volume * vp)
 {
@@ -910,20 +1533,29 @@ DumpVolumeHeader(struct iod *iodp, Volume * vp)
 static int
 DumpEnd(struct iod *iodp)
 {
-    return (DumpInt32(iodp, D_DUMPEND, DUMPENDMAGIC));
+    int code;
+
+    code = DumpInt32(iodp, D_DUMPEND, DUMPENDMAGIC);
+    if (!code)
+	code = iod_FinishCompress(iodp);
+    return code;
 }
 
 /* Guts of the dump code */
 
-/* Dump a whole volume */
+/* Dump a whole volume, compressed with zmethod at zlevel unless that is
+ * VOLDUMPCOMPRESS_NONE */
 int
 DumpVolume(struct rx_call *call, Volume * vp,
-	   afs_int32 fromtime, int dumpAllDirs)
+	   afs_int32 fromtime, int dumpAllDirs, int zmethod, int zlevel)
 {
     struct iod iod;
     int code = 0;
     struct iod *iodp = &iod;
+    afs_uint64 start = DumpNow();
     iod_Init(iodp, call);
+    iodp->zmethod = zmethod;
+    iodp->zlevel = zlevel;
 
     if (!code)
 	code = DumpDumpHeader(iodp, vp, fromtime);
@@ -935,22 +1567,35 @@ DumpVolume(struct rx_call *call, Volume * vp,
     if (rx_Error(iodp->call)) {
 	Log("1 Volser: DumpVolume: Rx call failed during dump, error %d\n",
 	    rx_Error(iodp->call));
+	iod_EndCompress(iodp);
 	return VOLSERDUMPERROR;
     }
     if (!code)
 	code = DumpEnd(iodp);
 
+    iod_EndCompress(iodp);
+    if (!code)
+	DumpLogStats(iodp, vp, start);
     return code;
 }
 
-/* Dump a volume to multiple places*/
+/* Dump a volume to multiple places.  If destTrans is given, it holds the
+ * transaction on the volume being restored for each call, and changed
+ * files are sent as block deltas where the destinations allow.  A
+ * compressed dump is compressed once for all of them. */
 int
 DumpVolMulti(struct rx_call **calls, int ncalls, Volume * vp,
-	     afs_int32 fromtime, int dumpAllDirs, int *codes)
+	     afs_int32 fromtime, int dumpAllDirs, int *codes,
+	     afs_int32 *destTrans, int zmethod, int zlevel)
 {
     struct iod iod;
     int code = 0;
+    afs_uint64 start = DumpNow();
     iod_InitMulti(&iod, calls, ncalls, codes);
+    if (fromtime)
+	iod.deltaTrans = destTrans;
+    iod.zmethod = zmethod;
+    iod.zlevel = zlevel;
 
     if (!code)
 	code = DumpDumpHeader(&iod, vp, fromtime);
@@ -958,7 +1603,139 @@ DumpVolMulti(struct rx_call **calls, int ncalls, Volume * vp,
 	code = DumpPartial(&iod, vp, fromtime, dumpAllDirs);
     if (!code)
 	code = DumpEnd(&iod);
+    iod_EndCompress(&iod);
+    if (!code)
+	DumpLogStats(&iod, vp, start);
+    return code;
+}
+
+#ifdef AFS_PTHREAD_ENV
+/* one of the calls of DumpVolumeStreams after the first */
+struct dumpStream {
+    struct iod iod;
+    Volume *vp;
+    afs_int32 fromtime;
+    int code;
+};
+
+static void *
+DumpStreamThread(void *rock)
+{
+    struct dumpStream *ds = rock;
+    int code = 0;
+    afs_uint64 start = DumpNow();
+
+    if (ds->iod.zmethod != VOLDUMPCOMPRESS_NONE)
+	code = iod_StartCompress(&ds->iod, 0);
+    if (!code)
+	code = DumpVnodeIndex(&ds->iod, ds->vp, vLarge, ds->fromtime, 0);
+    if (!code)
+	code = DumpVnodeIndex(&ds->iod, ds->vp, vSmall, ds->fromtime, 0);
+    if (!code && rx_Error(ds->iod.call))
+	code = VOLSERDUMPERROR;
+    if (!code)
+	code = DumpEnd(&ds->iod);
+    iod_EndCompress(&ds->iod);
+    if (!code)
+	DumpLogStats(&ds->iod, ds->vp, start);
+    ds->code = code;
+    return NULL;
+}
+#endif
+
+/*
+ * Dump a volume over several calls at once, each from its own thread.
+ * The first call carries an ordinary dump, except that the vnode index
+ * chunks are dealt out among all the calls; the others carry just their
+ * vnodes and a dump end, for RestoreVnodeStream.  codes receives the
+ * outcome of each call.  A compressed dump is compressed call by call.
+ */
+int
+DumpVolumeStreams(struct rx_call **calls, int ncalls, Volume * vp,
+		  afs_int32 fromtime, int *codes, int zmethod, int zlevel)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct dumpStream *ds;
+    pthread_t *tids;
+    pthread_attr_t tattr;
+    struct iod iod;
+    int code = 0, i, nthreads;
+    afs_uint64 start = DumpNow();
+
+    ds = calloc(ncalls, sizeof(*ds));
+    tids = calloc(ncalls, sizeof(*tids));
+    if (ds == NULL || tids == NULL) {
+	free(ds);
+	free(tids);
+	return ENOMEM;
+    }
+    iod_Init(&iod, calls[0]);
+    iod.nstreams = ncalls;
+    iod.zmethod = zmethod;
+    iod.zlevel = zlevel;
+    code = DumpDumpHeader(&iod, vp, fromtime);
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_JOINABLE) == 0);
+    for (nthreads = 1; nthreads < ncalls && !code; nthreads++) {
+	struct dumpStream *dsp = &ds[nthreads];
+
+	iod_Init(&dsp->iod, calls[nthreads]);
+	dsp->iod.device = iod.device;
+	dsp->iod.parentId = iod.parentId;
+	dsp->iod.dumpPartition = iod.dumpPartition;
+	dsp->iod.stream = nthreads;
+	dsp->iod.nstreams = ncalls;
+	dsp->iod.zmethod = zmethod;
+	dsp->iod.zlevel = zlevel;
+	dsp->vp = vp;
+	dsp->fromtime = fromtime;
+	if (pthread_create(&tids[nthreads], &tattr, DumpStreamThread,
+			   dsp) != 0) {
+	    Log("1 Volser: DumpVolumeStreams: cannot start a thread for "
+		"stream %d\n", nthreads);
+	    code = VOLSERDUMPERROR;
+	    break;
+	}
+    }
+    opr_Verify(pthread_attr_destroy(&tattr) == 0);
+
+    if (!code)
+	code = DumpPartial(&iod, vp, fromtime, 0);
+    if (!code && rx_Error(iod.call)) {
+	Log("1 Volser: DumpVolumeStreams: Rx call failed during dump, "
+	    "error %d\n", rx_Error(iod.call));
+	code = VOLSERDUMPERROR;
+    }
+    if (!code)
+	code = DumpEnd(&iod);
+    iod_EndCompress(&iod);
+    if (!code)
+	DumpLogStats(&iod, vp, start);
+    codes[0] = code;
+
+    /* a failed stream leaves the others' restores waiting; abort them */
+    if (code) {
+	for (i = 0; i < ncalls; i++)
+	    rx_InterruptCall(calls[i], code);
+    }
+    for (i = 1; i < nthreads; i++) {
+	opr_Verify(pthread_join(tids[i], NULL) == 0);
+	codes[i] = ds[i].code;
+	if (!code && ds[i].code) {
+	    code = ds[i].code;
+	    rx_InterruptCall(calls[0], code);
+	}
+    }
+    for (; i < ncalls; i++)
+	codes[i] = VOLSERDUMPERROR;
+    free(ds);
+    free(tids);
     return code;
+#else
+    return VOLSERBADOP;
+#endif
 }
 
 /* A partial dump (no dump header) */
@@ -976,50 +1753,192 @@ DumpPartial(struct iod *iodp, Volume * vp,
     return code;
 }
 
+/*
+ * Sequential reader for a vnode index.  Dumps visit every vnode, changed
+ * or not, since the restoring side deletes the vnodes a dump leaves out,
+ * so the index is read in large chunks, with the next chunk read ahead
+ * while the current one is being dumped.  A dump split into streams
+ * deals the chunks out to them in turn.
+ */
+#define INDEX_CHUNKSIZE	(256 * 1024)	/* a multiple of both vnode sizes */
+
+struct indexReader {
+    FdHandle_t *fdP;
+    struct VnodeClassInfo *vcp;
+    char *buf[2];
+    afs_foff_t off[2];		/* index offset of each buffer */
+    int cur;			/* buffer being handed out */
+    ih_aio_t aio;		/* read of the other buffer */
+    int reading;		/* aio outstanding */
+    afs_foff_t next;		/* index offset of the next read */
+    afs_foff_t skip;		/* other streams' chunks after each read */
+    afs_foff_t end;		/* index size */
+    ssize_t len;		/* bytes in buf[cur] */
+    ssize_t pos;		/* next vnode in buf[cur] */
+    ssize_t ahead;		/* next vnode in buf[cur] to read ahead */
+};
+
+static void
+IndexReadAhead(struct indexReader *r)
+{
+    afs_foff_t len = r->end - r->next;
+
+    if (len <= 0)
+	return;
+    if (len > INDEX_CHUNKSIZE)
+	len = INDEX_CHUNKSIZE;
+    r->off[!r->cur] = r->next;
+    FDH_APREAD(&r->aio, r->fdP, r->buf[!r->cur], len, r->next);
+    r->next += len + r->skip;
+    r->reading = 1;
+}
+
+/* Open the index for reading the chunks of one stream of nstreams. */
 static int
-DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
-	       afs_int32 fromtime, int forcedump)
+IndexOpen(struct indexReader *r, Volume * vp, VnodeClass class, int stream,
+	  int nstreams)
 {
-    int code = 0;
-    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
-    char buf[SIZEOF_LARGEDISKVNODE];
-    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
-    StreamHandle_t *file;
-    FdHandle_t *fdP;
-    afs_sfsize_t size, nVnodes;
-    int flag;
-    int vnodeIndex;
+    afs_sfsize_t size;
 
-    fdP = IH_OPEN(vp->vnodeIndex[class].handle);
-    opr_Assert(fdP != NULL);
-    file = FDH_FDOPEN(fdP, "r+");
-    opr_Assert(file != NULL);
-    size = OS_SIZE(fdP->fd_fd);
+    memset(r, 0, sizeof(*r));
+    r->vcp = &VnodeClassInfo[class];
+    r->fdP = IH_OPEN(vp->vnodeIndex[class].handle);
+    opr_Assert(r->fdP != NULL);
+    size = FDH_SIZE(r->fdP);
     opr_Assert(size != -1);
-    nVnodes = (size / vcp->diskSize) - 1;
-    if (nVnodes > 0) {
-	opr_Assert((nVnodes + 1) * vcp->diskSize == size);
-	opr_Assert(STREAM_ASEEK(file, vcp->diskSize) == 0);
-    } else
-	nVnodes = 0;
-    for (vnodeIndex = 0;
-	 nVnodes && STREAM_READ(vnode, vcp->diskSize, 1, file) == 1 && !code;
-	 nVnodes--, vnodeIndex++) {
-	flag = forcedump || (vnode->serverModifyTime >= fromtime);
-	/* Note:  the >= test is very important since some old volumes may not have
-	 * a serverModifyTime.  For an epoch dump, this results in 0>=0 test, which
+    if (size > r->vcp->diskSize)
+	opr_Assert(size % r->vcp->diskSize == 0);
+    r->buf[0] = malloc(INDEX_CHUNKSIZE);
+    r->buf[1] = malloc(INDEX_CHUNKSIZE);
+    if (r->buf[0] == NULL || r->buf[1] == NULL) {
+	free(r->buf[0]);
+	free(r->buf[1]);
+	FDH_CLOSE(r->fdP);
+	return ENOMEM;
+    }
+    /* the first slot of the index holds no vnode */
+    r->next = r->vcp->diskSize + (afs_foff_t)stream * INDEX_CHUNKSIZE;
+    r->skip = (afs_foff_t)(nstreams - 1) * INDEX_CHUNKSIZE;
+    r->end = size;
+    /* into buf[1]; IndexNext switches to it first */
+    IndexReadAhead(r);
+    return 0;
+}
+
+/*
+ * Return the next vnode in the index, NULL at the end of the index, or
+ * NULL with *errorp set if the index could not be read.  *vnodeIndexp is
+ * set to the returned vnode's bit number.
+ */
+static struct VnodeDiskObject *
+IndexNext(struct indexReader *r, int *vnodeIndexp, int *errorp)
+{
+    struct VnodeDiskObject *vnode;
+    ssize_t nbytes;
+
+    if (r->pos >= r->len) {
+	if (!r->reading)
+	    return NULL;
+	nbytes = FDH_AWAIT(&r->aio);
+	r->reading = 0;
+	if (nbytes != r->aio.aio_len) {
+	    Log("1 Volser: cannot read vnode index at offset %lld: %s\n",
+		(long long)r->aio.aio_off,
+		nbytes < 0 ? afs_error_message(r->aio.aio_errno) : "short read");
+	    *errorp = VOLSERDUMPERROR;
+	    return NULL;
+	}
+	r->cur = !r->cur;
+	r->len = nbytes;
+	r->pos = 0;
+	r->ahead = 0;
+	IndexReadAhead(r);
+    }
+    vnode = (struct VnodeDiskObject *)(r->buf[r->cur] + r->pos);
+    *vnodeIndexp = (r->off[r->cur] + r->pos) / r->vcp->diskSize - 1;
+    r->pos += r->vcp->diskSize;
+    return vnode;
+}
+
+/*
+ * Start reading in the data of the next DUMP_PREFETCH vnodes in the chunk
+ * that will have their data dumped, but not of files likely to be sent as
+ * block deltas, which read just what they need.
+ */
+static void
+IndexPrefetch(struct indexReader *r, struct iod *iodp, afs_int32 fromtime,
+	      int forcedump)
+{
+    struct VnodeDiskObject *v;
+    ssize_t limit;
+    afs_sfsize_t length;
+    IHandle_t *ihP;
+    FdHandle_t *fdP;
+
+    limit = r->pos + DUMP_PREFETCH * r->vcp->diskSize;
+    if (limit > r->len)
+	limit = r->len;
+    if (r->ahead < r->pos)
+	r->ahead = r->pos;
+    for (; r->ahead < limit; r->ahead += r->vcp->diskSize) {
+	v = (struct VnodeDiskObject *)(r->buf[r->cur] + r->ahead);
+	if (v->type == vNull || !VNDISK_GET_INO(v)
+	    || !(forcedump || v->serverModifyTime >= fromtime))
+	    continue;
+	VNDISK_GET_LEN(length, v);
+	if (length == 0 || (iodp->deltaTrans && v->type == vFile
+			    && length >= DELTA_MINSIZE))
+	    continue;
+	IH_INIT(ihP, iodp->device, iodp->parentId, VNDISK_GET_INO(v));
+	fdP = IH_OPEN(ihP);
+	if (fdP != NULL) {
+	    FDH_PREFETCH(fdP, 0, (length > DUMP_PREFETCHSIZE) ?
+			 DUMP_PREFETCHSIZE : length);
+	    FDH_CLOSE(fdP);
+	    iodp->stats.prefetched++;
+	}
+	IH_RELEASE(ihP);
+    }
+}
+
+static void
+IndexClose(struct indexReader *r)
+{
+    if (r->reading)
+	(void)FDH_AWAIT(&r->aio);
+    FDH_CLOSE(r->fdP);
+    free(r->buf[0]);
+    free(r->buf[1]);
+}
+
+static int
+DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
+	       afs_int32 fromtime, int forcedump)
+{
+    int code = 0;
+    struct indexReader reader;
+    struct VnodeDiskObject *vnode;
+    int flag;
+    int vnodeIndex;
+
+    code = IndexOpen(&reader, vp, class, iodp->stream, iodp->nstreams);
+    if (code)
+	return VOLSERDUMPERROR;
+    while (!code && (vnode = IndexNext(&reader, &vnodeIndex, &code)) != NULL) {
+	IndexPrefetch(&reader, iodp, fromtime, forcedump);
+	flag = forcedump || (vnode->serverModifyTime >= fromtime);
+	/* Note:  the >= test is very important since some old volumes may not have
+	 * a serverModifyTime.  For an epoch dump, this results in 0>=0 test, which
 	 * does dump the file! */
-	if (!code)
-	    code =
-		DumpVnode(iodp, vnode, V_id(vp),
-			  bitNumberToVnodeNumber(vnodeIndex, class), flag);
+	code =
+	    DumpVnode(iodp, vnode, V_id(vp),
+		      bitNumberToVnodeNumber(vnodeIndex, class), flag);
 #ifndef AFS_PTHREAD_ENV
 	if (!flag)
 	    IOMGR_Poll();	/* if we dont' xfr data, but scan instead, could lose conn */
 #endif
     }
-    STREAM_CLOSE(file);
-    FDH_CLOSE(fdP);
+    IndexClose(&reader);
     return code;
 }
 
@@ -1059,6 +1978,14 @@ DumpDumpHeader(struct iod *iodp, Volume * vp,
     }
     if (!code)
 	code = DumpArrayInt32(iodp, 't', (afs_uint32 *) dumpTimes, 2);
+    if (!code && iodp->zmethod != VOLDUMPCOMPRESS_NONE) {
+	/* must come last; what follows is compressed */
+	code = DumpTag(iodp, 0x7e);
+	if (!code)
+	    code = DumpInt32(iodp, 'z', iodp->zmethod);
+	if (!code)
+	    code = iod_StartCompress(iodp, 0);
+    }
     return code;
 }
 
@@ -1133,7 +2060,11 @@ DumpVnode(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
 		(unsigned long)indexlen, (unsigned long)disklen);
 	    return VOLSERREAD_DUMPERROR;
 	}
-	code = DumpFile(iodp, vnodeNumber, fdP);
+	code = DELTA_WHOLE;
+	if (iodp->deltaTrans && v->type == vFile && disklen >= DELTA_MINSIZE)
+	    code = DumpFileDelta(iodp, vnodeNumber, v, fdP, disklen);
+	if (code == DELTA_WHOLE)
+	    code = DumpFile(iodp, vnodeNumber, fdP);
 	FDH_CLOSE(fdP);
 	IH_RELEASE(ihP);
     }
@@ -1232,8 +2163,14 @@ ProcessIndex(Volume * vp, VnodeClass class, afs_foff_t ** Bufp, int *sizep,
 }
 
 
+/*
+ * Restore a dump into a volume.  If streams is given, the dump's vnodes
+ * are shared with other calls, which RestoreVnodeStream reads
+ * concurrently; the volume is finished once they are all done.
+ */
 int
-RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
+RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie,
+	      struct restoreStreams *streams)
 {
     VolumeDiskData vol;
     struct DumpHeader header;
@@ -1258,16 +2195,19 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 
     if (!ReadDumpHeader(iodp, &header)) {
 	Log("1 Volser: RestoreVolume: Error reading header file for dump; aborted\n");
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
     if (iod_getc(iodp) != D_VOLUMEHEADER) {
 	Log("1 Volser: RestoreVolume: Volume header missing from dump; not restored\n");
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
     if (ReadVolumeHeader(iodp, &vol) == VOLSERREAD_DUMPERROR) {
 	Log("1 Volser: RestoreVolume: Error reading volume header (id: %u); aborted\n",
 	    V_id(vp));
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
 
     if (!delo)
@@ -1287,6 +2227,20 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 
     V_needsSalvaged(vp) = 0;
 
+    if (streams) {
+	/* let the other streams go */
+	opr_mutex_enter(&streams->lock);
+	streams->b1 = b1;
+	streams->s1 = s1;
+	streams->b2 = b2;
+	streams->s2 = s2;
+	streams->delo = delo;
+	streams->zmethod = iodp->zmethod;
+	streams->ready = 1;
+	opr_cv_broadcast(&streams->cv);
+	opr_mutex_exit(&streams->lock);
+    }
+
     tdelo = delo;
     while (1) {
 	if (ReadVnodes(iodp, vp, b1, s1, b2, s2, tdelo)) {
@@ -1320,6 +2274,13 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 	goto clean;
     }
 
+    if (streams && WaitRestoreStreams(call, streams, 0)) {
+	Log("1 Volser: RestoreVolume: Error restoring vnodes from another stream (id: %u); aborted\n",
+	    V_id(vp));
+	error = VOLSERREAD_DUMPERROR;
+	goto clean;
+    }
+
     if (!delo) {
 	delo = ProcessIndex(vp, vLarge, &b1, &s1, 1);
 	if (!delo)
@@ -1331,6 +2292,8 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
     }
 
   clean:
+    if (streams && error)
+	WaitRestoreStreams(call, streams, error);
     if (DoPreserveVolumeStats) {
 	CopyVolumeStats(&saved_header, &vol);
     } else {
@@ -1366,6 +2329,9 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 	}
     }
   out:
+    if (streams && error)
+	WaitRestoreStreams(call, streams, error);
+    iod_EndCompress(iodp);
     /* Free the malloced space above */
     if (b1)
 	free(b1);
@@ -1374,15 +2340,474 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
     return error;
 }
 
+struct restoreStreams *
+NewRestoreStreams(int nstreams)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct restoreStreams *rs;
+
+    rs = calloc(1, sizeof(*rs));
+    if (rs == NULL)
+	return NULL;
+    opr_mutex_init(&rs->lock);
+    opr_cv_init(&rs->cv);
+    rs->nstreams = nstreams;
+    return rs;
+#else
+    return NULL;
+#endif
+}
+
+void
+FreeRestoreStreams(struct restoreStreams *rs)
+{
+    opr_mutex_destroy(&rs->lock);
+    opr_cv_destroy(&rs->cv);
+    free(rs);
+}
+
+/*
+ * Wait for the other streams of a restore.  If the restore has failed,
+ * with error, wait only for the streams still using RestoreVolume's
+ * buffers.  Otherwise wait for them all, and return nonzero if any of
+ * them failed, or our own call was aborted meanwhile.
+ */
+static int
+WaitRestoreStreams(struct rx_call *call, struct restoreStreams *rs, int error)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct timespec ts;
+    int code;
+
+    opr_mutex_enter(&rs->lock);
+    if (error && !rs->error) {
+	rs->error = error;
+	opr_cv_broadcast(&rs->cv);
+    }
+    while (rs->active > 0 || (!rs->error && rs->done < rs->nstreams)) {
+	if (!rs->error && rx_Error(call)) {
+	    rs->error = rx_Error(call);
+	    opr_cv_broadcast(&rs->cv);
+	    continue;
+	}
+	ts.tv_sec = time(NULL) + 5;
+	ts.tv_nsec = 0;
+	code = opr_cv_timedwait(&rs->cv, &rs->lock, &ts);
+	opr_Assert(code == 0 || code == ETIMEDOUT);
+    }
+    code = rs->error;
+    opr_mutex_exit(&rs->lock);
+    return code;
+#else
+    return error;
+#endif
+}
+
+/*
+ * Restore the vnodes one of the other calls of a split dump carries into
+ * a volume, once RestoreVolume has started on the volume header.
+ */
+int
+RestoreVnodeStream(struct rx_call *call, Volume * vp,
+		   struct restoreStreams *rs)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct iod iod;
+    struct iod *iodp = &iod;
+    struct timespec ts;
+    afs_uint32 endMagic;
+    int code = 0;
+
+    iod_Init(iodp, call);
+
+    /* until RestoreVolume has read the volume header, or given up */
+    opr_mutex_enter(&rs->lock);
+    while (!rs->ready && !rs->error && !rx_Error(call)) {
+	ts.tv_sec = time(NULL) + 5;
+	ts.tv_nsec = 0;
+	code = opr_cv_timedwait(&rs->cv, &rs->lock, &ts);
+	opr_Assert(code == 0 || code == ETIMEDOUT);
+    }
+    if (!rs->ready || rs->error) {
+	opr_mutex_exit(&rs->lock);
+	return VOLSERREAD_DUMPERROR;
+    }
+    rs->active++;
+    opr_mutex_exit(&rs->lock);
+    code = 0;
+
+    iodp->zmethod = rs->zmethod;
+    if (iodp->zmethod != VOLDUMPCOMPRESS_NONE && iod_StartCompress(iodp, 1)) {
+	Log("1 Volser: RestoreVnodeStream: dump compressed with unknown method %d\n",
+	    iodp->zmethod);
+	code = VOLSERREAD_DUMPERROR;
+    } else if (ReadVnodes(iodp, vp, rs->b1, rs->s1, rs->b2, rs->s2, rs->delo)) {
+	Log("1 Volser: RestoreVnodeStream: Error reading vnodes (id: %u); aborted\n",
+	    V_id(vp));
+	code = VOLSERREAD_DUMPERROR;
+    } else if (iod_getc(iodp) != D_DUMPEND || !ReadInt32(iodp, &endMagic)
+	       || endMagic != DUMPENDMAGIC || iod_getc(iodp) != EOF) {
+	Log("1 Volser: RestoreVnodeStream: End of dump not found; restore aborted\n");
+	code = VOLSERREAD_DUMPERROR;
+    }
+    iod_EndCompress(iodp);
+
+    opr_mutex_enter(&rs->lock);
+    rs->active--;
+    rs->done++;
+    if (code && !rs->error)
+	rs->error = code;
+    opr_cv_broadcast(&rs->cv);
+    opr_mutex_exit(&rs->lock);
+    return code;
+#else
+    return VOLSERBADOP;
+#endif
+}
+
+/*
+ * Parallel restore.  Creating an inode costs far more than parsing its
+ * vnode out of the dump, so with -restore-threads, ReadVnodes has a pool
+ * of threads create and fill the inodes of files small enough to hold in
+ * memory while it goes on parsing.  Each vnode it restores takes the next
+ * slot of a ring.  ReadVnodes reads a small file's data into its slot,
+ * and a thread creates the inode and writes the data.  Anything else is
+ * written as before, before the slot is taken.  Slots are retired in
+ * order, the oldest first, so the vnode index is still written in dump
+ * order.
+ */
+#define RESTORE_SLOTS	64
+#define RESTORE_MAXFILE	(64 * 1024)	/* larger files are written inline */
+
+#define SLOT_FREE	0
+#define SLOT_QUEUED	1		/* for a thread to create and fill */
+#define SLOT_BUSY	2		/* being created and filled */
+#define SLOT_DONE	3		/* ready for the vnode index */
+
+struct restoreSlot {
+    char vnode[SIZEOF_LARGEDISKVNODE];	/* first, to keep it aligned */
+    afs_int32 vnodeNumber;
+    char *data;			/* RESTORE_MAXFILE bytes */
+    afs_fsize_t length;		/* of the file in data */
+    Inode nearInode;
+    int state;
+    int error;
+};
+
+struct restorePool {
+    opr_mutex_t lock;
+    opr_cv_t workCV;		/* slots queued, or shutting down */
+    opr_cv_t doneCV;		/* a slot is done */
+    Volume *vp;
+    struct restoreSlot slots[RESTORE_SLOTS];
+    afs_uint32 head;		/* oldest slot not retired */
+    afs_uint32 tail;		/* next slot to take */
+    afs_uint32 next;		/* next slot for a thread to look at */
+    int shutdown;
+    int nthreads;
+#ifdef AFS_PTHREAD_ENV
+    pthread_t *tids;
+#endif
+};
+
+/* Write a restored vnode into the vnode index, releasing the inode of the
+ * vnode it replaces. */
+static int
+RestoreVnodeIndex(Volume * vp, afs_int32 vnodeNumber,
+		  struct VnodeDiskObject *vnode)
+{
+    VnodeClass class = vnodeIdToClass(vnodeNumber);
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    struct VnodeDiskObject oldvnode;
+    FdHandle_t *fdP;
+
+    fdP = IH_OPEN(vp->vnodeIndex[class].handle);
+    if (fdP == NULL) {
+	Log("1 Volser: ReadVnodes: Error opening vnode index: %s; restore aborted\n",
+	    afs_error_message(errno));
+	V_needsSalvaged(vp) = 1;
+	return VOLSERREAD_DUMPERROR;
+    }
+    if (FDH_PREAD(fdP, &oldvnode, sizeof(oldvnode), vnodeIndexOffset(vcp, vnodeNumber)) ==
+	sizeof(oldvnode)) {
+	if (oldvnode.type != vNull && VNDISK_GET_INO(&oldvnode)) {
+	    IH_DEC(V_linkHandle(vp), VNDISK_GET_INO(&oldvnode),
+		   V_parentId(vp));
+	}
+    }
+    vnode->vnodeMagic = vcp->magic;
+    if (FDH_PWRITE(fdP, vnode, vcp->diskSize, vnodeIndexOffset(vcp, vnodeNumber)) != vcp->diskSize) {
+	Log("1 Volser: ReadVnodes: Error writing vnode index: %s; restore aborted\n",
+	    afs_error_message(errno));
+	FDH_REALLYCLOSE(fdP);
+	V_needsSalvaged(vp) = 1;
+	return VOLSERREAD_DUMPERROR;
+    }
+    FDH_CLOSE(fdP);
+    return 0;
+}
+
+#ifdef AFS_PTHREAD_ENV
+/* Create and fill the inode of a queued slot. */
+static void
+RestoreSlotFile(Volume * vp, struct restoreSlot *sl)
+{
+    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)sl->vnode;
+    IHandle_t *tmpH;
+    FdHandle_t *fdP;
+    Inode ino;
+    ssize_t nBytes = 0;
+
+    tmpH = IH_CREATE_INIT(V_linkHandle(vp), V_device(vp),
+			  VPartitionPath(V_partition(vp)), sl->nearInode,
+			  V_parentId(vp), sl->vnodeNumber, vnode->uniquifier,
+			  vnode->dataVersion);
+    if (!tmpH) {
+	Log("1 Volser: ReadVnodes: IH_CREATE: %s - restore aborted\n",
+	    afs_error_message(errno));
+	sl->error = VOLSERREAD_DUMPERROR;
+	return;
+    }
+    ino = tmpH->ih_ino;
+    VNDISK_SET_INO(vnode, ino);
+    fdP = IH_OPEN(tmpH);
+    if (fdP == NULL) {
+	Log("1 Volser: ReadVnodes: IH_OPEN: %s - restore aborted\n",
+	    afs_error_message(errno));
+	IH_RELEASE(tmpH);
+	sl->error = VOLSERREAD_DUMPERROR;
+	return;
+    }
+    if (sl->length > 0) {
+	nBytes = FDH_PWRITE(fdP, sl->data, sl->length, 0);
+	if (nBytes != sl->length) {
+	    Log("1 Volser: WriteFile: Error writing (%u) bytes to vnode %d; %s; restore aborted\n",
+		(int)(nBytes & 0xffffffff), sl->vnodeNumber,
+		afs_error_message(errno));
+	    sl->error = VOLSERREAD_DUMPERROR;
+	}
+    }
+    VNDISK_SET_LEN(vnode, sl->length);
+    FDH_REALLYCLOSE(fdP);
+    IH_RELEASE(tmpH);
+    if (sl->error) {
+	Log("1 Volser: ReadVnodes: IDEC inode %llu\n", (afs_uintmax_t) ino);
+	IH_DEC(V_linkHandle(vp), ino, V_parentId(vp));
+    }
+}
+
+static void *
+RestorePoolThread(void *rock)
+{
+    struct restorePool *pool = rock;
+    struct restoreSlot *sl;
+
+    opr_mutex_enter(&pool->lock);
+    for (;;) {
+	while (pool->next != pool->tail
+	       && pool->slots[pool->next % RESTORE_SLOTS].state != SLOT_QUEUED)
+	    pool->next++;
+	if (pool->next != pool->tail) {
+	    sl = &pool->slots[pool->next++ % RESTORE_SLOTS];
+	    sl->state = SLOT_BUSY;
+	    opr_mutex_exit(&pool->lock);
+
+	    RestoreSlotFile(pool->vp, sl);
+
+	    opr_mutex_enter(&pool->lock);
+	    sl->state = SLOT_DONE;
+	    opr_cv_broadcast(&pool->doneCV);
+	    continue;
+	}
+	if (pool->shutdown)
+	    break;
+	opr_cv_wait(&pool->workCV, &pool->lock);
+    }
+    opr_mutex_exit(&pool->lock);
+    return NULL;
+}
+#endif /* AFS_PTHREAD_ENV */
+
+static int RestorePoolEnd(struct restorePool *pool, int code);
+
+/* Start a pool of nthreads threads restoring into vp; NULL if there is no
+ * point or no way to. */
+static struct restorePool *
+RestorePoolStart(Volume * vp, int nthreads)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct restorePool *pool;
+    int i;
+
+    if (nthreads < 2)
+	return NULL;
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+	return NULL;
+    pool->tids = calloc(nthreads, sizeof(*pool->tids));
+    if (pool->tids == NULL) {
+	free(pool);
+	return NULL;
+    }
+    for (i = 0; i < RESTORE_SLOTS; i++) {
+	pool->slots[i].data = malloc(RESTORE_MAXFILE);
+	if (pool->slots[i].data == NULL) {
+	    while (--i >= 0)
+		free(pool->slots[i].data);
+	    free(pool->tids);
+	    free(pool);
+	    return NULL;
+	}
+    }
+    opr_mutex_init(&pool->lock);
+    opr_cv_init(&pool->workCV);
+    opr_cv_init(&pool->doneCV);
+    pool->vp = vp;
+    for (i = 0; i < nthreads; i++) {
+	int code;
+	AFS_SIGSET_DECL;
+
+	AFS_SIGSET_CLEAR();
+	code = pthread_create(&pool->tids[i], NULL, RestorePoolThread, pool);
+	AFS_SIGSET_RESTORE();
+	if (code != 0)
+	    break;
+    }
+    pool->nthreads = i;
+    if (i == 0) {
+	RestorePoolEnd(pool, 0);
+	return NULL;
+    }
+    return pool;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Retire the oldest slot: wait for its inode, and write its vnode into
+ * the index.
+ */
+static int
+RestoreRetire(struct restorePool *pool)
+{
+    struct restoreSlot *sl = &pool->slots[pool->head % RESTORE_SLOTS];
+    int code;
+
+    opr_mutex_enter(&pool->lock);
+    while (sl->state != SLOT_DONE)
+	opr_cv_wait(&pool->doneCV, &pool->lock);
+    opr_mutex_exit(&pool->lock);
+
+    code = sl->error;
+    if (code)
+	V_needsSalvaged(pool->vp) = 1;
+    else
+	code = RestoreVnodeIndex(pool->vp, sl->vnodeNumber,
+				 (struct VnodeDiskObject *)sl->vnode);
+    sl->state = SLOT_FREE;
+    pool->head++;
+    return code;
+}
+
+/* The slot the next vnode will take, once one is free */
+static struct restoreSlot *
+RestoreNextSlot(struct restorePool *pool, int *codep)
+{
+    *codep = 0;
+    if (pool->tail - pool->head == RESTORE_SLOTS)
+	*codep = RestoreRetire(pool);
+    return &pool->slots[pool->tail % RESTORE_SLOTS];
+}
+
+/*
+ * Take the next slot for a vnode.  If queue is set, its data is in the
+ * slot, for a thread to create the inode; otherwise the vnode is complete.
+ */
+static void
+RestoreTakeSlot(struct restorePool *pool, struct restoreSlot *sl,
+		afs_int32 vnodeNumber, struct VnodeDiskObject *vnode,
+		Inode nearInode, int queue)
+{
+    memcpy(sl->vnode, vnode, sizeof(sl->vnode));
+    sl->vnodeNumber = vnodeNumber;
+    sl->nearInode = nearInode;
+    sl->error = 0;
+    opr_mutex_enter(&pool->lock);
+    sl->state = queue ? SLOT_QUEUED : SLOT_DONE;
+    pool->tail++;
+    if (queue)
+	opr_cv_signal(&pool->workCV);
+    opr_mutex_exit(&pool->lock);
+}
+
+/*
+ * Finish with a pool.  If the restore succeeded, retire the slots still
+ * in use; otherwise wait for the threads to be done with them, and
+ * release the inodes they were given.
+ */
+static int
+RestorePoolEnd(struct restorePool *pool, int code)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct restoreSlot *sl;
+    int i;
+
+    while (!code && pool->head != pool->tail)
+	code = RestoreRetire(pool);
+    opr_mutex_enter(&pool->lock);
+    for (; pool->head != pool->tail; pool->head++) {
+	sl = &pool->slots[pool->head % RESTORE_SLOTS];
+	while (sl->state != SLOT_DONE)
+	    opr_cv_wait(&pool->doneCV, &pool->lock);
+	if (!sl->error
+	    && VNDISK_GET_INO((struct VnodeDiskObject *)sl->vnode))
+	    IH_DEC(V_linkHandle(pool->vp),
+		   VNDISK_GET_INO((struct VnodeDiskObject *)sl->vnode),
+		   V_parentId(pool->vp));
+    }
+    pool->shutdown = 1;
+    opr_cv_broadcast(&pool->workCV);
+    opr_mutex_exit(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++)
+	opr_Verify(pthread_join(pool->tids[i], NULL) == 0);
+
+    opr_cv_destroy(&pool->doneCV);
+    opr_cv_destroy(&pool->workCV);
+    opr_mutex_destroy(&pool->lock);
+    for (i = 0; i < RESTORE_SLOTS; i++)
+	free(pool->slots[i].data);
+    free(pool->tids);
+    free(pool);
+#endif
+    return code;
+}
+
 static int
 ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
            afs_foff_t * Sbuf, afs_int32 s2, afs_int32 delo)
+{
+    struct restorePool *pool;
+    int code;
+
+    pool = RestorePoolStart(vp, RestoreThreads);
+    code = ParseVnodes(iodp, vp, Lbuf, s1, Sbuf, s2, delo, pool);
+    if (pool)
+	code = RestorePoolEnd(pool, code);
+    return code;
+}
+
+/* Restore the vnodes of a dump, through pool if it is not NULL */
+static int
+ParseVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
+	    afs_foff_t * Sbuf, afs_int32 s2, afs_int32 delo,
+	    struct restorePool *pool)
 {
     afs_int32 vnodeNumber;
     char buf[SIZEOF_LARGEDISKVNODE];
     int tag;
     struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
-    struct VnodeDiskObject oldvnode;
+    struct restoreSlot *slot = NULL;
     int idx;
     VnodeClass class;
     struct VnodeClassInfo *vcp;
@@ -1390,13 +2815,15 @@ ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
     FdHandle_t *fdP;
     Inode nearInode AFS_UNUSED;
     afs_int32 critical = 0;
-    int nbytes;
+    afs_size_t taglen = 0;
+    int nbytes, code;
 
     tag = iod_getc(iodp);
     V_pref(vp, nearInode);
     while (tag == D_VNODE) {
 	int haveStuff = 0;
 	int saw_f = 0;
+	int queue = 0;
 	memset(buf, 0, sizeof(buf));
 	if (!ReadInt32(iodp, (afs_uint32 *) & vnodeNumber))
 	    break;
@@ -1469,21 +2896,50 @@ ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
 		    return VOLSERREAD_DUMPERROR;
 		}
 		break;
+	    case 'D':
+		/* a block delta of the file; see DumpFileDelta */
+		if (!ReadStandardTagLen(iodp, tag, 2, &taglen))
+		    return VOLSERREAD_DUMPERROR;
+		/* FALLTHROUGH */
 	    case 'h':
 	    case 'f':{
 		    Inode ino;
 		    Error error;
-		    afs_fsize_t vnodeLength;
+		    afs_fsize_t vnodeLength = 0;
 
+		    if (tag != 'D' && !ReadFileLength(iodp, tag, &vnodeLength))
+			return VOLSERREAD_DUMPERROR;
 		    if (saw_f) {
 			Log("Volser: ReadVnodes: warning: ignoring duplicate "
 			    "file entries for vnode %lu in dump\n",
 			    (unsigned long)vnodeNumber);
-			volser_WriteFile(vnodeNumber, iodp, NULL, tag, &error);
+			if (tag == 'D') {
+			    if (!SkipData(iodp, taglen))
+				return VOLSERREAD_DUMPERROR;
+			} else
+			    volser_WriteFile(vnodeNumber, iodp, NULL,
+					     vnodeLength, &error);
 			break;
 		    }
 		    saw_f = 1;
 
+		    /* small enough for the pool; read it into the slot */
+		    if (pool && tag != 'D' && vnodeLength <= RESTORE_MAXFILE) {
+			slot = RestoreNextSlot(pool, &code);
+			if (code)
+			    return code;
+			if (vnodeLength > 0
+			    && iod_Read(iodp, slot->data, vnodeLength)
+			       != vnodeLength) {
+			    Log("1 Volser: WriteFile: Error reading dump file %d size=%llu; restore aborted\n",
+				vnodeNumber, (afs_uintmax_t) vnodeLength);
+			    return VOLSERREAD_DUMPERROR;
+			}
+			slot->length = vnodeLength;
+			queue = 1;
+			break;
+		    }
+
 		    tmpH =
 			IH_CREATE_INIT(V_linkHandle(vp), V_device(vp),
 				  VPartitionPath(V_partition(vp)), nearInode,
@@ -1506,8 +2962,14 @@ ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
 			V_needsSalvaged(vp) = 1;
 			return VOLSERREAD_DUMPERROR;
 		    }
-		    vnodeLength =
-			volser_WriteFile(vnodeNumber, iodp, fdP, tag, &error);
+		    if (tag == 'D')
+			vnodeLength =
+			    volser_WriteDelta(vp, vnodeNumber, vnode, iodp, fdP,
+					      taglen, &error);
+		    else
+			vnodeLength =
+			    volser_WriteFile(vnodeNumber, iodp, fdP,
+					     vnodeLength, &error);
 		    VNDISK_SET_LEN(vnode, vnodeLength);
 		    FDH_REALLYCLOSE(fdP);
 		    IH_RELEASE(tmpH);
@@ -1545,29 +3007,20 @@ ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
 	}
 
 	if (haveStuff) {
-	    FdHandle_t *fdP = IH_OPEN(vp->vnodeIndex[class].handle);
-	    if (fdP == NULL) {
-		Log("1 Volser: ReadVnodes: Error opening vnode index: %s; restore aborted\n",
-		    afs_error_message(errno));
-		V_needsSalvaged(vp) = 1;
-		return VOLSERREAD_DUMPERROR;
-	    }
-	    if (FDH_PREAD(fdP, &oldvnode, sizeof(oldvnode), vnodeIndexOffset(vcp, vnodeNumber)) ==
-		sizeof(oldvnode)) {
-		if (oldvnode.type != vNull && VNDISK_GET_INO(&oldvnode)) {
-		    IH_DEC(V_linkHandle(vp), VNDISK_GET_INO(&oldvnode),
-			   V_parentId(vp));
+	    if (pool) {
+		/* an inode queued for the pool has its slot already */
+		if (!queue) {
+		    slot = RestoreNextSlot(pool, &code);
+		    if (code)
+			return code;
 		}
+		RestoreTakeSlot(pool, slot, vnodeNumber, vnode, nearInode,
+				queue);
+	    } else {
+		code = RestoreVnodeIndex(vp, vnodeNumber, vnode);
+		if (code)
+		    return code;
 	    }
-	    vnode->vnodeMagic = vcp->magic;
-	    if (FDH_PWRITE(fdP, vnode, vcp->diskSize, vnodeIndexOffset(vcp, vnodeNumber)) != vcp->diskSize) {
-		Log("1 Volser: ReadVnodes: Error writing vnode index: %s; restore aborted\n",
-		    afs_error_message(errno));
-		FDH_REALLYCLOSE(fdP);
-		V_needsSalvaged(vp) = 1;
-		return VOLSERREAD_DUMPERROR;
-	    }
-	    FDH_CLOSE(fdP);
 	}
     }
     iod_ungetc(iodp, tag);
@@ -1576,20 +3029,35 @@ ReadVnodes(struct iod *iodp, Volume * vp, afs_foff_t * Lbuf, afs_int32 s1,
 }
 
 
-/* called with disk file only.  Note that we don't have to worry about rx_Read
- * needing to read an ungetc'd character, since the ReadInt32 will have read
- * it instead.
+/* Read the length of a file ('f' or 'h' tag) */
+static int
+ReadFileLength(struct iod *iodp, int tag, afs_fsize_t *lengthp)
+{
+    afs_uint32 filesize_high = 0L, filesize_low = 0L;
+
+    if (tag == 'h') {
+	if (!ReadInt32(iodp, &filesize_high))
+	    return 0;
+    }
+    if (!ReadInt32(iodp, &filesize_low))
+	return 0;
+    FillInt64(*lengthp, filesize_high, filesize_low);
+    return 1;
+}
+
+/* called with disk file only, after its length has been read.  Note that
+ * we don't have to worry about rx_Read needing to read an ungetc'd
+ * character, since the ReadInt32 will have read it instead.
  *
  * if handleP == NULL, don't write the file anywhere; just read and discard
  * the file contents
  */
 static afs_fsize_t
-volser_WriteFile(int vn, struct iod *iodp, FdHandle_t * handleP, int tag,
-		 Error * status)
+volser_WriteFile(int vn, struct iod *iodp, FdHandle_t * handleP,
+		 afs_fsize_t filesize, Error * status)
 {
     afs_int32 code;
     ssize_t nBytes;
-    afs_fsize_t filesize;
     afs_fsize_t written = 0;
     size_t size = 8192;
     afs_fsize_t nbytes;
@@ -1597,20 +3065,6 @@ volser_WriteFile(int vn, struct iod *iodp, FdHandle_t * handleP, int tag,
 
 
     *status = 0;
-    {
-	afs_uint32 filesize_high = 0L, filesize_low = 0L;
-	if (tag == 'h') {
-	    if (!ReadInt32(iodp, &filesize_high)) {
-		*status = 1;
-		return 0;
-	    }
-	}
-	if (!ReadInt32(iodp, &filesize_low)) {
-	    *status = 1;
-	    return 0;
-	}
-	FillInt64(filesize, filesize_high, filesize_low);
-    }
     p = malloc(size);
     if (p == NULL) {
 	*status = 2;
@@ -1640,6 +3094,136 @@ volser_WriteFile(int vn, struct iod *iodp, FdHandle_t * handleP, int tag,
     return (written);
 }
 
+/*
+ * Write a file from a block delta ('D' tag) against the copy of the same
+ * vnode the volume holds now.  Blocks are copied from the old copy, which
+ * stays intact, into the new inode; the kernel shares their data where the
+ * partition supports it.
+ */
+static afs_fsize_t
+volser_WriteDelta(Volume * vp, int vn, struct VnodeDiskObject *vnode,
+		  struct iod *iodp, FdHandle_t * handleP, afs_size_t taglen,
+		  Error * status)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[vSmall];
+    struct VnodeDiskObject base;
+    IHandle_t *baseH = NULL;
+    FdHandle_t *baseP = NULL, *fdP;
+    afs_uint32 blockSize, baseVersion, hi, lo, count;
+    afs_fsize_t length, baseLength, run;
+    afs_fsize_t written = 0;
+    afs_sfsize_t copied;
+    ssize_t n;
+    char *p = NULL;
+    int op;
+
+    *status = 0;
+    if (vnodeIdToClass(vn) != vSmall || taglen < 16
+	|| !ReadInt32(iodp, &blockSize)
+	|| !ReadInt32(iodp, &baseVersion) || !ReadInt32(iodp, &hi)
+	|| !ReadInt32(iodp, &lo)) {
+	*status = 1;
+	return 0;
+    }
+    taglen -= 16;
+    FillInt64(length, hi, lo);
+
+    /* the copy the source volserver took the checksums of */
+    fdP = IH_OPEN(vp->vnodeIndex[vSmall].handle);
+    if (fdP == NULL
+	|| FDH_PREAD(fdP, &base, sizeof(base),
+		     vnodeIndexOffset(vcp, vn)) != sizeof(base)
+	|| base.type != vFile || base.uniquifier != vnode->uniquifier
+	|| base.dataVersion != baseVersion
+	|| !VALID_INO(VNDISK_GET_INO(&base))) {
+	Log("1 Volser: WriteDelta: vnode %d does not match the delta; "
+	    "restore aborted\n", vn);
+	if (fdP)
+	    FDH_CLOSE(fdP);
+	*status = 5;
+	return 0;
+    }
+    FDH_CLOSE(fdP);
+    IH_INIT(baseH, V_device(vp), V_parentId(vp), VNDISK_GET_INO(&base));
+    baseP = IH_OPEN(baseH);
+    p = malloc(DELTA_BLOCKSIZE);
+    if (baseP == NULL || p == NULL) {
+	*status = 2;
+	goto done;
+    }
+    baseLength = FDH_SIZE(baseP);
+
+    while (taglen > 0 && !*status) {
+	op = iod_getc(iodp);
+	if (taglen < 5 || !ReadInt32(iodp, &count) || count == 0
+	    || written >= length) {
+	    *status = 1;
+	    break;
+	}
+	taglen -= 5;
+	run = (afs_fsize_t)count * blockSize;
+	if (run > length - written)
+	    run = length - written;
+	if (op == 'c') {
+	    /* unchanged blocks */
+	    if (written + run > baseLength) {
+		*status = 5;
+		break;
+	    }
+	    copied = FDH_COPYRANGE(baseP, handleP, written, run);
+	    if (copied < 0)
+		copied = 0;
+	    for (; copied < run; copied += n) {
+		n = (run - copied > DELTA_BLOCKSIZE) ?
+		    DELTA_BLOCKSIZE : run - copied;
+		if (FDH_PREAD(baseP, p, n, written + copied) != n
+		    || FDH_PWRITE(handleP, p, n, written + copied) != n) {
+		    Log("1 Volser: WriteDelta: Error copying vnode %d: %s; "
+			"restore aborted\n", vn, afs_error_message(errno));
+		    *status = 4;
+		    break;
+		}
+	    }
+	} else if (op == 'd' && run <= taglen) {
+	    /* changed blocks, from the dump */
+	    taglen -= run;
+	    for (copied = 0; copied < run; copied += n) {
+		n = (run - copied > DELTA_BLOCKSIZE) ?
+		    DELTA_BLOCKSIZE : run - copied;
+		if (iod_Read(iodp, p, n) != n) {
+		    Log("1 Volser: WriteDelta: Error reading dump for "
+			"vnode %d; restore aborted\n", vn);
+		    *status = 3;
+		    break;
+		}
+		if (FDH_PWRITE(handleP, p, n, written + copied) != n) {
+		    Log("1 Volser: WriteDelta: Error writing vnode %d: %s; "
+			"restore aborted\n", vn, afs_error_message(errno));
+		    *status = 4;
+		    break;
+		}
+	    }
+	} else {
+	    *status = 1;
+	    break;
+	}
+	if (!*status)
+	    written += run;
+    }
+    if (!*status && written != length)
+	*status = 1;
+    if (*status == 1 || *status == 5)
+	Log("1 Volser: WriteDelta: invalid delta for vnode %d; "
+	    "restore aborted\n", vn);
+
+  done:
+    free(p);
+    if (baseP)
+	FDH_CLOSE(baseP);
+    IH_RELEASE(baseH);
+    return written;
+}
+
 static int
 ReadDumpHeader(struct iod *iodp, struct DumpHeader *hp)
 {
@@ -1674,6 +3258,16 @@ ReadDumpHeader(struct iod *iodp, struct DumpHeader *hp)
 		    || !ReadInt32(iodp, (afs_uint32 *) & hp->dumpTimes[i].to))
 		    return 0;
 	    break;
+	case 'z':
+	    /* the rest of the dump is compressed */
+	    if (!ReadInt32(iodp, (afs_uint32 *) & iodp->zmethod))
+		return 0;
+	    if (iod_StartCompress(iodp, 1)) {
+		Log("1 Volser: ReadDumpHeader: dump compressed with unknown "
+		    "method %d\n", iodp->zmethod);
+		return 0;
+	    }
+	    break;
         case 0x7e:
             critical = 2;
             break;
@@ -1935,41 +3529,24 @@ SizeDumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
 		   struct volintSize *v_size)
 {
     int code = 0;
-    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
-    char buf[SIZEOF_LARGEDISKVNODE];
-    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
-    StreamHandle_t *file;
-    FdHandle_t *fdP;
-    afs_sfsize_t size, nVnodes;
+    struct indexReader reader;
+    struct VnodeDiskObject *vnode;
     int flag;
     int vnodeIndex;
 
-    fdP = IH_OPEN(vp->vnodeIndex[class].handle);
-    opr_Assert(fdP != NULL);
-    file = FDH_FDOPEN(fdP, "r+");
-    opr_Assert(file != NULL);
-    size = OS_SIZE(fdP->fd_fd);
-    opr_Assert(size != -1);
-    nVnodes = (size / vcp->diskSize) - 1;
-    if (nVnodes > 0) {
-	opr_Assert((nVnodes + 1) * vcp->diskSize == size);
-	opr_Assert(STREAM_ASEEK(file, vcp->diskSize) == 0);
-    } else
-	nVnodes = 0;
-    for (vnodeIndex = 0;
-	 nVnodes && STREAM_READ(vnode, vcp->diskSize, 1, file) == 1 && !code;
-	 nVnodes--, vnodeIndex++) {
+    code = IndexOpen(&reader, vp, class, iodp->stream, iodp->nstreams);
+    if (code)
+	return VOLSERDUMPERROR;
+    while (!code && (vnode = IndexNext(&reader, &vnodeIndex, &code)) != NULL) {
 	flag = forcedump || (vnode->serverModifyTime >= fromtime);
 	/* Note:  the >= test is very important since some old volumes may not have
 	 * a serverModifyTime.  For an epoch dump, this results in 0>=0 test, which
 	 * does dump the file! */
-	if (!code)
-	    code =
-		SizeDumpVnode(iodp, vnode, V_id(vp),
-			      bitNumberToVnodeNumber(vnodeIndex, class), flag,
-			      v_size);
+	code =
+	    SizeDumpVnode(iodp, vnode, V_id(vp),
+			  bitNumberToVnodeNumber(vnodeIndex, class), flag,
+			  v_size);
     }
-    STREAM_CLOSE(file);
-    FDH_CLOSE(fdP);
+    IndexClose(&reader);
     return code;
 }
@@ -19,6 +19,18 @@
  * of characters (i.e. characters should not double both as an end marker
  * and a begin marker)
  */
+
+/* What each stage of a dump moved, and how long the dump waited on it.
+ * Times are in microseconds. */
+struct dumpStats {
+    afs_uint64 readBytes;	/* file data read from disk */
+    afs_uint64 readWait;	/* waiting for those reads */
+    afs_uint64 sendBytes;	/* bytes written to the calls */
+    afs_uint64 sendWait;	/* writing them */
+    afs_uint32 files;		/* data files dumped */
+    afs_uint32 prefetched;	/* data files read ahead */
+};
+
 struct iod {
     struct rx_call *call;	/* call to which to write, might be an array */
     int device;			/* dump device ID for volume */
@@ -27,15 +39,53 @@ struct iod {
     struct rx_call **calls;	/* array of pointers to calls */
     int ncalls;			/* how many calls/codes in array */
     int *codes;			/* one return code for each call */
+    afs_int32 *deltaTrans;	/* destination transaction for each call, for
+				 * block deltas; 0 if it cannot take them */
+    int stream;			/* which share of the vnodes to dump, */
+    int nstreams;		/* when a dump is split over several calls */
+    int zmethod;		/* compress the dump after its header this */
+    int zlevel;			/* way (a VOLDUMPCOMPRESS_ method) */
+    struct iodCompress *z;	/* compressing or expanding the calls */
+    struct dumpStats stats;
     char haveOldChar;		/* state for pushing back a character */
     char oldChar;
 };
 
-extern int DumpVolume(struct rx_call *call, Volume *vp, afs_int32, int);
+/* A restore whose vnodes arrive over several calls, one of them
+ * RestoreVolume's.  The others are read by RestoreVnodeStream. */
+struct restoreStreams {
+    opr_mutex_t lock;
+    opr_cv_t cv;
+    int nstreams;		/* calls besides RestoreVolume's */
+    int active;			/* streams restoring vnodes now */
+    int done;			/* streams finished */
+    int ready;			/* RestoreVolume has read the volume header */
+    int zmethod;		/* how the dump is compressed */
+    int error;			/* a stream failed */
+    afs_foff_t *b1, *b2;	/* for ReadVnodes, from RestoreVolume */
+    int s1, s2, delo;
+    int refs;			/* calls using it; under the trans lock */
+    int claimed;		/* RestoreVolume has taken it */
+};
+
+extern int DumpVolume(struct rx_call *call, Volume *vp, afs_int32, int,
+		      int, int);
 extern int DumpVolMulti(struct rx_call **, int, Volume *, afs_int32, int,
-		        int *);
-extern int RestoreVolume(struct rx_call *, Volume *, struct restoreCookie *);
+		        int *, afs_int32 *, int, int);
+extern int DumpVolumeStreams(struct rx_call **, int, Volume *, afs_int32,
+			     int *, int, int);
+extern int CheckDumpCompression(afs_int32 method, afs_int32 level);
+extern int RestoreVolume(struct rx_call *, Volume *, struct restoreCookie *,
+			 struct restoreStreams *);
+extern struct restoreStreams *NewRestoreStreams(int nstreams);
+extern void FreeRestoreStreams(struct restoreStreams *);
+extern int RestoreVnodeStream(struct rx_call *, Volume *,
+			      struct restoreStreams *);
 extern int SizeDumpVolume(struct rx_call *, Volume *, afs_int32, int,
 			  struct volintSize *);
+extern int GetBlockSums(Volume *vp, afs_uint32 vnodeNumber,
+			afs_uint32 unique, afs_int32 blockSize,
+			afs_uint32 *dataVersion, afs_uint64 *length,
+			blockSums *sums);
 
 #endif
@@ -44,6 +44,12 @@
 
 #include <roken.h>
 
+#include <sys/wait.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include <afs/afsint.h>
 #include <afs/nfs.h>
 #include <rx/rx_queue.h>
@@ -65,6 +71,8 @@ char mntroot[MAXPATHLEN];
 
 int inc_dump = 0;
 FILE *dumpfile;
+FILE *compressedfile;	/* the dump itself, while dumpfile expands it */
+pid_t expandpid = -1;	/* process expanding a compressed dump */
 
 afs_int32
 readvalue(int size)
@@ -133,6 +141,120 @@ readdata(char *buffer, afs_sfsize_t size)
     }
 }
 
+/*
+ * The rest of the dump is compressed with method.  Expand it in a child
+ * process, and read what it expands to through a pipe instead.
+ */
+static int
+ExpandDump(afs_int32 method)
+{
+#ifdef HAVE_ZLIB
+    char in[BUFSIZE], out[BUFSIZE];
+    z_stream zs;
+    int fds[2], code, n;
+    pid_t pid;
+
+    if (method != VOLDUMPCOMPRESS_DEFLATE) {
+	fprintf(stderr, "Dump is compressed with unknown method %d\n",
+		method);
+	return -1;
+    }
+    if (pipe(fds) < 0) {
+	fprintf(stderr, "Cannot make a pipe; Errno = %d\n", errno);
+	return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+	fprintf(stderr, "Cannot fork; Errno = %d\n", errno);
+	close(fds[0]);
+	close(fds[1]);
+	return -1;
+    }
+    if (pid == 0) {
+	close(fds[0]);
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit(&zs) != Z_OK)
+	    _exit(1);
+	code = Z_OK;
+	while (code != Z_STREAM_END) {
+	    if (zs.avail_in == 0) {
+		n = fread(in, 1, sizeof(in), dumpfile);
+		if (n <= 0) {
+		    fprintf(stderr, "Cannot expand dump: compressed data "
+			    "ends early\n");
+		    _exit(1);
+		}
+		zs.next_in = (Bytef *)in;
+		zs.avail_in = n;
+	    }
+	    zs.next_out = (Bytef *)out;
+	    zs.avail_out = sizeof(out);
+	    code = inflate(&zs, Z_NO_FLUSH);
+	    if (code != Z_OK && code != Z_STREAM_END && code != Z_BUF_ERROR) {
+		fprintf(stderr, "Cannot expand dump: %s\n",
+			zs.msg ? zs.msg : "corrupt data");
+		_exit(1);
+	    }
+	    n = sizeof(out) - zs.avail_out;
+	    if (n > 0 && write(fds[1], out, n) != n)
+		_exit(1);
+	}
+	_exit(0);
+    }
+    /* the child is reading the original stream; it is closed once the
+     * child is done, by FinishExpandDump */
+    close(fds[1]);
+    expandpid = pid;
+    compressedfile = dumpfile;
+    dumpfile = fdopen(fds[0], "r");
+    if (!dumpfile) {
+	close(fds[0]);
+	fprintf(stderr, "Cannot read the expanded dump; Errno = %d\n", errno);
+	return -1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "Dump is compressed, and restorevol was built without "
+	    "zlib to expand it\n");
+    return -1;
+#endif
+}
+
+/*
+ * Collect the process expanding a compressed dump, if there is one.  After
+ * a complete dump, read whatever it still has to send so that it can
+ * finish; otherwise just stop reading.  Fails if the dump could not be
+ * expanded.
+ */
+static int
+FinishExpandDump(int complete)
+{
+    int status, code = 0;
+
+    if (expandpid < 0)
+	return 0;
+    if (dumpfile) {
+	if (complete) {
+	    while (fread(buf, 1, BUFSIZE, dumpfile) > 0)
+		;
+	}
+	fclose(dumpfile);
+    }
+    if (waitpid(expandpid, &status, 0) < 0 || !WIFEXITED(status)
+	|| WEXITSTATUS(status) != 0) {
+	if (complete)
+	    fprintf(stderr, "Compressed dump could not be expanded\n");
+	code = -1;
+    }
+    if (compressedfile != stdin)
+	fclose(compressedfile);
+    dumpfile = compressedfile = NULL;
+    expandpid = -1;
+    return code;
+}
+
 afs_int32
 ReadDumpHeader(struct DumpHeader *dh)
 {
@@ -173,6 +295,14 @@ ReadDumpHeader(struct DumpHeader *dh)
 	    }
 	    break;
 
+	case 0x7e:		/* next tag critical */
+	    break;
+
+	case 'z':		/* the rest of the dump is compressed */
+	    if (ExpandDump(ntohl(readvalue(4))))
+		return -1;
+	    break;
+
 	default:
 	    done = 1;
 	    break;
@@ -903,7 +1033,7 @@ open_fail:
 static int
 WorkerBee(struct cmd_syndesc *as, void *arock)
 {
-    int code = 0, len;
+    int code = 0, len, complete = 0;
     afs_int32 type, count, vcount;
     DIR *dirP, *dirQ;
     struct dirent *dirE, *dirF;
@@ -933,6 +1063,10 @@ WorkerBee(struct cmd_syndesc *as, void *arock)
 	goto cleanup;
     }
     type = ReadDumpHeader(&dh);
+    if (type < 0) {
+	code = -1;
+	goto cleanup;
+    }
 
     /* Get the root directory we restore to */
     if (as->parms[1].items) {	/* -dir <rootdir> */
@@ -1042,8 +1176,14 @@ WorkerBee(struct cmd_syndesc *as, void *arock)
 	code = -1;
 	goto cleanup;
     }
+    complete = 1;
 
   cleanup:
+    /* a corrupt compressed dump may still have parsed; the expanding
+     * process knows */
+    if (FinishExpandDump(complete))
+	code = -1;
+
     /* For incremental restores, Follow each directory link and
      * remove an "AFSFile" links.
      */
@@ -78,6 +78,8 @@ int rxkadDisableDotCheck = 0;
 int DoPreserveVolumeStats = 1;
 int rxJumbograms = 0;	/* default is to not send and receive jumbograms. */
 int rxMaxMTU = -1;
+static int aioThreads = 0;		/* asynchronous disk I/O threads */
+int RestoreThreads = 1;			/* threads creating restored files */
 char *auditFileName = NULL;
 static struct logOptions logopts;
 char *configDir = NULL;
@@ -252,7 +254,12 @@ enum optionsList {
     OPT_config,
     OPT_restricted_query,
     OPT_transarc_logs,
-    OPT_s2s_crypt
+    OPT_s2s_crypt,
+#ifdef AFS_PTHREAD_ENV
+    OPT_clone_threads,
+    OPT_aio_threads,
+    OPT_restore_threads
+#endif
 };
 
 static int
@@ -317,6 +324,14 @@ ParseArgs(int argc, char **argv) {
 	    CMD_SINGLE, CMD_OPTIONAL, "anyuser | admin");
     cmd_AddParmAtOffset(opts, OPT_s2s_crypt, "-s2scrypt",
 	    CMD_SINGLE, CMD_OPTIONAL, "always | inherit | never");
+#ifdef AFS_PTHREAD_ENV
+    cmd_AddParmAtOffset(opts, OPT_clone_threads, "-clone-threads",
+	    CMD_SINGLE, CMD_OPTIONAL, "threads per volume clone");
+    cmd_AddParmAtOffset(opts, OPT_aio_threads, "-aio-threads",
+	    CMD_SINGLE, CMD_OPTIONAL, "# of threads for asynchronous dump IO");
+    cmd_AddParmAtOffset(opts, OPT_restore_threads, "-restore-threads",
+	    CMD_SINGLE, CMD_OPTIONAL, "threads per restore creating files");
+#endif
 
     code = cmd_Parse(argc, argv, &opts);
     if (code == CMD_HELP) {
@@ -392,6 +407,30 @@ ParseArgs(int argc, char **argv) {
 	    lwps = MAXLWP;
 	}
     }
+#ifdef AFS_PTHREAD_ENV
+    if (cmd_OptionAsInt(opts, OPT_clone_threads, &optval) == 0) {
+	if (optval < 1) {
+	    printf("Invalid -clone-threads value %d\n", optval);
+	    return -1;
+	}
+	vol_clone_threads = optval;
+    }
+    if (cmd_OptionAsInt(opts, OPT_aio_threads, &aioThreads) == 0) {
+	if ((aioThreads < 0) || (aioThreads > 256)) {
+	    printf("Asynchronous IO thread count %d is invalid; "
+		   "must be between 0 and 256\n", aioThreads);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_restore_threads, &optval) == 0) {
+	if (optval < 1 || optval > 64) {
+	    printf("Invalid -restore-threads value %d; "
+		   "must be between 1 and 64\n", optval);
+	    return -1;
+	}
+	RestoreThreads = optval;
+    }
+#endif
     if (cmd_OptionAsString(opts, OPT_sleep, &sleepSpec) == 0) {
 	printf("Warning: -sleep option ignored; this option is obsolete\n");
     }
@@ -511,6 +550,9 @@ main(int argc, char **argv)
 	Log("Shutting down: errors encountered initializing volume package\n");
 	exit(1);
     }
+    if (ih_AsyncInit(aioThreads)) {
+	Log("Could not start all %d asynchronous IO threads\n", aioThreads);
+    }
     /* For nuke() */
     Lock_Init(&localLock);
     DInit(40);
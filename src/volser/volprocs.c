@@ -17,6 +17,8 @@
 #include <afs/opr.h>
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
+#else
+# include <opr/lockstub.h>
 #endif
 
 #include <rx/rx.h>
@@ -62,6 +64,7 @@ extern struct afsconf_dir *tdir;
 extern int DoPreserveVolumeStats;
 extern int restrictedQueryLevel;
 extern enum vol_s2s_crypt doCrypt;
+extern int lwps;
 
 extern void LogError(afs_int32 errcode);
 
@@ -97,6 +100,10 @@ static afs_int32 VolForward(struct rx_call *, afs_int32, afs_int32,
 			    struct restoreCookie *cookie);
 static afs_int32 VolDump(struct rx_call *, afs_int32, afs_int32, afs_int32);
 static afs_int32 VolRestore(struct rx_call *, afs_int32, struct restoreCookie *);
+static afs_int32 VolRestoreVnodes(struct rx_call *, afs_int32, afs_int32);
+static afs_int32 VolForwardStreams(struct rx_call *, afs_int32, afs_int32,
+				   struct destServer *, afs_int32,
+				   struct restoreCookie *, afs_int32);
 static afs_int32 VolEndTrans(struct rx_call *, afs_int32, afs_int32 *);
 static afs_int32 VolSetForwarding(struct rx_call *, afs_int32, afs_int32);
 static afs_int32 VolGetStatus(struct rx_call *, afs_int32,
@@ -1254,6 +1261,29 @@ MakeClient(struct rx_call *acid, struct rx_securityClass **securityObject,
     return code;
 }
 
+/*
+ * How to compress a dump forwarded from a transaction over tcon: as set
+ * on the transaction, if the destination volserver can expand it.
+ */
+static int
+ForwardCompression(struct volser_trans *tt, struct rx_connection *tcon,
+		   afs_int32 destTrans)
+{
+    afs_int32 code;
+
+    if (tt->zmethod == VOLDUMPCOMPRESS_NONE)
+	return VOLDUMPCOMPRESS_NONE;
+    code = AFSVolSetDumpCompression(tcon, destTrans, tt->zmethod,
+				    VOLDUMPCOMPRESS_PROBE);
+    if (code) {
+	Log("1 Volser: destination cannot expand compressed dumps (%d); "
+	    "forwarding volume %" AFS_VOLID_FMT " uncompressed\n", code,
+	    afs_printable_VolumeId_lu(tt->volid));
+	return VOLDUMPCOMPRESS_NONE;
+    }
+    return tt->zmethod;
+}
+
 static afs_int32
 VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
 	       struct destServer *destination, afs_int32 destTrans,
@@ -1267,6 +1297,7 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     struct rx_securityClass *securityObject;
     afs_int32 securityIndex;
     char caller[MAXKTCNAMELEN];
+    int zmethod;
 
     if (!afsconf_SuperUser(tdir, acid, caller))
 	return VOLSERBAD_ACCESS;	/*not a super user */
@@ -1303,6 +1334,7 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
 	TRELE(tt);
 	return ENOTCONN;
     }
+    zmethod = ForwardCompression(tt, tcon, destTrans);
     tcall = rx_NewCall(tcon);
     TSetRxCall(tt, tcall, "Forward");
     /* start restore going.  fromdate == 0 --> doing an incremental dump/restore */
@@ -1312,7 +1344,7 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     }
 
     /* these next calls implictly call rx_Write when writing out data */
-    code = DumpVolume(tcall, vp, fromDate, 0);	/* last field = don't dump all dirs */
+    code = DumpVolume(tcall, vp, fromDate, 0, zmethod, tt->zlevel);	/* don't dump all dirs */
     if (code)
 	goto fail;
     EndAFSVolRestore(tcall);	/* probably doesn't do much */
@@ -1339,6 +1371,153 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     return code;
 }
 
+/* Like Forward, but send the dump over nstreams calls at once, if the
+ * destination volserver can restore it that way.
+ */
+afs_int32
+SAFSVolForwardStreams(struct rx_call *acid, afs_int32 fromTrans,
+		      afs_int32 fromDate, struct destServer *destination,
+		      afs_int32 destTrans, struct restoreCookie *cookie,
+		      afs_int32 nstreams)
+{
+    afs_int32 code;
+
+    code =
+	VolForwardStreams(acid, fromTrans, fromDate, destination, destTrans,
+			  cookie, nstreams);
+    osi_auditU(acid, VS_ForwardEvent, code, AUD_LONG, fromTrans, AUD_HOST,
+	       htonl(destination->destHost), AUD_LONG, destTrans, AUD_END);
+    return code;
+}
+
+static afs_int32
+VolForwardStreams(struct rx_call *acid, afs_int32 fromTrans,
+		  afs_int32 fromDate, struct destServer *destination,
+		  afs_int32 destTrans, struct restoreCookie *cookie,
+		  afs_int32 nstreams)
+{
+    struct volser_trans *tt;
+    afs_int32 code, ec;
+    struct rx_connection *tcons[VOLMAXSTREAMS];
+    struct rx_call *tcalls[VOLMAXSTREAMS];
+    int codes[VOLMAXSTREAMS];
+    struct Volume *vp;
+    struct rx_securityClass *securityObject;
+    afs_int32 securityIndex;
+    char caller[MAXKTCNAMELEN];
+    int i, zmethod;
+
+    if (nstreams < 1 || nstreams > VOLMAXSTREAMS)
+	return EINVAL;
+#ifndef AFS_PTHREAD_ENV
+    nstreams = 1;
+#endif
+    if (nstreams == 1)
+	return VolForward(acid, fromTrans, fromDate, destination, destTrans,
+			  cookie);
+    if (!afsconf_SuperUser(tdir, acid, caller))
+	return VOLSERBAD_ACCESS;	/*not a super user */
+
+    /* find the local transaction */
+    tt = FindTrans(fromTrans);
+    if (!tt)
+	return ENOENT;
+    if (tt->vflags & VTDeleted) {
+	Log("1 Volser: VolForwardStreams: volume %" AFS_VOLID_FMT " has been deleted \n", afs_printable_VolumeId_lu(tt->volid));
+	TRELE(tt);
+	return ENOENT;
+    }
+    vp = tt->volume;
+    TSetRxCall(tt, NULL, "ForwardStreams");
+
+    /* get auth info for the this connection (uses afs from ticket file) */
+    code = MakeClient(acid, &securityObject, &securityIndex);
+    if (code) {
+	TClearRxCall(tt);
+	TRELE(tt);
+	return code;
+    }
+
+    /* a connection for each call, so that each gets its own window */
+    memset(tcons, 0, sizeof(tcons));
+    memset(tcalls, 0, sizeof(tcalls));
+    for (i = 0; i < nstreams; i++) {
+	tcons[i] =
+	    rx_NewConnection(htonl(destination->destHost),
+			     htons(destination->destPort), VOLSERVICE_ID,
+			     securityObject, securityIndex);
+	if (!tcons[i]) {
+	    code = ENOTCONN;
+	    break;
+	}
+    }
+    RXS_Close(securityObject); /* will be freed after connection destroyed */
+    if (code)
+	goto fail;
+
+    /* an older destination gets the whole dump over one call */
+    code = AFSVolSetRestoreStreams(tcons[0], destTrans, nstreams - 1);
+    if (code == RXGEN_OPCODE || code == VOLSERBADOP) {
+	Log("1 Volser: VolForwardStreams: destination cannot restore "
+	    "from several calls; using one\n");
+	nstreams = 1;
+	code = 0;
+    }
+    if (code)
+	goto fail;
+    zmethod = ForwardCompression(tt, tcons[0], destTrans);
+
+    /* start restore going.  fromdate == 0 --> doing an incremental dump/restore */
+    tcalls[0] = rx_NewCall(tcons[0]);
+    TSetRxCall(tt, tcalls[0], "ForwardStreams");
+    code = StartAFSVolRestore(tcalls[0], destTrans, (fromDate ? 1 : 0),
+			      cookie);
+    for (i = 1; i < nstreams && !code; i++) {
+	tcalls[i] = rx_NewCall(tcons[i]);
+	code = StartAFSVolRestoreVnodes(tcalls[i], destTrans, i);
+    }
+    if (code)
+	goto fail;
+
+    /* these next calls implictly call rx_Write when writing out data */
+    if (nstreams == 1)
+	code = DumpVolume(tcalls[0], vp, fromDate, 0, zmethod, tt->zlevel);
+    else
+	code = DumpVolumeStreams(tcalls, nstreams, vp, fromDate, codes,
+				 zmethod, tt->zlevel);
+    if (code)
+	goto fail;
+
+    /* the Restore call finishes only after the others */
+    for (i = nstreams - 1; i > 0 && !code; i--) {
+	EndAFSVolRestoreVnodes(tcalls[i]);
+	code = rx_EndCall(tcalls[i], 0);
+	tcalls[i] = NULL;
+    }
+    if (!code) {
+	EndAFSVolRestore(tcalls[0]);	/* probably doesn't do much */
+	TClearRxCall(tt);
+	code = rx_EndCall(tcalls[0], 0);
+	tcalls[0] = NULL;
+    }
+
+  fail:
+    TClearRxCall(tt);
+    for (i = 0; i < VOLMAXSTREAMS; i++) {
+	if (tcalls[i]) {
+	    ec = rx_EndCall(tcalls[i], code ? code : VOLSERDUMPERROR);
+	    if (!code)
+		code = ec;
+	}
+	if (tcons[i])
+	    rx_DestroyConnection(tcons[i]);	/* done with the connection */
+    }
+    if (TRELE(tt) && !code)
+	return VOLSERTRELE_ERROR;
+
+    return code;
+}
+
 /* Start a dump and send it to multiple places simultaneously.
  * If this returns an error (eg, return ENOENT), it means that
  * none of the releases worked.  If this returns 0, that means
@@ -1361,8 +1540,9 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     afs_int32 ec, code, *codes;
     struct rx_connection **tcons;
     struct rx_call **tcalls;
+    afs_int32 *ttrans;
     struct Volume *vp;
-    int i, is_incremental;
+    int i, is_incremental, zmethod;
 
     if (results) {
 	memset(results, 0, sizeof(manyResults));
@@ -1397,6 +1577,12 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
 	free(tcons);
 	return ENOMEM;
     }
+    ttrans = malloc(i * sizeof(afs_int32));
+    if (!ttrans) {
+	free(tcons);
+	free(tcalls);
+	return ENOMEM;
+    }
 
     /* get auth info for this connection (uses afs from ticket file) */
     code = MakeClient(acid, &securityObject, &securityIndex);
@@ -1407,6 +1593,7 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     /* make connections to all the other servers */
     for (i = 0; i < destinations->manyDests_len; i++) {
 	struct replica *dest = &(destinations->manyDests_val[i]);
+	ttrans[i] = dest->trans;
 	tcons[i] =
 	    rx_NewConnection(htonl(dest->server.destHost),
 			     htons(dest->server.destPort), VOLSERVICE_ID,
@@ -1433,8 +1620,16 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     /* Security object will be freed when all connections destroyed */
     RXS_Close(securityObject);
 
+    /* the dump is compressed only if every destination can expand it */
+    zmethod = tt->zmethod;
+    for (i = 0; i < destinations->manyDests_len; i++) {
+	if (tcons[i] && zmethod != VOLDUMPCOMPRESS_NONE)
+	    zmethod = ForwardCompression(tt, tcons[i], ttrans[i]);
+    }
+
     /* these next calls implictly call rx_Write when writing out data */
-    code = DumpVolMulti(tcalls, i, vp, fromDate, 0, codes);
+    code = DumpVolMulti(tcalls, i, vp, fromDate, 0, codes, ttrans, zmethod,
+			tt->zlevel);
 
 
   fail:
@@ -1459,6 +1654,7 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     }
     free(tcons);
     free(tcalls);
+    free(ttrans);
 
     if (tt) {
         TClearRxCall(tt);
@@ -1510,7 +1706,7 @@ VolDump(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     }
     TSetRxCall(tt, acid, "Dump");
     code = DumpVolume(acid, tt->volume, fromDate, (flags & VOLDUMPV2_OMITDIRS)
-		      ? 0 : 1);	/* squirt out the volume's data, too */
+		      ? 0 : 1, tt->zmethod, tt->zlevel);	/* squirt out the volume's data, too */
     if (code) {
         TClearRxCall(tt);
 	TRELE(tt);
@@ -1538,10 +1734,47 @@ SAFSVolRestore(struct rx_call *acid, afs_int32 atrans, afs_int32 aflags,
     return code;
 }
 
+/*
+ * Take a reference on the state of a restore split over several calls,
+ * if one has been set up on the transaction.  With claim, for the call
+ * carrying the volume header, ignore a state another restore has used.
+ */
+static struct restoreStreams *
+HoldRestoreStreams(struct volser_trans *tt, int claim)
+{
+    struct restoreStreams *rs;
+
+    VTRANS_OBJ_LOCK(tt);
+    rs = tt->streams;
+    if (rs && claim) {
+	if (rs->claimed)
+	    rs = NULL;
+	else
+	    rs->claimed = 1;
+    }
+    if (rs)
+	rs->refs++;
+    VTRANS_OBJ_UNLOCK(tt);
+    return rs;
+}
+
+static void
+ReleaseRestoreStreams(struct volser_trans *tt, struct restoreStreams *rs)
+{
+    int last;
+
+    VTRANS_OBJ_LOCK(tt);
+    last = (--rs->refs == 0 && rs != tt->streams);
+    VTRANS_OBJ_UNLOCK(tt);
+    if (last)
+	FreeRestoreStreams(rs);
+}
+
 static afs_int32
 VolRestore(struct rx_call *acid, afs_int32 atrans, struct restoreCookie *cookie)
 {
     struct volser_trans *tt;
+    struct restoreStreams *rs;
     afs_int32 code, tcode;
     char caller[MAXKTCNAMELEN];
 
@@ -1564,7 +1797,10 @@ VolRestore(struct rx_call *acid, afs_int32 atrans, struct restoreCookie *cookie)
 
     DFlushVolume(V_parentId(tt->volume)); /* Ensure dir buffers get dropped */
 
-    code = RestoreVolume(acid, tt->volume, cookie);
+    rs = HoldRestoreStreams(tt, 1);
+    code = RestoreVolume(acid, tt->volume, cookie, rs);
+    if (rs)
+	ReleaseRestoreStreams(tt, rs);
     FSYNC_VolOp(tt->volid, NULL, FSYNC_VOL_BREAKCBKS, 0l, NULL);
     TClearRxCall(tt);
     tcode = TRELE(tt);
@@ -1572,6 +1808,135 @@ VolRestore(struct rx_call *acid, afs_int32 atrans, struct restoreCookie *cookie)
     return (code ? code : tcode);
 }
 
+/*
+ * Prepare a transaction for a restore whose vnodes come over nstreams
+ * RestoreVnodes calls as well as the Restore call.
+ */
+afs_int32
+SAFSVolSetRestoreStreams(struct rx_call *acid, afs_int32 atrans,
+			 afs_int32 nstreams)
+{
+    struct volser_trans *tt;
+    struct restoreStreams *rs, *old;
+    char caller[MAXKTCNAMELEN];
+
+    if (!afsconf_SuperUser(tdir, acid, caller))
+	return VOLSERBAD_ACCESS;	/*not a super user */
+    if (nstreams < 1 || nstreams >= VOLMAXSTREAMS)
+	return EINVAL;
+    /* the restore holds a server thread per call until all are done */
+    if (nstreams + 1 > lwps / 2)
+	return VOLSERBADOP;
+    tt = FindTrans(atrans);
+    if (!tt)
+	return ENOENT;
+    if (tt->vflags & VTDeleted) {
+	TRELE(tt);
+	return ENOENT;
+    }
+    rs = NewRestoreStreams(nstreams);
+    if (!rs) {
+	TRELE(tt);
+	return VOLSERBADOP;
+    }
+    VTRANS_OBJ_LOCK(tt);
+    old = tt->streams;
+    tt->streams = rs;
+    if (old && old->refs > 0)
+	old = NULL;		/* its last user frees it */
+    VTRANS_OBJ_UNLOCK(tt);
+    if (old)
+	FreeRestoreStreams(old);
+    if (TRELE(tt))
+	return VOLSERTRELE_ERROR;
+    return 0;
+}
+
+afs_int32
+SAFSVolRestoreVnodes(struct rx_call *acid, afs_int32 atrans,
+		     afs_int32 astream)
+{
+    afs_int32 code;
+
+    code = VolRestoreVnodes(acid, atrans, astream);
+    osi_auditU(acid, VS_RestoreEvent, code, AUD_LONG, atrans, AUD_END);
+    return code;
+}
+
+static afs_int32
+VolRestoreVnodes(struct rx_call *acid, afs_int32 atrans, afs_int32 astream)
+{
+    struct volser_trans *tt;
+    struct restoreStreams *rs;
+    afs_int32 code, tcode;
+    char caller[MAXKTCNAMELEN];
+
+    if (!afsconf_SuperUser(tdir, acid, caller))
+	return VOLSERBAD_ACCESS;	/*not a super user */
+    tt = FindTrans(atrans);
+    if (!tt)
+	return ENOENT;
+    if (tt->vflags & VTDeleted) {
+	Log("1 Volser: VolRestoreVnodes: volume %" AFS_VOLID_FMT " has been deleted \n", afs_printable_VolumeId_lu(tt->volid));
+	TRELE(tt);
+	return ENOENT;
+    }
+    rs = HoldRestoreStreams(tt, 0);
+    if (!rs) {
+	TRELE(tt);
+	return EINVAL;
+    }
+    if (DoLogging) {
+	char buffer[16];
+	Log("%s on %s is executing RestoreVnodes %" AFS_VOLID_FMT " stream %d\n",
+	    caller, callerAddress(acid, buffer),
+	    afs_printable_VolumeId_lu(tt->volid), astream);
+    }
+    /* no TSetRxCall: the Restore call owns the transaction meanwhile */
+    code = RestoreVnodeStream(acid, tt->volume, rs);
+    ReleaseRestoreStreams(tt, rs);
+    tcode = TRELE(tt);
+
+    return (code ? code : tcode);
+}
+
+/* Compress dumps from a transaction with method at level (0 for the
+ * method's default), including those forwarded to volservers which can
+ * expand them.  Volservers restoring a dump need nothing set; a caller
+ * forwarding to one passes VOLDUMPCOMPRESS_PROBE as the level, which only
+ * asks whether the method can be expanded and changes nothing. */
+afs_int32
+SAFSVolSetDumpCompression(struct rx_call *acid, afs_int32 atrans,
+			  afs_int32 method, afs_int32 level)
+{
+    struct volser_trans *tt;
+    char caller[MAXKTCNAMELEN];
+    afs_int32 code;
+
+    if (!afsconf_SuperUser(tdir, acid, caller))
+	return VOLSERBAD_ACCESS;	/*not a super user */
+    code = CheckDumpCompression(method,
+				level == VOLDUMPCOMPRESS_PROBE ? 0 : level);
+    if (code)
+	return code;
+    tt = FindTrans(atrans);
+    if (!tt)
+	return ENOENT;
+    if (tt->vflags & VTDeleted) {
+	TRELE(tt);
+	return ENOENT;
+    }
+    if (level != VOLDUMPCOMPRESS_PROBE) {
+	VTRANS_OBJ_LOCK(tt);
+	tt->zmethod = method;
+	tt->zlevel = level;
+	VTRANS_OBJ_UNLOCK(tt);
+    }
+    if (TRELE(tt))
+	return VOLSERTRELE_ERROR;
+    return 0;
+}
+
 /* end a transaction, returning the transaction's final error code in rcode */
 afs_int32
 SAFSVolEndTrans(struct rx_call *acid, afs_int32 destTrans, afs_int32 *rcode)
@@ -3039,6 +3404,42 @@ SAFSVolGetSize(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     return code;
 }
 
+/*
+ * Checksum the blocks of one file in the volume of a transaction.  A
+ * volserver forwarding an incremental dump to us asks this on the
+ * transaction our restore is running on, so that it need only send the
+ * blocks of the file we do not have already.
+ */
+afs_int32
+SAFSVolGetBlockSums(struct rx_call *acid, afs_int32 trans, afs_uint32 vnode,
+		    afs_uint32 unique, afs_int32 blockSize,
+		    afs_uint32 *dataVersion, afs_uint64 *length,
+		    blockSums *sums)
+{
+    int code = 0;
+    struct volser_trans *tt;
+    char caller[MAXKTCNAMELEN];
+
+    sums->blockSums_len = 0;
+    sums->blockSums_val = NULL;
+    if (!afsconf_SuperUser(tdir, acid, caller))
+	return VOLSERBAD_ACCESS;	/*not a super user */
+    tt = FindTrans(trans);
+    if (!tt)
+	return ENOENT;
+    if (tt->vflags & VTDeleted) {
+	TRELE(tt);
+	return ENOENT;
+    }
+    /* no TSetRxCall: the restore owns the transaction's call meanwhile */
+    code = GetBlockSums(tt->volume, vnode, unique, blockSize, dataVersion,
+			length, sums);
+    if (TRELE(tt) && !code)
+	return VOLSERTRELE_ERROR;
+
+    return code;
+}
+
 afs_int32
 SAFSVolSplitVolume(struct rx_call *acall, afs_uint32 ovid, afs_uint32 onew,
 		   afs_uint32 where, afs_int32 verbose)
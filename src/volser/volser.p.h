@@ -59,6 +59,9 @@ struct volser_trans {
     /* the fields below are useful for debugging */
     char lastProcName[30];	/* name of the last procedure which used transaction */
     struct rx_call *rxCallPtr;	/* pointer to latest associated rx_call */
+    struct restoreStreams *streams;	/* restore split over several calls */
+    afs_int32 zmethod;		/* compress dumps from it this way, */
+    afs_int32 zlevel;		/* where the destination can expand them */
 #ifdef AFS_PTHREAD_ENV
     pthread_mutex_t lock;       /* per transaction lock */
 #endif
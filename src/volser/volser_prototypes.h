@@ -29,6 +29,12 @@ extern int UV_DeleteVolume(afs_uint32 aserver, afs_int32 apart,
 extern int UV_SetSecurity(struct rx_securityClass *as,
                           afs_int32 aindex);
 
+extern int UV_SetForwardStreams(int nstreams);
+
+extern int UV_SetDumpCompression(int level);
+
+extern int UV_SetReleaseFanout(int fanout);
+
 extern int UV_ListOneVolume(afs_uint32 aserver, afs_int32 apart,
 			    afs_uint32 volid, struct volintInfo **resultPtr);
 
@@ -22,6 +22,8 @@
 #include <afs/opr.h>
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
+#else
+# include <opr/lockstub.h>
 #endif
 
 #ifdef AFS_NT40_ENV
@@ -48,6 +50,7 @@
 #include "volint.h"
 #include "volser.h"
 #include "volser_internal.h"
+#include "dumpstuff.h"
 
 static struct volser_trans *allTrans = 0;
 static afs_int32 transCounter = 1;
@@ -130,6 +133,8 @@ DeleteTrans(struct volser_trans *atrans, afs_int32 lock)
 	    tt->volume = NULL;
 	    if (tt->rxCallPtr)
 		rxi_CallError(tt->rxCallPtr, RX_CALL_DEAD);
+	    if (tt->streams)
+		FreeRestoreStreams(tt->streams);
 	    *lt = tt->next;
             VTRANS_OBJ_LOCK_DESTROY(tt);
 	    free(tt);
@@ -2193,6 +2193,37 @@ DeleteVolume(struct cmd_syndesc *as, void *arock)
 }
 
 #define TESTM	0		/* set for move space tests, clear for production */
+/* set how many calls at once a move or copy sends the volume over */
+static int
+SetStreams(char *arg)
+{
+    afs_int32 streams;
+
+    if (util_GetInt32(arg, &streams) || streams < 1
+	|| streams > VOLMAXSTREAMS) {
+	fprintf(STDERR, "vos: -streams must be from 1 to %d\n",
+		VOLMAXSTREAMS);
+	return 1;
+    }
+    UV_SetForwardStreams(streams);
+    return 0;
+}
+
+/* set the level -compress, with or without one, compresses volumes at */
+static int
+SetCompress(struct cmd_item *item)
+{
+    afs_int32 level = 6;
+
+    if (item->data && (util_GetInt32(item->data, &level) || level < 1
+		       || level > 9)) {
+	fprintf(STDERR, "vos: -compress level must be from 1 to 9\n");
+	return 1;
+    }
+    UV_SetDumpCompression(level);
+    return 0;
+}
+
 static int
 MoveVolume(struct cmd_syndesc *as, void *arock)
 {
@@ -2260,6 +2291,10 @@ MoveVolume(struct cmd_syndesc *as, void *arock)
 
     flags = 0;
     if (as->parms[5].items) flags |= RV_NOCLONE;
+    if (as->parms[6].items && SetStreams(as->parms[6].items->data))
+	return EINVAL;
+    if (as->parms[7].items && SetCompress(as->parms[7].items))
+	return EINVAL;
 
     /*
      * check source partition for space to clone volume
@@ -2417,6 +2452,10 @@ CopyVolume(struct cmd_syndesc *as, void *arock)
     if (as->parms[6].items) flags |= RV_OFFLINE;
     if (as->parms[7].items) flags |= RV_RDONLY;
     if (as->parms[8].items) flags |= RV_NOCLONE;
+    if (as->parms[9].items && SetStreams(as->parms[9].items->data))
+	return EINVAL;
+    if (as->parms[10].items && SetCompress(as->parms[10].items))
+	return EINVAL;
 
     MapPartIdIntoName(topart, toPartName);
     MapPartIdIntoName(frompart, fromPartName);
@@ -2865,6 +2904,19 @@ ReleaseVolume(struct cmd_syndesc *as, void *arock)
     }
     if (as->parms[3].items) /* -force-reclone */
         flags |= REL_COMPLETE;
+    if (as->parms[4].items && SetCompress(as->parms[4].items)) /* -compress */
+	return EINVAL;
+    if (as->parms[5].items) { /* -fanout */
+	afs_int32 fanout;
+
+	if (util_GetInt32(as->parms[5].items->data, &fanout) || fanout < 1
+	    || fanout > NMAXNSERVERS) {
+	    fprintf(STDERR, "vos: -fanout must be from 1 to %d\n",
+		    NMAXNSERVERS);
+	    return EINVAL;
+	}
+	UV_SetReleaseFanout(fanout);
+    }
 
     avolid = vsu_GetVolumeID(as->parms[0].items->data, cstruct, &err);
     if (avolid == 0) {
@@ -2968,6 +3020,8 @@ DumpVolumeCmd(struct cmd_syndesc *as, void *arock)
     }
 
     flags = as->parms[6].items ? VOLDUMPV2_OMITDIRS : 0;
+    if (as->parms[7].items && SetCompress(as->parms[7].items))
+	return EINVAL;
 retry_dump:
     if (as->parms[5].items) {
 	code =
@@ -6040,6 +6094,10 @@ main(int argc, char **argv)
 		"partition name on destination");
     cmd_AddParm(ts, "-live", CMD_FLAG, CMD_OPTIONAL,
 		"copy live volume without cloning");
+    cmd_AddParm(ts, "-streams", CMD_SINGLE, CMD_OPTIONAL,
+		"number of calls to send the volume over at once");
+    cmd_AddParm(ts, "-compress", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compress the volume in transit, at level 1-9");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("copy", CopyVolume, NULL, 0, "copy a volume");
@@ -6058,6 +6116,10 @@ main(int argc, char **argv)
 		"make new volume read-only");
     cmd_AddParm(ts, "-live", CMD_FLAG, CMD_OPTIONAL,
 		"copy live volume without cloning");
+    cmd_AddParm(ts, "-streams", CMD_SINGLE, CMD_OPTIONAL,
+		"number of calls to send the volume over at once");
+    cmd_AddParm(ts, "-compress", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compress the volume in transit, at level 1-9");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("shadow", ShadowVolume, NULL, 0,
@@ -6116,6 +6178,10 @@ main(int argc, char **argv)
 		"release to cloned temp vol, then clone back to repsite RO");
     cmd_AddParm(ts, "-force-reclone", CMD_FLAG, CMD_OPTIONAL,
 		"force a reclone and complete release with incremental dumps");
+    cmd_AddParm(ts, "-compress", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compress the volume in transit, at level 1-9");
+    cmd_AddParm(ts, "-fanout", CMD_SINGLE, CMD_OPTIONAL,
+		"sites each released site forwards to at once");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("dump", DumpVolumeCmd, NULL, 0, "dump a volume");
@@ -6128,6 +6194,8 @@ main(int argc, char **argv)
 		"dump a clone of the volume");
     cmd_AddParm(ts, "-omitdirs", CMD_FLAG, CMD_OPTIONAL,
 		"omit unchanged directories from an incremental dump");
+    cmd_AddParm(ts, "-compress", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compress the dump, at level 1-9");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("restore", RestoreVolumeCmd, NULL, 0,
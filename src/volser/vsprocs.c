@@ -21,6 +21,7 @@
 #include <afs/voldefs.h>
 #include <rx/xdr.h>
 #include <rx/rx.h>
+#include <rx/rx_multi.h>
 #include <rx/rx_queue.h>
 #include <afs/vlserver.h>
 #include <afs/nfs.h>
@@ -163,6 +164,12 @@ static int GetTrans(struct nvldbentry *vldbEntryPtr, afs_int32 index,
 		    struct rx_connection **connPtr, afs_int32 * transPtr,
 		    afs_uint32 * crtimePtr, afs_uint32 * uptimePtr,
 		    afs_int32 *origflags, afs_uint32 tmpVolId);
+static afs_int32 ForwardVolume(struct rx_connection *fromconn,
+				afs_int32 fromtid, afs_int32 fromdate,
+				struct destServer *destination,
+				afs_int32 totid, struct restoreCookie *cookie);
+static void SetDumpCompression(struct rx_connection *fromconn,
+			       afs_int32 fromtid);
 static int SimulateForwardMultiple(struct rx_connection *fromconn,
 				   afs_int32 fromtid, afs_int32 fromdate,
 				   manyDests * tr, afs_int32 flags,
@@ -425,6 +432,35 @@ UV_SetSecurity(struct rx_securityClass *as, afs_int32 aindex)
     return 0;
 }
 
+static int uvstreams = 1;
+/* set how many calls at once moves and copies forward volumes over */
+int
+UV_SetForwardStreams(int nstreams)
+{
+    uvstreams = nstreams;
+    return 0;
+}
+
+static int uvcompress = 0;
+/* set the level dumps, moves, copies and releases compress volumes at;
+ * 0 for none */
+int
+UV_SetDumpCompression(int level)
+{
+    uvcompress = level;
+    return 0;
+}
+
+static int uvfanout = 0;
+/* set how many sites each site already released forwards a release on to;
+ * 0 to forward only from the release clone */
+int
+UV_SetReleaseFanout(int fanout)
+{
+    uvfanout = fanout;
+    return 0;
+}
+
 /* bind to volser on <port> <aserver> */
 /* takes server address in network order, port in host order.  dumb */
 struct rx_connection *
@@ -1782,7 +1818,7 @@ UV_MoveVolume2(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
 	VPRINT2("Dumping from clone %u on source to volume %u on destination ...",
 		newVol, afromvol);
 	code =
-	    AFSVolForward(fromconn, clonetid, 0, &destination, totid,
+	    ForwardVolume(fromconn, clonetid, 0, &destination, totid,
 			  &cookie);
 	EGOTO1(mfail, code, "Failed to move data for the volume %u\n", volid);
 	VDONE;
@@ -1817,7 +1853,7 @@ UV_MoveVolume2(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
 	 (flags & RV_NOCLONE) ? "" : " incremental",
 	 afromvol);
     code =
-	AFSVolForward(fromconn, fromtid, fromDate, &destination, totid,
+	ForwardVolume(fromconn, fromtid, fromDate, &destination, totid,
 		      &cookie);
     EGOTO1(mfail, code,
 	   "Failed to do the%s dump from rw volume on old site to rw volume on newsite\n",
@@ -2492,7 +2528,7 @@ cpincr:
 	VPRINT2("Dumping from clone %u on source to volume %u on destination ...",
 	    cloneVol, newVol);
 	code =
-	    AFSVolForward(fromconn, clonetid, cloneFromDate, &destination,
+	    ForwardVolume(fromconn, clonetid, cloneFromDate, &destination,
 			  totid, &cookie);
 	EGOTO1(mfail, code, "Failed to move data for the volume %u\n",
 	       newVol);
@@ -2528,7 +2564,7 @@ cpincr:
 	 (flags & RV_NOCLONE) ? "" : " incremental",
 	 afromvol);
     code =
-	AFSVolForward(fromconn, fromtid, fromDate, &destination, totid,
+	ForwardVolume(fromconn, fromtid, fromDate, &destination, totid,
 		      &cookie);
     EGOTO1(mfail, code,
 	   "Failed to do the%s dump from old site to new site\n",
@@ -3232,6 +3268,48 @@ GetTrans(struct nvldbentry *vldbEntryPtr, afs_int32 index,
     return code;
 }
 
+/*
+ * Forward a volume from one volserver to another, over several calls at
+ * once if so set and the source volserver knows how.
+ */
+static afs_int32
+ForwardVolume(struct rx_connection *fromconn, afs_int32 fromtid,
+	      afs_int32 fromdate, struct destServer *destination,
+	      afs_int32 totid, struct restoreCookie *cookie)
+{
+    afs_int32 code;
+
+    SetDumpCompression(fromconn, fromtid);
+
+    if (uvstreams > 1) {
+	code = AFSVolForwardStreams(fromconn, fromtid, fromdate, destination,
+				    totid, cookie, uvstreams);
+	if (code != RXGEN_OPCODE)
+	    return code;
+	VPRINT("(source volserver cannot use several calls) ");
+    }
+    return AFSVolForward(fromconn, fromtid, fromdate, destination, totid,
+			 cookie);
+}
+
+/*
+ * Ask the source volserver to compress what it dumps or forwards from a
+ * transaction, if so set.  One that cannot sends it uncompressed.
+ */
+static void
+SetDumpCompression(struct rx_connection *fromconn, afs_int32 fromtid)
+{
+    afs_int32 code;
+
+    if (!uvcompress)
+	return;
+    code = AFSVolSetDumpCompression(fromconn, fromtid,
+				    VOLDUMPCOMPRESS_DEFLATE, uvcompress);
+    if (code)
+	fprintf(STDERR, "Volserver cannot compress the volume (%s); "
+		"sending it uncompressed\n", afs_error_message(code));
+}
+
 static int
 SimulateForwardMultiple(struct rx_connection *fromconn, afs_int32 fromtid,
 			afs_int32 fromdate, manyDests * tr, afs_int32 flags,
@@ -3248,6 +3326,211 @@ SimulateForwardMultiple(struct rx_connection *fromconn, afs_int32 fromtid,
     return 0;
 }
 
+/*
+ * Forward the release clone to the replicas in tr from the clone's
+ * volserver and, at the same time, from the read-only volumes on the
+ * relays[] sites released to already, so that no one server sends the
+ * volume to more than uvfanout of them.  The replicas are dealt out
+ * among the senders in turn; a relay that cannot be used is left out and
+ * its share goes to the others.  The replicas of a relay that fails while
+ * forwarding are sent the volume again from the clone.  The results are
+ * filled in as AFSVolForwardMultiple would fill them in.
+ */
+static int
+ForwardFanout(struct rx_connection *fromconn, afs_int32 fromtid,
+	      afs_int32 fromdate, manyDests * tr, struct restoreCookie *cookie,
+	      manyResults * results, struct nvldbentry *entry, int *relays,
+	      int nrelays)
+{
+    struct rx_connection **conns;
+    afs_int32 *tids, *codes, *sresults;
+    manyDests *dests, rdests;
+    manyResults *res, rres;
+    struct replica *sorted, *retry;
+    int *order, *retryorder;
+    afs_int32 *retrycodes, *rresults;
+    int ndests = tr->manyDests_len;
+    int nsenders, nretry, r, s, i, j;
+    afs_int32 code = 0, rcode;
+    char hoststr[16];
+
+    conns = calloc(nrelays + 1, sizeof(struct rx_connection *));
+    tids = calloc(nrelays + 1, sizeof(afs_int32));
+    codes = calloc(nrelays + 1, sizeof(afs_int32));
+    dests = calloc(nrelays + 1, sizeof(manyDests));
+    res = calloc(nrelays + 1, sizeof(manyResults));
+    sorted = calloc(ndests, sizeof(struct replica));
+    sresults = calloc(ndests, sizeof(afs_int32));
+    order = calloc(ndests, sizeof(int));
+    retry = calloc(ndests, sizeof(struct replica));
+    retryorder = calloc(ndests, sizeof(int));
+    retrycodes = calloc(ndests, sizeof(afs_int32));
+    rresults = calloc(ndests, sizeof(afs_int32));
+    if (!conns || !tids || !codes || !dests || !res || !sorted || !sresults
+	|| !order || !retry || !retryorder || !retrycodes || !rresults) {
+	code = ENOMEM;
+	goto out;
+    }
+
+    conns[0] = fromconn;
+    tids[0] = fromtid;
+    nsenders = 1;
+    for (r = 0; r < nrelays && nsenders * uvfanout < ndests; r++) {
+	conns[nsenders] =
+	    UV_Bind(entry->serverNumber[relays[r]], AFSCONF_VOLUMEPORT);
+	if (!conns[nsenders])
+	    continue;
+	/* read-only, so that the site stays online while it forwards */
+	code =
+	    AFSVolTransCreate_retry(conns[nsenders], entry->volumeId[ROVOL],
+				    entry->serverPartition[relays[r]],
+				    ITReadOnly, &tids[nsenders]);
+	if (code) {
+	    fprintf(STDERR, "Cannot forward from the read-only volume on %s; ",
+		    noresolve ?
+		    afs_inet_ntoa_r(entry->serverNumber[relays[r]], hoststr) :
+		    hostutil_GetNameByINet(entry->serverNumber[relays[r]]));
+	    PrintError("", code);
+	    rx_DestroyConnection(conns[nsenders]);
+	    conns[nsenders] = 0;
+	    code = 0;
+	    continue;
+	}
+	SetDumpCompression(conns[nsenders], tids[nsenders]);
+	nsenders++;
+    }
+
+    for (s = 0, j = 0; s < nsenders; s++) {
+	dests[s].manyDests_val = &sorted[j];
+	res[s].manyResults_val = &sresults[j];
+	for (i = s; i < ndests; i += nsenders, j++) {
+	    sorted[j] = tr->manyDests_val[i];
+	    order[j] = i;
+	}
+	dests[s].manyDests_len = res[s].manyResults_len =
+	    &sorted[j] - dests[s].manyDests_val;
+    }
+
+    if (verbose) {
+	for (s = 1; s < nsenders; s++) {
+	    fprintf(STDOUT, "Relaying from %s to ",
+		    noresolve ?
+		    afs_inet_ntoa_r(rx_HostOf(rx_PeerOf(conns[s])), hoststr) :
+		    hostutil_GetNameByINet(rx_HostOf(rx_PeerOf(conns[s]))));
+	    for (i = 0; i < dests[s].manyDests_len; i++) {
+		fprintf(STDOUT, "%s%s", i ? " and " : "",
+			noresolve ?
+			afs_inet_ntoa_r(htonl(dests[s].manyDests_val[i].server.
+					      destHost), hoststr) :
+			hostutil_GetNameByINet(htonl(dests[s].manyDests_val[i].
+						     server.destHost)));
+	    }
+	    fprintf(STDOUT, ".\n");
+	}
+	fflush(STDOUT);
+    }
+
+    multi_Rx(conns, nsenders) {
+	multi_AFSVolForwardMultiple(tids[multi_i], fromdate, &dests[multi_i],
+				    0 /*spare */ , cookie, &res[multi_i]);
+	codes[multi_i] = multi_error;
+    } multi_End;
+
+    for (s = 0, j = 0; s < nsenders; s++) {
+	if (codes[s] && s > 0) {
+	    fprintf(STDERR, "Could not forward from the read-only volume "
+		    "on %s; ",
+		    noresolve ?
+		    afs_inet_ntoa_r(rx_HostOf(rx_PeerOf(conns[s])), hoststr) :
+		    hostutil_GetNameByINet(rx_HostOf(rx_PeerOf(conns[s]))));
+	    PrintError("", codes[s]);
+	}
+	for (i = 0; i < dests[s].manyDests_len; i++, j++)
+	    results->manyResults_val[order[j]] =
+		codes[s] ? codes[s] : sresults[j];
+    }
+
+    /* A failed relay takes down only the sites it was sending to; unless
+     * the clone failed too, send them the volume again from the clone,
+     * and keep the relay's error only for those that fail again. */
+    nretry = 0;
+    for (s = 0, j = 0; s < nsenders; s++) {
+	for (i = 0; i < dests[s].manyDests_len; i++, j++) {
+	    if (s > 0 && codes[s] && !codes[0]) {
+		retry[nretry] = sorted[j];
+		retryorder[nretry] = order[j];
+		retrycodes[nretry] = codes[s];
+		nretry++;
+	    }
+	}
+    }
+    if (nretry > 0) {
+	if (verbose) {
+	    fprintf(STDOUT, "Sending the release to %d site%s again from "
+		    "the release clone.\n", nretry, nretry > 1 ? "s" : "");
+	    fflush(STDOUT);
+	}
+	rdests.manyDests_val = retry;
+	rdests.manyDests_len = nretry;
+	rres.manyResults_val = rresults;
+	rres.manyResults_len = nretry;
+	rcode = AFSVolForwardMultiple(fromconn, fromtid, fromdate, &rdests,
+				      0 /*spare */ , cookie, &rres);
+	for (i = 0; i < nretry; i++)
+	    results->manyResults_val[retryorder[i]] =
+		rcode ? retrycodes[i] : rresults[i];
+    }
+
+    for (s = 1; s < nsenders; s++) {
+	AFSVolEndTrans(conns[s], tids[s], &rcode);
+	rx_DestroyConnection(conns[s]);
+    }
+
+  out:
+    free(conns);
+    free(tids);
+    free(codes);
+    free(dests);
+    free(res);
+    free(sorted);
+    free(sresults);
+    free(order);
+    free(retry);
+    free(retryorder);
+    free(retrycodes);
+    free(rresults);
+    return code;
+}
+
+/*
+ * Say how far the release has got and, from how long the rounds of
+ * forwarding so far took, about how long the rest will take.  Each round
+ * goes to at most nservers sites, and with a fan-out to at most fanout
+ * sites for each sender, the clone and every site released this time.
+ */
+static void
+PrintReleaseProgress(int done, int todo, int left, int rounds,
+		     time_t elapsed, int nservers, int fanout, int senders)
+{
+    int more = 0, n;
+
+    while (left > 0) {
+	n = nservers;
+	if (fanout && n > senders * fanout)
+	    n = senders * fanout;
+	left -= n;
+	senders += n;
+	more++;
+    }
+    fprintf(STDOUT, "Released to %d of %d sites in %lu seconds", done, todo,
+	    (unsigned long)elapsed);
+    if (more)
+	fprintf(STDOUT, "; about %lu seconds to go",
+		(unsigned long)(elapsed * more / rounds));
+    fprintf(STDOUT, ".\n");
+    fflush(STDOUT);
+}
+
 /**
  * Check if a trans has timed out, and recreate it if necessary.
  *
@@ -3412,6 +3695,11 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
     int justnewsites = 0; /* are we just trying to release to new RO sites? */
     int sites = 0; /* number of ro sites */
     int new_sites = 0; /* number of ro sites markes as new */
+    int fanout = uvfanout; /* sites each released site forwards to */
+    int *relays = 0; /* sites released this time, to forward from */
+    int nrelays = 0;
+    int batch, todo = 0, tried = 0, rounds = 0, started;
+    time_t starttime;
 
     typedef enum {
         CR_PARTIAL    = 0x0000, /**< just new sites added or recover from a previous failed release */
@@ -3842,7 +4130,9 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
      * individually: releasecount. This is to reduce the race condition
      * of clients trying to find an on-line RO volume. The remaining ROs
      * are released in parallel but no more than half the number of ROs
-     * (rounded up) at a time: nservers.
+     * (rounded up) at a time: nservers.  With a fan-out, the sites
+     * released already forward to the next ones alongside the clone, each
+     * to no more than fanout of them at a time.
      */
 
     strcpy(vname, entry.name);
@@ -3862,7 +4152,10 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
     times = calloc(nservers + 1, sizeof(struct release));
     toconns = calloc(nservers + 1, sizeof(struct rx_connection *));
     results.manyResults_val = calloc(nservers + 1, sizeof(afs_int32));
-    if (!replicas || !times || !results.manyResults_val || !toconns)
+    if (fanout)
+	relays = calloc(entry.nServers, sizeof(int));
+    if (!replicas || !times || !results.manyResults_val || !toconns
+	|| (fanout && !relays))
 	ONERROR0(ENOMEM,
 		"Failed to create transaction on the release clone\n");
 
@@ -3880,11 +4173,25 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
     ONERROR0(code, "Failed to create transaction on the release clone\n");
     VDONE;
 
+    /* count the sites still to go, for the progress reports */
+    for (i = 0; i < entry.nServers; i++) {
+	if (i != roindex && (entry.serverFlags[i] & VLSF_ROVOL)
+	    && (!(entry.serverFlags[i] & VLSF_NEWREPSITE)
+		|| (entry.serverFlags[i] & VLSF_DONTUSE)))
+	    todo++;
+    }
+    started = releasecount;
+    starttime = time(0);
+
     /* For each index in the VLDB */
     for (vldbindex = 0; vldbindex < entry.nServers;) {
+	batch = nservers;
+	if (fanout && batch > (nrelays + 1) * fanout)
+	    batch = (nrelays + 1) * fanout;
+
 	/* Get a transaction on the replicas. Pick replicas which have an old release. */
 	for (volcount = 0;
-	     ((volcount < nservers) && (vldbindex < entry.nServers));
+	     ((volcount < batch) && (vldbindex < entry.nServers));
 	     vldbindex++) {
 	    if (!justnewsites) {
 		/* The first two RO volumes will be released individually.
@@ -4027,14 +4334,22 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
 	/* Release the ones we have collected */
 	tr.manyDests_val = &(replicas[0]);
 	tr.manyDests_len = results.manyResults_len = volcount;
-	code =
-	    AFSVolForwardMultiple(fromconn, fromtid, fromdate, &tr,
-				  0 /*spare */ , &cookie, &results);
-	if (code == RXGEN_OPCODE) {	/* RPC Interface Mismatch */
+	SetDumpCompression(fromconn, fromtid);
+	if (nrelays > 0) {
+	    code =
+		ForwardFanout(fromconn, fromtid, fromdate, &tr, &cookie,
+			      &results, &entry, relays, nrelays);
+	} else {
 	    code =
-		SimulateForwardMultiple(fromconn, fromtid, fromdate, &tr,
-					0 /*spare */ , &cookie, &results);
-	    nservers = 1;
+		AFSVolForwardMultiple(fromconn, fromtid, fromdate, &tr,
+				      0 /*spare */ , &cookie, &results);
+	    if (code == RXGEN_OPCODE) {	/* RPC Interface Mismatch */
+		code =
+		    SimulateForwardMultiple(fromconn, fromtid, fromdate, &tr,
+					    0 /*spare */ , &cookie, &results);
+		nservers = 1;
+		fanout = 0;
+	    }
 	}
 
 	if (code) {
@@ -4082,6 +4397,11 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
 		entry.serverFlags[times[m].vldbEntryIndex] &= ~VLSF_DONTUSE;
 		entry.flags |= VLF_ROEXISTS;
 		releasecount++;
+
+		/* a site on another server can pass the release on */
+		if (fanout && entry.serverNumber[times[m].vldbEntryIndex]
+		    != afromserver)
+		    relays[nrelays++] = times[m].vldbEntryIndex;
 	    }
 	}
 
@@ -4090,6 +4410,13 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
 	vcode = VLDB_ReplaceEntry(afromvol, RWVOL, &storeEntry, 0);
 	ONERROR(vcode, afromvol,
 		" Could not update VLDB entry for volume %u\n");
+
+	tried += volcount;
+	rounds++;
+	if (verbose)
+	    PrintReleaseProgress(releasecount - started, todo, todo - tried,
+				 rounds, time(0) - starttime, nservers,
+				 fanout, nrelays + 1);
     }				/* for each index in the vldb */
 
     /* End the transaction on the cloned volume */
@@ -4225,6 +4552,8 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
 	free(toconns);
     if (times)
 	free(times);
+    if (relays)
+	free(relays);
     return error;
 }
 
@@ -4284,6 +4613,7 @@ UV_DumpVolume(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
 	   afromvol);
     VEDONE;
 
+    SetDumpCompression(fromconn, fromtid);
     fromcall = rx_NewCall(fromconn);
 
     VEPRINT1("Starting volume dump on volume %u...", afromvol);
@@ -4434,6 +4764,7 @@ UV_DumpClonedVolume(afs_uint32 afromvol, afs_uint32 afromserver,
     VEDONE;
 
 
+    SetDumpCompression(fromconn, clonetid);
     fromcall = rx_NewCall(fromconn);
 
     VEPRINT1("Starting volume dump from cloned volume %u...", clonevol);
@@ -237,7 +237,17 @@ PrintOverallPerfInfo(struct afs_PerfStats *a_ovP)
     printf("\t%10u rx_nBusies\n\n", a_ovP->rx_nBusies);
 
     printf("\t%10u fs_nBusies\n", a_ovP->fs_nBusies);
-    printf("\t%10u fs_GetCapabilities\n\n", a_ovP->fs_nGetCaps);
+    printf("\t%10u fs_GetCapabilities\n", a_ovP->fs_nGetCaps);
+    printf("\t%10u fs_nThrottledOps\n", a_ovP->fs_nThrottledOps);
+    printf("\t%10u fs_nThrottledXfers\n", a_ovP->fs_nThrottledXfers);
+    printf("\t%10u fs_ThrottledMSecs\n\n", a_ovP->fs_ThrottledMSecs);
+
+    printf("\t%10u fd_CacheSize\n", a_ovP->fd_CacheSize);
+    printf("\t%10u fd_InUse\n", a_ovP->fd_InUse);
+    printf("\t%10u fd_Hits\n", a_ovP->fd_Hits);
+    printf("\t%10u fd_Misses\n", a_ovP->fd_Misses);
+    printf("\t%10u fd_Evictions\n", a_ovP->fd_Evictions);
+    printf("\t%10u fd_Emfile\n\n", a_ovP->fd_Emfile);
     /*
      * Host module fields.
      */
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2026, Sine Nomine Associates and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Restore a small volume dump with restorevol, both as it is and
+ * compressed after its dump header, and check that both give the same
+ * files.  Builds without zlib must refuse the compressed dump, and every
+ * build must refuse a compression method it does not know, or a
+ * compressed dump that has been cut short.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <sys/wait.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <afs/afsint.h>
+#include <afs/nfs.h>
+#include <rx/rx_queue.h>
+#include <lock.h>
+#include <afs/ihandle.h>
+#include <afs/vnode.h>
+#include <afs/volume.h>
+#include <afs/afsutil.h>
+#include <afs/volint.h>
+#include <afs/dir.h>
+
+#include "dump.h"
+
+#include <tests/tap/basic.h>
+
+#define TEST_VOLID	536870912
+#define TEST_VOLNAME	"test.restore"
+#define TEST_FILENAME	"hello"
+#define TEST_METHOD_BAD	99
+
+static char testData[] =
+    "a file restored from a volume dump, repeated to give zlib something "
+    "to do; a file restored from a volume dump, repeated to give zlib "
+    "something to do\n";
+
+struct dumpbuf {
+    unsigned char *data;
+    size_t len;
+    size_t max;
+};
+
+static void
+put(struct dumpbuf *db, const void *data, size_t len)
+{
+    if (db->len + len > db->max) {
+	db->max = (db->len + len) * 2;
+	db->data = realloc(db->data, db->max);
+	if (db->data == NULL)
+	    sysbail("realloc");
+    }
+    memcpy(db->data + db->len, data, len);
+    db->len += len;
+}
+
+static void
+putc8(struct dumpbuf *db, int c)
+{
+    unsigned char b = c;
+
+    put(db, &b, 1);
+}
+
+static void
+put16(struct dumpbuf *db, afs_uint32 v)
+{
+    unsigned short n = htons(v);
+
+    put(db, &n, 2);
+}
+
+static void
+put32(struct dumpbuf *db, afs_uint32 v)
+{
+    afs_uint32 n = htonl(v);
+
+    put(db, &n, 4);
+}
+
+/* a tag followed by a nul-terminated string */
+static void
+putstring(struct dumpbuf *db, int tag, const char *s)
+{
+    putc8(db, tag);
+    put(db, s, strlen(s) + 1);
+}
+
+/* a directory entry in 32-byte block blk of a directory page */
+static void
+putdirent(unsigned char *page, int blk, int next, afs_uint32 vnode,
+	  const char *name)
+{
+    unsigned char *ent = page + blk * 32;
+    unsigned short n;
+    afs_uint32 v;
+
+    ent[0] = 1;			/* in use */
+    ent[1] = 1;			/* blocks */
+    n = htons(next);
+    memcpy(ent + 2, &n, 2);
+    v = htonl(vnode);
+    memcpy(ent + 4, &v, 4);
+    v = htonl(1);
+    memcpy(ent + 8, &v, 4);
+    strlcpy((char *)ent + 12, name, 20);
+}
+
+/* dump header, ending with a 'z' tag naming method unless it is
+ * VOLDUMPCOMPRESS_NONE */
+static void
+BuildDumpHeader(struct dumpbuf *db, int method)
+{
+    putc8(db, D_DUMPHEADER);
+    put32(db, DUMPBEGINMAGIC);
+    put32(db, DUMPVERSION);
+    putc8(db, 'v');
+    put32(db, TEST_VOLID);
+    putstring(db, 'n', TEST_VOLNAME);
+    putc8(db, 't');
+    put16(db, 2);
+    put32(db, 0);
+    put32(db, 1700000000);
+    if (method != VOLDUMPCOMPRESS_NONE) {
+	putc8(db, 0x7e);
+	putc8(db, 'z');
+	put32(db, method);
+    }
+}
+
+/* everything after the dump header: the volume header, a root directory
+ * holding one file, and the file */
+static void
+BuildDumpBody(struct dumpbuf *db)
+{
+    unsigned char page[AFS_PAGESIZE];
+    unsigned short n;
+
+    putc8(db, D_VOLUMEHEADER);
+    putc8(db, 'i');
+    put32(db, TEST_VOLID);
+    putstring(db, 'n', TEST_VOLNAME);
+
+    /* the directory page header takes the first 13 blocks; hash every
+     * entry into the first bucket */
+    memset(page, 0, sizeof(page));
+    putdirent(page, 13, 14, 1, ".");
+    putdirent(page, 14, 15, 1, "..");
+    putdirent(page, 15, 0, 2, TEST_FILENAME);
+    n = htons(13);
+    memcpy(page + 32 + 128, &n, 2);
+
+    putc8(db, D_VNODE);
+    put32(db, 1);
+    put32(db, 1);
+    putc8(db, 't');
+    putc8(db, vDirectory);
+    putc8(db, 'l');
+    put16(db, 2);
+    putc8(db, 'f');
+    put32(db, sizeof(page));
+    put(db, page, sizeof(page));
+
+    putc8(db, D_VNODE);
+    put32(db, 2);
+    put32(db, 1);
+    putc8(db, 't');
+    putc8(db, vFile);
+    putc8(db, 'l');
+    put16(db, 1);
+    putc8(db, 'b');
+    put16(db, 0644);
+    putc8(db, 'p');
+    put32(db, 1);
+    putc8(db, 'f');
+    put32(db, sizeof(testData) - 1);
+    put(db, testData, sizeof(testData) - 1);
+
+    putc8(db, D_DUMPEND);
+    put32(db, DUMPENDMAGIC);
+}
+
+static char *
+WriteDump(char *dirname, char *name, struct dumpbuf *db)
+{
+    char *path;
+    FILE *fp;
+
+    if (asprintf(&path, "%s/%s", dirname, name) < 0)
+	sysbail("asprintf");
+    fp = fopen(path, "w");
+    if (fp == NULL || fwrite(db->data, 1, db->len, fp) != db->len
+	|| fclose(fp) != 0)
+	sysbail("cannot write %s", path);
+    return path;
+}
+
+/* run restorevol on dumpfile into dirname, the volume going into a
+ * directory named for it plus ext; return its exit status */
+static int
+RunRestorevol(char *dumpfile, char *dirname, char *ext)
+{
+    char *build, *binPath;
+    int status, fd;
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0)
+	sysbail("fork");
+    if (pid == 0) {
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+	    dup2(fd, STDOUT_FILENO);
+	    dup2(fd, STDERR_FILENO);
+	}
+	build = getenv("BUILD");
+	if (build == NULL)
+	    build = "..";
+	if (asprintf(&binPath, "%s/../src/volser/restorevol", build) < 0)
+	    _exit(1);
+	execl(binPath, "restorevol", "-file", dumpfile, "-dir", dirname,
+	      "-extension", ext, NULL);
+	_exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+	sysbail("waitpid");
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* read back the file restored into dirname with ext; NULL if missing */
+static char *
+ReadRestored(char *dirname, char *ext)
+{
+    char *path, *buf;
+    FILE *fp;
+    size_t n;
+
+    if (asprintf(&path, "%s/%s%s/%s", dirname, TEST_VOLNAME, ext,
+		 TEST_FILENAME) < 0)
+	sysbail("asprintf");
+    fp = fopen(path, "r");
+    free(path);
+    if (fp == NULL)
+	return NULL;
+    buf = calloc(1, sizeof(testData) * 2);
+    if (buf == NULL)
+	sysbail("calloc");
+    n = fread(buf, 1, sizeof(testData) * 2 - 1, fp);
+    buf[n] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+static void
+RemoveRestored(char *dirname, char *ext)
+{
+    char *path;
+
+    if (asprintf(&path, "%s/%s%s/%s", dirname, TEST_VOLNAME, ext,
+		 TEST_FILENAME) < 0)
+	sysbail("asprintf");
+    unlink(path);
+    free(path);
+    if (asprintf(&path, "%s/%s%s", dirname, TEST_VOLNAME, ext) < 0)
+	sysbail("asprintf");
+    rmdir(path);
+    free(path);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct dumpbuf plain, zipped, bad;
+    char dirname[MAXPATHLEN];
+    char *plainFile, *zipFile, *badFile, *shortFile, *data;
+#ifdef HAVE_ZLIB
+    struct dumpbuf body;
+    uLongf zlen;
+#endif
+
+    plan(7);
+
+    snprintf(dirname, sizeof(dirname), "%s/afs_XXXXXX", gettmpdir());
+    if (mkdtemp(dirname) == NULL)
+	sysbail("mkdtemp");
+
+    memset(&plain, 0, sizeof(plain));
+    memset(&zipped, 0, sizeof(zipped));
+    memset(&bad, 0, sizeof(bad));
+
+    BuildDumpHeader(&plain, VOLDUMPCOMPRESS_NONE);
+    BuildDumpBody(&plain);
+
+    BuildDumpHeader(&zipped, VOLDUMPCOMPRESS_DEFLATE);
+#ifdef HAVE_ZLIB
+    memset(&body, 0, sizeof(body));
+    BuildDumpBody(&body);
+    zlen = compressBound(body.len);
+    zipped.data = realloc(zipped.data, zipped.len + zlen);
+    if (zipped.data == NULL)
+	sysbail("realloc");
+    if (compress(zipped.data + zipped.len, &zlen, body.data,
+		 body.len) != Z_OK)
+	bail("compress failed");
+    zipped.len += zlen;
+    zipped.max = zipped.len;
+    free(body.data);
+#else
+    /* cannot compress it here; a restorer must refuse it before reading
+     * any of it anyway */
+    BuildDumpBody(&zipped);
+#endif
+
+    BuildDumpHeader(&bad, TEST_METHOD_BAD);
+    BuildDumpBody(&bad);
+
+    plainFile = WriteDump(dirname, "plain.dump", &plain);
+    zipFile = WriteDump(dirname, "zipped.dump", &zipped);
+    badFile = WriteDump(dirname, "bad.dump", &bad);
+
+    /* lose the end of the compressed stream: with zlib the dump itself
+     * still parses, but its checksum is gone */
+    zipped.len -= 4;
+    shortFile = WriteDump(dirname, "short.dump", &zipped);
+
+    is_int(0, RunRestorevol(plainFile, dirname, ".plain"),
+	   "uncompressed dump restores");
+    data = ReadRestored(dirname, ".plain");
+    is_string(testData, data, "file restored from uncompressed dump");
+    free(data);
+
+#ifdef HAVE_ZLIB
+    is_int(0, RunRestorevol(zipFile, dirname, ".zipped"),
+	   "compressed dump restores");
+    data = ReadRestored(dirname, ".zipped");
+    is_string(testData, data,
+	      "compressed dump restores the same file");
+#else
+    ok(RunRestorevol(zipFile, dirname, ".zipped") != 0,
+       "compressed dump refused without zlib");
+    data = ReadRestored(dirname, ".zipped");
+    ok(data == NULL, "nothing restored from compressed dump without zlib");
+#endif
+    free(data);
+
+    ok(RunRestorevol(badFile, dirname, ".bad") != 0,
+       "dump compressed with an unknown method refused");
+    data = ReadRestored(dirname, ".bad");
+    ok(data == NULL, "nothing restored from an unknown method");
+    free(data);
+
+    ok(RunRestorevol(shortFile, dirname, ".short") != 0,
+       "compressed dump cut short refused");
+
+    RemoveRestored(dirname, ".plain");
+    RemoveRestored(dirname, ".zipped");
+    RemoveRestored(dirname, ".bad");
+    RemoveRestored(dirname, ".short");
+    unlink(plainFile);
+    unlink(zipFile);
+    unlink(badFile);
+    unlink(shortFile);
+    rmdir(dirname);
+    free(plainFile);
+    free(zipFile);
+    free(badFile);
+    free(shortFile);
+    free(plain.data);
+    free(zipped.data);
+    free(bad.data);
+
+    return 0;
+}